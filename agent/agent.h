@@ -118,6 +118,10 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* The lifetime of an unprotected key in the key cache.  0 disables
+   * that cache.  */
+  unsigned long unlocked_key_cache_ttl;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -382,6 +386,22 @@ cache_mode_t;
 /* The type of a function to lookup a TTL by a keygrip.  */
 typedef int (*lookup_ttl_t)(const char *hexgrip);
 
+/* An item of a batch signing request.  */
+struct pksign_batch_item_s
+{
+  int algo;
+  int valuelen;
+  unsigned char value[MAX_DIGEST_LEN];
+};
+
+/* Identifies the version of a key file for the unlocked key cache.  */
+struct key_file_stamp_s
+{
+  time_t mtime;
+  unsigned long long size;
+  unsigned long long ino;
+};
+
 
 /* This is a special version of the usual _() gettext macro.  It
    assumes a server connection control variable with the name "ctrl"
@@ -432,6 +452,8 @@ void *get_agent_daemon_notify_event (void);
 void agent_sighup_action (void);
 int map_pk_openpgp_to_gcry (int openpgp_algo);
 void agent_kick_the_loop (void);
+void agent_crypto_begin (void);
+void agent_crypto_end (void);
 
 /*-- command.c --*/
 gpg_error_t agent_inq_pinentry_launched (ctrl_t ctrl, unsigned long pid,
@@ -543,6 +565,15 @@ int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
 void agent_store_cache_hit (const char *key);
+char *agent_cache_stats (void);
+void agent_put_key_cache (ctrl_t ctrl, const unsigned char *grip,
+                          const struct key_file_stamp_s *stamp,
+                          time_t timestamp,
+                          const unsigned char *key, size_t keylen);
+unsigned char *agent_get_key_cache (ctrl_t ctrl, const unsigned char *grip,
+                                    const struct key_file_stamp_s *stamp,
+                                    time_t *r_timestamp);
+void agent_flush_key_cache (const unsigned char *grip);
 
 
 /*-- pksign.c --*/
@@ -554,6 +585,11 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                const struct pksign_batch_item_s *hashes,
+                                int nhashes,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
@@ -596,6 +632,8 @@ gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
 
 /*-- protect.c --*/
 void set_s2k_calibration_time (unsigned int milliseconds);
+void enable_s2k_state_file (void);
+void update_s2k_calibration (void);
 unsigned long get_calibrated_s2k_count (void);
 unsigned long get_standard_s2k_count (void);
 unsigned char get_standard_s2k_count_rfc4880 (void);
@@ -56,10 +56,13 @@ struct secret_data_s {
 /* The type of cache object.  */
 typedef struct cache_item_s *ITEM;
 
-/* The timer entry in a linked list.  */
+/* The timer entry of a cache object.  */
 struct timer_s {
   ITEM next;
-  int tv_sec;
+  ITEM *prevp;      /* The pointer pointing to this entry or NULL if the
+                     * entry is not in the timer wheel.  */
+  unsigned long expires;  /* Absolute expiration time in seconds.  */
+  int tv_sec;       /* Relative expiration time set by compute_expiration.  */
   int reason;
 };
 #define CACHE_EXPIRE_UNUSED      0
@@ -68,7 +71,8 @@ struct timer_s {
 
 /* The cache object.  */
 struct cache_item_s {
-  ITEM next;
+  ITEM next;        /* Next item in the same hash bucket.  */
+  unsigned int hash;  /* The hash value of KEY.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
@@ -79,17 +83,61 @@ struct cache_item_s {
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
-
-/* The timer list of expiration, in active.  */
-static ITEM the_timer_list;
-/* Newly created entries, to be inserted into the timer list.  */
-static ITEM the_timer_list_new;
+/* The cache himself.  This is a hash table with CACHE_TABLE_SIZE
+ * buckets indexed by the hash of the key.  The table is allocated on
+ * the first insert and doubled in size if the number of items exceeds
+ * twice the number of buckets.  */
+#define CACHE_TABLE_MINSIZE 64
+static ITEM *cache_table;
+static unsigned int cache_table_size;
+static unsigned int cache_count;
+
+/* The expiration of cache objects is managed by a hierarchical timer
+ * wheel.  Level N has TIMER_SLOTS slots each covering TIMER_SLOTS^N
+ * seconds.  Whenever the slots of a level wrap around, the next slot
+ * of the level above is moved down ("cascaded").  Inserting and
+ * removing a timer is thus O(1).  Timers more than TIMER_MAX_DELTA
+ * seconds ahead are put into the last slot and rescheduled when they
+ * are cascaded.  */
+#define TIMER_BITS   6
+#define TIMER_SLOTS  (1 << TIMER_BITS)
+#define TIMER_MASK   (TIMER_SLOTS - 1)
+#define TIMER_LEVELS 4
+#define TIMER_MAX_DELTA ((1UL << (TIMER_BITS * TIMER_LEVELS)) - 1)
+static ITEM the_wheel[TIMER_LEVELS][TIMER_SLOTS];
+/* The next second to be processed by the timer wheel.  */
+static unsigned long wheel_base;
+/* The number of timers in the wheel.  */
+static unsigned int wheel_count;
+
+/* Statistics for GETINFO cache_stats.  */
+static struct {
+  unsigned long lookups;
+  unsigned long hits;
+  unsigned long long lookup_ns;
+  unsigned long max_lookup_ns;
+} cache_stats;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
+/* The object of the unlocked key cache.  */
+typedef struct key_item_s *KEY_ITEM;
+struct key_item_s {
+  KEY_ITEM next;
+  time_t expires;   /* Absolute expiration time.  */
+  time_t timestamp; /* The creation time of the key or -1.  */
+  int restricted;   /* The value of ctrl->restricted is part of the key.  */
+  struct key_file_stamp_s stamp;  /* Identifies the version of the file. */
+  struct secret_data_s *keydata;  /* The canonical encoded key.  */
+  unsigned char grip[KEYGRIP_LEN];
+};
+
+/* The cache of unprotected private keys.  This is only used if
+ * opt.unlocked_key_cache_ttl is not 0.  It is protected by
+ * CACHE_LOCK.  */
+static KEY_ITEM thekeycache;
+
 
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
@@ -161,12 +209,14 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Store the LENGTH bytes of BUFFER encrypted in a new secret data
+ * object and return it at R_DATA.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data_buffer (const void *buffer, size_t length,
+                 struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
 
   *r_data = NULL;
@@ -175,8 +225,6 @@ new_data (const char *string, struct secret_data_s **r_data)
   if (err)
     return err;
 
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usually not possible but we better assume nothing about our secure
@@ -187,7 +235,9 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, buffer, length);
+  if (length < (size_t)(total - 8))
+    memset (d->data + length, 0, total - 8 - length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -211,107 +261,348 @@ new_data (const char *string, struct secret_data_s **r_data)
 }
 
 
+static gpg_error_t
+new_data (const char *string, struct secret_data_s **r_data)
+{
+  return new_data_buffer (string, strlen (string) + 1, r_data);
+}
+
+
+/* Decrypt DATA and return it in a new buffer allocated in secure
+ * memory.  The length of that buffer is DATA->TOTALLEN - 8.  */
+static gpg_error_t
+get_data (struct secret_data_s *data, char **r_value)
+{
+  gpg_error_t err;
+  char *value;
+
+  *r_value = NULL;
+  if (data->totallen < 32)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  if ((err = init_encryption ()))
+    return err;
+  if (!(value = xtrymalloc_secure (data->totallen - 8)))
+    return gpg_error_from_syserror ();
+  err = gcry_cipher_decrypt (encryption_handle,
+                             value, data->totallen - 8,
+                             data->data, data->totallen);
+  if (err)
+    {
+      xfree (value);
+      return err;
+    }
+  *r_value = value;
+  return 0;
+}
+
+
 static void
-insert_to_timer_list_new (ITEM entry)
+release_key_item (KEY_ITEM item)
 {
-  entry->t.next = the_timer_list_new;
-  the_timer_list_new = entry;
+  if (item)
+    {
+      release_data (item->keydata);
+      xfree (item);
+    }
 }
 
-/* Insert to the active timer list.  */
+
+/* Remove the entries for GRIP from the key cache or all entries if
+ * GRIP is NULL.  The caller must hold CACHE_LOCK.  */
 static void
-insert_to_timer_list (struct timespec *ts, ITEM entry)
+flush_key_cache (const unsigned char *grip)
 {
-  ITEM e, eprev;
+  KEY_ITEM r, rnext, rprev;
 
-  if (!the_timer_list || ts->tv_sec >= entry->t.tv_sec)
+  rprev = NULL;
+  for (r = thekeycache; r; r = rnext)
     {
-      if (the_timer_list)
+      rnext = r->next;
+      if (grip && memcmp (r->grip, grip, KEYGRIP_LEN))
         {
-          the_timer_list->t.tv_sec += ts->tv_sec - entry->t.tv_sec;
-          if (ts->tv_nsec >= 500000000)
-            the_timer_list->t.tv_sec++;
+          rprev = r;
+          continue;
         }
+      if (DBG_CACHE)
+        {
+          char hexgrip[2*KEYGRIP_LEN+1];
 
-      ts->tv_sec = entry->t.tv_sec;
-      ts->tv_nsec = 0;
-
-      entry->t.tv_sec = 0;
-      entry->t.next = the_timer_list;
-      the_timer_list = entry;
-      return;
+          log_debug ("  flushing key %s.%d\n",
+                     bin2hex (r->grip, KEYGRIP_LEN, hexgrip), r->restricted);
+        }
+      if (rprev)
+        rprev->next = rnext;
+      else
+        thekeycache = rnext;
+      release_key_item (r);
     }
+}
+
+
+/* Remove expired entries from the key cache and return the number of
+ * seconds until the next entry expires or 0 if there are no entries.
+ * The caller must hold CACHE_LOCK.  */
+static time_t
+expire_key_cache (time_t current)
+{
+  KEY_ITEM r, rnext, rprev;
+  time_t next = 0;
 
-  entry->t.tv_sec -= ts->tv_sec;
-  eprev = NULL;
-  for (e = the_timer_list; e; e = e->t.next)
+  rprev = NULL;
+  for (r = thekeycache; r; r = rnext)
     {
-      if (e->t.tv_sec > entry->t.tv_sec)
-        break;
+      rnext = r->next;
+      if (r->expires > current)
+        {
+          if (!next || r->expires - current < next)
+            next = r->expires - current;
+          rprev = r;
+          continue;
+        }
+      if (rprev)
+        rprev->next = rnext;
+      else
+        thekeycache = rnext;
+      release_key_item (r);
+    }
+
+  return next;
+}
+
+
+/* Return the current time in seconds as used by the timer wheel.  */
+static unsigned long
+wheel_clock (void)
+{
+  struct timespec curtime;
+
+  npth_clock_gettime (&curtime);
+  return (unsigned long)curtime.tv_sec;
+}
+
+
+/* Return the hash value for the string KEY.  This is FNV-1a.  */
+static unsigned int
+hash_key (const char *key)
+{
+  const unsigned char *s = (const unsigned char *)key;
+  unsigned int h = 2166136261u;
 
-      eprev = e;
-      entry->t.tv_sec -= e->t.tv_sec;
+  for (; *s; s++)
+    {
+      h ^= *s;
+      h *= 16777619u;
     }
+  return h;
+}
 
-  entry->t.next = e;
-  if (e)
-    e->t.tv_sec -= entry->t.tv_sec;
 
-  if (eprev)
-    eprev->t.next = entry;
-  else
-    the_timer_list = entry;
+/* Insert ENTRY into the hash table.  The hash of ENTRY must already
+ * be set.  */
+static gpg_error_t
+insert_into_table (ITEM entry)
+{
+  ITEM *newtable, r, rnext;
+  unsigned int newsize, i, idx;
+
+  if (!cache_table || cache_count >= 2 * cache_table_size)
+    {
+      newsize = cache_table? 2 * cache_table_size : CACHE_TABLE_MINSIZE;
+      newtable = xtrycalloc (newsize, sizeof *newtable);
+      if (!newtable)
+        {
+          if (!cache_table)
+            return gpg_error_from_syserror ();
+          /* We can live with longer chains.  */
+        }
+      else
+        {
+          for (i=0; i < cache_table_size; i++)
+            for (r = cache_table[i]; r; r = rnext)
+              {
+                rnext = r->next;
+                idx = r->hash & (newsize - 1);
+                r->next = newtable[idx];
+                newtable[idx] = r;
+              }
+          xfree (cache_table);
+          cache_table = newtable;
+          cache_table_size = newsize;
+        }
+    }
+
+  idx = entry->hash & (cache_table_size - 1);
+  entry->next = cache_table[idx];
+  cache_table[idx] = entry;
+  cache_count++;
+  return 0;
 }
 
+
+/* Remove ENTRY from the hash table.  */
 static void
-remove_from_timer_list (ITEM entry)
+remove_from_table (ITEM entry)
 {
-  ITEM e, eprev;
+  ITEM r, *rp;
 
-  eprev = NULL;
-  for (e = the_timer_list; e; e = e->t.next)
-    if (e != entry)
-      eprev = e;
-    else
+  rp = &cache_table[entry->hash & (cache_table_size - 1)];
+  for (r = *rp; r; rp = &r->next, r = r->next)
+    if (r == entry)
       {
-        if (e->t.next)
-          e->t.next->t.tv_sec += e->t.tv_sec;
-
-        if (eprev)
-          eprev->t.next = e->t.next;
-        else
-          the_timer_list = e->t.next;
-
+        *rp = r->next;
+        r->next = NULL;
+        cache_count--;
         break;
       }
+}
 
-  entry->t.next = NULL;
-  entry->t.tv_sec = 0;
+
+/* Put ENTRY into the slot of the timer wheel matching its expiration
+ * time.  */
+static void
+insert_into_wheel (ITEM entry)
+{
+  unsigned long delta, expires;
+  ITEM *slot;
+  int level;
+
+  if (entry->t.expires <= wheel_base)
+    slot = &the_wheel[0][wheel_base & TIMER_MASK];  /* Overdue.  */
+  else
+    {
+      delta = entry->t.expires - wheel_base;
+      if (delta > TIMER_MAX_DELTA)
+        delta = TIMER_MAX_DELTA;
+      expires = wheel_base + delta;
+      for (level=0; level < TIMER_LEVELS - 1; level++)
+        if (delta < (1UL << (TIMER_BITS * (level + 1))))
+          break;
+      slot = &the_wheel[level][(expires >> (TIMER_BITS * level)) & TIMER_MASK];
+    }
+
+  entry->t.next = *slot;
+  if (entry->t.next)
+    entry->t.next->t.prevp = &entry->t.next;
+  entry->t.prevp = slot;
+  *slot = entry;
+  wheel_count++;
 }
 
+
+/* Schedule ENTRY to expire in ENTRY->T.TV_SEC seconds.  */
 static void
-remove_from_timer_list_new (ITEM entry)
+schedule_expiration (ITEM entry)
 {
-  ITEM e, eprev;
+  unsigned long now = wheel_clock ();
+
+  /* If the wheel is empty we can simply move it to the current
+   * time.  */
+  if (!wheel_count)
+    wheel_base = now;
+  entry->t.expires = now + entry->t.tv_sec;
+  insert_into_wheel (entry);
+}
 
-  eprev = NULL;
-  for (e = the_timer_list_new; e; e = e->t.next)
-    if (e != entry)
-      eprev = e;
-    else
-      {
-        if (eprev)
-          eprev->t.next = e->t.next;
-        else
-          the_timer_list_new = e->t.next;
 
-        break;
-      }
+/* Remove ENTRY from the timer wheel.  */
+static void
+remove_from_wheel (ITEM entry)
+{
+  if (!entry->t.prevp)
+    return;  /* Not in the wheel.  */
 
+  *entry->t.prevp = entry->t.next;
+  if (entry->t.next)
+    entry->t.next->t.prevp = entry->t.prevp;
   entry->t.next = NULL;
-  entry->t.tv_sec = 0;
+  entry->t.prevp = NULL;
+  wheel_count--;
 }
 
+
+/* Reschedule all timers of SLOT at LEVEL.  Returns SLOT.  */
+static int
+cascade_wheel (int level, int slot)
+{
+  ITEM e, enext;
+
+  e = the_wheel[level][slot];
+  the_wheel[level][slot] = NULL;
+  for (; e; e = enext)
+    {
+      enext = e->t.next;
+      e->t.next = NULL;
+      e->t.prevp = NULL;
+      wheel_count--;
+      insert_into_wheel (e);
+    }
+  return slot;
+}
+
+
+/* Advance the timer wheel up to the time NOW and return a list of
+ * the expired entries linked via T.NEXT.  */
+static ITEM
+advance_wheel (unsigned long now)
+{
+  ITEM expired = NULL;
+  ITEM e, enext;
+  int idx, level;
+
+  if (!wheel_count)
+    {
+      wheel_base = now + 1;
+      return NULL;
+    }
+
+  while (wheel_base <= now && wheel_count)
+    {
+      idx = wheel_base & TIMER_MASK;
+      if (!idx)
+        {
+          for (level=1; level < TIMER_LEVELS; level++)
+            if (cascade_wheel (level, ((wheel_base >> (TIMER_BITS * level))
+                                       & TIMER_MASK)))
+              break;
+        }
+      for (e = the_wheel[0][idx]; e; e = enext)
+        {
+          enext = e->t.next;
+          e->t.prevp = NULL;
+          e->t.next = expired;
+          expired = e;
+          wheel_count--;
+        }
+      the_wheel[0][idx] = NULL;
+      wheel_base++;
+    }
+  if (!wheel_count && wheel_base <= now)
+    wheel_base = now + 1;
+
+  return expired;
+}
+
+
+/* Return the number of seconds from the start of the second
+ * WHEEL_BASE to the next slot which needs to be processed.  */
+static unsigned long
+wheel_next_event (void)
+{
+  unsigned long n;
+  int idx;
+
+  for (n=0; n < TIMER_SLOTS; n++)
+    {
+      idx = (wheel_base + n) & TIMER_MASK;
+      if (n && !idx)
+        break;  /* We need to cascade at this point.  */
+      if (the_wheel[0][idx])
+        break;
+    }
+  return n;
+}
+
+
 static int
 compute_expiration (ITEM r)
 {
@@ -375,14 +666,11 @@ static void
 update_expiration (ITEM entry, int is_new_entry)
 {
   if (!is_new_entry)
-    {
-      remove_from_timer_list (entry);
-      remove_from_timer_list_new (entry);
-    }
+    remove_from_wheel (entry);
 
   if (compute_expiration (entry))
     {
-      insert_to_timer_list_new (entry);
+      schedule_expiration (entry);
       agent_kick_the_loop ();
     }
 }
@@ -415,7 +703,7 @@ do_expire (ITEM e)
   e->accessed = 0;
 
   if (compute_expiration (e))
-    insert_to_timer_list_new (e);
+    schedule_expiration (e);
 
   return 0;
 }
@@ -424,81 +712,66 @@ do_expire (ITEM e)
 struct timespec *
 agent_cache_expiration (void)
 {
-  static struct timespec abstime;
   static struct timespec timeout;
   struct timespec *tp;
   struct timespec curtime;
   int res;
-  int expired = 0;
   ITEM e, enext;
+  unsigned long next;
+  time_t keynext;
 
   res = npth_mutex_lock (&cache_lock);
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
   npth_clock_gettime (&curtime);
-  if (the_timer_list)
-    {
-      if (npth_timercmp (&abstime, &curtime, <))
-        expired = 1;
-      else
-        npth_timersub (&abstime, &curtime, &timeout);
-    }
-
-  if (expired && (e = the_timer_list) && e->t.tv_sec == 0)
+  for (e = advance_wheel ((unsigned long)curtime.tv_sec); e; e = enext)
     {
-      the_timer_list = e->t.next;
+      enext = e->t.next;
       e->t.next = NULL;
 
       if (do_expire (e))
         {
-          ITEM r, rprev;
-
           if (DBG_CACHE)
             log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
                        e->key, e->restricted, e->cache_mode);
 
-          rprev = NULL;
-          for (r = thecache; r; r = r->next)
-            if (r == e)
-              {
-                if (!rprev)
-                  thecache = r->next;
-                else
-                  rprev->next = r->next;
-                break;
-              }
-            else
-              rprev = r;
-
-          remove_from_timer_list_new (e);
-
+          remove_from_table (e);
+          remove_from_wheel (e);
           xfree (e);
         }
     }
 
-  if (expired || !the_timer_list)
-    timeout.tv_sec = timeout.tv_nsec = 0;
-
-  for (e = the_timer_list_new; e; e = enext)
-    {
-      enext = e->t.next;
-      e->t.next = NULL;
-      insert_to_timer_list (&timeout, e);
-    }
-  the_timer_list_new = NULL;
-
-  if (!the_timer_list)
+  if (!wheel_count)
     tp = NULL;
   else
     {
-      if (the_timer_list->t.tv_sec != 0)
+      /* WHEEL_BASE is the next second to process, thus we need to
+       * wake up at the start of second WHEEL_BASE + NEXT.  */
+      next = wheel_base + wheel_next_event ();
+      if (next > (unsigned long)curtime.tv_sec)
         {
-          timeout.tv_sec += the_timer_list->t.tv_sec;
-          the_timer_list->t.tv_sec = 0;
+          timeout.tv_sec = next - (unsigned long)curtime.tv_sec - 1;
+          timeout.tv_nsec = 1000000000 - curtime.tv_nsec;
+          if (timeout.tv_nsec >= 1000000000)
+            {
+              timeout.tv_sec++;
+              timeout.tv_nsec -= 1000000000;
+            }
         }
+      else
+        timeout.tv_sec = timeout.tv_nsec = 0;
+      tp = &timeout;
+    }
 
-      npth_timeradd (&timeout, &curtime, &abstime);
+  /* The key cache uses absolute expiration times and is thus simply
+   * scanned here.  */
+  if (thekeycache
+      && (keynext = expire_key_cache (gnupg_get_time ()))
+      && (!tp || keynext < tp->tv_sec))
+    {
+      timeout.tv_sec = keynext;
+      timeout.tv_nsec = 0;
       tp = &timeout;
     }
 
@@ -515,6 +788,7 @@ agent_flush_cache (int pincache_only)
 {
   ITEM r;
   int res;
+  unsigned int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
@@ -523,20 +797,24 @@ agent_flush_cache (int pincache_only)
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-          update_expiration (r, 0);
-        }
-    }
+  for (i=0; i < cache_table_size; i++)
+    for (r=cache_table[i]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_data (r->pw);
+            r->pw = NULL;
+            r->accessed = 0;
+            update_expiration (r, 0);
+          }
+      }
+
+  if (!pincache_only)
+    flush_key_cache (NULL);
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -571,6 +849,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   ITEM r;
   int res;
   int restricted = ctrl? ctrl->restricted : -1;
+  unsigned int hash;
 
   res = npth_mutex_lock (&cache_lock);
   if (res)
@@ -590,12 +869,29 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
         default: ttl = opt.def_cache_ttl; break;
         }
     }
+  /* Clearing the passphrase of a key also clears the unprotected
+   * key.  */
+  if (!data && thekeycache
+      && cache_mode != CACHE_MODE_PIN && cache_mode != CACHE_MODE_DATA
+      && cache_mode != CACHE_MODE_NONCE
+      && strlen (key) == 2*KEYGRIP_LEN)
+    {
+      unsigned char grip[KEYGRIP_LEN];
+
+      if (hex2bin (key, grip, KEYGRIP_LEN) == 2*KEYGRIP_LEN)
+        flush_key_cache (grip);
+    }
+
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  hash = hash_key (key);
+  r = cache_table? cache_table[hash & (cache_table_size - 1)] : NULL;
+  for (; r; r = r->next)
     {
-      if (cache_mode == CACHE_MODE_PIN && data)
+      if (r->hash != hash)
+        ;
+      else if (cache_mode == CACHE_MODE_PIN && data)
         {
           /* PIN mode is special because it is only used by scdaemon.  */
           if (!strcmp (r->key, key))
@@ -641,19 +937,21 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
       else
         {
           strcpy (r->key, key);
+          r->hash = hash;
           r->restricted = restricted;
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
           err = new_data (data, &r->pw);
+          if (!err)
+            err = insert_into_table (r);
           if (err)
-            xfree (r);
-          else
             {
-              r->next = thecache;
-              thecache = r;
-              update_expiration (r, 1);
+              release_data (r->pw);
+              xfree (r);
             }
+          else
+            update_expiration (r, 1);
         }
       if (err)
         log_error ("error inserting cache item: %s\n", gpg_strerror (err));
@@ -680,10 +978,14 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
   int last_stored = 0;
   int restricted = ctrl? ctrl->restricted : -1;
   int yes;
+  unsigned int hash;
+  struct timespec start, stop;
+  unsigned long ns;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
 
+  npth_clock_gettime (&start);
   res = npth_mutex_lock (&cache_lock);
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
@@ -701,9 +1003,13 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
                key, restricted, cache_mode,
                last_stored? " (stored cache key)":"");
 
-  for (r=thecache; r; r = r->next)
+  hash = hash_key (key);
+  r = cache_table? cache_table[hash & (cache_table_size - 1)] : NULL;
+  for (; r; r = r->next)
     {
-      if (cache_mode == CACHE_MODE_PIN)
+      if (r->hash != hash)
+        yes = 0;
+      else if (cache_mode == CACHE_MODE_PIN)
         yes = (r->pw && !strcmp (r->key, key));
       else if (r->pw
                && ((cache_mode != CACHE_MODE_USER
@@ -727,22 +1033,9 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
             }
           if (DBG_CACHE)
             log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = gpg_error (GPG_ERR_INV_LENGTH);
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
-            {
-              err = gcry_cipher_decrypt (encryption_handle,
-                                         value, r->pw->totallen - 8,
-                                         r->pw->data, r->pw->totallen);
-            }
+          err = get_data (r->pw, &value);
           if (err)
             {
-              xfree (value);
-              value = NULL;
               log_error ("retrieving cache entry '%s'.%d failed: %s\n",
                          key, restricted, gpg_strerror (err));
             }
@@ -753,6 +1046,19 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
     log_debug ("... miss\n");
 
  out:
+  npth_clock_gettime (&stop);
+  ns = (stop.tv_sec > start.tv_sec
+        || (stop.tv_sec == start.tv_sec && stop.tv_nsec > start.tv_nsec))
+    ? ((unsigned long)(stop.tv_sec - start.tv_sec) * 1000000000
+       + stop.tv_nsec - start.tv_nsec)
+    : 0;
+  cache_stats.lookups++;
+  if (value)
+    cache_stats.hits++;
+  cache_stats.lookup_ns += ns;
+  if (ns > cache_stats.max_lookup_ns)
+    cache_stats.max_lookup_ns = ns;
+
   res = npth_mutex_unlock (&cache_lock);
   if (res)
     log_fatal ("failed to release cache mutex: %s\n", strerror (res));
@@ -761,6 +1067,199 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
 }
 
 
+/* Return a malloced string with statistics about the cache.  The
+ * string consists of space delimited NAME=VALUE pairs.  Returns NULL
+ * on error.  */
+char *
+agent_cache_stats (void)
+{
+  char *result;
+  ITEM r;
+  KEY_ITEM k;
+  unsigned int i, nactive, nused, maxchain, n, nkeys;
+  int res;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  nactive = nused = maxchain = 0;
+  for (i=0; i < cache_table_size; i++)
+    {
+      for (n=0, r=cache_table[i]; r; r = r->next, n++)
+        if (r->pw)
+          nactive++;
+      if (n)
+        nused++;
+      if (n > maxchain)
+        maxchain = n;
+    }
+  for (nkeys=0, k=thekeycache; k; k = k->next)
+    nkeys++;
+
+  result = xtryasprintf ("entries=%u active=%u timers=%u"
+                         " buckets=%u used_buckets=%u max_chain=%u"
+                         " keys=%u lookups=%lu hits=%lu"
+                         " avg_lookup_ns=%lu max_lookup_ns=%lu",
+                         cache_count, nactive, wheel_count,
+                         cache_table_size, nused, maxchain,
+                         nkeys, cache_stats.lookups, cache_stats.hits,
+                         (unsigned long)(cache_stats.lookups
+                                         ? (cache_stats.lookup_ns
+                                            / cache_stats.lookups)
+                                         : 0),
+                         cache_stats.max_lookup_ns);
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  return result;
+}
+
+
+/* Store the unprotected private key KEY with length KEYLEN for the
+ * keygrip GRIP in the key cache.  STAMP identifies the version of the
+ * key file from which KEY was taken and TIMESTAMP is the creation
+ * time of the key or -1.  This is a no-op if the key cache has not
+ * been enabled.  */
+void
+agent_put_key_cache (ctrl_t ctrl, const unsigned char *grip,
+                     const struct key_file_stamp_s *stamp, time_t timestamp,
+                     const unsigned char *key, size_t keylen)
+{
+  gpg_error_t err;
+  KEY_ITEM r;
+  int res;
+  int restricted = ctrl? ctrl->restricted : -1;
+  char hexgrip[2*KEYGRIP_LEN+1];
+
+  if (!opt.unlocked_key_cache_ttl)
+    return;
+
+  r = xtrycalloc (1, sizeof *r);
+  if (!r)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (r->grip, grip, KEYGRIP_LEN);
+  r->restricted = restricted;
+  r->stamp = *stamp;
+  r->timestamp = timestamp;
+  r->expires = gnupg_get_time () + opt.unlocked_key_cache_ttl;
+  err = new_data_buffer (key, keylen, &r->keydata);
+  if (err)
+    {
+      xfree (r);
+      goto leave;
+    }
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  if (DBG_CACHE)
+    log_debug ("agent_put_key_cache %s.%d ttl=%lu\n",
+               bin2hex (grip, KEYGRIP_LEN, hexgrip), restricted,
+               opt.unlocked_key_cache_ttl);
+
+  flush_key_cache (grip);
+  r->next = thekeycache;
+  thekeycache = r;
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  /* Make sure the main loop learns about the new expiration time.  */
+  agent_kick_the_loop ();
+
+ leave:
+  if (err)
+    log_error ("error inserting key cache item: %s\n", gpg_strerror (err));
+}
+
+
+/* Try to find the unprotected private key for GRIP in the key cache.
+ * The entry is only used if STAMP matches the one stored with it.
+ * Returns NULL if not found or a buffer in secure memory with the
+ * canonical encoded key.  The creation time of the key is stored at
+ * R_TIMESTAMP.  */
+unsigned char *
+agent_get_key_cache (ctrl_t ctrl, const unsigned char *grip,
+                     const struct key_file_stamp_s *stamp,
+                     time_t *r_timestamp)
+{
+  gpg_error_t err;
+  KEY_ITEM r;
+  char *value = NULL;
+  int res;
+  int restricted = ctrl? ctrl->restricted : -1;
+  char hexgrip[2*KEYGRIP_LEN+1];
+
+  if (!opt.unlocked_key_cache_ttl)
+    return NULL;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  for (r = thekeycache; r; r = r->next)
+    if (r->restricted == restricted
+        && !memcmp (r->grip, grip, KEYGRIP_LEN))
+      break;
+  if (r && (r->expires <= gnupg_get_time ()
+            || r->stamp.mtime != stamp->mtime
+            || r->stamp.size != stamp->size
+            || r->stamp.ino != stamp->ino))
+    {
+      /* Expired or the file has been changed.  */
+      flush_key_cache (grip);
+      r = NULL;
+    }
+  if (r)
+    {
+      err = get_data (r->keydata, &value);
+      if (err)
+        log_error ("retrieving key cache entry failed: %s\n",
+                   gpg_strerror (err));
+      else if (r_timestamp)
+        *r_timestamp = r->timestamp;
+    }
+
+  if (DBG_CACHE)
+    log_debug ("agent_get_key_cache %s.%d ... %s\n",
+               bin2hex (grip, KEYGRIP_LEN, hexgrip), restricted,
+               value? "hit":"miss");
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  return (unsigned char *)value;
+}
+
+
+/* Remove the unprotected key for GRIP from the key cache.  This needs
+ * to be called whenever the key file is changed or deleted.  */
+void
+agent_flush_key_cache (const unsigned char *grip)
+{
+  int res;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  flush_key_cache (grip);
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
 /* Store the key for the last successful cache hit.  That value is
    used by agent_get_cache if the requested KEY is given as NULL.
    NULL may be used to remove that key. */
@@ -54,6 +54,9 @@
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
+/* The maximum number of hashes for PKSIGN --batch.  */
+#define MAX_PKSIGN_BATCH 1024
+
 /* A shortcut to call assuan_set_error using an gpg_err_code_t and a
    text string.  */
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
@@ -1006,11 +1009,102 @@ cmd_sethash (assuan_context_t ctx, char *line)
 }
 
 
+/* Parse the list of hashes inquired by PKSIGN --batch.  Each line of
+ * BUFFER of length BUFLEN has the algorithm number and the hex
+ * encoded hash delimited by a space.  On success an array is stored
+ * at R_ITEMS and the number of items at R_NITEMS.  */
+static gpg_error_t
+parse_pksign_batch (assuan_context_t ctx,
+                    const unsigned char *buffer, size_t buflen,
+                    struct pksign_batch_item_s **r_items, int *r_nitems)
+{
+  gpg_error_t err = 0;
+  struct pksign_batch_item_s *items;
+  const char *s, *end, *eol;
+  char *endp;
+  int nitems, n, algo, i;
+
+  *r_items = NULL;
+  *r_nitems = 0;
+
+  items = xtrycalloc (MAX_PKSIGN_BATCH, sizeof *items);
+  if (!items)
+    return gpg_error_from_syserror ();
+
+  nitems = 0;
+  s = (const char *)buffer;
+  end = s + buflen;
+  for (; s < end; s = eol + 1)
+    {
+      eol = memchr (s, '\n', end - s);
+      if (!eol)
+        eol = end;
+      while (s < eol && spacep (s))
+        s++;
+      if (s == eol)
+        continue;  /* Skip empty lines.  */
+      if (nitems == MAX_PKSIGN_BATCH)
+        {
+          err = set_error (GPG_ERR_TOO_LARGE, "too many hashes");
+          goto leave;
+        }
+      algo = (int)strtoul (s, &endp, 10);
+      if (!algo || gcry_md_test_algo (algo))
+        {
+          err = set_error (GPG_ERR_UNSUPPORTED_ALGORITHM, NULL);
+          goto leave;
+        }
+      for (s = endp; s < eol && spacep (s); s++)
+        ;
+      for (n=0; s + n < eol && hexdigitp (s + n); n++)
+        ;
+      if (s + n < eol && !spacep (s + n) && s[n] != '\r')
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid hexstring");
+          goto leave;
+        }
+      if ((n & 1) || n/2 != gcry_md_get_algo_dlen (algo)
+          || n/2 > MAX_DIGEST_LEN)
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid length of hash");
+          goto leave;
+        }
+      items[nitems].algo = algo;
+      items[nitems].valuelen = n/2;
+      for (i=0; i < n/2; i++, s += 2)
+        items[nitems].value[i] = xtoi_2 (s);
+      nitems++;
+    }
+
+  if (!nitems)
+    {
+      err = set_error (GPG_ERR_MISSING_VALUE, "no hashes given");
+      goto leave;
+    }
+
+  *r_items = items;
+  *r_nitems = nitems;
+  items = NULL;
+
+ leave:
+  xfree (items);
+  return err;
+}
+
+
 static const char hlp_pksign[] =
   "PKSIGN [<options>] [<cache_nonce>]\n"
+  "PKSIGN --batch [<cache_nonce>]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --batch the hashes are not taken from SETHASH but inquired\n"
+  "using the keyword HASHES.  Each line of the inquired data has the\n"
+  "algorithm number and the hex encoded hash delimited by a space.\n"
+  "All hashes are signed with the same key and the signatures are\n"
+  "returned as a concatenation of canonical S-expressions in the\n"
+  "order of the hashes.  At most 1024 hashes may be given.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -1020,7 +1114,13 @@ cmd_pksign (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   char *cache_nonce = NULL;
   char *p;
+  int opt_batch;
+  unsigned char *hashbuf = NULL;
+  size_t hashbuflen;
+  struct pksign_batch_item_s *items = NULL;
+  int nitems = 0;
 
+  opt_batch = has_option (line, "--batch");
   line = skip_options (line);
 
   for (p=line; *p && *p != ' ' && *p != '\t'; p++)
@@ -1034,15 +1134,37 @@ cmd_pksign (assuan_context_t ctx, char *line)
   else if (!ctrl->server_local->use_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
 
-  init_membuf (&outbuf, 512);
+  if (opt_batch)
+    {
+      /* Each line may take up to 4 digits for the algo, a space, the
+       * hex encoded hash, and a LF.  */
+      size_t maxlen = MAX_PKSIGN_BATCH * (4 + 1 + 2*MAX_DIGEST_LEN + 1);
 
-  err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
-                      &outbuf, cache_mode);
+      err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%zu", maxlen);
+      if (!err)
+        err = assuan_inquire (ctx, "HASHES", &hashbuf, &hashbuflen, maxlen);
+      if (!err)
+        err = parse_pksign_batch (ctx, hashbuf, hashbuflen, &items, &nitems);
+      if (err)
+        goto leave;
+    }
+
+  init_membuf (&outbuf, opt_batch? nitems * 512 : 512);
+
+  if (opt_batch)
+    err = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                              items, nitems, &outbuf, cache_mode);
+  else
+    err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                        &outbuf, cache_mode);
   if (err)
     clear_outbuf (&outbuf);
   else
     err = write_and_clear_outbuf (ctx, &outbuf);
 
+ leave:
+  xfree (items);
+  xfree (hashbuf);
   xfree (cache_nonce);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
@@ -3925,6 +4047,7 @@ static const char hlp_getinfo[] =
   "  jent_active     - Returns OK if Libgcrypt's JENT is active.\n"
   "  ephemeral       - Returns OK if the connection is in ephemeral mode.\n"
   "  restricted      - Returns OK if the connection is in restricted mode.\n"
+  "  cache_stats     - Return statistics about the passphrase cache.\n"
   "  cmd_has_option CMD OPT\n"
   "                  - Returns OK if command CMD has option OPT.\n";
 static gpg_error_t
@@ -4015,6 +4138,18 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       else
         rc = gpg_error (GPG_ERR_NO_DATA);
     }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char *string = agent_cache_stats ();
+
+      if (!string)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, string, strlen (string));
+          xfree (string);
+        }
+    }
   else if (!strcmp (line, "scd_running"))
     {
       rc = agent_daemon_check_running (DAEMON_SCD)? 0:gpg_error (GPG_ERR_FALSE);
@@ -4324,6 +4459,11 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "mode1003"))
         return 1;
     }
+  else if (!strcmp (cmd, "PKSIGN"))
+    {
+      if (!strcmp (cmdopt, "batch"))
+        return 1;
+    }
 
   return 0;
 }
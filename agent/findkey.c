@@ -414,6 +414,8 @@ agent_write_private_key (ctrl_t ctrl,
   bump_key_eventcounter ();
 
  leave:
+  if (!ctrl->ephemeral_mode)
+    agent_flush_key_cache (grip);
   if (blocksigs)
     gnupg_unblock_all_signals ();
   if (ctrl->ephemeral_mode)
@@ -539,6 +541,8 @@ agent_update_private_key (ctrl_t ctrl, const unsigned char *grip, nvc_t pk)
 
 
  leave:
+  if (!ctrl->ephemeral_mode)
+    agent_flush_key_cache (grip);
   if (blocksigs)
     gnupg_unblock_all_signals ();
   if (ctrl->ephemeral_mode)
@@ -1212,6 +1216,35 @@ remove_key_file (const unsigned char *grip)
     }
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
+  agent_flush_key_cache (grip);
+  xfree (fname);
+  return err;
+}
+
+
+/* Store a stamp identifying the current version of the key file for
+ * GRIP at R_STAMP.  This is used to detect changes of the file by
+ * other processes for entries in the unlocked key cache.  */
+static gpg_error_t
+get_key_file_stamp (const unsigned char *grip,
+                    struct key_file_stamp_s *r_stamp)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  struct stat st;
+
+  memset (r_stamp, 0, sizeof *r_stamp);
+  fname = fname_from_keygrip (grip, 0);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  if (gnupg_stat (fname, &st))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      r_stamp->mtime = st.st_mtime;
+      r_stamp->size = st.st_size;
+      r_stamp->ino = st.st_ino;
+    }
   xfree (fname);
   return err;
 }
@@ -1360,7 +1393,9 @@ prompt_for_card (ctrl_t ctrl, const unsigned char *grip,
    R_PASSPHRASE is not NULL, the function succeeded and the key was
    protected the used passphrase (entered or from the cache) is stored
    there; if not NULL will be stored.  The caller needs to free the
-   returned passphrase.   */
+   returned passphrase.  If enabled, protected keys are kept in the
+   unlocked key cache after they have been unprotected and taken from
+   there as long as the key file has not been changed.  */
 gpg_error_t
 agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
                      const char *desc_text,
@@ -1375,6 +1410,10 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   gcry_sexp_t s_skey;
   nvc_t keymeta = NULL;
   char *desc_text_buffer = NULL;  /* Used in case we extend DESC_TEXT.  */
+  struct key_file_stamp_s stamp;
+  int use_key_cache;
+  int need_confirm = 0;
+  time_t timestamp = (time_t)(-1);
 
   *result = NULL;
   if (shadow_info)
@@ -1387,6 +1426,31 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (!grip && !ctrl->have_keygrip)
     return gpg_error (GPG_ERR_NO_SECKEY);
 
+  /* The stamp of the file needs to be taken before the file is read
+   * so that a concurrent update will be detected later.  */
+  use_key_cache = (opt.unlocked_key_cache_ttl
+                   && !ctrl->ephemeral_mode
+                   && cache_mode != CACHE_MODE_IGNORE
+                   && !get_key_file_stamp (grip? grip : ctrl->keygrip,
+                                           &stamp));
+  if (use_key_cache && !r_passphrase)
+    {
+      buf = agent_get_key_cache (ctrl, grip? grip : ctrl->keygrip,
+                                 &stamp, r_timestamp);
+      if (buf)
+        {
+          err = sexp_sscan_private_key (result, &erroff, buf);
+          xfree (buf);
+          if (!err)
+            return 0;
+          log_error ("failed to build S-Exp (off=%u): %s\n",
+                     (unsigned int)erroff, gpg_strerror (err));
+          agent_flush_key_cache (grip? grip : ctrl->keygrip);
+          if (r_timestamp)
+            *r_timestamp = (time_t)(-1);
+        }
+    }
+
   err = read_key_file (ctrl, grip? grip : ctrl->keygrip,
                        &s_skey, &keymeta, NULL);
   if (err)
@@ -1410,21 +1474,24 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
       return err;
     }
 
-  if (r_timestamp && keymeta)
+  if (keymeta)
     {
       const char *created = nvc_get_string (keymeta, "Created:");
+      const char *ask_confirmation = nvc_get_string (keymeta, "Confirm:");
 
       if (created)
-        *r_timestamp = isotime2epoch (created);
+        timestamp = isotime2epoch (created);
+      need_confirm = (ask_confirmation
+                      && ((!strcmp (ask_confirmation, "restricted")
+                           && ctrl->restricted)
+                          || !strcmp (ask_confirmation, "yes")));
     }
+  if (r_timestamp)
+    *r_timestamp = timestamp;
 
   if (!grip && keymeta)
     {
-      const char *ask_confirmation = nvc_get_string (keymeta, "Confirm:");
-
-      if (ask_confirmation
-          && ((!strcmp (ask_confirmation, "restricted") && ctrl->restricted)
-              || !strcmp (ask_confirmation, "yes")))
+      if (need_confirm)
         {
           char hexgrip[40+4+1];
           char *prompt;
@@ -1526,6 +1593,14 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
             if (err)
               log_error ("failed to unprotect the secret key: %s\n",
                          gpg_strerror (err));
+            else if (use_key_cache && !need_confirm)
+              {
+                /* Keys which require a confirmation are not cached
+                 * because that would bypass the confirmation.  */
+                agent_put_key_cache (ctrl, grip? grip : ctrl->keygrip,
+                                     &stamp, timestamp, buf,
+                                     gcry_sexp_canon_len (buf, 0, NULL, NULL));
+              }
           }
 
 	xfree (desc_text_final);
@@ -109,6 +109,7 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oUnlockedKeyCacheTTL,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
@@ -145,6 +146,7 @@ enum cmd_and_opt_values
   oS2KCalibration,
   oAutoExpandSecmem,
   oListenBacklog,
+  oCryptoThreads,
   oInactivityTimeout,
 
   oWriteEnvFile,
@@ -237,6 +239,7 @@ static gpgrt_opt_t opts[] = {
 #endif
                 ),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_i (oCryptoThreads, "crypto-threads", "@"),
   ARGPARSE_op_u (oAutoExpandSecmem, "auto-expand-secmem", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
 
@@ -251,6 +254,8 @@ static gpgrt_opt_t opts[] = {
                 /* */     N_("|N|set maximum PIN cache lifetime to N seconds")),
   ARGPARSE_s_u (oMaxCacheTTLSSH, "max-cache-ttl-ssh",
                 /* */     N_("|N|set maximum SSH key lifetime to N seconds")),
+  ARGPARSE_s_u (oUnlockedKeyCacheTTL, "unlocked-key-cache-ttl",
+                /* */     N_("|N|keep unprotected keys for N seconds")),
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
   ARGPARSE_s_n (oNoAllowExternalCache,  "no-allow-external-cache",
@@ -385,6 +390,11 @@ static int shutdown_pending;
 /* Flags to indicate that check_own_socket shall not be called.  */
 static int disable_check_own_socket;
 
+/* The value of --s2k-calibration as parsed from the options.  This
+ * is applied by finalize_rereadable_options so that a reload does
+ * not look like a change of the calibration time.  */
+static unsigned int s2k_calibration_option;
+
 /* Flag indicating that we are in supervised mode.  */
 static int is_supervised;
 
@@ -433,6 +443,26 @@ static assuan_sock_nonce_t socket_nonce_ssh;
  * Let's try this as default.  Change at runtime with --listen-backlog.  */
 static int listen_backlog = 64;
 
+/* The maximum number of threads running a CPU bound Libgcrypt
+ * operation outside of the nPth lock.  0 uses the number of CPUs.
+ * Change at startup with --crypto-threads.  */
+static int crypto_threads;
+
+/* The number of threads currently running such an operation, the
+ * condition to wait for a free slot, and the mutex to protect both.  */
+static int crypto_threads_active;
+static npth_mutex_t crypto_threads_lock;
+static npth_cond_t crypto_threads_cond;
+
+/* Thread specific flag telling that the thread has released the
+ * nPth lock in agent_crypto_begin.  Only valid if
+ * CRYPTO_THREADS_READY is set.  */
+static npth_key_t crypto_thread_key;
+static int crypto_threads_ready;
+
+/* Flag indicating that the S2K calibration thread is running.  */
+static int s2k_calibration_running;
+
 #ifdef HAVE_W32_SYSTEM
 /* The event to break the select call.  */
 static HANDLE the_event2;
@@ -535,6 +565,7 @@ static int check_for_running_agent (int silent);
 static void *check_own_socket_thread (void *arg);
 #endif
 static void *check_others_thread (void *arg);
+static void start_s2k_calibration (void);
 
 /*
    Functions.
@@ -891,6 +922,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.unlocked_key_cache_ttl = 0;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -909,7 +941,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       /* Note: When changing the next line, change also gpgconf_list.  */
       opt.ssh_fingerprint_digest = GCRY_MD_SHA256;
       opt.s2k_count = 0;
-      set_s2k_calibration_time (0);  /* Set to default.  */
+      s2k_calibration_option = 0;  /* Use the default.  */
       return 1;
     }
 
@@ -968,6 +1000,9 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oDefCacheTTLSSH: opt.def_cache_ttl_ssh = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
+    case oUnlockedKeyCacheTTL:
+      opt.unlocked_key_cache_ttl = pargs->r.ret_ulong;
+      break;
 
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
@@ -1020,7 +1055,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       break;
 
     case oS2KCalibration:
-      set_s2k_calibration_time (pargs->r.ret_ulong);
+      s2k_calibration_option = pargs->r.ret_ulong;
       break;
 
     case oNoop: break;
@@ -1045,6 +1080,29 @@ finalize_rereadable_options (void)
    * trusted feature.  */
   if (opt.no_user_trustlist)
     opt.allow_mark_trusted = 0;
+
+  /* Apply the calibration time only now so that it is compared
+   * against the final value and not against the default.  */
+  set_s2k_calibration_time (s2k_calibration_option);
+}
+
+
+/* Our system call clamp.  Libgcrypt and libgpg-error call these
+ * functions around blocking system calls.  This may also happen
+ * between agent_crypto_begin and agent_crypto_end where the thread
+ * does not hold the nPth lock and thus must not release it again.  */
+static void
+agent_pre_syscall (void)
+{
+  if (!crypto_threads_ready || !npth_getspecific (crypto_thread_key))
+    npth_unprotect ();
+}
+
+static void
+agent_post_syscall (void)
+{
+  if (!crypto_threads_ready || !npth_getspecific (crypto_thread_key))
+    npth_protect ();
 }
 
 
@@ -1058,7 +1116,7 @@ thread_init_once (void)
       npth_initialized++;
       npth_init ();
     }
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  gpgrt_set_syscall_clamp (agent_pre_syscall, agent_post_syscall);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
    * that it should get them from libgpg-error.  Note that Libgcrypt
    * has already been initialized but at that point nPth was not
@@ -1069,10 +1127,39 @@ thread_init_once (void)
 }
 
 
+/* Prepare the limiting of parallel Libgcrypt operations.  If this
+ * fails the operations are run with the nPth lock held.  */
+static void
+initialize_crypto_threads (void)
+{
+  int err;
+
+  if (crypto_threads_ready)
+    return;
+
+  if (crypto_threads <= 0)
+    crypto_threads = gnupg_get_ncpus ();
+
+  err = npth_mutex_init (&crypto_threads_lock, NULL);
+  if (!err)
+    err = npth_cond_init (&crypto_threads_cond, NULL);
+  if (!err)
+    err = npth_key_create (&crypto_thread_key, NULL);
+  if (err)
+    {
+      log_error ("error initializing crypto threads: %s\n", strerror (err));
+      return;
+    }
+  crypto_threads_ready = 1;
+}
+
+
 static void
 initialize_modules (void)
 {
   thread_init_once ();
+  initialize_crypto_threads ();
+  enable_s2k_state_file ();
   initialize_module_cache ();
   initialize_module_call_pinentry ();
   initialize_module_daemon ();
@@ -1337,6 +1424,10 @@ main (int argc, char **argv)
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oCryptoThreads:
+          crypto_threads = pargs.r.ret_int;
+          break;
+
         case oDebugQuickRandom:
           /* Only used by the first stage command line parser.  */
           break;
@@ -1483,6 +1574,8 @@ main (int argc, char **argv)
                  GC_OPT_FLAG_DEFAULT, MAX_CACHE_TTL );
       es_printf ("max-cache-ttl-ssh:%lu:%d:\n",
                  GC_OPT_FLAG_DEFAULT, MAX_CACHE_TTL_SSH );
+      es_printf ("unlocked-key-cache-ttl:%lu:0:\n",
+                 GC_OPT_FLAG_DEFAULT);
       es_printf ("min-passphrase-len:%lu:%d:\n",
                  GC_OPT_FLAG_DEFAULT, MIN_PASSPHRASE_LEN );
       es_printf ("min-passphrase-nonalpha:%lu:%d:\n",
@@ -1887,6 +1980,67 @@ agent_exit (int rc)
 }
 
 
+/* Release the nPth lock so that a CPU bound Libgcrypt operation can
+ * run in parallel to those of other connections.  If already
+ * CRYPTO_THREADS operations are running, wait until one of them has
+ * finished.  Between this call and agent_crypto_end only Libgcrypt
+ * functions may be called; in particular no data shared with other
+ * threads may be accessed.  */
+void
+agent_crypto_begin (void)
+{
+  int res;
+
+  if (!crypto_threads_ready)
+    return;
+
+  res = npth_mutex_lock (&crypto_threads_lock);
+  if (res)
+    log_fatal ("failed to acquire crypto threads mutex: %s\n",
+               strerror (res));
+  while (crypto_threads_active >= crypto_threads)
+    {
+      res = npth_cond_wait (&crypto_threads_cond, &crypto_threads_lock);
+      if (res)
+        log_fatal ("failed to wait for crypto threads: %s\n",
+                   strerror (res));
+    }
+  crypto_threads_active++;
+  res = npth_mutex_unlock (&crypto_threads_lock);
+  if (res)
+    log_fatal ("failed to release crypto threads mutex: %s\n",
+               strerror (res));
+
+  npth_setspecific (crypto_thread_key, &crypto_threads_active);
+  npth_unprotect ();
+}
+
+
+/* Re-acquire the nPth lock after agent_crypto_begin.  */
+void
+agent_crypto_end (void)
+{
+  int res;
+
+  if (!crypto_threads_ready || !npth_getspecific (crypto_thread_key))
+    return;
+
+  npth_protect ();
+  npth_setspecific (crypto_thread_key, NULL);
+
+  res = npth_mutex_lock (&crypto_threads_lock);
+  if (res)
+    log_fatal ("failed to acquire crypto threads mutex: %s\n",
+               strerror (res));
+  crypto_threads_active--;
+  npth_cond_signal (&crypto_threads_cond);
+  res = npth_mutex_unlock (&crypto_threads_lock);
+  if (res)
+    log_fatal ("failed to release crypto threads mutex: %s\n",
+               strerror (res));
+}
+
+
 /* This is our callback function for gcrypt progress messages.  It is
    set once at startup and dispatches progress messages to the
    corresponding threads of the agent.  */
@@ -1899,6 +2053,10 @@ agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
 
   (void)data;
 
+  /* We may not access the list without the nPth lock.  */
+  if (crypto_threads_ready && npth_getspecific (crypto_thread_key))
+    return;
+
   for (dispatch = progress_dispatch_list; dispatch; dispatch = dispatch->next)
     if (dispatch->ctrl && dispatch->tid == mytid)
       break;
@@ -2448,6 +2606,50 @@ create_directories (void)
 }
 
 
+/* The thread to do the S2K calibration in the background.  */
+static void *
+s2k_calibration_thread (void *arg)
+{
+  (void)arg;
+
+  update_s2k_calibration ();
+  s2k_calibration_running = 0;
+  return NULL;
+}
+
+
+/* Start a thread to do the S2K calibration unless a fixed S2K count
+ * has been configured or the calibration is already running.  */
+static void
+start_s2k_calibration (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int err;
+
+  if (opt.s2k_count || s2k_calibration_running)
+    return;
+
+  err = npth_attr_init (&tattr);
+  if (err)
+    {
+      log_error ("error allocating thread attributes: %s\n", strerror (err));
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+
+  s2k_calibration_running = 1;
+  err = npth_create (&thread, &tattr, s2k_calibration_thread, NULL);
+  if (err)
+    {
+      log_error ("error spawning s2k_calibration_thread: %s\n",
+                 strerror (err));
+      s2k_calibration_running = 0;
+    }
+  npth_attr_destroy (&tattr);
+}
+
+
 /* A global function which allows us to call the reload stuff from
    other places too.  This is only used when build for W32.  */
 void
@@ -2459,6 +2661,7 @@ agent_sighup_action (void)
   agent_flush_cache (0);
   reread_configuration ();
   agent_reload_trustlist ();
+  start_s2k_calibration ();
   /* We flush the module name cache so that after installing a
      "pinentry" binary that one can be used in case the
      "pinentry-basic" fallback was in use.  */
@@ -3080,6 +3283,10 @@ handle_connections (gnupg_fd_t listen_fd,
         log_error ("error spawning check_others_thread: %s\n", strerror (err));
     }
 
+  /* Calibrate the S2K count now so that the first request which
+   * protects a key does not need to wait for it.  */
+  start_s2k_calibration ();
+
   /* On Windows we need to fire up a separate thread to listen for
      requests from Putty (an SSH client), so we can replace Putty's
      Pageant (its ssh-agent implementation). */
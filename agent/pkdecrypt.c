@@ -189,7 +189,9 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 /*           gcry_sexp_dump (s_skey); */
 /*         } */
 
+      agent_crypto_begin ();
       err = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+      agent_crypto_end ();
       if (err)
         {
           log_error ("decryption failed: %s\n", gpg_strerror (err));
@@ -352,9 +354,11 @@ ecc_raw_kem (const struct ecc_params *ecc, gcry_sexp_t s_skey,
   if (err)
     goto leave;
 
+  agent_crypto_begin ();
   err = gcry_kem_decap (ecc->kem_algo, ecc_sk, ecc->scalar_len,
                         ecc_ct, ecc->point_len, ecc_ecdh, ecc->point_len,
                         NULL, 0);
+  agent_crypto_end ();
   if (err)
     {
       if (opt.verbose)
@@ -680,9 +684,11 @@ composite_pgp_kem_decrypt (ctrl_t ctrl, const char *desc_text,
       err = gpg_error (GPG_ERR_INV_DATA);
       goto leave;
     }
+  agent_crypto_begin ();
   err = gcry_kem_decap (mlkem_kem_algo, mlkem_sk, mlkem_sk_len,
                         mlkem_ct, mlkem_ct_len, mlkem_ss, mlkem_ss_len,
                         NULL, 0);
+  agent_crypto_end ();
   if (err)
     {
       if (opt.verbose)
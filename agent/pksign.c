@@ -268,20 +268,18 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
-/* SIGN whatever information we have accumulated in CTRL and return
- * the signature S-expression.  LOOKUP is an optional function to
- * provide a way for lower layers to ask for the caching TTL.  If a
- * CACHE_NONCE is given that cache item is first tried to get a
- * passphrase.  If OVERRIDEDATA is not NULL, OVERRIDEDATALEN bytes
- * from this buffer are used instead of the data in CTRL.  The
- * override feature is required to allow the use of Ed25519 with ssh
- * because Ed25519 does the hashing itself.  */
-gpg_error_t
-agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
-                 const char *desc_text,
-		 gcry_sexp_t *signature_sexp,
-                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
-                 const void *overridedata, size_t overridedatalen)
+/* Worker for agent_pksign_do and agent_pksign_batch.  If R_SKEY is
+ * not NULL and a key is stored there, that key is used instead of
+ * reading it from the file.  If R_SKEY is not NULL and the key is
+ * not stored on a token, the key is returned at R_SKEY for use by a
+ * further call.  The caller must then release it.  */
+static gpg_error_t
+do_pksign (ctrl_t ctrl, const char *cache_nonce,
+           const char *desc_text,
+           gcry_sexp_t *signature_sexp,
+           cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
+           const void *overridedata, size_t overridedatalen,
+           gcry_sexp_t *r_skey)
 {
   gpg_error_t err = 0;
   gcry_sexp_t s_skey = NULL;
@@ -314,15 +312,23 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   if (!ctrl->have_keygrip)
     return gpg_error (GPG_ERR_NO_SECKEY);
 
-  err = agent_key_from_file (ctrl, cache_nonce, desc_text, NULL,
-                             &shadow_info, cache_mode, lookup_ttl,
-                             &s_skey, NULL, NULL);
-  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
-    no_shadow_info = 1;
-  else if (err)
+  if (r_skey && *r_skey)
     {
-      log_error ("failed to read the secret key\n");
-      goto leave;
+      s_skey = *r_skey;
+      *r_skey = NULL;
+      algo = get_pk_algo_from_key (s_skey);
+    }
+  else if ((err = agent_key_from_file (ctrl, cache_nonce, desc_text, NULL,
+                                       &shadow_info, cache_mode, lookup_ttl,
+                                       &s_skey, NULL, NULL)))
+    {
+      if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
+        no_shadow_info = 1;
+      else
+        {
+          log_error ("failed to read the secret key\n");
+          goto leave;
+        }
     }
   else
     algo = get_pk_algo_from_key (s_skey);
@@ -528,7 +534,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       /* sign */
+      agent_crypto_begin ();
       err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      agent_crypto_end ();
       if (err)
         {
           log_error ("signing failed: %s\n", gpg_strerror (err));
@@ -588,6 +596,11 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 
   *signature_sexp = s_sig;
 
+  if (r_skey && s_skey && !shadow_info && !no_shadow_info)
+    {
+      *r_skey = s_skey;
+      s_skey = NULL;
+    }
   gcry_sexp_release (s_pkey);
   gcry_sexp_release (s_skey);
   gcry_sexp_release (s_hash);
@@ -597,6 +610,47 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+/* SIGN whatever information we have accumulated in CTRL and return
+ * the signature S-expression.  LOOKUP is an optional function to
+ * provide a way for lower layers to ask for the caching TTL.  If a
+ * CACHE_NONCE is given that cache item is first tried to get a
+ * passphrase.  If OVERRIDEDATA is not NULL, OVERRIDEDATALEN bytes
+ * from this buffer are used instead of the data in CTRL.  The
+ * override feature is required to allow the use of Ed25519 with ssh
+ * because Ed25519 does the hashing itself.  */
+gpg_error_t
+agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
+                 const char *desc_text,
+		 gcry_sexp_t *signature_sexp,
+                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
+                 const void *overridedata, size_t overridedatalen)
+{
+  return do_pksign (ctrl, cache_nonce, desc_text, signature_sexp,
+                    cache_mode, lookup_ttl, overridedata, overridedatalen,
+                    NULL);
+}
+
+
+/* Append the signature S_SIG in canonical format to OUTBUF.  */
+static gpg_error_t
+put_sig_into_membuf (gcry_sexp_t s_sig, membuf_t *outbuf)
+{
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  put_membuf (outbuf, buf, len);
+  xfree (buf);
+  return 0;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and write it
  * back to OUTFP.  If a CACHE_NONCE is given that cache item is first
  * tried to get a passphrase.  */
@@ -606,29 +660,89 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 {
   gpg_error_t err;
   gcry_sexp_t s_sig = NULL;
-  char *buf = NULL;
-  size_t len = 0;
 
   err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig, cache_mode,
                          NULL, NULL, 0);
-  if (err)
-    goto leave;
+  if (!err)
+    err = put_sig_into_membuf (s_sig, outbuf);
 
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
-  log_assert (len);
-  buf = xtrymalloc (len);
-  if (!buf)
+  gcry_sexp_release (s_sig);
+  return err;
+}
+
+
+/* Return true if the use of the key set in CTRL needs to be
+ * confirmed by the user.  Errors are ignored here because they are
+ * detected when the key is actually used.  */
+static int
+key_needs_confirmation (ctrl_t ctrl)
+{
+  gcry_sexp_t s_skey;
+  nvc_t keymeta = NULL;
+  const char *value;
+  int result = 0;
+
+  if (agent_raw_key_from_file (ctrl, ctrl->keygrip, &s_skey, &keymeta))
+    return 0;
+  gcry_sexp_release (s_skey);
+  if (keymeta)
     {
-      err = gpg_error_from_syserror ();
-      goto leave;
+      value = nvc_get_string (keymeta, "Confirm:");
+      result = (value
+                && ((!strcmp (value, "restricted") && ctrl->restricted)
+                    || !strcmp (value, "yes")));
+      nvc_release (keymeta);
     }
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
-  log_assert (len);
-  put_membuf (outbuf, buf, len);
+  return result;
+}
 
- leave:
-  gcry_sexp_release (s_sig);
-  xfree (buf);
 
+/* Sign the NHASHES hashes from the array HASHES with the key set in
+ * CTRL and write the signatures in the same order to OUTBUF.  The
+ * key is read and unprotected only once.  Note that the digest in
+ * CTRL is overwritten.  Keys which require a confirmation for each
+ * use are rejected with GPG_ERR_NOT_SUPPORTED because the user would
+ * only confirm the first signature.  */
+gpg_error_t
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text,
+                    const struct pksign_batch_item_s *hashes, int nhashes,
+                    membuf_t *outbuf, cache_mode_t cache_mode)
+{
+  gpg_error_t err = 0;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig;
+  int i;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  if (key_needs_confirmation (ctrl))
+    {
+      log_info ("batch signing refused: key requires confirmation\n");
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  for (i=0; i < nhashes; i++)
+    {
+      xfree (ctrl->digest.data);
+      ctrl->digest.data = NULL;
+      ctrl->digest.algo = hashes[i].algo;
+      ctrl->digest.valuelen = hashes[i].valuelen;
+      memcpy (ctrl->digest.value, hashes[i].value, hashes[i].valuelen);
+      ctrl->digest.raw_value = 0;
+      ctrl->digest.is_pss = 0;
+
+      s_sig = NULL;
+      err = do_pksign (ctrl, cache_nonce, desc_text, &s_sig, cache_mode,
+                       NULL, NULL, 0, &s_skey);
+      if (!err)
+        err = put_sig_into_membuf (s_sig, outbuf);
+      gcry_sexp_release (s_sig);
+      if (err)
+        break;
+    }
+
+  gcry_sexp_release (s_skey);
   return err;
 }
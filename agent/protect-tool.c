@@ -762,6 +762,16 @@ agent_key_available (ctrl_t ctrl, const unsigned char *grip)
   return -1;  /* Not available.  */
 }
 
+void
+agent_crypto_begin (void)
+{
+}
+
+void
+agent_crypto_end (void)
+{
+}
+
 char *
 agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
 {
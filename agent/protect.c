@@ -75,6 +75,24 @@ static const struct {
 static unsigned int s2k_calibration_time = AGENT_S2K_CALIBRATION;
 static unsigned long s2k_calibrated_count;
 
+/* The measured time in milliseconds for S2K_CALIBRATED_COUNT or 0 if
+ * not known and the time the calibration was done.  */
+static unsigned long s2k_calibrated_ms;
+static time_t s2k_calibrated_at;
+
+/* Incremented each time the calibration is invalidated so that a
+ * background calibration can detect that its result is outdated.  */
+static unsigned int s2k_calibration_seqno;
+
+/* If set the calibration is read from and written to the state file
+ * in the home directory.  */
+static int s2k_use_state_file;
+
+/* The name of the state file and the age in seconds after which a
+ * calibration read from it is done again in the background.  */
+#define S2K_STATE_FILE    "s2k-calibration"
+#define S2K_STATE_MAX_AGE (7*86400)
+
 
 /* A helper object for time measurement.  */
 struct calibrate_time_s
@@ -215,6 +233,111 @@ calibrate_s2k_count (void)
 }
 
 
+/* Read the calibration from the state file.  The values are only
+ * used if they were done for the current calibration time and the
+ * same Libgcrypt version.  Returns true if a calibration was read.  */
+static int
+read_s2k_state (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[256];
+  const char *fields[7];
+  unsigned long count;
+  int n;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_STATE_FILE, NULL);
+  if (!fname)
+    return 0;
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT && opt.verbose)
+        log_info ("can't open '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      xfree (fname);
+      return 0;
+    }
+
+  count = 0;
+  while (es_fgets (line, sizeof line, fp))
+    {
+      trim_spaces (line);
+      if (!*line || *line == '#')
+        continue;
+      n = split_fields (line, fields, DIM (fields));
+      if (n == 6 && !strcmp (fields[0], "v1")
+          && strtoul (fields[1], NULL, 10) == s2k_calibration_time
+          && !strcmp (fields[5], gcry_check_version (NULL)))
+        {
+          count = strtoul (fields[2], NULL, 10);
+          if (count >= 65536)
+            {
+              s2k_calibrated_count = count;
+              s2k_calibrated_ms = strtoul (fields[3], NULL, 10);
+              s2k_calibrated_at = (time_t)strtoul (fields[4], NULL, 10);
+            }
+          else
+            count = 0;
+        }
+      break;
+    }
+  es_fclose (fp);
+
+  if (count && opt.verbose)
+    log_info ("S2K calibration read from '%s': %lu -> %lums\n",
+              fname, s2k_calibrated_count, s2k_calibrated_ms);
+  xfree (fname);
+  return !!count;
+}
+
+
+/* Write the current calibration to the state file.  */
+static void
+write_s2k_state (void)
+{
+  gpg_error_t err;
+  char *fname, *tmpfname;
+  estream_t fp;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_STATE_FILE, NULL);
+  tmpfname = fname? strconcat (fname, ".tmp", NULL) : NULL;
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  fp = es_fopen (tmpfname, "w,mode=-rw");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_fprintf (fp, "# Created by gpg-agent - do not edit\n"
+              "v1 %u %lu %lu %lu %s\n",
+              s2k_calibration_time, s2k_calibrated_count, s2k_calibrated_ms,
+              (unsigned long)s2k_calibrated_at, gcry_check_version (NULL));
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  if (err && opt.verbose)
+    log_info ("error writing '%s': %s\n",
+              fname? fname : S2K_STATE_FILE, gpg_strerror (err));
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
 /* Set the calibration time.  This may be called early at startup or
  * at any time.  Thus it should one set variables.  */
 void
@@ -224,8 +347,53 @@ set_s2k_calibration_time (unsigned int milliseconds)
     milliseconds = AGENT_S2K_CALIBRATION;
   else if (milliseconds > 60 * 1000)
     milliseconds = 60 * 1000;  /* Cap at 60 seconds.  */
+  if (milliseconds == s2k_calibration_time)
+    return;
   s2k_calibration_time = milliseconds;
   s2k_calibrated_count = 0;  /* Force re-calibration.  */
+  s2k_calibrated_ms = 0;
+  s2k_calibration_seqno++;
+}
+
+
+/* Enable the use of the state file to keep the calibration across
+ * restarts.  This is called by gpg-agent at startup.  */
+void
+enable_s2k_state_file (void)
+{
+  s2k_use_state_file = 1;
+}
+
+
+/* Do the S2K calibration if it has not been done or is outdated.
+ * This is called by a background thread of gpg-agent so that the
+ * time required for the calibration does not delay a request.  */
+void
+update_s2k_calibration (void)
+{
+  unsigned int seqno;
+  unsigned long count, ms;
+
+  if (!s2k_calibrated_count && s2k_use_state_file)
+    read_s2k_state ();
+  if (s2k_calibrated_count
+      && s2k_calibrated_at + S2K_STATE_MAX_AGE > gnupg_get_time ())
+    return;  /* Recent enough.  */
+
+  seqno = s2k_calibration_seqno;
+  count = calibrate_s2k_count ();
+  ms = calibrate_s2k_count_one (count);
+  if (seqno != s2k_calibration_seqno)
+    return;  /* The calibration time has been changed meanwhile.  */
+
+  if (opt.verbose)
+    log_info ("S2K calibration done in the background: %lu -> %lums\n",
+              count, ms);
+  s2k_calibrated_count = count;
+  s2k_calibrated_ms = ms;
+  s2k_calibrated_at = gnupg_get_time ();
+  if (s2k_use_state_file)
+    write_s2k_state ();
 }
 
 
@@ -234,8 +402,15 @@ set_s2k_calibration_time (unsigned int milliseconds)
 unsigned long
 get_calibrated_s2k_count (void)
 {
-  if (!s2k_calibrated_count)
-    s2k_calibrated_count = calibrate_s2k_count ();
+  if (!s2k_calibrated_count
+      && !(s2k_use_state_file && read_s2k_state ()))
+    {
+      s2k_calibrated_count = calibrate_s2k_count ();
+      s2k_calibrated_ms = 0;
+      s2k_calibrated_at = gnupg_get_time ();
+      if (s2k_use_state_file)
+        write_s2k_state ();
+    }
 
   /* Enforce a lower limit.  */
   return s2k_calibrated_count < 65536 ? 65536 : s2k_calibrated_count;
@@ -254,11 +429,20 @@ get_standard_s2k_count (void)
 
 
 /* Return the milliseconds required for the standard S2K
- * operation.  */
+ * operation.  The time measured by the calibration is used if
+ * available.  */
 unsigned long
 get_standard_s2k_time (void)
 {
-  return calibrate_s2k_count_one (get_standard_s2k_count ());
+  unsigned long count = get_standard_s2k_count ();
+  unsigned long ms;
+
+  if (s2k_calibrated_ms && count == s2k_calibrated_count)
+    return s2k_calibrated_ms;
+  ms = calibrate_s2k_count_one (count);
+  if (count == s2k_calibrated_count)
+    s2k_calibrated_ms = ms;
+  return ms;
 }
 
 
@@ -1401,17 +1585,22 @@ hash_passphrase (const char *passphrase, int hashalgo,
                  unsigned long s2kcount,
                  unsigned char *key, size_t keylen)
 {
+  gpg_error_t err;
+
   /* The key derive function does not support a zero length string for
      the passphrase in the S2K modes.  Return a better suited error
      code than GPG_ERR_INV_DATA.  */
   if (!passphrase || !*passphrase)
     return gpg_error (GPG_ERR_NO_PASSPHRASE);
-  return gcry_kdf_derive (passphrase, strlen (passphrase),
-                          s2kmode == 3? GCRY_KDF_ITERSALTED_S2K :
-                          s2kmode == 1? GCRY_KDF_SALTED_S2K :
-                          s2kmode == 0? GCRY_KDF_SIMPLE_S2K : GCRY_KDF_NONE,
-                          hashalgo, s2ksalt, 8, s2kcount,
-                          keylen, key);
+  agent_crypto_begin ();
+  err = gcry_kdf_derive (passphrase, strlen (passphrase),
+                         s2kmode == 3? GCRY_KDF_ITERSALTED_S2K :
+                         s2kmode == 1? GCRY_KDF_SALTED_S2K :
+                         s2kmode == 0? GCRY_KDF_SIMPLE_S2K : GCRY_KDF_NONE,
+                         hashalgo, s2ksalt, 8, s2kcount,
+                         keylen, key);
+  agent_crypto_end ();
+  return err;
 }
 
 
@@ -349,3 +349,15 @@ convert_from_openpgp_native (gcry_sexp_t s_pgp, const char *passphrase,
   (void)r_key;
   return gpg_error (GPG_ERR_BUG);
 }
+
+/* Stub function.  */
+void
+agent_crypto_begin (void)
+{
+}
+
+/* Stub function.  */
+void
+agent_crypto_end (void)
+{
+}
@@ -40,6 +40,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#if !defined(HAVE_W32_SYSTEM) && !defined(HAVE_CLOCK_GETTIME)
+# include <sys/time.h>
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -50,6 +54,13 @@
 # include <kernel.h>
 # include <swis.h>
 #endif /* __riscos__ */
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_MMAP_INPUT 1
+#endif
 
 #include <assuan.h>
 
@@ -70,12 +81,35 @@
    instead of the internal buffers. */
 #define IOBUF_ZEROCOPY_THRESHOLD_SIZE 1024
 
+/* Regular files smaller than this are read using read(2) even if
+   memory mapped input has been enabled.  */
+#define IOBUF_MMAP_THRESHOLD_SIZE (256*1024)
+
+/* The size of the window used to map an input file into memory.
+   This must be a multiple of the page size.  Using a window instead
+   of mapping the entire file keeps the address space usage low on
+   32 bit systems.  */
+#define IOBUF_MMAP_WINDOW_SIZE (64*1024*1024)
+
 /*-- End configurable part.  --*/
 
 /* The size of the iobuffers.  This can be changed using the
  * iobuf_set_buffer_size function.  */
 static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 
+/* Flag indicating that input files shall be memory mapped.  This can
+ * be changed using the iobuf_set_mmap function.  */
+static int iobuf_use_mmap;
+
+/* Flag indicating that statistics for each filter shall be collected
+ * and printed.  This can be changed using the iobuf_set_stats
+ * function.  */
+static int iobuf_stats_mode;
+
+/* The time in nanoseconds spent in nested filter calls during the
+ * current filter call.  Used to compute the self time of a filter.  */
+static uint64_t stats_nested_ns;
+
 
 #ifdef HAVE_W32_SYSTEM
 # define FD_FOR_STDIN  (GetStdHandle (STD_INPUT_HANDLE))
@@ -98,6 +132,12 @@ typedef struct
   char peeked[32];     /* Read ahead buffer.  */
   byte npeeked;        /* Number of bytes valid in peeked.  */
   byte upeeked;        /* Number of bytes used from peeked.  */
+  int use_mmap;        /* Input is read from a memory mapping.  */
+  byte *map;           /* The current mmap window or NULL.  */
+  size_t maplen;       /* Length of that window.  */
+  off_t mapbase;       /* File offset of the window.  */
+  off_t mapoff;        /* File offset of the next byte to return.  */
+  off_t mapsize;       /* Size of the file at the time it was opened.  */
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -455,6 +495,142 @@ fd_cache_open (const char *fname, const char *mode)
 }
 
 
+#ifdef USE_MMAP_INPUT
+/* Stop using the memory mapping for the file filter context A.  The
+ * file position is set to the current read offset so that reading
+ * can continue using read(2).  */
+static void
+mmap_leave (file_filter_ctx_t *a)
+{
+  if (a->map)
+    {
+      munmap (a->map, a->maplen);
+      a->map = NULL;
+    }
+  a->use_mmap = 0;
+  if (lseek (a->fp, a->mapoff, SEEK_SET) == (off_t) - 1)
+    {
+      a->delayed_rc = gpg_error_from_syserror ();
+      log_error ("%s: can't lseek: %s\n", a->fname,
+                 gpg_strerror (a->delayed_rc));
+    }
+}
+
+
+/* Return a pointer to the data at the current read offset of the
+ * file filter context A and store the number of bytes available at
+ * that pointer at R_AVAIL.  The mmap window is moved as needed.  If
+ * the end of the mapped region has been reached or a new window
+ * could not be mapped, A is switched to read(2) and NULL is
+ * returned.  */
+static const byte *
+mmap_window (file_filter_ctx_t *a, size_t *r_avail)
+{
+  static long pagesize;
+  off_t base;
+  size_t len;
+  void *p;
+
+  *r_avail = 0;
+  if (a->mapoff >= a->mapsize)
+    {
+      /* Switch to read for the rest; this also handles files which
+       * have grown since we opened them.  */
+      mmap_leave (a);
+      return NULL;
+    }
+
+  if (!a->map || a->mapoff < a->mapbase
+      || a->mapoff >= a->mapbase + (off_t)a->maplen)
+    {
+      if (a->map)
+        {
+          munmap (a->map, a->maplen);
+          a->map = NULL;
+        }
+      if (!pagesize)
+        {
+          pagesize = sysconf (_SC_PAGESIZE);
+          if (pagesize <= 0)
+            pagesize = 4096;
+        }
+      base = a->mapoff - (a->mapoff % pagesize);
+      len = IOBUF_MMAP_WINDOW_SIZE;
+      if (a->mapsize - base < (off_t)len)
+        len = a->mapsize - base;
+      p = mmap (NULL, len, PROT_READ, MAP_PRIVATE, a->fp, base);
+      if (p == MAP_FAILED)
+        {
+          if (DBG_IOBUF)
+            log_debug ("%s: mmap failed: %s - using read\n",
+                       a->fname, strerror (errno));
+          mmap_leave (a);
+          return NULL;
+        }
+#ifdef MADV_SEQUENTIAL
+      madvise (p, len, MADV_SEQUENTIAL);
+#endif
+      a->map = p;
+      a->maplen = len;
+      a->mapbase = base;
+    }
+
+  *r_avail = a->mapbase + a->maplen - a->mapoff;
+  return a->map + (a->mapoff - a->mapbase);
+}
+
+
+/* Copy up to SIZE bytes from the mapped file of A to BUF.  If
+ * ADVANCE is set the read offset is moved forward.  Returns the
+ * number of bytes copied; 0 is returned at the end of the mapped
+ * region and A has then been switched to read(2).  */
+static size_t
+mmap_copy (file_filter_ctx_t *a, byte *buf, size_t size, int advance)
+{
+  const byte *p;
+  size_t n;
+  size_t nbytes = 0;
+
+  while (nbytes < size && a->use_mmap && (p = mmap_window (a, &n)))
+    {
+      if (n > size - nbytes)
+        n = size - nbytes;
+      memcpy (buf + nbytes, p, n);
+      nbytes += n;
+      if (!advance)
+        break;
+      a->mapoff += n;
+    }
+  return nbytes;
+}
+
+
+/* Enable memory mapped input for the file filter context A if this
+ * has been requested and A refers to a large enough regular file.  */
+static void
+mmap_setup (file_filter_ctx_t *a)
+{
+  struct stat st;
+  off_t pos;
+
+  if (!iobuf_use_mmap)
+    return;
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode)
+      || st.st_size < IOBUF_MMAP_THRESHOLD_SIZE)
+    return;
+  pos = lseek (a->fp, 0, SEEK_CUR);
+  if (pos == (off_t) - 1 || pos >= st.st_size)
+    return;
+
+  a->mapoff = pos;
+  a->mapsize = st.st_size;
+  a->use_mmap = 1;
+  if (DBG_IOBUF)
+    log_debug ("%s: using mmap for input\n", a->fname);
+}
+#endif /*USE_MMAP_INPUT*/
+
+
 static int
 file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	     size_t * ret_len)
@@ -492,6 +668,12 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
             a->eof_seen = -1;
 	  *ret_len = 0;
         }
+#ifdef USE_MMAP_INPUT
+      else if (a->use_mmap && (nbytes = mmap_copy (a, buf, size, 1)))
+        {
+          *ret_len = nbytes;
+        }
+#endif /*USE_MMAP_INPUT*/
       else
 	{
 #ifdef HAVE_W32_SYSTEM
@@ -621,7 +803,23 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->no_cache = 0;
       a->npeeked = 0;
       a->upeeked = 0;
+      a->use_mmap = 0;
+      a->map = NULL;
+      a->maplen = 0;
+      a->mapbase = 0;
+      a->mapoff = 0;
+      a->mapsize = 0;
+    }
+#ifdef USE_MMAP_INPUT
+  else if (control == IOBUFCTRL_PEEK && a->use_mmap
+           && (nbytes = mmap_copy (a, buf, (size < sizeof a->peeked
+                                            ? size : sizeof a->peeked), 0)))
+    {
+      /* Peek directly into the mapping; this does not need the read
+       * ahead buffer.  */
+      *ret_len = nbytes;
     }
+#endif /*USE_MMAP_INPUT*/
   else if (control == IOBUFCTRL_PEEK)
     {
       /* Peek on the input.  */
@@ -694,6 +892,10 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#ifdef USE_MMAP_INPUT
+      if (a->use_mmap)
+        mmap_leave (a);
+#endif
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -1228,6 +1430,40 @@ iobuf_set_buffer_size (unsigned int kilobyte)
 }
 
 
+/* Enable (ENABLE > 0) or disable (ENABLE == 0) the use of memory
+ * mapped I/O for input files opened by iobuf_open.  Only regular
+ * files of a certain minimum size are mapped; all other files and
+ * systems without mmap use read(2).  Note that a mapped file which
+ * is truncated by another process while being read may terminate the
+ * process.  Using a negative value has no effect except for returning
+ * the current value.  */
+int
+iobuf_set_mmap (int enable)
+{
+  if (enable >= 0)
+    iobuf_use_mmap = !!enable;
+#ifdef USE_MMAP_INPUT
+  return iobuf_use_mmap;
+#else
+  return 0;
+#endif
+}
+
+
+/* Enable (ENABLE > 0) or disable (ENABLE == 0) the collection of
+ * statistics for each filter.  The statistics of a pipeline with at
+ * least one pushed filter are printed as debug output when the
+ * pipeline is closed.  Using a negative value has no effect except
+ * for returning the current value.  */
+int
+iobuf_set_stats (int enable)
+{
+  if (enable >= 0)
+    iobuf_stats_mode = !!enable;
+  return iobuf_stats_mode;
+}
+
+
 #define MAX_IOBUF_DESC 32
 /*
  * Fill the buffer by the description of iobuf A.
@@ -1269,6 +1505,157 @@ iobuf_print_chain (iobuf_t a)
   return 0;
 }
 
+
+/* The statistics of one stage as printed by print_stats.  */
+struct stats_entry_s
+{
+  int no;
+  int subno;
+  byte desc[MAX_IOBUF_DESC];
+  uint64_t nbytes;
+  unsigned long nunderflow;
+  unsigned long nflush;
+  uint64_t total_ns;
+  uint64_t self_ns;
+};
+
+
+/* Return a monotonic time in nanoseconds.  */
+static uint64_t
+stats_clock (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER cnt;
+
+  if (!freq.QuadPart)
+    QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&cnt);
+  return (uint64_t)((double)cnt.QuadPart * 1e9 / (double)freq.QuadPart);
+#elif defined(HAVE_CLOCK_GETTIME)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+
+/* Call the filter of A with CONTROL, BUF and LEN and update the
+ * statistics of A if enabled.  */
+static int
+call_filter (iobuf_t a, int control, byte *buf, size_t *len)
+{
+  uint64_t saved, start, elapsed;
+  int rc;
+
+  if (!iobuf_stats_mode)
+    return a->filter (a->filter_ov, control, a->chain, buf, len);
+
+  saved = stats_nested_ns;
+  stats_nested_ns = 0;
+  start = stats_clock ();
+  rc = a->filter (a->filter_ov, control, a->chain, buf, len);
+  elapsed = stats_clock () - start;
+
+  a->stats.total_ns += elapsed;
+  if (elapsed > stats_nested_ns)
+    a->stats.self_ns += elapsed - stats_nested_ns;
+  stats_nested_ns = saved + elapsed;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      a->stats.nunderflow++;
+      a->stats.nbytes += *len;
+    }
+  else if (control == IOBUFCTRL_FLUSH)
+    {
+      a->stats.nflush++;
+      a->stats.nbytes += *len;
+    }
+
+  return rc;
+}
+
+
+/* Store the statistics of A at E.  DESC is the description of A's
+ * filter which must be taken before the filter is released.  */
+static void
+record_stats (struct stats_entry_s *e, iobuf_t a, const byte *desc)
+{
+  e->no = a->no;
+  e->subno = a->subno;
+  memcpy (e->desc, desc, MAX_IOBUF_DESC);
+  e->desc[MAX_IOBUF_DESC-1] = 0;
+  e->nbytes = a->stats.nbytes;
+  e->nunderflow = a->stats.nunderflow;
+  e->nflush = a->stats.nflush;
+  e->total_ns = a->stats.total_ns;
+  e->self_ns = a->stats.self_ns;
+
+  /* The data of a temp stream does not pass a filter.  */
+  if (!a->filter && !e->nunderflow && !e->nflush
+      && (a->use == IOBUF_INPUT_TEMP || a->use == IOBUF_OUTPUT_TEMP))
+    e->nbytes = a->d.len;
+}
+
+
+/* Print the first NPRINT of the N statistics entries ENTS of a
+ * pipeline.  OUTPUT tells whether this is an output pipeline.  The
+ * bytes an output filter writes are the bytes the next stage
+ * receives and the bytes an input filter reads are those the next
+ * stage returns; for the last stage both numbers are the same.  */
+static void
+print_stats (struct stats_entry_s *ents, int n, int nprint, int output)
+{
+  int i;
+  uint64_t nin, nout;
+
+  for (i = 0; i < n && i < nprint; i++)
+    {
+      if (output)
+        {
+          nin = ents[i].nbytes;
+          nout = i+1 < n? ents[i+1].nbytes : nin;
+        }
+      else
+        {
+          nout = ents[i].nbytes;
+          nin = i+1 < n? ents[i+1].nbytes : nout;
+        }
+      log_debug ("iobuf-%d.%d: stats '%s': in=%llu out=%llu"
+                 " underflow=%lu flush=%lu time=%.3fms self=%.3fms\n",
+                 ents[i].no, ents[i].subno, ents[i].desc,
+                 (unsigned long long)nin, (unsigned long long)nout,
+                 ents[i].nunderflow, ents[i].nflush,
+                 ents[i].total_ns / 1e6, ents[i].self_ns / 1e6);
+    }
+}
+
+
+/* Print the statistics of A which is about to be removed from its
+ * pipeline.  DESC is the description of A's filter.  */
+static void
+print_stage_stats (iobuf_t a, const byte *desc)
+{
+  struct stats_entry_s ents[2];
+  int n = 1;
+
+  record_stats (ents, a, desc);
+  if (a->chain)
+    {
+      record_stats (ents+1, a->chain, (const byte *)"");
+      n++;
+    }
+  print_stats (ents, n, 1,
+               (a->use == IOBUF_OUTPUT || a->use == IOBUF_OUTPUT_TEMP));
+}
+
 iobuf_t
 iobuf_alloc (int use, size_t bufsize)
 {
@@ -1303,6 +1690,17 @@ iobuf_close (iobuf_t a)
   iobuf_t a_chain;
   size_t dummy_len = 0;
   int rc = 0;
+  struct stats_entry_s stats[MAX_NESTING_FILTER + 1];
+  int nstats = 0;
+  int want_stats = 0;
+  int stats_output = 0;
+
+  /* Statistics are only of interest if filters have been pushed.  */
+  if (iobuf_stats_mode && a && a->subno)
+    {
+      want_stats = 1;
+      stats_output = (a->use == IOBUF_OUTPUT || a->use == IOBUF_OUTPUT_TEMP);
+    }
 
   for (; a; a = a_chain)
     {
@@ -1314,18 +1712,22 @@ iobuf_close (iobuf_t a)
       if (a->use == IOBUF_OUTPUT && (rc = filter_flush (a)))
 	log_error ("filter_flush failed on close: %s\n", gpg_strerror (rc));
 
+      if (DBG_IOBUF || want_stats)
+        iobuf_desc (a, desc);
       if (DBG_IOBUF)
-	log_debug ("iobuf-%d.%d: close '%s'\n",
-		   a->no, a->subno, iobuf_desc (a, desc));
+	log_debug ("iobuf-%d.%d: close '%s'\n", a->no, a->subno, desc);
 
-      if (a->filter && (rc2 = a->filter (a->filter_ov, IOBUFCTRL_FREE,
-					 a->chain, NULL, &dummy_len)))
+      if (a->filter && (rc2 = call_filter (a, IOBUFCTRL_FREE,
+                                           NULL, &dummy_len)))
 	log_error ("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror (rc));
       if (! rc && rc2)
 	/* Whoops!  An error occurred.  Save it in RC if we haven't
 	   already recorded an error.  */
 	rc = rc2;
 
+      if (want_stats && nstats < DIM (stats))
+        record_stats (stats + nstats++, a, desc);
+
       xfree (a->real_fname);
       if (a->d.buf)
 	{
@@ -1334,6 +1736,10 @@ iobuf_close (iobuf_t a)
 	}
       xfree (a);
     }
+
+  if (want_stats)
+    print_stats (stats, nstats, nstats, stats_output);
+
   return rc;
 }
 
@@ -1470,6 +1876,10 @@ do_open (const char *fname, int special_filenames,
   a->filter = file_filter;
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+#ifdef USE_MMAP_INPUT
+  if (use == IOBUF_INPUT)
+    mmap_setup (fcx);
+#endif
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: open '%s' desc=%s fd=%d\n",
 	       a->no, a->subno, fname, iobuf_desc (a, desc),
@@ -1777,6 +2187,7 @@ iobuf_push_filter2 (iobuf_t a,
   a->filter_ov = NULL;
   a->filter_ov_owner = 0;
   a->filter_eof = 0;
+  memset (&a->stats, 0, sizeof a->stats);
   if (a->use == IOBUF_OUTPUT_TEMP)
     /* A TEMP filter buffers any data sent to it; it does not forward
        any data down the pipeline.  If we add a new filter to the
@@ -1890,12 +2301,15 @@ iobuf_pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
       return rc;
     }
   /* and tell the filter to free it self */
-  if (b->filter && (rc = b->filter (b->filter_ov, IOBUFCTRL_FREE, b->chain,
-				    NULL, &dummy_len)))
+  if (iobuf_stats_mode)
+    iobuf_desc (b, desc);
+  if (b->filter && (rc = call_filter (b, IOBUFCTRL_FREE, NULL, &dummy_len)))
     {
       log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
       return rc;
     }
+  if (iobuf_stats_mode)
+    print_stage_stats (b, desc);
   if (b->filter_ov && b->filter_ov_owner)
     {
       xfree (b->filter_ov);
@@ -2053,8 +2467,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      log_debug ("iobuf-%d.%d: underflow: A->FILTER (%lu bytes, to external drain)\n",
 			 a->no, a->subno, (ulong)len);
 
-	    rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-			    a->e_d.buf, &len);
+	    rc = call_filter (a, IOBUFCTRL_UNDERFLOW, a->e_d.buf, &len);
 	    a->e_d.used = len;
 	    len = 0;
 	  }
@@ -2064,8 +2477,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      log_debug ("iobuf-%d.%d: underflow: A->FILTER (%lu bytes)\n",
 			 a->no, a->subno, (ulong)len);
 
-	    rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-			    &a->d.buf[a->d.len], &len);
+	    rc = call_filter (a, IOBUFCTRL_UNDERFLOW, &a->d.buf[a->d.len], &len);
 	  }
       }
       a->d.len += len;
@@ -2083,11 +2495,15 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	/* EOF.  */
 	{
 	  size_t dummy_len = 0;
+	  byte desc[MAX_IOBUF_DESC];
 
 	  /* Tell the filter to free itself */
-	  if ((rc = a->filter (a->filter_ov, IOBUFCTRL_FREE, a->chain,
-			       NULL, &dummy_len)))
+	  if (iobuf_stats_mode)
+	    iobuf_desc (a, desc);
+	  if ((rc = call_filter (a, IOBUFCTRL_FREE, NULL, &dummy_len)))
 	    log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
+	  if (iobuf_stats_mode)
+	    print_stage_stats (a, desc);
 
 	  /* Free everything except for the internal buffer.  */
 	  if (a->filter_ov && a->filter_ov_owner)
@@ -2188,7 +2604,7 @@ filter_flush (iobuf_t a)
     }
 
   len = src_len;
-  rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, src_buf, &len);
+  rc = call_filter (a, IOBUFCTRL_FLUSH, src_buf, &len);
   if (!rc && len != src_len)
     {
       log_info ("filter_flush did not write all!\n");
@@ -2347,6 +2763,41 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 
 
 
+size_t
+iobuf_borrow (iobuf_t a, const void **r_buf, size_t maxlen)
+{
+#ifdef USE_MMAP_INPUT
+  file_filter_ctx_t *fcx;
+  const byte *p;
+  size_t n;
+
+  *r_buf = NULL;
+  if (a->use != IOBUF_INPUT || a->chain || a->filter != file_filter
+      || a->nlimit || a->d.start < a->d.len || !maxlen)
+    return 0;
+  fcx = a->filter_ov;
+  if (!fcx->use_mmap || fcx->npeeked > fcx->upeeked
+      || fcx->eof_seen || fcx->delayed_rc)
+    return 0;
+
+  p = mmap_window (fcx, &n);
+  if (!p)
+    return 0;  /* End of mapping - let iobuf_read do the rest.  */
+  if (n > maxlen)
+    n = maxlen;
+  fcx->mapoff += n;
+  a->nbytes += n;
+  *r_buf = p;
+  return n;
+#else /*!USE_MMAP_INPUT*/
+  (void)a;
+  (void)maxlen;
+  *r_buf = NULL;
+  return 0;
+#endif /*!USE_MMAP_INPUT*/
+}
+
+
 int
 iobuf_peek (iobuf_t a, byte * buf, unsigned buflen)
 {
@@ -2726,6 +3177,8 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	  log_error ("can't lseek: %s\n", strerror (errno));
 	  return -1;
 	}
+      if (b->use_mmap)
+        b->mapoff = newpos;
 #endif
       /* Discard the buffer it is not a temp stream.  */
       a->d.len = 0;
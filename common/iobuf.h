@@ -269,6 +269,20 @@ struct iobuf_struct
      This amount of nesting typically indicates corrupted data or an
      active denial of service attack.  */
   int subno;
+
+  /* Statistics for the filter of this stage.  They are only updated
+     if enabled with iobuf_set_stats.  NBYTES is the number of bytes
+     returned by an input filter or passed to an output filter.  The
+     times are in nanoseconds; SELF_NS does not include the time
+     spent in the filters further down the pipeline.  */
+  struct
+  {
+    uint64_t nbytes;
+    unsigned long nunderflow;
+    unsigned long nflush;
+    uint64_t total_ns;
+    uint64_t self_ns;
+  } stats;
 };
 
 extern int iobuf_debug_mode;
@@ -280,6 +294,16 @@ extern int iobuf_debug_mode;
  * returning the current value.  */
 unsigned int iobuf_set_buffer_size (unsigned int kilobyte);
 
+/* Enable or disable memory mapped input for files opened with
+ * iobuf_open.  Returns the current value; using -1 has no effect
+ * except for returning the current value.  */
+int iobuf_set_mmap (int enable);
+
+/* Enable or disable the collection of per filter statistics which
+ * are printed when a pipeline is closed.  Returns the current value;
+ * using -1 has no effect except for returning the current value.  */
+int iobuf_set_stats (int enable);
+
 /* Returns whether the specified filename corresponds to a pipe.  In
    particular, this function checks if FNAME is "-" and, if special
    filenames are enabled (see check_special_filename), whether
@@ -508,6 +532,15 @@ int iobuf_readbyte (iobuf_t a);
    bytes read.  */
 int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
 
+/* Try to get up to MAXLEN bytes from A without copying them.  This
+   only works if A is a file pipeline without any pushed filters, the
+   file is memory mapped (see iobuf_set_mmap) and there is no buffered
+   data.  On success a pointer to the data is stored at R_BUF and the
+   number of bytes is returned; the data is only valid until the next
+   operation on A.  If 0 is returned, the caller needs to use
+   iobuf_read instead; this is also the case at EOF.  */
+size_t iobuf_borrow (iobuf_t a, const void **r_buf, size_t maxlen);
+
 /* Read a line of input (including the '\n') from the pipeline.
 
    The semantics are the same as for fgets(), but if the buffer is too
@@ -544,6 +544,27 @@ gnupg_usleep (unsigned int usecs)
 }
 
 
+/* Return the number of online CPUs.  If that number can't be
+ * determined 1 is returned.  This is used to size worker thread
+ * pools.  */
+int
+gnupg_get_ncpus (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  SYSTEM_INFO si;
+
+  GetSystemInfo (&si);
+  return si.dwNumberOfProcessors > 0? (int)si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0? (int)n : 1;
+#else
+  return 1;
+#endif
+}
+
+
 /* This function is a NOP for POSIX systems but required under Windows
    as the file handles as returned by OS calls (like CreateFile) are
    different from the libc file descriptors (like open). This function
@@ -436,5 +436,64 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Read a file using memory mapped input.  The file is larger than
+     the mmap threshold and the iobuf buffer size so that we cross
+     several buffer boundaries.  Parts are read using iobuf_borrow and
+     parts using iobuf_read.  */
+  {
+    const char *fname = "t-iobuf-mmap.tmp";
+    size_t filesize = 1024 * 1024 + 17;
+    iobuf_t iobuf;
+    FILE *fp;
+    byte peekbuf[8];
+    byte *buffer;
+    const void *p;
+    size_t i, n, total;
+    int rc;
+
+    fp = fopen (fname, "wb");
+    assert (fp);
+    for (i = 0; i < filesize; i++)
+      putc ((int)(i % 251), fp);
+    assert (!fclose (fp));
+
+    iobuf_set_mmap (1);
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+
+    rc = iobuf_ioctl (iobuf, IOBUF_IOCTL_PEEK, sizeof peekbuf, peekbuf);
+    assert (rc == sizeof peekbuf);
+    for (i = 0; i < sizeof peekbuf; i++)
+      assert (peekbuf[i] == i % 251);
+
+    buffer = xmalloc (10000);
+    total = 0;
+    for (;;)
+      {
+        /* Alternate between borrowing and reading.  */
+        if ((total / 10000) % 2)
+          n = iobuf_borrow (iobuf, &p, 10000);
+        else
+          n = 0;
+        if (!n)
+          {
+            rc = iobuf_read (iobuf, buffer, 10000);
+            if (rc == -1)
+              break;
+            n = rc;
+            p = buffer;
+          }
+        for (i = 0; i < n; i++)
+          assert (((const byte *)p)[i] == (total + i) % 251);
+        total += n;
+        assert (iobuf_tell (iobuf) == total);
+      }
+    assert (total == filesize);
+    free (buffer);
+    iobuf_close (iobuf);
+    iobuf_set_mmap (0);
+    remove (fname);
+  }
+
   return 0;
 }
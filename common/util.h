@@ -64,6 +64,11 @@
  * This is the possible truncated fingerprint of the primary key.  */
 #define UBID_LEN    20
 
+/* The length of the key used by the keyboxd's signature cache.  This
+ * is a SHA-256 hash over the signer's fingerprint, the digest of the
+ * signed data and the signature.  */
+#define SIGCACHE_HASH_LEN 32
+
 
 /* Get all the stuff from jnlib. */
 #include "../common/logging.h"
@@ -33,6 +33,7 @@
 #include "packet.h"
 #include "options.h"
 #include "main.h"
+#include "radix64.h"
 #include "../common/i18n.h"
 
 #define MAX_LINELEN 20000
@@ -884,95 +885,24 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 		&& n + 12 < size)
 	      {
 		/* Fast path for radix64 to binary conversion.  */
-		u32 b0,b1,b2,b3;
-
-		/* Speculatively load 15 more input bytes.  */
-		b0 = binc << (3 * 6);
-		b0 |= asctobin[2][afx->buffer[afx->buffer_pos + 0]];
-		b0 |= asctobin[1][afx->buffer[afx->buffer_pos + 1]];
-		b0 |= asctobin[0][afx->buffer[afx->buffer_pos + 2]];
-		b1  = asctobin[3][afx->buffer[afx->buffer_pos + 3]];
-		b1 |= asctobin[2][afx->buffer[afx->buffer_pos + 4]];
-		b1 |= asctobin[1][afx->buffer[afx->buffer_pos + 5]];
-		b1 |= asctobin[0][afx->buffer[afx->buffer_pos + 6]];
-		b2  = asctobin[3][afx->buffer[afx->buffer_pos + 7]];
-		b2 |= asctobin[2][afx->buffer[afx->buffer_pos + 8]];
-		b2 |= asctobin[1][afx->buffer[afx->buffer_pos + 9]];
-		b2 |= asctobin[0][afx->buffer[afx->buffer_pos + 10]];
-		b3  = asctobin[3][afx->buffer[afx->buffer_pos + 11]];
-		b3 |= asctobin[2][afx->buffer[afx->buffer_pos + 12]];
-		b3 |= asctobin[1][afx->buffer[afx->buffer_pos + 13]];
-		b3 |= asctobin[0][afx->buffer[afx->buffer_pos + 14]];
-
-		/* Check if any of the input bytes were invalid. */
-		if( (b0 | b1 | b2 | b3) != 0xffffffffUL )
-		  {
-		    /* All 16 bytes are valid. */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    buf[n + 9] = b3 >> (2 * 8);
-		    buf[n + 10] = b3 >> (1 * 8);
-		    buf[n + 11] = b3 >> (0 * 8);
-		    afx->buffer_pos += 16 - 1;
-		    n += 12;
-		    continue;
-		  }
-		else if( b0 == 0xffffffffUL )
-		  {
-		    /* byte[1..3] have invalid character(s).  Switch to slow
-		       path.  */
-		    skip_fast = 1;
-		  }
-		else if( b1 == 0xffffffffUL )
-		  {
-		    /* byte[4..7] have invalid character(s), first 4 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    afx->buffer_pos += 4 - 1;
-		    n += 3;
-		    skip_fast = 1;
-		    continue;
-		  }
-		else if( b2 == 0xffffffffUL )
-		  {
-		    /* byte[8..11] have invalid character(s), first 8 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    afx->buffer_pos += 8 - 1;
-		    n += 6;
+		size_t nin, nused;
+
+		/* Process the rest of the line including the current
+		   character as far as it fits into BUF.  */
+		nin = afx->buffer_len - afx->buffer_pos + 1;
+		if( nin / 4 * 3 > size - n )
+		    nin = (size - n) / 3 * 4;
+		nin &= ~(size_t)3;
+		nused = radix64_decode (buf + n,
+					afx->buffer + afx->buffer_pos - 1, nin);
+		if( nused < nin )
+		    /* A group has an invalid character.  Switch to the
+		       slow path.  */
 		    skip_fast = 1;
-		    continue;
-		  }
-		else /*if( b3 == 0xffffffffUL )*/
+		if( nused )
 		  {
-		    /* byte[12..15] have invalid character(s), first 12 bytes
-		       are valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    afx->buffer_pos += 12 - 1;
-		    n += 9;
-		    skip_fast = 1;
+		    afx->buffer_pos += nused - 1;
+		    n += nused / 4 * 3;
 		    continue;
 		  }
 	      }
@@ -1175,9 +1105,8 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
   byte radbuf[sizeof (afx->radbuf)];
   byte outbuf[64 + sizeof (afx->eol)];
   unsigned int eollen = strlen (afx->eol);
-  u32 in, in2;
+  u32 in;
   int idx, idx2;
-  int i;
 
   idx = afx->idx;
   idx2 = afx->idx2;
@@ -1223,25 +1152,9 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 	{
 	  /* idx and idx2 == 0 */
 
-	  for (i = 0; i < (64/8); i++)
-	    {
-	      in = (u32)buf[0] << (2 * 8);
-	      in |= (u32)buf[1] << (1 * 8);
-	      in |= (u32)buf[2] << (0 * 8);
-	      in2 = (u32)buf[3] << (2 * 8);
-	      in2 |= (u32)buf[4] << (1 * 8);
-	      in2 |= (u32)buf[5] << (0 * 8);
-	      outbuf[i*8+0] = bintoasc[(in >> 18) & 077];
-	      outbuf[i*8+1] = bintoasc[(in >> 12) & 077];
-	      outbuf[i*8+2] = bintoasc[(in >> 6) & 077];
-	      outbuf[i*8+3] = bintoasc[(in >> 0) & 077];
-	      outbuf[i*8+4] = bintoasc[(in2 >> 18) & 077];
-	      outbuf[i*8+5] = bintoasc[(in2 >> 12) & 077];
-	      outbuf[i*8+6] = bintoasc[(in2 >> 6) & 077];
-	      outbuf[i*8+7] = bintoasc[(in2 >> 0) & 077];
-	      buf+=6;
-	      size-=6;
-	    }
+	  radix64_encode (outbuf, buf, (64/4)*3);
+	  buf += (64/4)*3;
+	  size -= (64/4)*3;
 
 	  /* pgp doesn't like 72 here */
 	  iobuf_write (a, outbuf, 64 + eollen);
@@ -0,0 +1,965 @@
+/* bench-filter.c - Benchmark for the OpenPGP data path filters
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This program pushes synthetic data through the iobuf filter stacks
+ * gpg uses for armoring, compression, encryption, decryption and
+ * hashing and reports the throughput, the CPU time and the number of
+ * memory allocations for each of them.  The hash benchmarks cover
+ * the data path of signing and verification; the public key
+ * operations do not depend on the size of the data and are not
+ * measured.  The stages which are not covered are listed along with
+ * the results (see not_covered).
+ *
+ * The program is not run by "make check".  Use "make bench" in the
+ * top or the g10 directory or run it directly:
+ *
+ *   ./bench-filter [--size MB] [--repeat N] [--random] [--parallel]
+ *                  [--json] [NAMES]
+ *
+ * NAMES selects the benchmarks to run; the default is to run all.
+ * MB are units of 2^20 bytes.  With --repeat the fastest run is
+ * reported.  With --parallel the threaded filters are used as done
+ * by gpg's "--compatibility-flags parallelized"; the allocation
+ * counters are then only approximate.  With --json the result is
+ * printed as a JSON object to allow tracking regressions.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_GETRUSAGE
+# include <sys/resource.h>
+#endif
+#ifndef HAVE_CLOCK_GETTIME
+# include <sys/time.h>
+#endif
+#include <npth.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/init.h"
+#include "../common/membuf.h"
+#include "options.h"
+#include "packet.h"
+#include "filter.h"
+#include "main.h"
+#include "dek.h"
+
+#define PGM "bench-filter"
+
+/* Size of the block of synthetic data which is repeated to form the
+ * input.  This is larger than the window of all compression
+ * algorithms so that they do not see the repetition.  */
+#define SAMPLE_SIZE (1024*1024)
+
+static int verbose;
+
+/* The synthetic input data.  */
+static byte *sample;
+
+/* Counters updated by our allocation handlers.  */
+static unsigned long alloc_count;
+static uint64_t alloc_bytes;
+
+
+/* The result of one benchmark run.  */
+struct result_s
+{
+  uint64_t inbytes;      /* Bytes fed into the filter stack.       */
+  uint64_t outbytes;     /* Bytes emitted by the filter stack.     */
+  double wall;           /* Elapsed time in seconds.               */
+  double cpu;            /* CPU time of all threads in seconds.    */
+  unsigned long allocs;  /* Number of allocations and reallocs.    */
+  uint64_t allocbytes;   /* Number of bytes requested by those.    */
+};
+
+
+/* Description of a benchmark.  RUN is called with the number of
+ * bytes to process and, if ENCODE is not NULL, with the output of
+ * ENCODE for the same number of bytes.  */
+struct bench_s
+{
+  const char *name;
+  int algo;
+  int flags;
+  gpg_error_t (*encode) (const struct bench_s *b, uint64_t size,
+                         membuf_t *mb);
+  gpg_error_t (*run) (const struct bench_s *b, uint64_t size,
+                      const void *data, size_t datalen,
+                      struct result_s *r);
+};
+
+/* Flags for the encryption benchmark.  */
+#define BENCH_AEAD     1
+#define BENCH_ARMOR    2
+
+
+
+static void *
+bench_alloc (size_t n)
+{
+  alloc_count++;
+  alloc_bytes += n;
+  return malloc (n);
+}
+
+
+static void *
+bench_realloc (void *p, size_t n)
+{
+  alloc_count++;
+  alloc_bytes += n;
+  return realloc (p, n);
+}
+
+
+static int
+bench_is_secure (const void *p)
+{
+  (void)p;
+  return 0;
+}
+
+
+static double
+wall_time (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+
+static double
+cpu_time (void)
+{
+#ifdef HAVE_GETRUSAGE
+  struct rusage ru;
+
+  getrusage (RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+          + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+#else
+  return (double)clock () / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static void
+start_timer (struct result_s *r)
+{
+  memset (r, 0, sizeof *r);
+  r->allocs = alloc_count;
+  r->allocbytes = alloc_bytes;
+  r->cpu = cpu_time ();
+  r->wall = wall_time ();
+}
+
+
+static void
+stop_timer (struct result_s *r)
+{
+  r->wall = wall_time () - r->wall;
+  r->cpu = cpu_time () - r->cpu;
+  r->allocs = alloc_count - r->allocs;
+  r->allocbytes = alloc_bytes - r->allocbytes;
+}
+
+
+/* Fill the sample buffer with either random data or with words made
+ * up from a simple deterministic generator.  The latter compresses
+ * roughly like natural text.  */
+static void
+make_sample (int use_random)
+{
+  static const char letters[] = "etaoinshrdlcumwfgypbvkjxqz";
+  unsigned int seed = 42;
+  size_t i, wordlen;
+
+  sample = xmalloc (SAMPLE_SIZE);
+  if (use_random)
+    {
+      gcry_create_nonce (sample, SAMPLE_SIZE);
+      return;
+    }
+
+  for (i = wordlen = 0; i < SAMPLE_SIZE; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      if (wordlen > 2 && !((seed >> 16) % 6))
+        {
+          sample[i] = ((seed >> 8) % 13)? ' ' : '\n';
+          wordlen = 0;
+        }
+      else
+        {
+          /* Prefer the letters at the start of the table.  */
+          sample[i] = letters[((seed >> 16) % 26) * ((seed >> 8) % 26) / 26];
+          wordlen++;
+        }
+    }
+}
+
+
+/* An iobuf filter which yields the number of bytes given by OPAQUE
+ * from the sample buffer.  */
+static int
+source_filter (void *opaque, int control,
+               iobuf_t chain, byte *buf, size_t *ret_len)
+{
+  uint64_t *left = opaque;
+  static size_t off;
+  size_t n;
+
+  (void)chain;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      if (!*left)
+        {
+          *ret_len = 0;
+          return -1;  /* EOF */
+        }
+      n = *ret_len;
+      if (n > *left)
+        n = *left;
+      if (n > SAMPLE_SIZE - off)
+        n = SAMPLE_SIZE - off;
+      memcpy (buf, sample + off, n);
+      off = (off + n) % SAMPLE_SIZE;
+      *left -= n;
+      *ret_len = n;
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "source_filter", *ret_len);
+  return 0;
+}
+
+
+/* Parameters for sink_filter.  */
+struct sink_parm_s
+{
+  uint64_t nbytes;
+  membuf_t *mb;     /* If not NULL the data is stored here.  */
+};
+
+/* An iobuf filter which counts and drops or collects all data
+ * written to it.  */
+static int
+sink_filter (void *opaque, int control,
+             iobuf_t chain, byte *buf, size_t *ret_len)
+{
+  struct sink_parm_s *parm = opaque;
+
+  (void)chain;
+
+  if (control == IOBUFCTRL_FLUSH)
+    {
+      parm->nbytes += *ret_len;
+      if (parm->mb)
+        put_membuf (parm->mb, buf, *ret_len);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "sink_filter", *ret_len);
+  return 0;
+}
+
+
+/* Return an input iobuf which yields SIZE bytes.  */
+static iobuf_t
+open_source (uint64_t *size)
+{
+  iobuf_t inp;
+
+  inp = iobuf_temp_with_content ("", 0);
+  iobuf_push_filter (inp, source_filter, size);
+  return inp;
+}
+
+
+/* Return an output iobuf which uses PARM as described for
+ * sink_filter.  */
+static iobuf_t
+open_sink (struct sink_parm_s *parm, membuf_t *mb)
+{
+  iobuf_t out;
+
+  memset (parm, 0, sizeof *parm);
+  parm->mb = mb;
+  out = iobuf_temp ();
+  iobuf_push_filter (out, sink_filter, parm);
+  return out;
+}
+
+
+/* Read all data from INP and add the number of bytes to *R_NBYTES.  */
+static gpg_error_t
+read_all (iobuf_t inp, uint64_t *r_nbytes)
+{
+  static byte buffer[32768];
+  int n;
+
+  while ((n = iobuf_read (inp, buffer, sizeof buffer)) != -1)
+    *r_nbytes += n;
+  return iobuf_error (inp);
+}
+
+
+/* Callback for handle_compressed.  */
+static int
+read_all_cb (iobuf_t inp, void *opaque)
+{
+  return read_all (inp, opaque);
+}
+
+
+/* Write SIZE bytes of sample data to the armor filter.  */
+static gpg_error_t
+encode_armor (const struct bench_s *b, uint64_t size, membuf_t *mb)
+{
+  gpg_error_t err;
+  struct sink_parm_s parm;
+  armor_filter_context_t *afx;
+  iobuf_t inp, out;
+
+  (void)b;
+
+  inp = open_source (&size);
+  out = open_sink (&parm, mb);
+  afx = new_armor_context ();
+  push_armor_filter (afx, out);
+  release_armor_context (afx);
+  iobuf_copy (out, inp);
+  err = iobuf_error (out);
+  iobuf_close (inp);
+  iobuf_close (out);
+  return err;
+}
+
+
+/* Write SIZE bytes of sample data to the compress filter.  */
+static gpg_error_t
+encode_compress (const struct bench_s *b, uint64_t size, membuf_t *mb)
+{
+  gpg_error_t err;
+  struct sink_parm_s parm;
+  compress_filter_context_t zfx;
+  iobuf_t inp, out;
+
+  memset (&zfx, 0, sizeof zfx);
+  inp = open_source (&size);
+  out = open_sink (&parm, mb);
+  push_compress_filter (out, &zfx, b->algo);
+  iobuf_copy (out, inp);
+  err = iobuf_error (out);
+  iobuf_close (inp);
+  iobuf_close (out);
+  return err;
+}
+
+
+/* Run an encoder benchmark.  This writes to a sink which drops the
+ * data.  */
+static gpg_error_t
+run_encode (const struct bench_s *b, uint64_t size,
+            const void *data, size_t datalen, struct result_s *r)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  void *p;
+  size_t n = 0;
+
+  (void)data;
+  (void)datalen;
+
+  /* Get the size of the output with an extra run so that the
+   * timed run can use a dropping sink.  */
+  init_membuf (&mb, 4096);
+  err = b->encode (b, size, &mb);
+  p = get_membuf (&mb, &n);
+  xfree (p);
+  if (err)
+    return err;
+
+  start_timer (r);
+  err = b->encode (b, size, NULL);
+  stop_timer (r);
+  r->inbytes = size;
+  r->outbytes = n;
+  return err;
+}
+
+
+/* Read DATA through the armor filter.  */
+static gpg_error_t
+run_dearmor (const struct bench_s *b, uint64_t size,
+             const void *data, size_t datalen, struct result_s *r)
+{
+  gpg_error_t err;
+  armor_filter_context_t *afx;
+  iobuf_t inp;
+
+  (void)b;
+  (void)size;
+
+  inp = iobuf_temp_with_content (data, datalen);
+  start_timer (r);
+  afx = new_armor_context ();
+  push_armor_filter (afx, inp);
+  release_armor_context (afx);
+  err = read_all (inp, &r->outbytes);
+  iobuf_close (inp);
+  stop_timer (r);
+  r->inbytes = datalen;
+  return err;
+}
+
+
+/* Read DATA through the decompression filter.  */
+static gpg_error_t
+run_decompress (const struct bench_s *b, uint64_t size,
+                const void *data, size_t datalen, struct result_s *r)
+{
+  gpg_error_t err;
+  struct parse_packet_ctx_s parsectx;
+  PACKET pkt;
+  iobuf_t inp;
+
+  (void)b;
+  (void)size;
+
+  inp = iobuf_temp_with_content (data, datalen);
+  start_timer (r);
+  init_packet (&pkt);
+  init_parse_packet (&parsectx, inp);
+  err = parse_packet (&parsectx, &pkt);
+  if (!err && pkt.pkttype != PKT_COMPRESSED)
+    err = gpg_error (GPG_ERR_UNEXPECTED);
+  if (!err)
+    err = handle_compressed (NULL, NULL, pkt.pkt.compressed,
+                             read_all_cb, &r->outbytes);
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  iobuf_close (inp);
+  stop_timer (r);
+  r->inbytes = datalen;
+  return err;
+}
+
+
+/* Return the session key for the encryption benchmarks with AEAD
+ * or with MDC.  The same key is used for all runs so that the
+ * decryption benchmarks can decrypt the output of encode_encrypt.  */
+static DEK *
+get_dek (int aead)
+{
+  static DEK *deks[2];
+  DEK *dek = deks[!!aead];
+
+  if (!dek)
+    {
+      dek = xmalloc_secure_clear (sizeof *dek);
+      dek->algo = CIPHER_ALGO_AES256;
+      if (aead)
+        dek->use_aead = AEAD_ALGO_OCB;
+      else
+        dek->use_mdc = 1;
+      make_session_key (dek);
+      deks[!!aead] = dek;
+    }
+  return dek;
+}
+
+
+/* Encrypt SIZE bytes of sample data in a literal data packet the
+ * same way encrypt_simple does, optionally with compression and
+ * armor.  The output is stored at MB if that is not NULL and its
+ * length is stored at R_NBYTES.  */
+static gpg_error_t
+write_encrypted (const struct bench_s *b, uint64_t size, membuf_t *mb,
+                 uint64_t *r_nbytes)
+{
+  gpg_error_t err;
+  struct sink_parm_s parm;
+  armor_filter_context_t *afx = NULL;
+  compress_filter_context_t zfx;
+  cipher_filter_context_t cfx;
+  PKT_plaintext *pt;
+  PACKET pkt;
+  iobuf_t inp, out;
+
+  memset (&cfx, 0, sizeof cfx);
+  memset (&zfx, 0, sizeof zfx);
+  cfx.dek = get_dek ((b->flags & BENCH_AEAD));
+
+  pt = xmalloc_clear (sizeof *pt);
+  pt->timestamp = make_timestamp ();
+  pt->mode = 'b';
+  pt->new_ctb = 1;
+
+  inp = open_source (&size);
+  out = open_sink (&parm, mb);
+  if ((b->flags & BENCH_ARMOR))
+    {
+      afx = new_armor_context ();
+      push_armor_filter (afx, out);
+    }
+  iobuf_push_filter (out,
+                     cfx.dek->use_aead? cipher_filter_aead
+                     /**/             : cipher_filter_cfb,
+                     &cfx);
+  if (b->algo)
+    {
+      zfx.new_ctb = 1;
+      push_compress_filter (out, &zfx, b->algo);
+    }
+
+  pt->buf = inp;
+  init_packet (&pkt);
+  pkt.pkttype = PKT_PLAINTEXT;
+  pkt.pkt.plaintext = pt;
+  err = build_packet (out, &pkt);
+  pt->buf = NULL;
+  iobuf_close (inp);
+  if (err)
+    iobuf_cancel (out);
+  else
+    iobuf_close (out);
+  *r_nbytes = parm.nbytes;
+
+  release_armor_context (afx);
+  xfree (pt);
+  return err;
+}
+
+
+/* Write SIZE bytes of encrypted sample data to MB.  */
+static gpg_error_t
+encode_encrypt (const struct bench_s *b, uint64_t size, membuf_t *mb)
+{
+  uint64_t nbytes;
+
+  return write_encrypted (b, size, mb, &nbytes);
+}
+
+
+/* Run an encryption benchmark.  */
+static gpg_error_t
+run_encrypt (const struct bench_s *b, uint64_t size,
+             const void *data, size_t datalen, struct result_s *r)
+{
+  gpg_error_t err;
+  uint64_t nbytes;
+
+  (void)data;
+  (void)datalen;
+
+  start_timer (r);
+  err = write_encrypted (b, size, NULL, &nbytes);
+  stop_timer (r);
+  r->inbytes = size;
+  r->outbytes = nbytes;
+  return err;
+}
+
+
+/* The number of bytes written to the plaintext sink.  */
+static uint64_t plaintext_nbytes;
+
+/* Write function for the estream used as opt.outfp.  It counts and
+ * drops the decrypted data.  */
+static gpgrt_ssize_t
+plaintext_sink_write (void *cookie, const void *buffer, size_t size)
+{
+  (void)cookie;
+  (void)buffer;
+
+  plaintext_nbytes += size;
+  return size;
+}
+
+
+/* Decrypt DATA the same way proc_encrypted does and write the
+ * plaintext to a sink which drops it.  */
+static gpg_error_t
+run_decrypt (const struct bench_s *b, uint64_t size,
+             const void *data, size_t datalen, struct result_s *r)
+{
+  gpg_error_t err;
+  struct parse_packet_ctx_s parsectx;
+  struct server_control_s ctrl;
+  PACKET pkt;
+  iobuf_t inp;
+  int compliance_error;
+
+  (void)size;
+
+  memset (&ctrl, 0, sizeof ctrl);
+  inp = iobuf_temp_with_content (data, datalen);
+  start_timer (r);
+  plaintext_nbytes = 0;
+  init_packet (&pkt);
+  init_parse_packet (&parsectx, inp);
+  err = parse_packet (&parsectx, &pkt);
+  if (!err && pkt.pkttype != PKT_ENCRYPTED
+      && pkt.pkttype != PKT_ENCRYPTED_MDC
+      && pkt.pkttype != PKT_ENCRYPTED_AEAD)
+    err = gpg_error (GPG_ERR_UNEXPECTED);
+  if (!err)
+    err = decrypt_data (&ctrl, NULL, pkt.pkt.encrypted,
+                        get_dek ((b->flags & BENCH_AEAD)),
+                        &compliance_error);
+  if (!err)
+    err = es_fflush (opt.outfp)? gpg_error_from_syserror () : 0;
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  iobuf_close (inp);
+  stop_timer (r);
+  r->inbytes = datalen;
+  r->outbytes = plaintext_nbytes;
+  return err;
+}
+
+
+/* Hash SIZE bytes of sample data with the md filter as done by
+ * sign_file and by the verification code.  */
+static gpg_error_t
+run_hash (const struct bench_s *b, uint64_t size,
+          const void *data, size_t datalen, struct result_s *r)
+{
+  gpg_error_t err;
+  md_filter_context_t mfx;
+  md_thd_filter_context_t mfx2 = NULL;
+  iobuf_t inp;
+
+  (void)data;
+  (void)datalen;
+
+  memset (&mfx, 0, sizeof mfx);
+  start_timer (r);
+  r->inbytes = size;
+  err = gcry_md_open (&mfx.md, b->algo, 0);
+  if (err)
+    return err;
+  inp = open_source (&size);
+  if ((opt.compat_flags & COMPAT_PARALLELIZED))
+    {
+      iobuf_push_filter (inp, md_thd_filter, &mfx2);
+      md_thd_filter_set_md (mfx2, mfx.md);
+    }
+  else
+    iobuf_push_filter (inp, md_filter, &mfx);
+  err = read_all (inp, &r->outbytes);
+  iobuf_close (inp);
+  gcry_md_final (mfx.md);
+  gcry_md_close (mfx.md);
+  stop_timer (r);
+  return err;
+}
+
+
+static struct bench_s benchmarks[] =
+  {
+    { "armor",         0, 0, encode_armor, run_encode },
+    { "dearmor",       0, 0, encode_armor, run_dearmor },
+    { "compress-zip",  COMPRESS_ALGO_ZIP, 0, encode_compress, run_encode },
+    { "decompress-zip",COMPRESS_ALGO_ZIP, 0, encode_compress, run_decompress },
+    { "compress-zlib", COMPRESS_ALGO_ZLIB, 0, encode_compress, run_encode },
+    { "decompress-zlib",COMPRESS_ALGO_ZLIB,0, encode_compress,run_decompress },
+#ifdef HAVE_BZIP2
+    { "compress-bzip2", COMPRESS_ALGO_BZIP2, 0, encode_compress, run_encode },
+    { "decompress-bzip2", COMPRESS_ALGO_BZIP2, 0,
+      encode_compress, run_decompress },
+#endif
+    { "encrypt-cfb",   0, 0,          NULL, run_encrypt },
+    { "encrypt-aead",  0, BENCH_AEAD, NULL, run_encrypt },
+    { "encrypt-aead-zlib-armor", COMPRESS_ALGO_ZLIB, BENCH_AEAD|BENCH_ARMOR,
+      NULL, run_encrypt },
+    { "decrypt-cfb",   0, 0,          encode_encrypt, run_decrypt },
+    { "decrypt-aead",  0, BENCH_AEAD, encode_encrypt, run_decrypt },
+    { "hash-sha256",   DIGEST_ALGO_SHA256, 0, NULL, run_hash },
+    { "hash-sha512",   DIGEST_ALGO_SHA512, 0, NULL, run_hash },
+    { NULL }
+  };
+
+
+/* The stages of gpg's data path which are not or only partly
+ * measured.  They are listed with the results so that the numbers
+ * are not mistaken for a complete picture.  */
+static struct
+{
+  const char *stage;
+  const char *note;
+} not_covered[] =
+  {
+    { "sign",    "hashing only (hash-*); the signature creation is "
+      "not measured" },
+    { "verify",  "hashing only (hash-*); the signature verification is "
+      "not measured" },
+    { NULL }
+  };
+
+
+/* Run benchmark B REPEAT times and store the fastest result at R.  */
+static gpg_error_t
+run_bench (const struct bench_s *b, uint64_t size, int repeat,
+           struct result_s *r)
+{
+  gpg_error_t err = 0;
+  struct result_s tmp;
+  membuf_t mb;
+  void *data = NULL;
+  size_t datalen = 0;
+  int i;
+
+  /* Prepare the input for decoders.  */
+  if (b->encode && b->run != run_encode)
+    {
+      init_membuf (&mb, 4096);
+      err = b->encode (b, size, &mb);
+      data = get_membuf (&mb, &datalen);
+      if (!err && !data)
+        err = gpg_error_from_syserror ();
+      if (err)
+        goto leave;
+    }
+
+  for (i = 0; i < repeat; i++)
+    {
+      err = b->run (b, size, data, datalen, &tmp);
+      if (err)
+        goto leave;
+      if (verbose)
+        log_info ("%s: run %d: %.3fs\n", b->name, i+1, tmp.wall);
+      if (!i || tmp.wall < r->wall)
+        *r = tmp;
+    }
+
+ leave:
+  xfree (data);
+  return err;
+}
+
+
+/* Return the throughput in MB/s for result R.  For decoders the
+ * output is the plaintext.  */
+static double
+throughput (const struct bench_s *b, const struct result_s *r)
+{
+  uint64_t n = (b->encode && b->run != run_encode)? r->outbytes : r->inbytes;
+
+  return r->wall > 0? (n / (1024.0*1024.0)) / r->wall : 0.0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  int last_argc = -1;
+  unsigned long size_mb = 64;
+  int repeat = 1;
+  int use_random = 0;
+  int json = 0;
+  int any_failed = 0;
+  int any = 0;
+  int i;
+  struct bench_s *b;
+  struct result_s r;
+
+  /* This must be done before libgcrypt is used.  */
+  gcry_set_allocation_handler (bench_alloc, bench_alloc, bench_is_secure,
+                               bench_realloc, free);
+
+  early_system_init ();
+  log_set_prefix (PGM, GPGRT_LOG_WITH_PREFIX);
+  init_common_subsystems (&argc, &argv);
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] [NAMES]\n"
+                 "Options:\n"
+                 "  --size MB     process MB of data (default 64)\n"
+                 "  --repeat N    report the fastest of N runs\n"
+                 "  --random      use random instead of text-like data\n"
+                 "  --parallel    use the threaded filters\n"
+                 "  --json        print the results as JSON\n"
+                 "  --list        list the benchmarks\n"
+                 "  --verbose     print more diagnostics\n", stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--list"))
+        {
+          for (b = benchmarks; b->name; b++)
+            puts (b->name);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose++;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--random"))
+        {
+          use_random = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--parallel"))
+        {
+          opt.compat_flags |= COMPAT_PARALLELIZED;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--json"))
+        {
+          json = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--size") && argc > 1)
+        {
+          size_mb = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--repeat") && argc > 1)
+        {
+          repeat = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          log_error ("unknown option '%s'\n", *argv);
+          exit (2);
+        }
+    }
+  if (!size_mb || repeat < 1)
+    {
+      log_error ("invalid value for --size or --repeat\n");
+      exit (2);
+    }
+
+  npth_init ();
+  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+
+  opt.compress_level = -1;
+  opt.bz2_compress_level = -1;
+  opt.chunk_size = 22;
+  opt.quiet = !verbose;
+  opt.verbose = verbose > 1;
+
+  make_sample (use_random);
+
+  /* The decryption benchmarks write the plaintext to opt.outfp.  */
+  {
+    es_cookie_io_functions_t io = { NULL };
+
+    io.func_write = plaintext_sink_write;
+    opt.outfp = es_fopencookie (NULL, "wb", io);
+    if (!opt.outfp)
+      log_fatal ("error creating the plaintext sink: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+  }
+
+  if (json)
+    printf ("{\n  \"size\": %llu,\n  \"repeat\": %d,\n"
+            "  \"data\": \"%s\",\n  \"parallel\": %s,\n"
+            "  \"results\": [",
+            (unsigned long long)size_mb * 1024 * 1024, repeat,
+            use_random? "random":"text",
+            (opt.compat_flags & COMPAT_PARALLELIZED)? "true":"false");
+  else
+    printf ("%-24s %10s %9s %9s %10s %12s\n",
+            "benchmark", "MB/s", "wall[s]", "cpu[s]", "allocs", "out");
+
+  for (b = benchmarks; b->name; b++)
+    {
+      if (argc)
+        {
+          for (i = 0; i < argc; i++)
+            if (!strcmp (argv[i], b->name))
+              break;
+          if (!(i < argc))
+            continue;
+        }
+
+      err = run_bench (b, (uint64_t)size_mb * 1024 * 1024, repeat, &r);
+      if (err)
+        {
+          log_error ("%s: failed: %s\n", b->name, gpg_strerror (err));
+          any_failed = 1;
+          continue;
+        }
+
+      if (json)
+        printf ("%s\n    {\"name\": \"%s\", \"mb_per_s\": %.2f,"
+                " \"wall_s\": %.6f, \"cpu_s\": %.6f,"
+                " \"in_bytes\": %llu, \"out_bytes\": %llu,"
+                " \"allocs\": %lu, \"alloc_bytes\": %llu}",
+                any? ",":"", b->name, throughput (b, &r), r.wall, r.cpu,
+                (unsigned long long)r.inbytes,
+                (unsigned long long)r.outbytes,
+                r.allocs, (unsigned long long)r.allocbytes);
+      else
+        printf ("%-24s %10.2f %9.3f %9.3f %10lu %12llu\n",
+                b->name, throughput (b, &r), r.wall, r.cpu,
+                r.allocs, (unsigned long long)r.outbytes);
+      any = 1;
+    }
+
+  if (json)
+    {
+      printf ("\n  ],\n  \"not_covered\": [");
+      for (i = 0; not_covered[i].stage; i++)
+        printf ("%s\n    {\"stage\": \"%s\", \"note\": \"%s\"}",
+                i? ",":"", not_covered[i].stage, not_covered[i].note);
+      printf ("\n  ]\n}\n");
+    }
+  else
+    {
+      printf ("\nNot covered:\n");
+      for (i = 0; not_covered[i].stage; i++)
+        printf ("  %-8s %s\n", not_covered[i].stage, not_covered[i].note);
+    }
+
+  es_fclose (opt.outfp);
+  xfree (sample);
+  return any_failed;
+}
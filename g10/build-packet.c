@@ -1966,8 +1966,10 @@ do_signature( IOBUF out, int ctb, PKT_signature *sig )
   n = pubkey_get_nsig( sig->pubkey_algo );
   if ( !n )
     write_fake_data( a, sig->data[0] );
-  if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
-      || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
+  else if (sig->flags.lazy_data)
+    rc = gpg_mpi_write_opaque_nohdr (a, sig->data[0]);
+  else if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
+           || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
     for (i=0; i < n && !rc ; i++ )
       rc = sos_write (a, sig->data[i], NULL);
   else
@@ -70,12 +70,78 @@ struct keyboxd_local_s
   /* Flag indicating that a search reset is required.  */
   unsigned int need_search_reset : 1;
 
+  /* Flags indicating that the keyboxd supports the --multi option of
+   * the SEARCH and STORE commands.  */
+  unsigned int has_multi_search : 1;
+  unsigned int has_multi_store : 1;
+
 };
 
 
 /* Flag indicating that for example bulk import is enabled.  */
 static unsigned int in_transaction;
 
+/* The maximum number of keys and bytes queued for one batched STORE.  */
+#define PENDING_STORE_MAX_KEYS  256
+#define PENDING_STORE_MAX_BYTES (4*1024*1024)
+
+/* An entry in the list of fingerprints of the queued keys.  */
+struct pending_fpr_s
+{
+  u32 keyid[2];
+  byte fprlen;
+  byte primary;  /* This is the primary key of a queued key.  */
+  byte fpr[MAX_FINGERPRINT_LEN];
+};
+
+/* During a bulk import keydb_insert_keyblock does not send each key
+ * to the keyboxd but queues them here so that they can be stored with
+ * one STORE --multi command.  We also keep the fingerprints of all
+ * primary keys and subkeys of the queued keys so that a search which
+ * can't match any of them does not need to flush the queue.  */
+static struct
+{
+  membuf_t blobs;  /* The length prefixed key images.  */
+  unsigned int nkeys;
+  struct pending_fpr_s *fprs;
+  unsigned int nfprs;
+  unsigned int fprs_size;
+} pending_store;
+
+/* The function called for each queued key which could not be stored
+ * and its first argument.  */
+static keydb_store_failed_cb_t store_failed_cb;
+static void *store_failed_cb_arg;
+
+
+/* An entry of the signature cache of a keyblock.  */
+struct sigcache_item_s
+{
+  byte hash[SIGCACHE_HASH_LEN];
+  byte valid;
+};
+
+/* The signature verification results of the keyblock last used with
+ * keydb_sigcache_get or keydb_sigcache_put.  The results cached by
+ * the keyboxd are fetched with one SIGCACHE command per keyblock.  New
+ * results are queued and sent with one SIGCACHE --store command when
+ * another keyblock is used or the session ends.  */
+static struct
+{
+  unsigned int unsupported:1;  /* The keyboxd has no signature cache.  */
+  unsigned int ubid_valid:1;   /* UBID is valid.  */
+  byte ubid[UBID_LEN];
+  struct sigcache_item_s *items;  /* The fetched results sorted by hash. */
+  unsigned int nitems;
+  unsigned int itemssize;
+  membuf_t pending;        /* The queued lines "<hash> good|bad".  */
+  unsigned int npending;
+} sigcache;
+
+
+static gpg_error_t flush_pending_store (assuan_context_t ctx);
+static gpg_error_t flush_sigcache (assuan_context_t ctx);
+
 
 
 
@@ -93,6 +159,11 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
         log_error ("oops: trying to cleanup an active keyboxd context\n");
       else
         {
+          if (kbl->ctx && (err = flush_pending_store (kbl->ctx)))
+            log_error ("error storing queued keys: %s\n", gpg_strerror (err));
+          if (kbl->ctx && (err = flush_sigcache (kbl->ctx)))
+            log_error ("error storing signature cache: %s\n",
+                       gpg_strerror (err));
           if (kbl->ctx && in_transaction)
             {
               /* This is our hack to commit the changes done during a
@@ -238,6 +309,13 @@ open_context (ctrl_t ctrl, keyboxd_local_t *r_kbl)
           return err;
         }
 
+      kbl->has_multi_search = !assuan_transact
+        (kbl->ctx, "GETINFO cmd_has_option SEARCH multi",
+         NULL, NULL, NULL, NULL, NULL, NULL);
+      kbl->has_multi_store = !assuan_transact
+        (kbl->ctx, "GETINFO cmd_has_option STORE multi",
+         NULL, NULL, NULL, NULL, NULL, NULL);
+
       /* For thread-saftey we add it to the list and retry; this is
        * easier than to employ a lock.  */
       kbl->next = ctrl->keyboxd_local;
@@ -392,6 +470,37 @@ keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb)
 }
 
 
+/* Return the raw image of the keyblock last found by keydb_search()
+ * without parsing it.  On success a pointer to the image is stored
+ * at R_IMAGE and its length at R_IMAGELEN; the buffer is owned by HD
+ * and is valid until the next call to keydb_search or
+ * keydb_get_keyblock.  The image is in the format written by
+ * build_keyblock_image and thus includes ring trust packets.  If HD
+ * is not backed by the keyboxd GPG_ERR_NOT_SUPPORTED is returned; in
+ * that case and on any other error keydb_get_keyblock may still be
+ * used to retrieve the keyblock.  */
+gpg_error_t
+keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                          const void **r_image, size_t *r_imagelen)
+{
+  *r_image = NULL;
+  *r_imagelen = 0;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (!hd->use_keyboxd)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (!hd->kbl->search_result)
+    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
+  *r_image = iobuf_get_temp_buffer (hd->kbl->search_result);
+  *r_imagelen = iobuf_get_temp_length (hd->kbl->search_result);
+  return 0;
+}
+
+
 /* Default status callback used to show diagnostics from the keyboxd  */
 static gpg_error_t
 keydb_default_status_cb (void *opaque, const char *line)
@@ -438,6 +547,227 @@ store_inq_cb (void *opaque, const char *line)
 }
 
 
+/* Handle the inquiries from the STORE --multi command.  */
+static gpg_error_t
+store_multi_inq_cb (void *opaque, const char *line)
+{
+  struct store_parm_s *parm = opaque;
+  gpg_error_t err = 0;
+
+  if (has_leading_keyword (line, "BLOBS"))
+    {
+      if (parm->data)
+        err = assuan_send_data (parm->ctx, parm->data, parm->datalen);
+    }
+  else
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  return err;
+}
+
+
+/* Handle the status lines from the STORE --multi command.  */
+static gpg_error_t
+store_multi_status_cb (void *opaque, const char *line)
+{
+  const char *s;
+  char *endp;
+  unsigned int idx, i;
+  gpg_error_t storeerr;
+  struct pending_fpr_s *fp;
+  char hexfpr[2*MAX_FINGERPRINT_LEN+1];
+
+  if (!(s = has_leading_keyword (line, "STORE_FAILED")))
+    return keydb_default_status_cb (opaque, line);
+
+  idx = strtoul (s, &endp, 10);
+  storeerr = strtoul (endp, NULL, 10);
+  if (!storeerr)
+    storeerr = gpg_error (GPG_ERR_GENERAL);
+
+  /* Find the primary key of the IDX-th queued key.  */
+  for (i=0, fp = pending_store.fprs; i < pending_store.nfprs; i++, fp++)
+    if (fp->primary)
+      {
+        if (!idx)
+          break;
+        idx--;
+      }
+  if (i == pending_store.nfprs)
+    {
+      log_error ("keyboxd reported an invalid key index: %s\n", s);
+      return 0;
+    }
+
+  if (store_failed_cb)
+    store_failed_cb (store_failed_cb_arg, fp->fpr, fp->fprlen, storeerr);
+  else
+    {
+      bin2hex (fp->fpr, fp->fprlen, hexfpr);
+      log_error (_("key %s: error storing key: %s\n"),
+                 hexfpr, gpg_strerror (storeerr));
+    }
+  return 0;
+}
+
+
+/* Send all keys queued by keydb_insert_keyblock using the connection
+ * CTX.  Keys which could not be stored are reported using the
+ * function set by keydb_set_store_failed_cb; they do not cause an
+ * error return.  */
+static gpg_error_t
+flush_pending_store (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  struct store_parm_s parm = {NULL};
+  void *data;
+  size_t datalen;
+  unsigned int nkeys;
+
+  if (!pending_store.nkeys)
+    return 0;
+
+  nkeys = pending_store.nkeys;
+  data = get_membuf (&pending_store.blobs, &datalen);
+  pending_store.nkeys = 0;
+  if (!data)
+    {
+      pending_store.nfprs = 0;
+      return gpg_error_from_syserror ();
+    }
+
+  if (DBG_KEYDB)
+    log_debug ("%s: storing %u keys (%zu bytes)\n", __func__, nkeys, datalen);
+
+  parm.ctx = ctx;
+  parm.data = data;
+  parm.datalen = datalen;
+  err = assuan_transact (ctx, "STORE --insert --multi",
+                         NULL, NULL,
+                         store_multi_inq_cb, &parm,
+                         store_multi_status_cb, NULL);
+  pending_store.nfprs = 0;
+  xfree (data);
+  return err;
+}
+
+
+/* Set the function CB to be called with CB_ARG for each key queued
+ * during a bulk import which the keyboxd could not store.  Such keys
+ * are only sent after keydb_insert_keyblock has returned and thus
+ * after the caller has already counted them.  Pass NULL to reset.  */
+void
+keydb_set_store_failed_cb (keydb_store_failed_cb_t cb, void *cb_arg)
+{
+  store_failed_cb = cb;
+  store_failed_cb_arg = cb_arg;
+}
+
+
+/* Send the keys queued during a bulk import to the keyboxd now.  The
+ * callback set with keydb_set_store_failed_cb is called for each key
+ * which could not be stored.  */
+gpg_error_t
+keydb_flush_queued_keys (ctrl_t ctrl)
+{
+  keyboxd_local_t kbl;
+
+  if (!pending_store.nkeys)
+    return 0;
+
+  for (kbl = ctrl->keyboxd_local; kbl; kbl = kbl->next)
+    if (kbl->ctx && !kbl->is_active)
+      return flush_pending_store (kbl->ctx);
+
+  return gpg_error (GPG_ERR_NOT_INITIALIZED);
+}
+
+
+/* Queue the keyblock image (IMAGE,IMAGELEN) of the keyblock KB for
+ * storing with a later STORE --multi.  */
+static gpg_error_t
+queue_pending_store (kbnode_t kb, const void *image, size_t imagelen)
+{
+  kbnode_t node;
+  struct pending_fpr_s *fp;
+  unsigned char lenbuf[4];
+  size_t n;
+
+  if (!pending_store.nkeys)
+    init_membuf (&pending_store.blobs, 65536);
+
+  for (node = kb; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+
+      if (pending_store.nfprs == pending_store.fprs_size)
+        {
+          n = pending_store.fprs_size? 2 * pending_store.fprs_size : 64;
+          fp = xtryrealloc (pending_store.fprs, n * sizeof *fp);
+          if (!fp)
+            return gpg_error_from_syserror ();
+          pending_store.fprs = fp;
+          pending_store.fprs_size = n;
+        }
+      fp = pending_store.fprs + pending_store.nfprs++;
+      keyid_from_pk (node->pkt->pkt.public_key, fp->keyid);
+      fingerprint_from_pk (node->pkt->pkt.public_key, fp->fpr, &n);
+      fp->fprlen = n;
+      fp->primary = (node == kb);
+    }
+
+  ulongtobuf (lenbuf, imagelen);
+  put_membuf (&pending_store.blobs, lenbuf, 4);
+  put_membuf (&pending_store.blobs, image, imagelen);
+  pending_store.nkeys++;
+  return 0;
+}
+
+
+/* Return true if one of the search descriptions (DESC,NDESC) may
+ * match a key queued for storing.  */
+static int
+pending_store_may_match (KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  struct pending_fpr_s *fp;
+  unsigned int i;
+
+  if (!pending_store.nkeys)
+    return 0;
+
+  for (; ndesc; desc++, ndesc--)
+    {
+      switch (desc->mode)
+        {
+        case KEYDB_SEARCH_MODE_FPR:
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          break;
+        default:
+          return 1;  /* We can't tell.  */
+        }
+
+      for (i=0, fp = pending_store.fprs; i < pending_store.nfprs; i++, fp++)
+        {
+          if (desc->mode == KEYDB_SEARCH_MODE_FPR)
+            {
+              if (desc->fprlen == fp->fprlen
+                  && !memcmp (desc->u.fpr, fp->fpr, fp->fprlen))
+                return 1;
+            }
+          else if (desc->u.kid[1] == fp->keyid[1]
+                   && (desc->mode == KEYDB_SEARCH_MODE_SHORT_KID
+                       || desc->u.kid[0] == fp->keyid[0]))
+            return 1;
+        }
+    }
+
+  return 0;
+}
+
+
 /* Update the keyblock KB (i.e., extract the fingerprint and find the
  * corresponding keyblock in the keyring).
  *
@@ -478,6 +808,10 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
       goto leave;
     }
 
+  err = flush_pending_store (hd->kbl->ctx);
+  if (err)
+    goto leave;
+
   err = build_keyblock_image (kb, &iobuf);
   if (err)
     goto leave;
@@ -503,7 +837,10 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
  * came is used.  If there was no previous search result (or
  * keydb_search_reset was called), then the keyring / keybox where the
  * next search would start is used (i.e., the current file position).
- * In keyboxd mode the keyboxd decides where to store it.
+ * In keyboxd mode the keyboxd decides where to store it.  With the
+ * bulk import option the key may be queued and sent to the keyboxd
+ * along with other keys; if it can't be stored this is reported to
+ * the function set by keydb_set_store_failed_cb.
  *
  * Note: this doesn't do anything if --dry-run was specified.
  *
@@ -534,6 +871,19 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (err)
     goto leave;
 
+  /* In bulk import mode queue the key for a batched store.  */
+  if (in_transaction && hd->kbl->has_multi_store)
+    {
+      err = queue_pending_store (kb, iobuf_get_temp_buffer (iobuf),
+                                 iobuf_get_temp_length (iobuf));
+      if (!err
+          && (pending_store.nkeys >= PENDING_STORE_MAX_KEYS
+              || get_membuf_len (&pending_store.blobs)
+              >= PENDING_STORE_MAX_BYTES))
+        err = flush_pending_store (hd->kbl->ctx);
+      goto leave;
+    }
+
   parm.ctx = hd->kbl->ctx;
   parm.data = iobuf_get_temp_buffer (iobuf);
   parm.datalen = iobuf_get_temp_length (iobuf);
@@ -581,6 +931,10 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       goto leave;
     }
 
+  err = flush_pending_store (hd->kbl->ctx);
+  if (err)
+    goto leave;
+
   bin2hex (hd->last_ubid, UBID_LEN, hexubid);
   snprintf (line, sizeof line, "DELETE %s", hexubid);
   err = assuan_transact (hd->kbl->ctx, line,
@@ -593,6 +947,224 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
 }
 
 
+/* Status callback for the SIGCACHE command.  This collects the
+ * results in SIGCACHE.ITEMS.  */
+static gpg_error_t
+sigcache_status_cb (void *opaque, const char *line)
+{
+  const char *s;
+  struct sigcache_item_s *item;
+  int n;
+
+  if (!(s = has_leading_keyword (line, "SIGCACHE")))
+    return keydb_default_status_cb (opaque, line);
+
+  if (sigcache.nitems == sigcache.itemssize)
+    {
+      struct sigcache_item_s *newitems;
+      unsigned int newsize = sigcache.itemssize? 2*sigcache.itemssize : 64;
+
+      newitems = xtryrealloc (sigcache.items, newsize * sizeof *newitems);
+      if (!newitems)
+        return gpg_error_from_syserror ();
+      sigcache.items = newitems;
+      sigcache.itemssize = newsize;
+    }
+
+  item = sigcache.items + sigcache.nitems;
+  if ((n = hex2bin (s, item->hash, SIGCACHE_HASH_LEN)) < 0 || s[n] != ' ')
+    return gpg_error (GPG_ERR_INV_RESPONSE);
+  item->valid = !strcmp (s + n + 1, "good");
+  sigcache.nitems++;
+  return 0;
+}
+
+
+/* qsort and bsearch helper for the SIGCACHE.ITEMS.  */
+static int
+cmp_sigcache_items (const void *a, const void *b)
+{
+  return memcmp (((const struct sigcache_item_s *)a)->hash,
+                 ((const struct sigcache_item_s *)b)->hash,
+                 SIGCACHE_HASH_LEN);
+}
+
+
+/* Handle the inquiries from the SIGCACHE --store command.  */
+static gpg_error_t
+sigcache_inq_cb (void *opaque, const char *line)
+{
+  struct store_parm_s *parm = opaque;
+
+  if (!has_leading_keyword (line, "RESULTS"))
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  return assuan_send_data (parm->ctx, parm->data, parm->datalen);
+}
+
+
+/* Check the error ERR returned by a SIGCACHE command and set
+ * SIGCACHE.UNSUPPORTED if the keyboxd does not support the command or
+ * its database has no signature cache.  */
+static gpg_error_t
+check_sigcache_error (gpg_error_t err)
+{
+  if (gpg_err_code (err) == GPG_ERR_ASS_UNKNOWN_CMD
+      || gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      sigcache.unsupported = 1;
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  return err;
+}
+
+
+/* Send the results queued by keydb_sigcache_put to the keyboxd using
+ * the connection CTX.  */
+static gpg_error_t
+flush_sigcache (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  struct store_parm_s parm = {NULL};
+  char line[ASSUAN_LINELENGTH];
+  char hexubid[UBID_LEN * 2 + 1];
+  void *data;
+  size_t datalen;
+
+  if (!sigcache.npending)
+    return 0;
+
+  sigcache.npending = 0;
+  data = get_membuf (&sigcache.pending, &datalen);
+  if (!data)
+    return gpg_error_from_syserror ();
+
+  if (DBG_KEYDB)
+    log_debug ("%s: storing %zu bytes of results\n", __func__, datalen);
+
+  bin2hex (sigcache.ubid, UBID_LEN, hexubid);
+  snprintf (line, sizeof line, "SIGCACHE --store %s", hexubid);
+  parm.ctx = ctx;
+  parm.data = data;
+  parm.datalen = datalen;
+  err = assuan_transact (ctx, line, NULL, NULL,
+                         sigcache_inq_cb, &parm,
+                         keydb_default_status_cb, NULL);
+  xfree (data);
+  return check_sigcache_error (err);
+}
+
+
+/* Make the keyblock UBID the current one of the signature cache.
+ * This sends the queued results of the former keyblock and fetches
+ * the cached results of the new one.  */
+static gpg_error_t
+select_sigcache_keyblock (ctrl_t ctrl, const byte *ubid)
+{
+  gpg_error_t err;
+  keyboxd_local_t kbl;
+  char line[ASSUAN_LINELENGTH];
+  char hexubid[UBID_LEN * 2 + 1];
+
+  if (!opt.use_keyboxd || sigcache.unsupported)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (sigcache.ubid_valid && !memcmp (sigcache.ubid, ubid, UBID_LEN))
+    return 0;
+
+  err = open_context (ctrl, &kbl);
+  if (err)
+    return err;
+
+  err = flush_sigcache (kbl->ctx);
+  if (err)
+    log_info ("error storing signature cache: %s\n", gpg_strerror (err));
+
+  sigcache.ubid_valid = 0;
+  sigcache.nitems = 0;
+  if (sigcache.unsupported)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  bin2hex (ubid, UBID_LEN, hexubid);
+  snprintf (line, sizeof line, "SIGCACHE %s", hexubid);
+  err = assuan_transact (kbl->ctx, line, NULL, NULL, NULL, NULL,
+                         sigcache_status_cb, NULL);
+  err = check_sigcache_error (err);
+  if (err)
+    {
+      sigcache.nitems = 0;
+      goto leave;
+    }
+  if (sigcache.nitems > 1)
+    qsort (sigcache.items, sigcache.nitems, sizeof *sigcache.items,
+           cmp_sigcache_items);
+
+  memcpy (sigcache.ubid, ubid, UBID_LEN);
+  sigcache.ubid_valid = 1;
+
+ leave:
+  kbl->is_active = 0;
+  return err;
+}
+
+
+/* Look up HASH, which has SIGCACHE_HASH_LEN bytes, in the signature
+ * cache of the keyboxd and store the cached verification result at
+ * R_VALID.  UBID identifies the keyblock with the signature.  Returns
+ * GPG_ERR_NOT_FOUND if HASH is not cached and GPG_ERR_NOT_SUPPORTED
+ * if no keyboxd or no cache is available.  */
+gpg_error_t
+keydb_sigcache_get (ctrl_t ctrl, const byte *ubid, const byte *hash,
+                    int *r_valid)
+{
+  gpg_error_t err;
+  struct sigcache_item_s *item;
+
+  *r_valid = 0;
+
+  err = select_sigcache_keyblock (ctrl, ubid);
+  if (err)
+    return err;
+
+  item = bsearch (hash, sigcache.items, sigcache.nitems,
+                  sizeof *sigcache.items, cmp_sigcache_items);
+  if (!item)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  *r_valid = item->valid;
+  return 0;
+}
+
+
+/* Queue the verification result VALID for HASH for the signature
+ * cache of the keyboxd.  UBID identifies the keyblock with the
+ * signature.  */
+gpg_error_t
+keydb_sigcache_put (ctrl_t ctrl, const byte *ubid, const byte *hash,
+                    int valid)
+{
+  gpg_error_t err;
+  char hexhash[SIGCACHE_HASH_LEN * 2 + 1];
+
+  if (opt.dry_run)
+    return 0;
+
+  err = select_sigcache_keyblock (ctrl, ubid);
+  if (err)
+    return err;
+
+  if (!sigcache.npending)
+    init_membuf (&sigcache.pending, 4096);
+  bin2hex (hash, SIGCACHE_HASH_LEN, hexhash);
+  put_membuf_printf (&sigcache.pending, "%s %s\n",
+                     hexhash, valid? "good" : "bad");
+  sigcache.npending++;
+  return 0;
+}
+
+
 /* Clears the current search result and resets the handle's position
  * so that the next search starts at the beginning of the database.
  *
@@ -680,6 +1252,125 @@ search_status_cb (void *opaque, const char *line)
 }
 
 
+/* Format the search description DESC as a keyboxd search pattern
+ * into BUFFER of size BUFSIZE.  */
+static gpg_error_t
+format_search_pattern (KEYDB_SEARCH_DESC *desc, char *buffer, size_t bufsize)
+{
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_EXACT:
+      snprintf (buffer, bufsize, "=%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBSTR:
+      snprintf (buffer, bufsize, "*%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      snprintf (buffer, bufsize, "<%s",
+                desc->u.name+(desc->u.name[0] == '<') );
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILSUB:
+      snprintf (buffer, bufsize, "@%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
+      snprintf (buffer, bufsize, ".%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_WORDS:
+      snprintf (buffer, bufsize, "+%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      snprintf (buffer, bufsize, "0x%08lX", (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      snprintf (buffer, bufsize, "0x%08lX%08lX",
+                (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      {
+        unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
+        log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
+        bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
+        snprintf (buffer, bufsize, "0x%s", hexfpr);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER:
+      snprintf (buffer, bufsize, "#/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+    case KEYDB_SEARCH_MODE_SN:
+      snprintf (buffer, bufsize, "#%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      snprintf (buffer, bufsize, "/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      {
+        unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
+        bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
+        snprintf (buffer, bufsize, "&%s", hexgrip);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      {
+        unsigned char hexubid[UBID_LEN * 2 + 1];
+        bin2hex (desc->u.ubid, UBID_LEN, hexubid);
+        snprintf (buffer, bufsize, "^%s", hexubid);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_NEXT:
+      log_debug ("%s: mode next - we should not get to here!\n", __func__);
+      return gpg_error (GPG_ERR_INV_ARG);
+
+    case KEYDB_SEARCH_MODE_FIRST:
+      log_debug ("%s: mode first - we should not get to here!\n", __func__);
+      /*fallthru*/
+    default:
+      return gpg_error (GPG_ERR_INV_ARG);
+    }
+
+  return 0;
+}
+
+
+/* Communication object for SEARCH --multi commands.  */
+struct search_parm_s
+{
+  assuan_context_t ctx;
+  const void *data;   /* The LF delimited patterns.  */
+  size_t datalen;     /* The length of DATA.  */
+};
+
+
+/* Handle the inquiries from the SEARCH --multi command.  */
+static gpg_error_t
+search_inq_cb (void *opaque, const char *line)
+{
+  struct search_parm_s *parm = opaque;
+  gpg_error_t err = 0;
+
+  if (has_leading_keyword (line, "PATTERNS"))
+    err = assuan_send_data (parm->ctx, parm->data, parm->datalen);
+  else
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  return err;
+}
+
+
 /* Search the database for keys matching the search description.  If
  * the DB contains any legacy keys, these are silently ignored.
  *
@@ -705,8 +1396,12 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   gpg_error_t err;
   int i;
   char line[ASSUAN_LINELENGTH];
+  char pattern[ASSUAN_LINELENGTH];
   char *buffer;
   size_t len;
+  membuf_t patterns;
+  char *patterndata = NULL;
+  struct search_parm_s parm = {NULL};
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -741,6 +1436,15 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       hd->kbl->search_result = NULL;
     }
 
+  /* Keys queued by a bulk import need to be stored first if the
+   * search may find them.  */
+  if (pending_store_may_match (desc, ndesc))
+    {
+      err = flush_pending_store (hd->kbl->ctx);
+      if (err)
+        goto leave;
+    }
+
   /* Check whether this is a NEXT search.  */
   if (!hd->kbl->need_search_reset)
     {
@@ -771,97 +1475,41 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
         goto do_search;
       }
 
-  for ( ; ndesc; desc++, ndesc--)
+  if (ndesc > 1 && hd->kbl->has_multi_search)
     {
-      const char *more = ndesc > 1 ? "--openpgp --more" : "--openpgp";
-
-      switch (desc->mode)
+      /* Send all patterns with one command.  */
+      init_membuf (&patterns, 1024);
+      for ( ; ndesc; desc++, ndesc--)
         {
-        case KEYDB_SEARCH_MODE_EXACT:
-          snprintf (line, sizeof line, "SEARCH %s -- =%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBSTR:
-          snprintf (line, sizeof line, "SEARCH %s -- *%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAIL:
-          snprintf (line, sizeof line, "SEARCH %s -- <%s",
-                    more, desc->u.name+(desc->u.name[0] == '<') );
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILSUB:
-          snprintf (line, sizeof line, "SEARCH %s -- @%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILEND:
-          snprintf (line, sizeof line, "SEARCH %s -- .%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_WORDS:
-          snprintf (line, sizeof line, "SEARCH %s -- +%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SHORT_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX", more,
-                    (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_LONG_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX%08lX", more,
-                    (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_FPR:
-          {
-            unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
-            log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
-            bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
-            snprintf (line, sizeof line, "SEARCH %s -- 0x%s", more, hexfpr);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER:
-          snprintf (line, sizeof line, "SEARCH %s -- #/%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER_SN:
-        case KEYDB_SEARCH_MODE_SN:
-          snprintf (line, sizeof line, "SEARCH %s -- #%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBJECT:
-          snprintf (line, sizeof line, "SEARCH %s -- /%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_KEYGRIP:
-          {
-            unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
-            bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
-            snprintf (line, sizeof line, "SEARCH %s -- &%s", more, hexgrip);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_UBID:
-          {
-            unsigned char hexubid[UBID_LEN * 2 + 1];
-            bin2hex (desc->u.ubid, UBID_LEN, hexubid);
-            snprintf (line, sizeof line, "SEARCH %s -- ^%s", more, hexubid);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_NEXT:
-          log_debug ("%s: mode next - we should not get to here!\n", __func__);
-          snprintf (line, sizeof line, "NEXT");
-          break;
-
-        case KEYDB_SEARCH_MODE_FIRST:
-          log_debug ("%s: mode first - we should not get to here!\n", __func__);
-          /*fallthru*/
-        default:
-          err = gpg_error (GPG_ERR_INV_ARG);
+          err = format_search_pattern (desc, pattern, sizeof pattern);
+          if (err)
+            {
+              xfree (get_membuf (&patterns, NULL));
+              goto leave;
+            }
+          put_membuf_str (&patterns, pattern);
+          put_membuf (&patterns, "\n", 1);
+        }
+      patterndata = get_membuf (&patterns, &parm.datalen);
+      if (!patterndata)
+        {
+          err = gpg_error_from_syserror ();
           goto leave;
         }
+      parm.ctx = hd->kbl->ctx;
+      parm.data = patterndata;
+      snprintf (line, sizeof line, "SEARCH --openpgp --multi");
+      goto do_search;
+    }
+
+  for ( ; ndesc; desc++, ndesc--)
+    {
+      const char *more = ndesc > 1 ? "--openpgp --more" : "--openpgp";
+
+      err = format_search_pattern (desc, pattern, sizeof pattern);
+      if (err)
+        goto leave;
+      snprintf (line, sizeof line, "SEARCH %s -- %s", more, pattern);
 
       if (ndesc > 1)
         {
@@ -870,12 +1518,12 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
             goto leave;
         }
     }
-  while (ndesc);
-
 
  do_search:
   hd->last_ubid_valid = 0;
-  err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
+  err = kbx_client_data_cmd (hd->kbl->kcd, line,
+                             parm.data? search_inq_cb : NULL, &parm,
+                             search_status_cb, hd);
   if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len)))
     {
       hd->kbl->search_result = iobuf_temp_with_content (buffer, len);
@@ -886,6 +1534,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     }
 
  leave:
+  xfree (patterndata);
   if (DBG_CLOCK)
     log_clock ("%s leave (%sfound)", __func__, err? "not ":"");
   return err;
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -32,12 +33,60 @@
 #include "packet.h"
 #include "options.h"
 #include "main.h"
+#include "workqueue.h"
 
 
 /* The size of the buffer we allocate to encrypt the data.  This must
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* Parallel encryption is only used if a chunk is not larger than
+ * this because each queued chunk is kept in memory.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (4*1024*1024)
+
+
+/* The state of a job for parallel encryption.  */
+enum aead_job_state
+  {
+    AEAD_JOB_FREE = 0,  /* Not in use or being filled.  */
+    AEAD_JOB_QUEUED,    /* Queued for or being encrypted by a worker.  */
+    AEAD_JOB_DONE       /* Encrypted but not yet written.  */
+  };
+
+/* A job for parallel encryption.  Each job holds one entire chunk.  */
+struct aead_job_s
+{
+  enum aead_job_state state;
+  uint64_t chunkindex;  /* The chunk index used for the nonce.  */
+  size_t len;           /* Used length of BUFFER.  */
+  gpg_error_t err;      /* The result of the encryption.  */
+  byte tag[16];         /* The authentication tag of the chunk.  */
+  byte *buffer;         /* Buffer of CHUNKSIZE bytes.  */
+};
+
+/* A worker thread for parallel encryption.  */
+struct aead_worker_s
+{
+  struct aead_parallel_s *par;
+  gcry_cipher_hd_t cipher_hd;  /* The worker's own cipher handle.  */
+};
+
+/* The context for parallel encryption.  The jobs are used as a ring
+ * buffer: WRITEIDX is the oldest job not yet written and the
+ * NPENDING jobs following it are queued, busy or done.  The job
+ * after them is the one being filled.  */
+struct aead_parallel_s
+{
+  cipher_filter_context_t *cfx;
+  workqueue_t wq;
+  int nworkers;
+  struct aead_worker_s workers[WORKQUEUE_MAX_WORKERS];
+  int writeidx;
+  int npending;
+  int njobs;
+  struct aead_job_s jobs[1];
+};
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -55,12 +104,13 @@ my_iobuf_write (iobuf_t a, const void *buffer, size_t buflen)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  If
- * FINAL is set the final AEAD chunk is processed.  This also reset
- * the encryption machinery so that the handle can be used for a new
- * chunk.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX on
+ * the cipher handle HD.  If FINAL is set the final AEAD chunk is
+ * processed.  This also reset the encryption machinery so that the
+ * handle can be used for a new chunk.  */
 static gpg_error_t
-set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+set_nonce_and_ad (cipher_filter_context_t *cfx, gcry_cipher_hd_t hd,
+                  uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char nonce[16];
@@ -83,18 +133,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
       BUG ();
     }
 
-  nonce[i++] ^= cfx->chunkindex >> 56;
-  nonce[i++] ^= cfx->chunkindex >> 48;
-  nonce[i++] ^= cfx->chunkindex >> 40;
-  nonce[i++] ^= cfx->chunkindex >> 32;
-  nonce[i++] ^= cfx->chunkindex >> 24;
-  nonce[i++] ^= cfx->chunkindex >> 16;
-  nonce[i++] ^= cfx->chunkindex >>  8;
-  nonce[i++] ^= cfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, 15, "nonce:");
-  err = gcry_cipher_setiv (cfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -103,14 +153,14 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
   ad[2] = cfx->dek->algo;
   ad[3] = cfx->dek->use_aead;
   ad[4] = cfx->chunkbyte;
-  ad[5] = cfx->chunkindex >> 56;
-  ad[6] = cfx->chunkindex >> 48;
-  ad[7] = cfx->chunkindex >> 40;
-  ad[8] = cfx->chunkindex >> 32;
-  ad[9] = cfx->chunkindex >> 24;
-  ad[10]= cfx->chunkindex >> 16;
-  ad[11]= cfx->chunkindex >>  8;
-  ad[12]= cfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = cfx->total >> 56;
@@ -124,7 +174,215 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (cfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* The job function of a worker for parallel encryption.  It
+ * encrypts the entire chunk in place and computes its tag.  */
+static void
+aead_job_fnc (void *worker_data, void *arg)
+{
+  struct aead_worker_s *worker = worker_data;
+  struct aead_job_s *job = arg;
+  gpg_error_t err;
+
+  err = set_nonce_and_ad (worker->par->cfx, worker->cipher_hd,
+                          job->chunkindex, 0);
+  if (!err)
+    {
+      npth_unprotect ();
+      gcry_cipher_final (worker->cipher_hd);
+      err = gcry_cipher_encrypt (worker->cipher_hd, job->buffer, job->len,
+                                 NULL, 0);
+      if (!err)
+        err = gcry_cipher_gettag (worker->cipher_hd, job->tag, 16);
+      npth_protect ();
+    }
+  job->err = err;
+}
+
+
+/* Called by a worker with the lock held after a job.  */
+static void
+aead_job_done (void *arg)
+{
+  struct aead_job_s *job = arg;
+
+  job->state = AEAD_JOB_DONE;
+}
+
+
+/* Terminate the workers and release the parallel encryption context
+ * of CFX.  Queued jobs are not anymore processed.  */
+static void
+stop_parallel (cipher_filter_context_t *cfx)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  int i;
+
+  if (!par)
+    return;
+
+  workqueue_release (par->wq);
+  for (i = 0; i < par->nworkers; i++)
+    gcry_cipher_close (par->workers[i].cipher_hd);
+  for (i = 0; i < par->njobs; i++)
+    xfree (par->jobs[i].buffer);
+  xfree (par);
+  cfx->parallel = NULL;
+}
+
+
+/* Setup parallel encryption for CFX if requested and worthwhile.  On
+ * any error the serial code is used.  */
+static void
+start_parallel (cipher_filter_context_t *cfx, enum gcry_cipher_modes ciphermode)
+{
+  struct aead_parallel_s *par;
+  gpg_error_t err;
+  int nworkers, njobs;
+  int i;
+
+  if (cfx->chunksize > AEAD_MAX_PARALLEL_CHUNKSIZE)
+    return;
+  nworkers = workqueue_max_workers (WORKQUEUE_MAX_WORKERS);
+  if (!nworkers)
+    return;
+  njobs = 2 * nworkers;
+
+  par = xtrycalloc (1, sizeof *par + (njobs - 1) * sizeof par->jobs[0]);
+  if (!par)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  par->cfx = cfx;
+  par->njobs = njobs;
+  cfx->parallel = par;
+
+  err = workqueue_new (&par->wq, njobs, aead_job_fnc, aead_job_done);
+  if (err)
+    goto leave;
+
+  for (i = 0; i < njobs; i++)
+    {
+      par->jobs[i].buffer = xtrymalloc (cfx->chunksize);
+      if (!par->jobs[i].buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  for (i = 0; i < nworkers && !err; i++)
+    {
+      struct aead_worker_s *worker = par->workers + i;
+
+      worker->par = par;
+      err = openpgp_cipher_open (&worker->cipher_hd, cfx->dek->algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (err && i >= 2)
+        {
+          /* Probably out of secure memory - go with what we have.  */
+          err = 0;
+          break;
+        }
+      par->nworkers++;
+      if (!err)
+        err = gcry_cipher_setkey (worker->cipher_hd,
+                                  cfx->dek->key, cfx->dek->keylen);
+      if (!err)
+        err = workqueue_add_worker (par->wq, worker);
+    }
+
+ leave:
+  if (err)
+    {
+      log_info ("parallel AEAD encryption disabled: %s\n",
+                gpg_strerror (err));
+      stop_parallel (cfx);
+    }
+  else if (DBG_FILTER)
+    log_debug ("parallel AEAD encryption with %d workers\n", par->nworkers);
+}
+
+
+/* Write the jobs which are done in chunk order to A.  If ALL is set
+ * wait until all pending jobs have been written; otherwise wait only
+ * if no job is left for filling.  */
+static gpg_error_t
+write_parallel_jobs (cipher_filter_context_t *cfx, iobuf_t a, int all)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_job_s *job;
+  gpg_error_t err = 0;
+
+  workqueue_lock (par->wq);
+  while (par->npending)
+    {
+      job = par->jobs + par->writeidx;
+      if (job->state != AEAD_JOB_DONE)
+        {
+          if (!all && par->npending < par->njobs)
+            break;
+          workqueue_wait (par->wq);
+          continue;
+        }
+      workqueue_unlock (par->wq);
+
+      err = job->err;
+      if (!err)
+        err = my_iobuf_write (a, job->buffer, job->len);
+      if (!err)
+        {
+          if (DBG_FILTER)
+            log_debug ("writing tag: chunkindex=%ju len=%zu\n",
+                       (uintmax_t)job->chunkindex, job->len);
+          err = my_iobuf_write (a, job->tag, 16);
+        }
+
+      workqueue_lock (par->wq);
+      job->state = AEAD_JOB_FREE;
+      job->len = 0;
+      par->writeidx = (par->writeidx + 1) % par->njobs;
+      par->npending--;
+      if (err)
+        break;
+    }
+  workqueue_unlock (par->wq);
+
+  if (err)
+    log_error ("parallel AEAD encryption failed: %s\n", gpg_strerror (err));
+  return err;
+}
+
+
+/* Return the job which is currently being filled.  */
+static struct aead_job_s *
+fill_job (struct aead_parallel_s *par)
+{
+  log_assert (par->npending < par->njobs);
+  return par->jobs + (par->writeidx + par->npending) % par->njobs;
+}
+
+
+/* Hand the job currently being filled over to the workers.  */
+static void
+submit_fill_job (cipher_filter_context_t *cfx)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_job_s *job;
+
+  workqueue_lock (par->wq);
+  job = fill_job (par);
+  job->chunkindex = cfx->chunkindex++;
+  job->err = 0;
+  job->state = AEAD_JOB_QUEUED;
+  cfx->total += job->len;
+  par->npending++;
+  workqueue_put (par->wq, job);
+  workqueue_unlock (par->wq);
 }
 
 
@@ -198,6 +456,8 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  start_parallel (cfx, ciphermode);
+
   cfx->wrote_header = 1;
 
  leave:
@@ -233,7 +493,7 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
   gpg_error_t err;
   char dummy[1];
 
-  err = set_nonce_and_ad (cfx, 1);
+  err = set_nonce_and_ad (cfx, cfx->cipher_hd, cfx->chunkindex, 1);
   if (err)
     goto leave;
 
@@ -341,7 +601,8 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
             {
               if (DBG_FILTER)
                 log_debug ("start encrypting a new chunk\n");
-              err = set_nonce_and_ad (cfx, 0);
+              err = set_nonce_and_ad (cfx, cfx->cipher_hd,
+                                      cfx->chunkindex, 0);
               if (err)
                 goto leave;
             }
@@ -396,6 +657,69 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
 }
 
 
+/* The flush sub-function of cipher_filter_aead for parallel mode.
+ * The data is collected into entire chunks which are then encrypted
+ * by the workers.  */
+static gpg_error_t
+do_flush_parallel (cipher_filter_context_t *cfx, iobuf_t a,
+                   byte *buf, size_t size)
+{
+  struct aead_job_s *job;
+  gpg_error_t err = 0;
+  size_t n;
+
+  while (size)
+    {
+      /* This makes sure that there is a job to fill.  */
+      err = write_parallel_jobs (cfx, a, 0);
+      if (err)
+        break;
+
+      job = fill_job (cfx->parallel);
+      n = cfx->chunksize - job->len;
+      if (n > size)
+        n = size;
+      memcpy (job->buffer + job->len, buf, n);
+      job->len += n;
+      buf += n;
+      size -= n;
+      if (job->len == cfx->chunksize)
+        submit_fill_job (cfx);
+    }
+
+  return err;
+}
+
+
+/* The free sub-function of cipher_filter_aead for parallel mode.  */
+static gpg_error_t
+do_free_parallel (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  gpg_error_t err;
+
+  /* Submit the last chunk unless it is empty.  If all jobs are
+   * pending there is no partially filled chunk.  */
+  if (par->npending < par->njobs && fill_job (par)->len)
+    submit_fill_job (cfx);
+  err = write_parallel_jobs (cfx, a, 1);
+  stop_parallel (cfx);
+  if (err)
+    goto leave;
+
+  if (DBG_FILTER)
+    log_debug ("creating final chunk\n");
+  err = write_final_chunk (cfx, a);
+
+ leave:
+  xfree (cfx->buffer);
+  cfx->buffer = NULL;
+  gcry_cipher_close (cfx->cipher_hd);
+  cfx->cipher_hd = NULL;
+  return err;
+}
+
+
 /* The core of the free sub-function of cipher_filter_aead.   */
 static gpg_error_t
 do_free (cipher_filter_context_t *cfx, iobuf_t a)
@@ -405,6 +729,9 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   if (DBG_FILTER)
     log_debug ("do_free: buflen=%zu\n", cfx->buflen);
 
+  if (cfx->parallel)
+    return do_free_parallel (cfx, a);
+
   if (cfx->chunklen || cfx->buflen)
     {
       if (DBG_FILTER)
@@ -414,7 +741,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
         {
           if (DBG_FILTER)
             log_debug ("start encrypting a new chunk\n");
-          err = set_nonce_and_ad (cfx, 0);
+          err = set_nonce_and_ad (cfx, cfx->cipher_hd, cfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -475,6 +802,8 @@ cipher_filter_aead (void *opaque, int control,
     {
       if (!cfx->wrote_header && (rc=write_header (cfx, a)))
         ;
+      else if (cfx->parallel)
+        rc = do_flush_parallel (cfx, a, buf, size);
       else
         rc = do_flush (cfx, a, buf, size);
     }
@@ -36,7 +36,7 @@
    do ZIP, ZLIB, and BZIP2, but it became dangerously unreadable with
    #ifdefs and if(algo) -dshaw */
 
-static void
+static int
 init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
 {
   int rc;
@@ -55,12 +55,13 @@ init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzCompressInit(bzs,level,0,0))!=BZ_OK)
     {
       log_error ("bz2lib problem: %d\n",rc);
-      write_status_error ("bzip2.init", gpg_error (GPG_ERR_INTERNAL));
-      g10_exit (2);
+      return compress_fatal_error (zfx, "bzip2.init",
+                                   gpg_error (GPG_ERR_INTERNAL));
     }
 
   zfx->outbufsize = 8192;
   zfx->outbuf = xmalloc( zfx->outbufsize );
+  return 0;
 }
 
 static int
@@ -86,8 +87,8 @@ do_compress(compress_filter_context_t *zfx, bz_stream *bzs, int flush, IOBUF a)
       else if( zrc != BZ_RUN_OK && zrc != BZ_FINISH_OK )
         {
           log_error ("bz2lib deflate problem: rc=%d\n", zrc );
-          write_status_error ("bzip2.deflate", gpg_error (GPG_ERR_INTERNAL));
-          g10_exit (2);
+          return compress_fatal_error (zfx, "bzip2.deflate",
+                                       gpg_error (GPG_ERR_INTERNAL));
         }
 
       n = zfx->outbufsize - bzs->avail_out;
@@ -237,7 +238,9 @@ compress_filter_bz2( void *opaque, int control,
 	  if( build_packet( a, &pkt ))
 	    log_bug("build_packet(PKT_COMPRESSED) failed\n");
 	  bzs = zfx->opaque = xmalloc_clear( sizeof *bzs );
-	  init_compress( zfx, bzs );
+	  rc = init_compress( zfx, bzs );
+	  if( rc )
+	    return rc;
 	  zfx->status = 2;
 	}
 
@@ -258,7 +261,7 @@ compress_filter_bz2( void *opaque, int control,
 	{
 	  bzs->next_in = buf;
 	  bzs->avail_in = 0;
-	  do_compress( zfx, bzs, BZ_FINISH, a );
+	  rc = do_compress( zfx, bzs, BZ_FINISH, a );
 	  BZ2_bzCompressEnd(bzs);
 	  xfree(bzs);
 	  zfx->opaque = NULL;
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <npth.h>
 #ifdef HAVE_ZIP
 # include <zlib.h>
 #endif
@@ -53,8 +54,51 @@
 int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
+/* The number of bytes collected before they are handed over to the
+ * compression thread.  */
+#define COMPRESS_THD_JOBSIZE (256*1024)
+
+/* The state of a job for the compression thread.  */
+enum compress_job_state
+  {
+    COMPRESS_JOB_FREE = 0,  /* Not in use.  */
+    COMPRESS_JOB_QUEUED,    /* Waiting for or being processed by the
+                               thread.  */
+    COMPRESS_JOB_DONE       /* Compressed data is available.  */
+  };
+
+/* A job for the compression thread.  */
+struct compress_job_s
+{
+  enum compress_job_state state;
+  int control;      /* IOBUFCTRL_FLUSH or IOBUFCTRL_FREE.  */
+  byte *buf;        /* The data to compress.  */
+  size_t bufsize;   /* Allocated size of BUF.  */
+  size_t len;       /* Used length of BUF.  */
+  iobuf_t out;      /* Temporary iobuf receiving the compressed data.  */
+  int rc;           /* The return code of the compress filter.  */
+};
+
+/* The context of the threaded compression stage.  The two jobs are
+ * used for double buffering: While the thread compresses one job the
+ * main thread writes the output of the other one down the pipeline.  */
+struct compress_thd_s
+{
+  compress_filter_context_t *zfx;
+  int rel;          /* ZFX is to be released by us.  */
+  int (*filter) (void *opaque, int control,
+                 iobuf_t a, byte *buf, size_t *ret_len);
+  npth_t thd;
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+  int any_flush;    /* A flush has been seen for the current job.  */
+  const char *fatal_status;  /* Set by the filter on a fatal error.  */
+  int next;         /* The index of the job to fill.  */
+  struct compress_job_s jobs[2];
+};
+
 #ifdef HAVE_ZIP
-static void
+static int
 init_compress( compress_filter_context_t *zfx, z_stream *zs )
 {
     int rc;
@@ -77,12 +121,13 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 			       rc == Z_MEM_ERROR ? "out of core" :
 			       rc == Z_VERSION_ERROR ? "invalid lib version" :
 						       "unknown error" );
-        write_status_error ("zlib.init", gpg_error (GPG_ERR_INTERNAL));
-        g10_exit (2);
+        return compress_fatal_error (zfx, "zlib.init",
+                                     gpg_error (GPG_ERR_INTERNAL));
     }
 
     zfx->outbufsize = 65536;
     zfx->outbuf = xmalloc( zfx->outbufsize );
+    return 0;
 }
 
 static int
@@ -109,8 +154,8 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
 		log_error ("zlib deflate problem: %s\n", zs->msg );
 	    else
 		log_error ("zlib deflate problem: rc=%d\n", zrc );
-            write_status_error ("zlib.deflate", gpg_error (GPG_ERR_INTERNAL));
-            g10_exit (2);
+            return compress_fatal_error (zfx, "zlib.deflate",
+                                         gpg_error (GPG_ERR_INTERNAL));
 	}
 	n = zfx->outbufsize - zs->avail_out;
 	if( DBG_FILTER )
@@ -260,7 +305,9 @@ compress_filter( void *opaque, int control,
 	    if( build_packet( a, &pkt ))
 		log_bug("build_packet(PKT_COMPRESSED) failed\n");
 	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
+	    rc = init_compress( zfx, zs );
+	    if( rc )
+		return rc;
 	    zfx->status = 2;
 	}
 
@@ -278,7 +325,7 @@ compress_filter( void *opaque, int control,
 	else if( zfx->status == 2 ) {
 	    zs->next_in = BYTEF_CAST (buf);
 	    zs->avail_in = 0;
-	    do_compress( zfx, zs, Z_FINISH, a );
+	    rc = do_compress( zfx, zs, Z_FINISH, a );
 	    deflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
@@ -293,6 +340,25 @@ compress_filter( void *opaque, int control,
 }
 #endif /*HAVE_ZIP*/
 
+/* Handle the fatal error ERR of the compress filter ZFX.  STATUS is
+ * the tag for the ERROR status line.  If the filter runs in its own
+ * thread this is left to the main thread and ERR is returned;
+ * otherwise the process is terminated.  */
+int
+compress_fatal_error (compress_filter_context_t *zfx, const char *status,
+                      gpg_error_t err)
+{
+  if (zfx->fatal_status)
+    {
+      *zfx->fatal_status = status;
+      return err;
+    }
+  write_status_error (status, err);
+  g10_exit (2);
+  return err;  /* Not reached.  */
+}
+
+
 static void
 release_context (compress_filter_context_t *ctx)
 {
@@ -331,6 +397,235 @@ handle_compressed (ctrl_t ctrl, void *procctx, PKT_compressed *cd,
     return rc;
 }
 
+static void
+lock_compress (struct compress_thd_s *ctx)
+{
+  int rc = npth_mutex_lock (&ctx->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_compress (struct compress_thd_s *ctx)
+{
+  int rc = npth_mutex_unlock (&ctx->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* The compression thread.  It runs the actual compress filter on the
+ * queued jobs in order and writes the output to the job's temporary
+ * iobuf.  The thread terminates after the IOBUFCTRL_FREE job.  */
+static void *
+compress_thread (void *arg)
+{
+  struct compress_thd_s *ctx = arg;
+  struct compress_job_s *job;
+  int idx = 0;
+  int control;
+  size_t len;
+
+  do
+    {
+      job = ctx->jobs + idx;
+      lock_compress (ctx);
+      while (job->state != COMPRESS_JOB_QUEUED)
+        npth_cond_wait (&ctx->cond, &ctx->mutex);
+      unlock_compress (ctx);
+
+      control = job->control;
+      len = job->len;
+      npth_unprotect ();
+      job->rc = ctx->filter (ctx->zfx, control, job->out, job->buf, &len);
+      npth_protect ();
+
+      lock_compress (ctx);
+      job->state = COMPRESS_JOB_DONE;
+      npth_cond_broadcast (&ctx->cond);
+      unlock_compress (ctx);
+
+      idx = !idx;
+    }
+  while (control != IOBUFCTRL_FREE);
+
+  return NULL;
+}
+
+
+/* Wait until JOB has been processed, write its output to A and mark
+ * it as free.  */
+static int
+finish_compress_job (struct compress_thd_s *ctx, struct compress_job_s *job,
+                     iobuf_t a)
+{
+  int rc;
+
+  lock_compress (ctx);
+  if (job->state == COMPRESS_JOB_FREE)
+    {
+      unlock_compress (ctx);
+      return 0;
+    }
+  while (job->state != COMPRESS_JOB_DONE)
+    npth_cond_wait (&ctx->cond, &ctx->mutex);
+  unlock_compress (ctx);
+
+  rc = job->rc;
+  if (rc && ctx->fatal_status)
+    {
+      /* Terminate the process from the main thread.  */
+      write_status_error (ctx->fatal_status, rc);
+      g10_exit (2);
+    }
+  if (!rc)
+    rc = iobuf_write_temp (a, job->out);
+  iobuf_close (job->out);
+  job->out = NULL;
+  job->len = 0;
+  job->state = COMPRESS_JOB_FREE;
+  return rc;
+}
+
+
+/* Queue the current job with CONTROL for the compression thread and
+ * write the output of the previous job to A.  */
+static int
+submit_compress_job (struct compress_thd_s *ctx, int control, iobuf_t a)
+{
+  struct compress_job_s *job = ctx->jobs + ctx->next;
+
+  job->control = control;
+  job->out = iobuf_temp ();
+  ctx->any_flush = 0;
+
+  lock_compress (ctx);
+  job->state = COMPRESS_JOB_QUEUED;
+  npth_cond_broadcast (&ctx->cond);
+  unlock_compress (ctx);
+
+  ctx->next = !ctx->next;
+  return finish_compress_job (ctx, ctx->jobs + ctx->next, a);
+}
+
+
+/* The filter used for threaded compression.  It collects the data
+ * and passes it to the compress filter running in its own thread.  */
+static int
+compress_thd_filter (void *opaque, int control,
+                     iobuf_t a, byte *buf, size_t *ret_len)
+{
+  struct compress_thd_s *ctx = opaque;
+  size_t size = *ret_len;
+  struct compress_job_s *job;
+  int rc = 0;
+  int rc2;
+
+  if (control == IOBUFCTRL_FLUSH)
+    {
+      job = ctx->jobs + ctx->next;
+      if (job->len + size > job->bufsize)
+        {
+          job->bufsize = job->len + size;
+          if (job->bufsize < COMPRESS_THD_JOBSIZE)
+            job->bufsize = COMPRESS_THD_JOBSIZE;
+          job->buf = xrealloc (job->buf, job->bufsize);
+        }
+      memcpy (job->buf + job->len, buf, size);
+      job->len += size;
+      ctx->any_flush = 1;
+      if (job->len >= COMPRESS_THD_JOBSIZE)
+        rc = submit_compress_job (ctx, IOBUFCTRL_FLUSH, a);
+    }
+  else if (control == IOBUFCTRL_FREE)
+    {
+      if (ctx->any_flush)
+        rc = submit_compress_job (ctx, IOBUFCTRL_FLUSH, a);
+      rc2 = submit_compress_job (ctx, IOBUFCTRL_FREE, a);
+      if (!rc)
+        rc = rc2;
+      rc2 = finish_compress_job (ctx, ctx->jobs + !ctx->next, a);
+      if (!rc)
+        rc = rc2;
+
+      npth_join (ctx->thd, NULL);
+      npth_cond_destroy (&ctx->cond);
+      npth_mutex_destroy (&ctx->mutex);
+      xfree (ctx->jobs[0].buf);
+      xfree (ctx->jobs[1].buf);
+      if (ctx->rel)
+        xfree (ctx->zfx);
+      xfree (ctx);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "compress_thd_filter", *ret_len);
+
+  return rc;
+}
+
+
+/* Push the compress FILTER with context ZFX onto OUT so that the
+ * compression is done by a separate thread.  Returns an error if the
+ * thread could not be started; nothing has been pushed then.  */
+static gpg_error_t
+push_compress_thd_filter (iobuf_t out, compress_filter_context_t *zfx,
+                          int rel,
+                          int (*filter) (void *opaque, int control,
+                                         iobuf_t a, byte *buf,
+                                         size_t *ret_len))
+{
+  struct compress_thd_s *ctx;
+  npth_attr_t tattr;
+  int rc;
+
+  ctx = xtrycalloc (1, sizeof *ctx);
+  if (!ctx)
+    return gpg_error_from_syserror ();
+  ctx->zfx = zfx;
+  ctx->rel = rel;
+  ctx->filter = filter;
+  zfx->fatal_status = &ctx->fatal_status;
+
+  rc = npth_mutex_init (&ctx->mutex, NULL);
+  if (rc)
+    {
+      xfree (ctx);
+      return gpg_error_from_errno (rc);
+    }
+  rc = npth_cond_init (&ctx->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&ctx->mutex);
+      xfree (ctx);
+      return gpg_error_from_errno (rc);
+    }
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      npth_cond_destroy (&ctx->cond);
+      npth_mutex_destroy (&ctx->mutex);
+      xfree (ctx);
+      return gpg_error_from_errno (rc);
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&ctx->thd, &tattr, compress_thread, ctx);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      npth_cond_destroy (&ctx->cond);
+      npth_mutex_destroy (&ctx->mutex);
+      xfree (ctx);
+      return gpg_error_from_errno (rc);
+    }
+
+  iobuf_push_filter (out, compress_thd_filter, ctx);
+  return 0;
+}
+
+
 gpg_error_t
 push_compress_filter(IOBUF out,compress_filter_context_t *zfx,int algo)
 {
@@ -344,6 +639,8 @@ push_compress_filter2(IOBUF out,compress_filter_context_t *zfx,
 		      int algo,int rel)
 {
   gpg_error_t err = gpg_error (GPG_ERR_FALSE);
+  int (*filter) (void *opaque, int control,
+                 iobuf_t a, byte *buf, size_t *ret_len) = NULL;
 
   if(algo>=0)
     zfx->algo=algo;
@@ -358,15 +655,13 @@ push_compress_filter2(IOBUF out,compress_filter_context_t *zfx,
 #ifdef HAVE_ZIP
     case COMPRESS_ALGO_ZIP:
     case COMPRESS_ALGO_ZLIB:
-      iobuf_push_filter2(out,compress_filter,zfx,rel);
-      err = 0;
+      filter = compress_filter;
       break;
 #endif
 
 #ifdef HAVE_BZIP2
     case COMPRESS_ALGO_BZIP2:
-      iobuf_push_filter2(out,compress_filter_bz2,zfx,rel);
-      err = 0;
+      filter = compress_filter_bz2;
       break;
 #endif
 
@@ -374,5 +669,23 @@ push_compress_filter2(IOBUF out,compress_filter_context_t *zfx,
       BUG();
     }
 
+  if (filter)
+    {
+      /* When writing, the compression may optionally be done by a
+       * separate thread so that it overlaps with the encryption.  */
+      if ((out->use == IOBUF_OUTPUT || out->use == IOBUF_OUTPUT_TEMP)
+          && (opt.compat_flags & COMPAT_PARALLELIZED)
+          && gnupg_get_ncpus () > 1)
+        {
+          err = push_compress_thd_filter (out, zfx, rel, filter);
+          if (err)
+            log_info ("threaded compression disabled: %s\n",
+                      gpg_strerror (err));
+        }
+      if (err)
+        iobuf_push_filter2 (out, filter, zfx, rel);
+      err = 0;
+    }
+
   return err;
 }
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -31,6 +32,12 @@
 #include "../common/i18n.h"
 #include "../common/status.h"
 #include "../common/compliance.h"
+#include "workqueue.h"
+
+
+/* Parallel decryption is only used if a chunk is not larger than
+ * this because each read ahead chunk is kept in memory.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (4*1024*1024)
 
 
 static int aead_decode_filter (void *opaque, int control, iobuf_t a,
@@ -99,9 +106,64 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* The context for parallel AEAD decryption or NULL.  */
+  struct aead_parallel_s *parallel;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
+static void stop_parallel (decode_filter_ctx_t dfx);
+
+
+/* The state of a job for parallel decryption.  */
+enum aead_job_state
+  {
+    AEAD_JOB_FREE = 0,  /* Not in use.  */
+    AEAD_JOB_QUEUED,    /* Queued for or being decrypted by a worker.  */
+    AEAD_JOB_DONE       /* Decrypted and tag checked.  */
+  };
+
+/* A job for parallel decryption.  Each job holds one entire chunk.  */
+struct aead_job_s
+{
+  enum aead_job_state state;
+  uint64_t chunkindex;  /* The chunk index used for the nonce.  */
+  size_t len;           /* Length of the data in BUFFER.  */
+  size_t off;           /* Number of plaintext bytes already returned.  */
+  gpg_error_t err;      /* The result of the decryption.  */
+  unsigned int tag_failed:1;  /* ERR is from the tag check.  */
+  byte tag[16];         /* The authentication tag of the chunk.  */
+  byte *buffer;         /* Buffer of CHUNKSIZE+32 bytes.  */
+};
+
+/* A worker thread for parallel decryption.  */
+struct aead_worker_s
+{
+  struct aead_parallel_s *par;
+  gcry_cipher_hd_t cipher_hd;  /* The worker's own cipher handle.  */
+};
+
+/* The context for parallel decryption.  The jobs are used as a ring
+ * buffer: READIDX is the oldest job whose plaintext has not yet been
+ * entirely returned and the NPENDING jobs starting there are queued,
+ * busy or done.  */
+struct aead_parallel_s
+{
+  decode_filter_ctx_t dfx;
+  workqueue_t wq;
+  int nworkers;
+  struct aead_worker_s workers[WORKQUEUE_MAX_WORKERS];
+  byte carry[16];       /* Bytes read beyond the last queued chunk.  */
+  unsigned int carrylen;
+  unsigned int all_read:1;  /* The final tag has been read.  */
+  unsigned int finished:1;  /* The final tag has been checked.  */
+  byte finaltag[16];    /* The tag of the final chunk.  */
+  int readidx;
+  int npending;
+  int njobs;
+  struct aead_job_s jobs[1];
+};
+
 
 /* Helper to release the decode context.  */
 static void
@@ -113,6 +175,7 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      stop_parallel (dfx);
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -122,12 +185,13 @@ release_dfx_context (decode_filter_ctx_t dfx)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  This
- * also reset the decryption machinery so that the handle can be
- * used for a new chunk.  If FINAL is set the final AEAD chunk is
- * processed.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX on
+ * the cipher handle HD.  This also reset the decryption machinery so
+ * that the handle can be used for a new chunk.  If FINAL is set the
+ * final AEAD chunk is processed.  */
 static gpg_error_t
-aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+aead_set_nonce_and_ad (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                       uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char ad[21];
@@ -149,18 +213,18 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     default:
       BUG ();
     }
-  nonce[i++] ^= dfx->chunkindex >> 56;
-  nonce[i++] ^= dfx->chunkindex >> 48;
-  nonce[i++] ^= dfx->chunkindex >> 40;
-  nonce[i++] ^= dfx->chunkindex >> 32;
-  nonce[i++] ^= dfx->chunkindex >> 24;
-  nonce[i++] ^= dfx->chunkindex >> 16;
-  nonce[i++] ^= dfx->chunkindex >>  8;
-  nonce[i++] ^= dfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, i, "nonce:");
-  err = gcry_cipher_setiv (dfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -169,14 +233,14 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
   ad[2] = dfx->cipher_algo;
   ad[3] = dfx->aead_algo;
   ad[4] = dfx->chunkbyte;
-  ad[5] = dfx->chunkindex >> 56;
-  ad[6] = dfx->chunkindex >> 48;
-  ad[7] = dfx->chunkindex >> 40;
-  ad[8] = dfx->chunkindex >> 32;
-  ad[9] = dfx->chunkindex >> 24;
-  ad[10]= dfx->chunkindex >> 16;
-  ad[11]= dfx->chunkindex >>  8;
-  ad[12]= dfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = dfx->total >> 56;
@@ -190,7 +254,7 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (dfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
 }
 
 
@@ -218,6 +282,151 @@ aead_checktag (decode_filter_ctx_t dfx, int final, const void *tagbuf)
 }
 
 
+/* The job function of a worker for parallel decryption.  It
+ * decrypts the entire chunk in place and checks its tag.  */
+static void
+aead_job_fnc (void *worker_data, void *arg)
+{
+  struct aead_worker_s *worker = worker_data;
+  struct aead_job_s *job = arg;
+  gpg_error_t err;
+  int tag_failed = 0;
+
+  err = aead_set_nonce_and_ad (worker->par->dfx, worker->cipher_hd,
+                               job->chunkindex, 0);
+  if (!err)
+    {
+      npth_unprotect ();
+      gcry_cipher_final (worker->cipher_hd);
+      err = gcry_cipher_decrypt (worker->cipher_hd, job->buffer, job->len,
+                                 NULL, 0);
+      if (!err)
+        {
+          err = gcry_cipher_checktag (worker->cipher_hd, job->tag, 16);
+          tag_failed = !!err;
+        }
+      npth_protect ();
+    }
+  job->err = err;
+  job->tag_failed = tag_failed;
+}
+
+
+/* Called by a worker with the lock held after a job.  */
+static void
+aead_job_done (void *arg)
+{
+  struct aead_job_s *job = arg;
+
+  job->state = AEAD_JOB_DONE;
+}
+
+
+/* Terminate the workers and release the parallel decryption context
+ * of DFX.  Queued jobs are not anymore processed.  */
+static void
+stop_parallel (decode_filter_ctx_t dfx)
+{
+  struct aead_parallel_s *par = dfx->parallel;
+  int i;
+
+  if (!par)
+    return;
+
+  workqueue_release (par->wq);
+  for (i = 0; i < par->nworkers; i++)
+    gcry_cipher_close (par->workers[i].cipher_hd);
+  for (i = 0; i < par->njobs; i++)
+    {
+      if (par->jobs[i].buffer)
+        wipememory (par->jobs[i].buffer, dfx->chunksize + 32);
+      xfree (par->jobs[i].buffer);
+    }
+  xfree (par);
+  dfx->parallel = NULL;
+}
+
+
+/* Setup parallel decryption for DFX using the key from DEK if
+ * requested and worthwhile.  On any error the serial code is used.  */
+static void
+start_parallel (decode_filter_ctx_t dfx, enum gcry_cipher_modes ciphermode,
+                DEK *dek)
+{
+  struct aead_parallel_s *par;
+  gpg_error_t err;
+  int nworkers, njobs;
+  int i;
+
+  if (dfx->chunksize > AEAD_MAX_PARALLEL_CHUNKSIZE)
+    return;
+  nworkers = workqueue_max_workers (WORKQUEUE_MAX_WORKERS);
+  if (!nworkers)
+    return;
+  njobs = 2 * nworkers;
+
+  par = xtrycalloc (1, sizeof *par + (njobs - 1) * sizeof par->jobs[0]);
+  if (!par)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  par->dfx = dfx;
+  par->njobs = njobs;
+  dfx->parallel = par;
+
+  err = workqueue_new (&par->wq, njobs, aead_job_fnc, aead_job_done);
+  if (err)
+    goto leave;
+
+  /* Each job buffer also takes the chunk's tag and the 16 bytes read
+   * ahead to detect the final tag.  */
+  for (i = 0; i < njobs; i++)
+    {
+      par->jobs[i].buffer = xtrymalloc (dfx->chunksize + 32);
+      if (!par->jobs[i].buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  for (i = 0; i < nworkers && !err; i++)
+    {
+      struct aead_worker_s *worker = par->workers + i;
+
+      worker->par = par;
+      err = openpgp_cipher_open (&worker->cipher_hd, dfx->cipher_algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (err && i >= 2)
+        {
+          /* Probably out of secure memory - go with what we have.  */
+          err = 0;
+          break;
+        }
+      par->nworkers++;
+      if (!err)
+        {
+          err = gcry_cipher_setkey (worker->cipher_hd, dek->key, dek->keylen);
+          if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+            err = 0;  /* Already warned by the caller.  */
+        }
+      if (!err)
+        err = workqueue_add_worker (par->wq, worker);
+    }
+
+ leave:
+  if (err)
+    {
+      log_info ("parallel AEAD decryption disabled: %s\n",
+                gpg_strerror (err));
+      stop_parallel (dfx);
+    }
+  else if (DBG_FILTER)
+    log_debug ("parallel AEAD decryption with %d workers\n", par->nworkers);
+}
+
+
 /****************
  * Decrypt the data, specified by ED with the key DEK.  On return
  * COMPLIANCE_ERROR is set to true iff the decryption can claim that
@@ -397,6 +606,7 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
           goto leave;
         }
 
+      start_parallel (dfx, ciphermode, dek);
     }
   else /* CFB encryption.  */
     {
@@ -710,7 +920,8 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
       if (!dfx->chunklen)
         {
           /* First data for this chunk - prepare.  */
-          err = aead_set_nonce_and_ad (dfx, 0);
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                         dfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -792,7 +1003,8 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
       if (!dfx->chunklen)
         {
           /* First data for this chunk - prepare.  */
-          err = aead_set_nonce_and_ad (dfx, 0);
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                         dfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -842,7 +1054,7 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
         }
 
       /* Check the final chunk.  */
-      err = aead_set_nonce_and_ad (dfx, 1);
+      err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd, dfx->chunkindex, 1);
       if (err)
         goto leave;
       gcry_cipher_final (dfx->cipher_hd);
@@ -881,6 +1093,202 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
 }
 
 
+/* Read the next chunk including its tag into a free job of the
+ * parallel decryption context and queue it for the workers.  If the
+ * EOF is encountered the final tag is stored and ALL_READ is set.  */
+static gpg_error_t
+read_parallel_job (decode_filter_ctx_t dfx, iobuf_t a)
+{
+  struct aead_parallel_s *par = dfx->parallel;
+  struct aead_job_s *job;
+  size_t len;
+
+  job = par->jobs + (par->readidx + par->npending) % par->njobs;
+  log_assert (job->state == AEAD_JOB_FREE);
+
+  /* As with the serial code we need to read 16 bytes beyond the
+   * chunk's tag to detect the final tag; those bytes are carried
+   * over to the next chunk.  */
+  memcpy (job->buffer, par->carry, par->carrylen);
+  len = fill_buffer (dfx, a, job->buffer, dfx->chunksize + 32, par->carrylen);
+  par->carrylen = 0;
+  if (!dfx->eof_seen)
+    {
+      par->carrylen = 16;
+      memcpy (par->carry, job->buffer + len - 16, 16);
+      len -= 16;
+    }
+  else if (len == 16 && dfx->chunkindex)
+    {
+      /* The last chunk has already been queued.  */
+      memcpy (par->finaltag, job->buffer, 16);
+      par->all_read = 1;
+      return 0;
+    }
+  else if (len < 32)
+    return gpg_error (GPG_ERR_TRUNCATED);
+  else
+    {
+      memcpy (par->finaltag, job->buffer + len - 16, 16);
+      par->all_read = 1;
+      len -= 16;
+    }
+
+  len -= 16;
+  memcpy (job->tag, job->buffer + len, 16);
+  job->len = len;
+  job->off = 0;
+  job->err = 0;
+  job->tag_failed = 0;
+  job->chunkindex = dfx->chunkindex++;
+  dfx->total += len;
+  if (DBG_FILTER)
+    log_debug ("queuing chunk: chunkindex=%ju len=%zu\n",
+               (uintmax_t)job->chunkindex, job->len);
+
+  workqueue_lock (par->wq);
+  job->state = AEAD_JOB_QUEUED;
+  par->npending++;
+  workqueue_put (par->wq, job);
+  workqueue_unlock (par->wq);
+
+  return 0;
+}
+
+
+/* The underflow function of the aead_decode_filter used for parallel
+ * decryption.  Chunks are read ahead and handed to the worker threads;
+ * the plaintext of a chunk is returned only in chunk order and only
+ * after its tag has been verified.  */
+static gpg_error_t
+aead_underflow_parallel (decode_filter_ctx_t dfx, iobuf_t a,
+                         byte *buf, size_t *ret_len)
+{
+  struct aead_parallel_s *par = dfx->parallel;
+  const size_t size = *ret_len; /* The allocated size of BUF.  */
+  gpg_error_t err = 0;
+  size_t totallen = 0; /* The number of bytes to return on success or EOF.  */
+  struct aead_job_s *job;
+  size_t n;
+  int done;
+
+  if (par->finished)
+    {
+      err = gpg_error (GPG_ERR_EOF);
+      goto leave;
+    }
+
+  while (totallen < size)
+    {
+      /* Read ahead as long as we have free jobs but return to the
+       * caller as soon as the oldest job is ready.  */
+      for (;;)
+        {
+          workqueue_lock (par->wq);
+          done = (par->npending
+                  && par->jobs[par->readidx].state == AEAD_JOB_DONE);
+          workqueue_unlock (par->wq);
+          if (done || par->all_read || par->npending == par->njobs)
+            break;
+          err = read_parallel_job (dfx, a);
+          if (err)
+            goto leave;
+        }
+
+      if (!par->npending)
+        {
+          /* All chunks have been returned - check the final chunk.  */
+          par->finished = 1;
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                       dfx->chunkindex, 1);
+          if (err)
+            goto leave;
+          gcry_cipher_final (dfx->cipher_hd);
+          /* Decrypt an empty string (using FINALTAG as a dummy).  */
+          err = gcry_cipher_decrypt (dfx->cipher_hd, par->finaltag, 0,
+                                     NULL, 0);
+          if (err)
+            {
+              log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                         gpg_strerror (err));
+              goto leave;
+            }
+          err = aead_checktag (dfx, 1, par->finaltag);
+          if (err)
+            goto leave;
+          err = gpg_error (GPG_ERR_EOF);
+          goto leave;
+        }
+
+      job = par->jobs + par->readidx;
+      workqueue_lock (par->wq);
+      if (job->state != AEAD_JOB_DONE && totallen)
+        {
+          /* Don't block while we have something to return.  */
+          workqueue_unlock (par->wq);
+          break;
+        }
+      while (job->state != AEAD_JOB_DONE)
+        workqueue_wait (par->wq);
+      workqueue_unlock (par->wq);
+
+      if (job->err)
+        {
+          err = job->err;
+          if (job->tag_failed)
+            {
+              log_error ("gcry_cipher_checktag failed: %s\n",
+                         gpg_strerror (err));
+              write_status_error ("aead_checktag", err);
+              dfx->checktag_failed = 1;
+            }
+          else
+            log_error ("gcry_cipher_decrypt failed: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+
+      n = job->len - job->off;
+      if (n > size - totallen)
+        n = size - totallen;
+      memcpy (buf + totallen, job->buffer + job->off, n);
+      job->off += n;
+      totallen += n;
+      if (job->off == job->len)
+        {
+          if (DBG_FILTER)
+            log_debug ("tag is valid\n");
+          workqueue_lock (par->wq);
+          job->state = AEAD_JOB_FREE;
+          par->readidx = (par->readidx + 1) % par->njobs;
+          par->npending--;
+          workqueue_unlock (par->wq);
+        }
+    }
+
+ leave:
+  if (DBG_FILTER)
+    log_debug ("aead_underflow_parallel: returning %zu (%s)\n",
+               totallen, gpg_strerror (err));
+
+  /* In case of an auth error we map the error code to the same as
+   * used by the MDC decryption.  */
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+
+  /* In case of an error we better wipe out the buffer than to convey
+   * partly decrypted data.  */
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      memset (buf, 0, size);
+      totallen = 0;
+    }
+
+  *ret_len = totallen;
+
+  return err;
+}
+
+
 /* The IOBUF filter used to decrypt AEAD encrypted data.  */
 static int
 aead_decode_filter (void *opaque, int control, IOBUF a,
@@ -889,7 +1297,16 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->parallel )
+    {
+      /* The parallel code reads ahead and thus sees the EOF early.  */
+      log_assert (a);
+
+      rc = aead_underflow_parallel (dfx, a, buf, ret_len);
+      if (gpg_err_code (rc) == GPG_ERR_EOF)
+        rc = -1;
+    }
+  else if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
     {
       *ret_len = 0;
       rc = -1;
@@ -2187,6 +2187,257 @@ do_export_revocs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid,
 }
 
 
+/* Parse the header of the OpenPGP packet at BUFFER of LENGTH bytes
+ * as found in a keyblock image.  On success the packet type is
+ * stored at R_PKTTYPE and the total length of the packet including
+ * its header at R_PKTLEN; the body starts R_HDRLEN bytes into
+ * BUFFER.  Returns -1 for a truncated packet or for header forms we
+ * do not expect in a keyblock image, like partial lengths.  */
+static int
+image_packet_header (const byte *buffer, size_t length,
+                     int *r_pkttype, size_t *r_hdrlen, size_t *r_pktlen)
+{
+  const byte *p = buffer;
+  size_t n = length;
+  size_t pktlen, hdrlen;
+  int ctb, pkttype, c;
+
+  if (!n)
+    return -1;
+  ctb = *p++; n--;
+  if (!(ctb & 0x80))
+    return -1;
+
+  if ((ctb & 0x40))  /* New style CTB.  */
+    {
+      pkttype = (ctb & 0x3f);
+      if (!n)
+        return -1;
+      c = *p++; n--;
+      if (c < 192)
+        pktlen = c;
+      else if (c < 224)
+        {
+          if (!n)
+            return -1;
+          pktlen = ((c - 192) << 8) + *p++ + 192;
+          n--;
+        }
+      else if (c == 255)
+        {
+          if (n < 4)
+            return -1;
+          pktlen = buf32_to_size_t (p);
+          p += 4; n -= 4;
+        }
+      else /* Partial length.  */
+        return -1;
+    }
+  else /* Old style CTB.  */
+    {
+      int lenbytes;
+
+      pkttype = ((ctb >> 2) & 0xf);
+      lenbytes = ((ctb & 3) == 3)? 0 : (1 << (ctb & 3));
+      if (!lenbytes || n < lenbytes)
+        return -1;
+      for (pktlen = 0; lenbytes; lenbytes--, n--)
+        pktlen = (pktlen << 8) | *p++;
+    }
+
+  if (pktlen > n)
+    return -1;
+
+  hdrlen = p - buffer;
+  *r_pkttype = pkttype;
+  *r_hdrlen = hdrlen;
+  *r_pktlen = hdrlen + pktlen;
+  return 0;
+}
+
+
+/* Return true if the subpacket area at BUFFER of LENGTH bytes
+ * contains a subpacket which affects the export of the signature or
+ * if it is malformed.  */
+static int
+image_subpkts_need_parse (const byte *buffer, size_t length)
+{
+  size_t n;
+  int type;
+
+  while (length)
+    {
+      n = *buffer++; length--;
+      if (n == 255)
+        {
+          if (length < 4)
+            return 1;
+          n = buf32_to_size_t (buffer);
+          buffer += 4; length -= 4;
+        }
+      else if (n >= 192)
+        {
+          if (!length)
+            return 1;
+          n = ((n - 192) << 8) + *buffer++ + 192;
+          length--;
+        }
+      if (!n || n > length)
+        return 1;
+      type = (*buffer & 0x7f);
+      if (type == SIGSUBPKT_EXPORTABLE || type == SIGSUBPKT_REV_KEY)
+        return 1;
+      buffer += n; length -= n;
+    }
+  return 0;
+}
+
+
+/* Return true if the signature packet body at BUFFER of LENGTH bytes
+ * may be exported verbatim regardless of the export options.  That
+ * is the case for v3 signatures and for v4 and v5 signatures without
+ * an exportable or revocation key subpacket.  */
+static int
+image_sig_exportable_p (const byte *buffer, size_t length)
+{
+  size_t n;
+
+  if (length < 6)
+    return 0;
+  if (buffer[0] == 2 || buffer[0] == 3)
+    return 1;
+  if (buffer[0] != 4 && buffer[0] != 5)
+    return 0;
+
+  buffer += 4; length -= 4;
+  n = buf16_to_uint (buffer);
+  buffer += 2; length -= 2;
+  if (n > length || image_subpkts_need_parse (buffer, n))
+    return 0;
+  buffer += n; length -= n;
+
+  if (length < 2)
+    return 0;
+  n = buf16_to_uint (buffer);
+  buffer += 2; length -= 2;
+  if (n > length || image_subpkts_need_parse (buffer, n))
+    return 0;
+
+  return 1;
+}
+
+
+/* Return true if the keyblock IMAGE of IMAGELEN bytes as returned by
+ * keydb_get_keyblock_image can be exported with OPTIONS by just
+ * stripping the ring trust packets.  We are conservative here and
+ * let the regular code handle everything which needs a decision
+ * based on the parsed packets.  */
+static int
+keyblock_image_exportable_p (const byte *image, size_t imagelen,
+                             unsigned int options)
+{
+  size_t off, hdrlen, pktlen;
+  int pkttype;
+
+  for (off = 0; off < imagelen; off += pktlen)
+    {
+      if (image_packet_header (image + off, imagelen - off,
+                               &pkttype, &hdrlen, &pktlen))
+        return 0;
+
+      if (!off && pkttype != PKT_PUBLIC_KEY)
+        return 0;
+
+      switch (pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+          if (off)
+            return 0;
+          break;
+
+        case PKT_PUBLIC_SUBKEY:
+        case PKT_USER_ID:
+        case PKT_RING_TRUST:
+          break;
+
+        case PKT_ATTRIBUTE:
+          if (!(options & EXPORT_ATTRIBUTES))
+            return 0;
+          break;
+
+        case PKT_SIGNATURE:
+          if (!image_sig_exportable_p (image + off + hdrlen, pktlen - hdrlen))
+            return 0;
+          break;
+
+        default:
+          return 0;
+        }
+    }
+
+  return off > 0;
+}
+
+
+/* Helper for do_export_stream which writes the keyblock IMAGE of
+ * IMAGELEN bytes to OUT without the ring trust packets.  The caller
+ * must have checked the image using keyblock_image_exportable_p.  */
+static gpg_error_t
+do_export_keyblock_image (const byte *image, size_t imagelen, iobuf_t out,
+                          export_stats_t stats, int *any)
+{
+  gpg_error_t err = 0;
+  size_t off, start, hdrlen, pktlen;
+  int pkttype;
+
+  /* Only the primary key is parsed and only for the status line.  */
+  if (is_status_enabled ()
+      && !image_packet_header (image, imagelen, &pkttype, &hdrlen, &pktlen))
+    {
+      struct parse_packet_ctx_s parsectx;
+      PACKET pkt;
+      iobuf_t a;
+
+      a = iobuf_temp_with_content (image, pktlen);
+      init_packet (&pkt);
+      init_parse_packet (&parsectx, a);
+      if (!parse_packet (&parsectx, &pkt) && pkt.pkttype == PKT_PUBLIC_KEY)
+        print_status_exported (pkt.pkt.public_key);
+      free_packet (&pkt, &parsectx);
+      deinit_parse_packet (&parsectx);
+      iobuf_close (a);
+    }
+
+  /* Write runs of packets up to the next ring trust packet with one
+   * call.  */
+  for (start = off = 0; off < imagelen; off += pktlen)
+    {
+      if (image_packet_header (image + off, imagelen - off,
+                               &pkttype, &hdrlen, &pktlen))
+        return gpg_error (GPG_ERR_INV_KEYRING);  /* Checked by caller.  */
+      if (pkttype == PKT_RING_TRUST)
+        {
+          if (off > start
+              && (err = iobuf_write (out, image + start, off - start)))
+            goto leave;
+          start = off + pktlen;
+        }
+    }
+  if (off > start)
+    err = iobuf_write (out, image + start, off - start);
+
+ leave:
+  if (err)
+    log_error ("error writing keyblock: %s\n", gpg_strerror (err));
+  else
+    {
+      stats->exported++;
+      *any = 1;
+    }
+  return err;
+}
+
+
 /* For secret key export we need to setup a decryption context.
  * Returns 0 and the context at r_cipherhd.  */
 static gpg_error_t
@@ -2255,6 +2506,9 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   gcry_cipher_hd_t cipherhd = NULL;
   struct export_stats_s dummystats;
   iobuf_t out_help = NULL;
+  int use_image;
+  const void *image;
+  size_t imagelen;
 
   if (!stats)
     stats = &dummystats;
@@ -2307,6 +2561,14 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   if (secret && (err = get_keywrap_key (ctrl, &cipherhd)))
     goto leave;
 
+  /* Without any filtering the keyblock images stored by the keyboxd
+   * can be written out directly.  */
+  use_image = (!secret && !keyblock_out && !out_help
+               && !(options & (EXPORT_CLEAN | EXPORT_MINIMAL
+                               | EXPORT_REVOCS | EXPORT_BACKUP))
+               && !export_keep_uid && !export_drop_subkey
+               && !export_select_filter);
+
   for (;;)
     {
       u32 keyid[2];
@@ -2318,6 +2580,17 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       if (err)
         break;
 
+      if (use_image && !desc[descindex].exact
+          && !keydb_get_keyblock_image (kdbhd, &image, &imagelen)
+          && keyblock_image_exportable_p (image, imagelen, options))
+        {
+          stats->count++;
+          err = do_export_keyblock_image (image, imagelen, out, stats, any);
+          if (err)
+            break;
+          continue;
+        }
+
       /* Read the keyblock. */
       release_kbnode (keyblock);
       keyblock = NULL;
@@ -87,6 +87,10 @@ struct compress_filter_context_s {
     int algo1hack;
     int new_ctb;
     void (*release)(struct compress_filter_context_s*);
+    /* If not NULL the filter runs in its own thread.  A fatal error is
+       then not handled by the filter; instead the tag for the status
+       line is stored here for the main thread.  */
+    const char **fatal_status;
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
 
@@ -137,6 +141,9 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* The context for parallel AEAD encryption or NULL.  */
+  struct aead_parallel_s *parallel;
+
 } cipher_filter_context_t;
 
 
@@ -183,6 +190,8 @@ gpg_error_t push_compress_filter (iobuf_t out, compress_filter_context_t *zfx,
                                   int algo);
 gpg_error_t push_compress_filter2 (iobuf_t out,compress_filter_context_t *zfx,
                                    int algo, int rel);
+int compress_fatal_error (compress_filter_context_t *zfx, const char *status,
+                          gpg_error_t err);
 
 /*-- cipher.c --*/
 int cipher_filter_cfb (void *opaque, int control,
@@ -25,11 +25,113 @@
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/init.h"
 #include "packet.h"
 #include "../common/iobuf.h"
 #include "options.h"
 
 
+/* Released signature and public key structures are kept in these
+ * lists for reuse.  A keyblock is usually released as a whole right
+ * before the next one is read and thus this saves most of the malloc
+ * and free calls for the packet structures.  The lists are limited to
+ * MAX_UNUSED_OBJS objects each so that the memory of an exceptionally
+ * large keyblock is returned to the system.  */
+#define MAX_UNUSED_OBJS 2048
+
+struct unused_obj_s
+{
+  struct unused_obj_s *next;
+};
+
+static int cleanup_registered;
+static struct unused_obj_s *unused_sigs;
+static unsigned int n_unused_sigs;
+static struct unused_obj_s *unused_pks;
+static unsigned int n_unused_pks;
+
+
+static void
+release_unused_list (struct unused_obj_s **list, unsigned int *count)
+{
+  struct unused_obj_s *next;
+
+  for (; *list; *list = next)
+    {
+      next = (*list)->next;
+      xfree (*list);
+    }
+  *count = 0;
+}
+
+
+static void
+release_unused_objs (void)
+{
+  release_unused_list (&unused_sigs, &n_unused_sigs);
+  release_unused_list (&unused_pks, &n_unused_pks);
+}
+
+
+/* Return a cleared object of SIZE bytes from LIST or allocate a new
+ * one.  */
+static void *
+alloc_obj (struct unused_obj_s **list, unsigned int *count, size_t size)
+{
+  struct unused_obj_s *obj;
+
+  obj = *list;
+  if (!obj)
+    return xmalloc_clear (size);
+  *list = obj->next;
+  --*count;
+  memset (obj, 0, size);
+  return obj;
+}
+
+
+/* Release OBJ by putting it onto LIST.  */
+static void
+free_obj (struct unused_obj_s **list, unsigned int *count, void *obj)
+{
+  struct unused_obj_s *o = obj;
+
+  if (!o)
+    return;
+  if (*count >= MAX_UNUSED_OBJS)
+    {
+      xfree (o);
+      return;
+    }
+  if (!cleanup_registered)
+    {
+      cleanup_registered = 1;
+      register_mem_cleanup_func (release_unused_objs);
+    }
+  o->next = *list;
+  *list = o;
+  ++*count;
+}
+
+
+/* Return a new and cleared signature structure.  It may be released
+ * using free_seckey_enc or xfree.  */
+PKT_signature *
+alloc_signature (void)
+{
+  return alloc_obj (&unused_sigs, &n_unused_sigs, sizeof (PKT_signature));
+}
+
+
+/* Return a new and cleared public key structure.  It may be released
+ * using free_public_key or xfree.  */
+PKT_public_key *
+alloc_public_key (void)
+{
+  return alloc_obj (&unused_pks, &n_unused_pks, sizeof (PKT_public_key));
+}
+
+
 /* This is a wrapper for mpi_copy which handles opaque MPIs with a
  * NULL pointer as opaque data; e.g. gcry_mpi_set_opaque(a, NULL, 0).
  * It seems that at least gcry_mpi_set_opaque_copy does not yet handle
@@ -113,7 +215,7 @@ free_seckey_enc( PKT_signature *sig )
 
   xfree (sig->signers_uid);
 
-  xfree(sig);
+  free_obj (&unused_sigs, &n_unused_sigs, sig);
 }
 
 
@@ -172,7 +274,7 @@ free_public_key (PKT_public_key *pk)
   if (pk)
     {
       release_public_key_parts (pk);
-      xfree(pk);
+      free_obj (&unused_pks, &n_unused_pks, pk);
     }
 }
 
@@ -226,7 +328,7 @@ copy_public_key_basics (PKT_public_key *d, PKT_public_key *s)
   int n, i;
 
   if (!d)
-    d = xmalloc (sizeof *d);
+    d = alloc_public_key ();
   memcpy (d, s, sizeof *d);
   d->seckey_info = NULL;
   d->user_id = NULL;
@@ -286,7 +388,7 @@ copy_signature( PKT_signature *d, PKT_signature *s )
     int n, i;
 
     if( !d )
-	d = xmalloc(sizeof *d);
+	d = alloc_signature ();
     memcpy( d, s, sizeof *d );
     n = pubkey_get_nsig( s->pubkey_algo );
     if( !n )
@@ -563,6 +665,14 @@ cmp_signatures( PKT_signature *a, PKT_signature *b )
     n = pubkey_get_nsig( a->pubkey_algo );
     if( !n )
 	return -1; /* can't compare due to unknown algorithm */
+    if (a->flags.lazy_data && b->flags.lazy_data)
+      {
+        /* The raw MPIs are in canonical form and thus we can compare
+         * them without parsing.  */
+        return gcry_mpi_cmp (a->data[0], b->data[0])? -1 : 0;
+      }
+    decode_sig_data (a);
+    decode_sig_data (b);
     for(i=0; i < n; i++ ) {
 	if( mpi_cmp( a->data[i] , b->data[i] ) )
 	    return -1;
@@ -125,15 +125,33 @@ typedef struct keyid_list
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache is a hash table indexed by the key ID with an
+ * additional doubly linked list in LRU order.  The head of that list
+ * is the most recently used entry.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;      /* Next in the hash bucket.  */
+  struct pk_cache_entry *lru_prev;  /* Previous (more recently used). */
+  struct pk_cache_entry *lru_next;  /* Next (less recently used).  */
   u32 keyid[2];
+  byte fprlen;
+  byte fpr[MAX_FINGERPRINT_LEN];
   PKT_public_key *pk;
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
-static int pk_cache_entries;	/* Number of entries in pk cache.  */
+static pk_cache_entry_t *pk_cache;  /* The hash table.  */
+static unsigned int pk_cache_size;  /* Number of buckets.  */
+static unsigned int pk_cache_max;   /* Max. number of entries.  */
+static pk_cache_entry_t pk_cache_lru_head;
+static pk_cache_entry_t pk_cache_lru_tail;
+static unsigned int pk_cache_entries;	/* Number of entries in pk cache.  */
 static int pk_cache_disabled;
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long added;
+  unsigned long evicted;
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
@@ -168,24 +186,139 @@ print_stats ()
 #endif
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Unlink CE from the LRU list.  */
+static void
+pk_cache_lru_unlink (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_lru_head = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru_tail = ce->lru_prev;
+  ce->lru_prev = ce->lru_next = NULL;
+}
+
+
+/* Put CE at the head of the LRU list.  */
+static void
+pk_cache_lru_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_lru_head;
+  if (pk_cache_lru_head)
+    pk_cache_lru_head->lru_prev = ce;
+  else
+    pk_cache_lru_tail = ce;
+  pk_cache_lru_head = ce;
+}
+
+
+/* Allocate the hash table of the public key cache.  Returns false if
+ * the cache can't be used.  */
+static int
+pk_cache_init (void)
+{
+  unsigned int size;
+
+  if (pk_cache)
+    return 1;
+  if (pk_cache_disabled)
+    return 0;
+
+  pk_cache_max = opt.pk_cache_size? opt.pk_cache_size : MAX_PK_CACHE_ENTRIES;
+  if (pk_cache_max < 16)
+    pk_cache_max = 16;  /* We need a few entries for key creation.  */
+
+  /* Use about two entries per bucket.  */
+  for (size = 64; size < pk_cache_max / 2 && size < (1 << 20); size <<= 1)
+    ;
+  pk_cache = xtrycalloc (size, sizeof *pk_cache);
+  if (!pk_cache)
+    {
+      log_error ("can't allocate the public key cache: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      pk_cache_disabled = 1;
+      return 0;
+    }
+  pk_cache_size = size;
+  return 1;
+}
+
+
+/* Return the cache entry for KEYID or NULL if not cached.  A found
+ * entry is moved to the head of the LRU list.  */
+static pk_cache_entry_t
+pk_cache_lookup (u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache)
+    return NULL;
+
+  for (ce = pk_cache[keyid[1] % pk_cache_size]; ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      {
+        if (ce != pk_cache_lru_head)
+          {
+            pk_cache_lru_unlink (ce);
+            pk_cache_lru_push (ce);
+          }
+        return ce;
+      }
+
+  return NULL;
+}
+
+
+/* Remove the least recently used entry from the cache.  */
+static void
+pk_cache_evict (void)
+{
+  pk_cache_entry_t ce = pk_cache_lru_tail;
+  pk_cache_entry_t *cep;
+
+  if (!ce)
+    return;
+
+  pk_cache_lru_unlink (ce);
+  for (cep = &pk_cache[ce->keyid[1] % pk_cache_size]; *cep; cep = &(*cep)->next)
+    if (*cep == ce)
+      {
+        *cep = ce->next;
+        break;
+      }
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+  pk_cache_stats.evicted++;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
  * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
  * from the public key (e.g., unsupported algorithm), or a key with
- * the key id is already in the cache.
+ * the key id is already in the cache.  If the cache is full, the
+ * least recently used entry is removed.
  *
  * The public key packet is copied into the cache using
  * copy_public_key.  Thus, any secret parts are not copied, for
  * instance.
  *
- * This cache is filled by get_pubkey and is read by get_pubkey and
- * get_pubkey_fast.  */
+ * This cache is filled by get_pubkey and get_pubkey_for_sig and is
+ * read by these functions and get_pubkey_fast.  */
 void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
+  pk_cache_entry_t ce;
   u32 keyid[2];
+  size_t fprlen;
 
   if (pk_cache_disabled)
     return;
@@ -205,43 +338,46 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
-    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-      {
-	if (DBG_CACHE)
-	  log_debug ("cache_public_key: already in cache\n");
-	return;
-      }
+  if (!pk_cache_init ())
+    return;
 
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
+  if (pk_cache_lookup (keyid))
     {
-      int n;
-
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
+      if (DBG_CACHE)
+        log_debug ("cache_public_key: already in cache\n");
+      return;
     }
-  pk_cache_entries++;
-  ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
+
+  while (pk_cache_entries >= pk_cache_max)
+    pk_cache_evict ();
+
+  ce = xtrycalloc (1, sizeof *ce);
+  if (!ce)
+    return;  /* Not cached - no problem.  */
   ce->pk = copy_public_key (NULL, pk);
   ce->keyid[0] = keyid[0];
   ce->keyid[1] = keyid[1];
+  fingerprint_from_pk (pk, ce->fpr, &fprlen);
+  ce->fprlen = fprlen;
+  ce->next = pk_cache[keyid[1] % pk_cache_size];
+  pk_cache[keyid[1] % pk_cache_size] = ce;
+  pk_cache_lru_push (ce);
+  pk_cache_entries++;
+  pk_cache_stats.added++;
+#endif
+}
+
+
+/* Dump the statistics of the public key cache.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk_cache: entries=%u/%u buckets=%u"
+            " hits=%lu misses=%lu added=%lu evicted=%lu\n",
+            pk_cache_entries, pk_cache_max, pk_cache_size,
+            pk_cache_stats.hits, pk_cache_stats.misses,
+            pk_cache_stats.added, pk_cache_stats.evicted);
 #endif
 }
 
@@ -269,19 +405,12 @@ void
 getkey_disable_caches (void)
 {
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  while (pk_cache_entries)
+    pk_cache_evict ();
+  xfree (pk_cache);
+  pk_cache = NULL;
+  pk_cache_size = 0;
+  pk_cache_disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
@@ -332,8 +461,30 @@ get_pubkey_for_sig (ctrl_t ctrl, PKT_public_key *pk, PKT_signature *sig,
 
   /* First try the ISSUER_FPR info.  */
   fpr = issuer_fpr_raw (sig, &fprlen);
+#if MAX_PK_CACHE_ENTRIES
+  if (fpr && (fprlen == 20 || fprlen == 32) && pk_cache)
+    {
+      pk_cache_entry_t ce;
+      u32 keyid[2];
+
+      /* The key ID is part of the fingerprint.  */
+      keyid[0] = buf32_to_u32 (fprlen == 32? fpr : fpr + 12);
+      keyid[1] = buf32_to_u32 (fprlen == 32? fpr + 4 : fpr + 16);
+      ce = pk_cache_lookup (keyid);
+      if (ce && ce->fprlen == fprlen && !memcmp (ce->fpr, fpr, fprlen))
+        {
+          pk_cache_stats.hits++;
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
+      pk_cache_stats.misses++;
+    }
+#endif
   if (fpr && !get_pubkey_byfpr (ctrl, pk, NULL, fpr, fprlen))
-    return 0;
+    {
+      cache_public_key (pk);
+      return 0;
+    }
 
   /* Fallback to use the ISSUER_KEYID.  */
   return get_pubkey (ctrl, pk, sig->keyid);
@@ -374,16 +525,17 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
          NULL as it does not guarantee that the user IDs are
          cached. */
       pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    /* XXX: We don't check PK->REQ_USAGE here, but if we don't
-	       read from the cache, we do check it!  */
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
+
+      ce = pk_cache_lookup (keyid);
+      if (ce)
+        {
+          /* XXX: We don't check PK->REQ_USAGE here, but if we don't
+             read from the cache, we do check it!  */
+          pk_cache_stats.hits++;
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
+      pk_cache_stats.misses++;
     }
 #endif
   /* More init stuff.  */
@@ -511,18 +663,18 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
     /* Try to get it from the cache */
     pk_cache_entry_t ce;
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    ce = pk_cache_lookup (keyid);
+    if (ce
+        /* Only consider primary keys.  */
+        && ce->pk->keyid[0] == ce->pk->main_keyid[0]
+        && ce->pk->keyid[1] == ce->pk->main_keyid[1])
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        pk_cache_stats.hits++;
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
+    pk_cache_stats.misses++;
   }
 #endif
 
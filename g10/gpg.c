@@ -107,6 +107,7 @@ enum cmd_and_opt_values
     oBatch	  = 500,
     oMaxOutput,
     oInputSizeHint,
+    oMmapInput,
     oChunkSize,
     oSigNotation,
     oCertNotation,
@@ -388,6 +389,7 @@ enum cmd_and_opt_values
     oFixedListMode,
     oLegacyListMode,
     oNoSigCache,
+    oPkCacheSize,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
     oPreservePermissions,
@@ -735,6 +737,7 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_s_n (oMultifile, "multifile", "@"),
   ARGPARSE_s_s (oInputSizeHint, "input-size-hint", "@"),
+  ARGPARSE_s_n (oMmapInput, "mmap-input", "@"),
   ARGPARSE_s_n (oUtf8Strings,      "utf8-strings", "@"),
   ARGPARSE_s_n (oNoUtf8Strings, "no-utf8-strings", "@"),
   ARGPARSE_p_u (oSetFilesize, "set-filesize", "@"),
@@ -897,6 +900,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oVerifyOptions, "verify-options", "@"),
   ARGPARSE_s_n (oNoRandomSeedFile,  "no-random-seed-file", "@"),
   ARGPARSE_s_n (oNoSigCache,         "no-sig-cache", "@"),
+  ARGPARSE_s_u (oPkCacheSize,        "pk-cache-size", "@"),
   ARGPARSE_s_n (oIgnoreTimeConflict, "ignore-time-conflict", "@"),
   ARGPARSE_s_n (oIgnoreValidFrom,    "ignore-valid-from", "@"),
   ARGPARSE_s_n (oIgnoreCrcError, "ignore-crc-error", "@"),
@@ -1042,6 +1046,7 @@ static struct debug_flags_s debug_flags [] =
     { DBG_LOOKUP_VALUE , "lookup"  },
     { DBG_EXTPROG_VALUE, "extprog" },
     { DBG_KEYDB_VALUE,   "keydb"   },
+    { DBG_IOSTAT_VALUE,  "iostat"  },
     { 0, NULL }
   };
 
@@ -1397,6 +1402,8 @@ set_debug (const char *level)
     gcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1);
   if ((opt.debug & DBG_IOBUF_VALUE))
     iobuf_debug_mode = 1;
+  if ((opt.debug & DBG_IOSTAT_VALUE))
+    iobuf_set_stats (1);
   gcry_control (GCRYCTL_SET_VERBOSITY, (int)opt.verbose);
 
   if (opt.debug)
@@ -2799,6 +2806,10 @@ main (int argc, char **argv)
             opt.input_size_hint = string_to_u64 (pargs.r.ret_str);
             break;
 
+          case oMmapInput:
+            iobuf_set_mmap (1);
+            break;
+
           case oChunkSize:
             opt.chunk_size = pargs.r.ret_int;
             break;
@@ -3546,6 +3557,7 @@ main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oPkCacheSize: opt.pk_cache_size = pargs.r.ret_ulong; break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
 	  case oAllowFreeformUID: opt.allow_freeform_uid = 1; break;
@@ -5619,9 +5631,12 @@ g10_exit( int rc )
       keydb_dump_stats ();
       sig_check_dump_stats ();
       objcache_dump_stats ();
+      getkey_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
+  else if (DBG_CACHE)
+    getkey_dump_stats ();
   if (opt.debug)
     gcry_control (GCRYCTL_DUMP_SECMEM_STATS );
 
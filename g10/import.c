@@ -42,6 +42,8 @@
 #include "../common/mbox-util.h"
 #include "key-check.h"
 #include "key-clean.h"
+#include "pkglue.h"
+#include "workqueue.h"
 
 
 struct import_stats_s
@@ -79,6 +81,45 @@ struct import_stats_s
 #define NODE_TRANSFER_SECKEY 16
 
 
+/* The maximum number of worker threads used to check the
+ * self-signatures of imported keys.  */
+#define IMPORT_MAX_WORKERS 16
+
+/* The number of keyblocks per worker read ahead of the import.  */
+#define IMPORT_JOBS_PER_WORKER 4
+
+/* The state of a keyblock read ahead of the import.  */
+enum import_job_state
+  {
+   IMPORT_JOB_QUEUED,   /* Queued for or being checked by a worker.  */
+   IMPORT_JOB_DONE      /* Ready to be imported.  */
+  };
+
+/* A keyblock read ahead of the import along with the results of
+ * read_block.  */
+struct import_job_s
+{
+  enum import_job_state state;
+  int rc;
+  int v3keys;
+  kbnode_t keyblock;
+};
+
+/* The context for the pipelined import.  The jobs are used as a ring
+ * buffer: READIDX is the next job to be imported and the NPENDING
+ * jobs starting there have been read.  */
+struct import_parallel_s
+{
+  workqueue_t wq;
+  int eof;              /* read_block won't return more keyblocks.  */
+  int readidx;
+  int npending;
+  int njobs;
+  struct import_job_s jobs[1];
+};
+typedef struct import_parallel_s *import_parallel_t;
+
+
 /* An object and a global instance to store selectors created from
  * --import-filter keep-uid=EXPR.
  * --import-filter drop-sig=EXPR.
@@ -104,6 +145,11 @@ static int import (ctrl_t ctrl,
                    int origin, const char *url);
 static int read_block (IOBUF a, unsigned int options,
                        PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys);
+static import_parallel_t start_parallel (unsigned int options);
+static void stop_parallel (import_parallel_t par);
+static int read_next_block (import_parallel_t par, IOBUF a,
+                            unsigned int options, PACKET **pending_pkt,
+                            kbnode_t *ret_root, int *r_v3keys);
 static void revocation_present (ctrl_t ctrl, kbnode_t keyblock);
 static gpg_error_t import_one (ctrl_t ctrl,
                        kbnode_t keyblock,
@@ -531,6 +577,26 @@ import_included_key_block (ctrl_t ctrl, kbnode_t keyblock)
  *
  *  Key revocation certificates have special handling.
  */
+/* Called for a key which has been queued for storing in bulk import
+ * mode but could not be stored by the keyboxd.  The key has already
+ * been reported as imported; correct the statistics.  */
+static void
+import_store_failed_cb (void *opaque, const byte *fpr, size_t fprlen,
+                        gpg_error_t err)
+{
+  import_stats_t stats = opaque;
+  char hexfpr[2*MAX_FINGERPRINT_LEN+1];
+
+  bin2hex (fpr, fprlen, hexfpr);
+  log_error (_("key %s: error storing key: %s\n"),
+             hexfpr, gpg_strerror (err));
+  write_status_printf (STATUS_IMPORT_PROBLEM, "4 %s", hexfpr);
+  if (stats->imported)
+    stats->imported--;
+  stats->not_imported++;
+}
+
+
 static gpg_error_t
 import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 		      import_stats_t stats_handle,
@@ -541,11 +607,14 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 {
   int i;
   gpg_error_t err = 0;
+  gpg_error_t rc;
   struct import_stats_s *stats = stats_handle;
 
   if (!stats)
     stats = import_new_stats_handle ();
 
+  keydb_set_store_failed_cb (import_store_failed_cb, stats);
+
   if (inp)
     {
       err = import (ctrl, inp, "[stream]", stats, fpr, fpr_len, options,
@@ -587,6 +656,16 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 	}
     }
 
+  /* Store the keys queued in bulk import mode so that the
+   * statistics are correct.  */
+  if ((rc = keydb_flush_queued_keys (ctrl)))
+    {
+      log_error ("error storing queued keys: %s\n", gpg_strerror (rc));
+      if (!err)
+        err = rc;
+    }
+  keydb_set_store_failed_cb (NULL, NULL);
+
   if (!stats_handle)
     {
       if ((options & (IMPORT_SHOW | IMPORT_DRY_RUN))
@@ -659,6 +738,7 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
   kbnode_t secattic = NULL;  /* Kludge for PGP desktop percularity */
   int rc = 0;
   int v3keys;
+  import_parallel_t par;
 
   getkey_disable_caches ();
 
@@ -672,7 +752,10 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
       release_armor_context (afx);
     }
 
-  while (!(rc = read_block (inp, options, &pending_pkt, &keyblock, &v3keys)))
+  par = start_parallel (options);
+
+  while (!(rc = read_next_block (par, inp, options,
+                                 &pending_pkt, &keyblock, &v3keys)))
     {
       stats->v3keys += v3keys;
       if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
@@ -764,6 +847,7 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
           break;
         }
     }
+  stop_parallel (par);
   stats->v3keys += v3keys;
   if (rc == -1)
     rc = 0;
@@ -1164,6 +1248,186 @@ read_block( IOBUF a, unsigned int options,
 }
 
 
+/* Verify all self-signatures of KEYBLOCK to cache the results in the
+ * signature packets.  chk_self_sigs will then find them in the cache
+ * and does not need to verify them again.  This runs in the import
+ * workers and thus may not use the CTRL object; this also means that
+ * the keyboxd's signature cache is not used here.  */
+static void
+cache_self_sigs (kbnode_t keyblock)
+{
+  u32 keyid[2];
+  kbnode_t n;
+  PKT_signature *sig;
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, keyid);
+  for (n = keyblock; (n = find_next_kbnode (n, PKT_SIGNATURE)); )
+    {
+      sig = n->pkt->pkt.signature;
+      if (keyid[0] != sig->keyid[0] || keyid[1] != sig->keyid[1])
+        continue;
+      if (!sig->flags.checked)
+        check_key_signature (NULL, keyblock, n, NULL);
+    }
+}
+
+
+/* The job function of an import worker: Check the self-signatures
+ * of the job's keyblock.  */
+static void
+import_job_fnc (void *worker_data, void *arg)
+{
+  struct import_job_s *job = arg;
+
+  (void)worker_data;
+  cache_self_sigs (job->keyblock);
+}
+
+
+/* Called by an import worker with the lock held after a job.  */
+static void
+import_job_done (void *arg)
+{
+  struct import_job_s *job = arg;
+
+  job->state = IMPORT_JOB_DONE;
+}
+
+
+/* Setup a pipelined import if requested and worthwhile.  Returns NULL
+ * if the serial code shall be used.  */
+static import_parallel_t
+start_parallel (unsigned int options)
+{
+  import_parallel_t par;
+  gpg_error_t err;
+  int nworkers, njobs;
+  int i;
+
+  /* The pipeline only pre-fills the signature cache of the packets.
+   * Repairing the PKS subkey bug changes the keyblock before the
+   * self-signatures are checked.  */
+  if (opt.no_sig_cache || opt.interactive
+      || (options & IMPORT_REPAIR_PKS_SUBKEY_BUG))
+    return NULL;
+  nworkers = workqueue_max_workers (IMPORT_MAX_WORKERS);
+  if (!nworkers)
+    return NULL;
+  njobs = IMPORT_JOBS_PER_WORKER * nworkers;
+
+  par = xtrycalloc (1, sizeof *par + (njobs - 1) * sizeof par->jobs[0]);
+  if (!par)
+    return NULL;
+  par->njobs = njobs;
+  err = workqueue_new (&par->wq, njobs, import_job_fnc, import_job_done);
+  if (err)
+    {
+      xfree (par);
+      return NULL;
+    }
+
+  for (i = 0; i < nworkers; i++)
+    {
+      err = workqueue_add_worker (par->wq, NULL);
+      if (err)
+        {
+          log_info ("error spawning import worker: %s\n",
+                    gpg_strerror (err));
+          break;
+        }
+    }
+  if (!workqueue_nworkers (par->wq))
+    {
+      workqueue_release (par->wq);
+      xfree (par);
+      return NULL;
+    }
+
+  pk_verify_set_unprotected (1);
+  if (opt.verbose)
+    log_info ("using %d threads to check self-signatures\n",
+              workqueue_nworkers (par->wq));
+  return par;
+}
+
+
+/* Terminate the workers and release PAR.  Keyblocks read ahead but
+ * not yet imported are released.  */
+static void
+stop_parallel (import_parallel_t par)
+{
+  int i;
+
+  if (!par)
+    return;
+
+  workqueue_release (par->wq);
+  pk_verify_set_unprotected (0);
+
+  for (i = 0; i < par->npending; i++)
+    release_kbnode (par->jobs[(par->readidx + i) % par->njobs].keyblock);
+  xfree (par);
+}
+
+
+/* Return the next keyblock from A.  This is a wrapper around
+ * read_block which, if PAR is not NULL, reads ahead and has the
+ * self-signatures of the keyblocks checked by the workers while the
+ * caller imports the previous keyblocks.  The keyblocks are returned
+ * in the order they have been read.  */
+static int
+read_next_block (import_parallel_t par, IOBUF a, unsigned int options,
+                 PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
+{
+  struct import_job_s *job;
+  kbnode_t keyblock;
+  int v3keys;
+  int rc;
+
+  if (!par)
+    return read_block (a, options, pending_pkt, ret_root, r_v3keys);
+
+  /* Fill up the queue.  */
+  while (!par->eof && par->npending < par->njobs)
+    {
+      keyblock = NULL;
+      rc = read_block (a, options, pending_pkt, &keyblock, &v3keys);
+      job = par->jobs + (par->readidx + par->npending) % par->njobs;
+      job->rc = rc;
+      job->v3keys = v3keys;
+      job->keyblock = rc? NULL : keyblock;
+      if (rc)
+        par->eof = 1;
+
+      workqueue_lock (par->wq);
+      par->npending++;
+      if (!rc && keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+        {
+          job->state = IMPORT_JOB_QUEUED;
+          workqueue_put (par->wq, job);
+        }
+      else
+        job->state = IMPORT_JOB_DONE;
+      workqueue_unlock (par->wq);
+    }
+
+  /* Return the oldest one.  */
+  workqueue_lock (par->wq);
+  log_assert (par->npending);
+  job = par->jobs + par->readidx;
+  while (job->state != IMPORT_JOB_DONE)
+    workqueue_wait (par->wq);
+  par->readidx = (par->readidx + 1) % par->njobs;
+  par->npending--;
+  workqueue_unlock (par->wq);
+
+  *ret_root = job->keyblock;
+  *r_v3keys = job->v3keys;
+  job->keyblock = NULL;
+  return job->rc;
+}
+
+
 /* Walk through the subkeys on a pk to find if we have the PKS
    disease: multiple subkeys with their binding sigs stripped, and the
    sig for the first subkey placed after the last subkey.  That is,
@@ -2287,7 +2551,7 @@ import_one_real (ctrl_t ctrl,
 
           clear_ownertrusts (ctrl, pk);
           if (non_self_or_utk)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
         }
 
       /* Release the handle and thus unlock the keyring asap.  */
@@ -2380,7 +2644,7 @@ import_one_real (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (err));
           else if (non_self_or_utk)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
 
           /* Release the handle and thus unlock the keyring asap.  */
           keydb_release (hd);
@@ -3697,7 +3961,7 @@ import_revoke_cert (ctrl_t ctrl, kbnode_t node, unsigned int options,
       if (get_ownertrust (ctrl, pk) == TRUST_ULTIMATE)
         clear_ownertrusts (ctrl, pk);
 
-      revalidation_mark (ctrl);
+      revalidation_mark_key (ctrl, pk);
     }
   stats->n_revoc++;
 
@@ -89,6 +89,9 @@ sig_comparison (const void *av, const void *bv)
   if (ndataa != ndatab)
     return (ndataa < ndatab)? -1 : 1;
 
+  decode_sig_data (an->pkt->pkt.signature);
+  decode_sig_data (bn->pkt->pkt.signature);
+
   for (i = 0; i < ndataa; i ++)
     {
       int c = gcry_mpi_cmp (a->data[i], b->data[i]);
@@ -583,6 +586,7 @@ key_check_all_keysigs (ctrl_t ctrl, int mode, kbnode_t kb,
             {
               int i;
 
+              decode_sig_data (sig);
               for (i = 0; i < pubkey_get_nsig (sig->pubkey_algo); i ++)
                 {
                   char buffer[1024];
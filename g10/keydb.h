@@ -188,12 +188,29 @@ gpg_error_t keydb_lock (KEYDB_HANDLE hd);
 /* Return the keyblock last found by keydb_search.  */
 gpg_error_t keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb);
 
+/* Return the raw image of the keyblock last found by keydb_search.  */
+gpg_error_t keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                                      const void **r_image,
+                                      size_t *r_imagelen);
+
 /* Update the keyblock KB.  */
 gpg_error_t keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb);
 
 /* Insert a keyblock into one of the storage system.  */
 gpg_error_t keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
 
+/* The type of the function called for a queued key which could not
+ * be stored.  */
+typedef void (*keydb_store_failed_cb_t) (void *opaque,
+                                         const byte *fpr, size_t fprlen,
+                                         gpg_error_t err);
+
+/* Set a function to be called for queued keys which can't be stored.  */
+void keydb_set_store_failed_cb (keydb_store_failed_cb_t cb, void *cb_arg);
+
+/* Store all keys queued during a bulk import.  */
+gpg_error_t keydb_flush_queued_keys (ctrl_t ctrl);
+
 /* Delete the currently selected keyblock.  */
 gpg_error_t keydb_delete_keyblock (KEYDB_HANDLE hd);
 
@@ -204,6 +221,14 @@ gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
                           size_t ndesc, size_t *descindex);
 
+/* Look up a signature verification result in the keyboxd's cache.  */
+gpg_error_t keydb_sigcache_get (ctrl_t ctrl, const byte *ubid,
+                                const byte *hash, int *r_valid);
+
+/* Queue a signature verification result for the keyboxd's cache.  */
+gpg_error_t keydb_sigcache_put (ctrl_t ctrl, const byte *ubid,
+                                const byte *hash, int valid);
+
 
 
 /*-- keydb.c --*/
@@ -329,6 +354,9 @@ void cache_public_key( PKT_public_key *pk );
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
+/* Print statistics of the public key cache.  */
+void getkey_dump_stats (void);
+
 /* Return the public key used for signature SIG and store it at PK.  */
 gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
                                 PKT_public_key *pk, PKT_signature *sig,
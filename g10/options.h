@@ -241,6 +241,7 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  unsigned int pk_cache_size;  /* Max. # of entries in the pk cache.  */
   int no_auto_check_trustdb;
   int preserve_permissions;
   int no_homedir_creation;
@@ -369,6 +370,7 @@ struct {
 #define DBG_LOOKUP_VALUE  8192	/* debug the key lookup */
 #define DBG_EXTPROG_VALUE 16384 /* debug external program calls */
 #define DBG_KEYDB_VALUE   32768 /* debug keydb and keyboxd searches. */
+#define DBG_IOSTAT_VALUE  65536 /* show iobuf filter statistics.  */
 
 /* Tests for the debugging flags.  */
 #define DBG_PACKET (opt.debug & DBG_PACKET_VALUE)
@@ -392,7 +394,9 @@ EXTERN_UNLESS_MAIN_MODULE int memory_debug_mode;
 EXTERN_UNLESS_MAIN_MODULE int memory_stat_debug_mode;
 
 /* Compatibility flags */
-#define COMPAT_PARALLELIZED   1  /* Use threaded hashing for signatures.  */
+#define COMPAT_PARALLELIZED   1  /* Use threaded hashing for signatures,
+                                    parallel AEAD en-/decryption and
+                                    threaded compression.  */
 #define COMPAT_T7014_OLD      2  /* Use initial T7014 test data.  */
 
 
@@ -230,6 +230,7 @@ typedef struct
     unsigned pref_ks:1;     /* At least one preferred keyserver is present */
     unsigned key_block:1;   /* A key block subpacket is present.  */
     unsigned expired:1;
+    unsigned lazy_data:1;   /* DATA[0] holds the raw MPIs.  */
   } flags;
   /* The key that allegedly generated this signature.  (Directly
      serialized in v3 sigs; for v4 sigs, this must be explicitly added
@@ -786,6 +787,11 @@ int skip_some_packets (iobuf_t inp, unsigned int n);
 int parse_signature( iobuf_t inp, int pkttype, unsigned long pktlen,
 		     PKT_signature *sig );
 
+/* The MPIs of a signature may be kept in their raw form by
+ * parse_signature.  This function parses them and must be called
+ * before SIG->DATA is accessed.  */
+gpg_error_t decode_sig_data (PKT_signature *sig);
+
 /* Given a signature packet, either:
  *
  *   - test whether there are any subpackets with the critical bit set
@@ -903,6 +909,9 @@ void release_pubkey_enc_parts (PKT_pubkey_enc *enc);
 void free_pubkey_enc( PKT_pubkey_enc *enc );
 void copy_pubkey_enc_parts (PKT_pubkey_enc *dst, PKT_pubkey_enc *src);
 
+PKT_signature *alloc_signature (void);
+PKT_public_key *alloc_public_key (void);
+
 void free_seckey_enc( PKT_signature *enc );
 
 void release_public_key_parts( PKT_public_key *pk );
@@ -986,7 +986,7 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
     case PKT_PUBLIC_SUBKEY:
     case PKT_SECRET_KEY:
     case PKT_SECRET_SUBKEY:
-      pkt->pkt.public_key = xmalloc_clear (sizeof *pkt->pkt.public_key);
+      pkt->pkt.public_key = alloc_public_key ();
       rc = parse_key (inp, pkttype, pktlen, hdr, hdrlen, pkt);
       break;
     case PKT_SYMKEY_ENC:
@@ -996,7 +996,7 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
       rc = parse_pubkeyenc (inp, pkttype, pktlen, pkt);
       break;
     case PKT_SIGNATURE:
-      pkt->pkt.signature = xmalloc_clear (sizeof *pkt->pkt.signature);
+      pkt->pkt.signature = alloc_signature ();
       rc = parse_signature (inp, pkttype, pktlen, pkt->pkt.signature);
       break;
     case PKT_ONEPASS_SIG:
@@ -2212,6 +2212,113 @@ parse_revkeys (PKT_signature * sig)
 }
 
 
+/* Read the NDATA MPIs of signature SIG from INP into SIG->DATA.
+ * *PKTLEN gives the remaining length of the packet and is updated.
+ * If LISTIT is set the MPIs are also printed for --list-packets.  */
+static int
+read_sig_data (iobuf_t inp, PKT_signature *sig, int ndata,
+               unsigned long *pktlen, int listit)
+{
+  int rc = 0;
+  unsigned int n;
+  int i;
+
+  for (i = 0; i < ndata; i++)
+    {
+      n = *pktlen;
+      if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
+          || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
+        sig->data[i] = sos_read (inp, &n, 0);
+      else
+        sig->data[i] = mpi_read (inp, &n, 0);
+      *pktlen -= n;
+      if (listit)
+        {
+          es_fprintf (listfp, "\tdata: ");
+          mpi_print (listfp, sig->data[i], mpi_print_mode);
+          es_putc ('\n', listfp);
+        }
+      if (!sig->data[i])
+        rc = GPG_ERR_INV_PACKET;
+    }
+  return rc;
+}
+
+
+/* Return the length of the NDATA MPIs of a signature with PUBKEY_ALGO
+ * at BUFFER of LENGTH.  0 is returned if they are not well-formed or
+ * not in the canonical form build_packet would write them; such MPIs
+ * can't be kept in their raw form.  */
+static size_t
+lazy_sig_data_len (int pubkey_algo, int ndata,
+                   const byte *buffer, size_t length)
+{
+  int sos = (pubkey_algo == PUBKEY_ALGO_ECDSA
+             || pubkey_algo == PUBKEY_ALGO_EDDSA);
+  unsigned int nbits, nbytes, topbits;
+  size_t off = 0;
+  int i;
+
+  for (i = 0; i < ndata; i++)
+    {
+      if (length - off < 2)
+        return 0;
+      nbits = (buffer[off] << 8) | buffer[off+1];
+      off += 2;
+      if (nbits > MAX_EXTERN_MPI_BITS)
+        return 0;
+      nbytes = (nbits + 7) / 8;
+      if (!nbytes)
+        {
+          if (sos)
+            return 0;
+          continue;
+        }
+      if (length - off < nbytes)
+        return 0;
+      if (buffer[off])
+        {
+          for (topbits = 8; !(buffer[off] & (1 << (topbits - 1))); topbits--)
+            ;
+          if (nbits != (nbytes - 1) * 8 + topbits)
+            return 0;
+        }
+      else if (!sos)
+        return 0;
+      off += nbytes;
+    }
+  return off;
+}
+
+
+/* Parse the MPIs of SIG if they have been kept in their raw form by
+ * parse_signature.  This needs to be called before SIG->DATA is
+ * used.  */
+gpg_error_t
+decode_sig_data (PKT_signature *sig)
+{
+  gcry_mpi_t raw;
+  const void *p;
+  unsigned int nbits;
+  unsigned long len;
+  iobuf_t a;
+  int rc;
+
+  if (!sig->flags.lazy_data)
+    return 0;
+
+  raw = sig->data[0];
+  sig->data[0] = NULL;
+  sig->flags.lazy_data = 0;
+  p = gcry_mpi_get_opaque (raw, &nbits);
+  len = nbits / 8;
+  a = iobuf_temp_with_content (p, len);
+  rc = read_sig_data (a, sig, pubkey_get_nsig (sig->pubkey_algo), &len, 0);
+  iobuf_close (a);
+  gcry_mpi_release (raw);
+  return rc? gpg_error (rc) : 0;
+}
+
 int
 parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 		 PKT_signature * sig)
@@ -2220,7 +2327,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
   unsigned n;
   int is_v4or5 = 0;
   int rc = 0;
-  int i, ndata;
+  int ndata;
 
   if (pktlen < 16)
     {
@@ -2503,27 +2610,43 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	  pktlen = 0;
 	}
     }
-  else
+  else if (!list_mode && pktlen
+           && pktlen <= ndata * (2 + MAX_EXTERN_MPI_BITS / 8))
     {
-      for (i = 0; i < ndata; i++)
-	{
-	  n = pktlen;
-          if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
-              || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
-            sig->data[i] = sos_read (inp, &n, 0);
+      /* Keep the MPIs in their raw form; most signatures in a
+       * keyblock are never verified.  See decode_sig_data.  */
+      byte *tmpp = xmalloc (pktlen);
+      int nread = iobuf_read (inp, tmpp, pktlen);
+
+      if (nread <= 0)
+        {
+          xfree (tmpp);
+          rc = read_sig_data (inp, sig, ndata, &pktlen, 0);
+        }
+      else
+        {
+          pktlen -= nread;
+          n = lazy_sig_data_len (sig->pubkey_algo, ndata, tmpp, nread);
+          if (n)
+            {
+              sig->data[0] = gcry_mpi_set_opaque (NULL, tmpp, n * 8);
+              sig->flags.lazy_data = 1;
+            }
           else
-            sig->data[i] = mpi_read (inp, &n, 0);
-	  pktlen -= n;
-	  if (list_mode)
-	    {
-	      es_fprintf (listfp, "\tdata: ");
-	      mpi_print (listfp, sig->data[i], mpi_print_mode);
-	      es_putc ('\n', listfp);
-	    }
-	  if (!sig->data[i])
-	    rc = GPG_ERR_INV_PACKET;
-	}
+            {
+              /* Not in canonical form - parse it now so that the
+               * usual diagnostics are printed.  */
+              iobuf_t a = iobuf_temp_with_content (tmpp, nread);
+              unsigned long dummy = nread;
+
+              rc = read_sig_data (a, sig, ndata, &dummy, 0);
+              iobuf_close (a);
+              xfree (tmpp);
+            }
+        }
     }
+  else
+    rc = read_sig_data (inp, sig, ndata, &pktlen, list_mode);
 
  leave:
   iobuf_skip_rest (inp, pktlen, 0);
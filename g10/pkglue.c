@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -38,6 +39,12 @@
 #define ECC_HASH_LEN_MAX 64
 
 
+/* If set, pk_verify runs the actual verification outside of the npth
+ * lock so that other threads may verify at the same time.  This may
+ * only be set after npth has been initialized.  */
+static int verify_unprotected;
+
+
 /* FIXME: Better change the function name because mpi_ is used by
    gcrypt macros.  */
 gcry_mpi_t
@@ -206,6 +213,15 @@ get_data_from_sexp (gcry_sexp_t sexp, const char *item, size_t *r_size)
 }
 
 
+/* Enable (if YES is true) or disable the release of the npth lock
+ * while verifying a signature.  */
+void
+pk_verify_set_unprotected (int yes)
+{
+  verify_unprotected = yes;
+}
+
+
 /****************
  * Emulate our old PK interface here - sometime in the future we might
  * change the internal design to directly fit to libgcrypt.
@@ -428,7 +444,15 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
     BUG ();
 
   if (!rc)
-    rc = gcry_pk_verify (s_sig, s_hash, s_pkey);
+    {
+      int unprotected = verify_unprotected;
+
+      if (unprotected)
+        npth_unprotect ();
+      rc = gcry_pk_verify (s_sig, s_hash, s_pkey);
+      if (unprotected)
+        npth_protect ();
+    }
 
  leave:
   gcry_sexp_release (s_sig);
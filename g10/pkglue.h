@@ -29,6 +29,7 @@ gpg_error_t sexp_extract_param_sos (gcry_sexp_t sexp, const char *param,
 gpg_error_t sexp_extract_param_sos_nlz (gcry_sexp_t sexp, const char *param,
                                         gcry_mpi_t *r_sos);
 
+void pk_verify_set_unprotected (int yes);
 int pk_verify (pubkey_algo_t algo, gcry_mpi_t hash, gcry_mpi_t *data,
                gcry_mpi_t *pkey);
 gpg_error_t pk_encrypt (PKT_public_key *pk, gcry_mpi_t data, int seskey_algo,
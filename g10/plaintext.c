@@ -564,12 +564,22 @@ do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
     {
       size_t temp_size = iobuf_set_buffer_size(0) * 1024;
       byte *buffer = xmalloc (temp_size);
+      const void *p;
       int ret;
 
-      while ((ret = iobuf_read (fp, buffer, temp_size)) != -1)
+      for (;;)
 	{
+          /* Hash directly from a memory mapped file if possible.  */
+          ret = iobuf_borrow (fp, &p, temp_size);
+          if (!ret)
+            {
+              ret = iobuf_read (fp, buffer, temp_size);
+              if (ret == -1)
+                break;
+              p = buffer;
+            }
 	  if (md)
-	    gcry_md_write (md, buffer, ret);
+	    gcry_md_write (md, p, ret);
 	}
 
       xfree (buffer);
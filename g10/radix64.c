@@ -0,0 +1,583 @@
+/* radix64.c - Radix64 encoding and decoding for the armor filter
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module provides the bulk radix64 conversion used by the armor
+   filter.  Besides the generic table driven code there are vectorized
+   versions for x86 (SSSE3 and AVX2) and for ARMv8 (NEON).  The x86
+   versions are selected at runtime depending on the CPU features.
+   The module does not depend on other gpg code so that it can be
+   tested and benchmarked in isolation; see t-radix64.c.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/types.h"
+#include "radix64.h"
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define USE_X86_SIMD 1
+# include <immintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+# define USE_NEON 1
+# include <arm_neon.h>
+#endif
+
+
+static const byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               "abcdefghijklmnopqrstuvwxyz"
+                               "0123456789+/";
+
+/* Map a radix64 character to its value; 0xff marks an invalid
+   character.  */
+static const byte asctobin[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+
+
+/* The selected implementation.  */
+static int current_impl;
+static void (*encode_fnc) (byte *out, const byte *in, size_t inlen);
+static size_t (*decode_fnc) (byte *out, const byte *in, size_t inlen);
+
+
+
+/*
+ * Generic implementation.
+ */
+
+static void
+encode_generic (byte *out, const byte *in, size_t inlen)
+{
+  u32 v;
+
+  for (; inlen >= 3; in += 3, inlen -= 3, out += 4)
+    {
+      v = ((u32)in[0] << 16) | ((u32)in[1] << 8) | in[2];
+      out[0] = bintoasc[(v >> 18) & 077];
+      out[1] = bintoasc[(v >> 12) & 077];
+      out[2] = bintoasc[(v >> 6) & 077];
+      out[3] = bintoasc[v & 077];
+    }
+}
+
+
+static size_t
+decode_generic (byte *out, const byte *in, size_t inlen)
+{
+  const byte *start = in;
+  byte c0, c1, c2, c3;
+  u32 v;
+
+  for (; inlen >= 4; in += 4, inlen -= 4, out += 3)
+    {
+      c0 = asctobin[in[0]];
+      c1 = asctobin[in[1]];
+      c2 = asctobin[in[2]];
+      c3 = asctobin[in[3]];
+      if ((c0 | c1 | c2 | c3) & 0x80)
+        break;
+      v = ((u32)c0 << 18) | ((u32)c1 << 12) | ((u32)c2 << 6) | c3;
+      out[0] = v >> 16;
+      out[1] = v >> 8;
+      out[2] = v;
+    }
+
+  return in - start;
+}
+
+
+
+/*
+ * x86 implementations.  The algorithms are those described by Wojciech
+ * Muła and Daniel Lemire, "Faster Base64 Encoding and Decoding Using
+ * AVX2 Instructions", ACM Transactions on the Web 12(3), 2018.
+ */
+#ifdef USE_X86_SIMD
+
+/* Convert the 6 bit values in V to radix64 characters.  */
+__attribute__ ((target ("ssse3")))
+static inline __m128i
+ssse3_enc_translate (__m128i v)
+{
+  const __m128i shift_lut = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+  __m128i idx;
+
+  idx = _mm_subs_epu8 (v, _mm_set1_epi8 (51));
+  idx = _mm_or_si128 (idx, _mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8 (26),
+                                                          v),
+                                          _mm_set1_epi8 (13)));
+  return _mm_add_epi8 (v, _mm_shuffle_epi8 (shift_lut, idx));
+}
+
+
+/* Split the first 12 bytes of IN into 16 6 bit values.  */
+__attribute__ ((target ("ssse3")))
+static inline __m128i
+ssse3_enc_reshuffle (__m128i in)
+{
+  __m128i t0, t1;
+
+  in = _mm_shuffle_epi8 (in, _mm_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4,
+                                            7, 6, 8, 7, 10, 9, 11, 10));
+  t0 = _mm_mulhi_epu16 (_mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00)),
+                        _mm_set1_epi32 (0x04000040));
+  t1 = _mm_mullo_epi16 (_mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0)),
+                        _mm_set1_epi32 (0x01000010));
+  return _mm_or_si128 (t0, t1);
+}
+
+
+__attribute__ ((target ("ssse3")))
+static void
+encode_ssse3 (byte *out, const byte *in, size_t inlen)
+{
+  byte tmp[16];
+  __m128i v;
+
+  for (; inlen >= 12; in += 12, inlen -= 12, out += 16)
+    {
+      if (inlen >= 16)
+        v = _mm_loadu_si128 ((const __m128i *)in);
+      else
+        {
+          /* Do not read beyond the input.  */
+          memcpy (tmp, in, 12);
+          v = _mm_loadu_si128 ((const __m128i *)tmp);
+        }
+      v = ssse3_enc_translate (ssse3_enc_reshuffle (v));
+      _mm_storeu_si128 ((__m128i *)out, v);
+    }
+  encode_generic (out, in, inlen);
+}
+
+
+/* Check that all characters in STR are valid and convert them to
+   their 6 bit values.  Returns false if an invalid character was
+   found.  */
+__attribute__ ((target ("ssse3")))
+static inline int
+ssse3_dec_translate (__m128i *str)
+{
+  const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a,
+                                        0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02,
+                                        0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10,
+                                        0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+  __m128i hi_nibbles, lo, hi, roll;
+
+  hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*str, 4), mask_2f);
+  lo = _mm_shuffle_epi8 (lut_lo, _mm_and_si128 (*str, mask_2f));
+  hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+  if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_and_si128 (lo, hi),
+                                         _mm_setzero_si128 ())) != 0xffff)
+    return 0;
+
+  roll = _mm_shuffle_epi8 (lut_roll,
+                           _mm_add_epi8 (_mm_cmpeq_epi8 (*str, mask_2f),
+                                         hi_nibbles));
+  *str = _mm_add_epi8 (*str, roll);
+  return 1;
+}
+
+
+/* Pack the 16 6 bit values in V into the first 12 bytes.  */
+__attribute__ ((target ("ssse3")))
+static inline __m128i
+ssse3_dec_reshuffle (__m128i v)
+{
+  v = _mm_maddubs_epi16 (v, _mm_set1_epi32 (0x01400140));
+  v = _mm_madd_epi16 (v, _mm_set1_epi32 (0x00011000));
+  return _mm_shuffle_epi8 (v, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9,
+                                             8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+
+__attribute__ ((target ("ssse3")))
+static size_t
+decode_ssse3 (byte *out, const byte *in, size_t inlen)
+{
+  const byte *start = in;
+  byte tmp[16];
+  __m128i v;
+
+  for (; inlen >= 16; in += 16, inlen -= 16, out += 12)
+    {
+      v = _mm_loadu_si128 ((const __m128i *)in);
+      if (!ssse3_dec_translate (&v))
+        break;
+      _mm_storeu_si128 ((__m128i *)tmp, ssse3_dec_reshuffle (v));
+      memcpy (out, tmp, 12);
+    }
+  return (in - start) + decode_generic (out, in, inlen);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void
+encode_avx2 (byte *out, const byte *in, size_t inlen)
+{
+  const __m256i shift_lut = _mm256_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0,
+                                              'a' - 26, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0);
+  const __m256i shuf = _mm256_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4,
+                                         7, 6, 8, 7, 10, 9, 11, 10,
+                                         1, 0, 2, 1, 4, 3, 5, 4,
+                                         7, 6, 8, 7, 10, 9, 11, 10);
+  byte tmp[32];
+  const byte *p;
+  __m256i v, t0, t1, idx;
+
+  for (; inlen >= 24; in += 24, inlen -= 24, out += 32)
+    {
+      /* Each lane takes 12 input bytes.  */
+      if (inlen >= 28)
+        p = in;
+      else
+        {
+          memcpy (tmp, in, 24);
+          p = tmp;
+        }
+      v = _mm256_inserti128_si256
+        (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)p)),
+         _mm_loadu_si128 ((const __m128i *)(p + 12)), 1);
+
+      v = _mm256_shuffle_epi8 (v, shuf);
+      t0 = _mm256_mulhi_epu16 (_mm256_and_si256
+                               (v, _mm256_set1_epi32 (0x0fc0fc00)),
+                               _mm256_set1_epi32 (0x04000040));
+      t1 = _mm256_mullo_epi16 (_mm256_and_si256
+                               (v, _mm256_set1_epi32 (0x003f03f0)),
+                               _mm256_set1_epi32 (0x01000010));
+      v = _mm256_or_si256 (t0, t1);
+
+      idx = _mm256_subs_epu8 (v, _mm256_set1_epi8 (51));
+      idx = _mm256_or_si256 (idx, _mm256_and_si256
+                             (_mm256_cmpgt_epi8 (_mm256_set1_epi8 (26), v),
+                              _mm256_set1_epi8 (13)));
+      v = _mm256_add_epi8 (v, _mm256_shuffle_epi8 (shift_lut, idx));
+      _mm256_storeu_si256 ((__m256i *)out, v);
+    }
+  encode_ssse3 (out, in, inlen);
+}
+
+
+__attribute__ ((target ("avx2")))
+static size_t
+decode_avx2 (byte *out, const byte *in, size_t inlen)
+{
+  const __m256i lut_lo = _mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a,
+                                           0x1b, 0x1b, 0x1b, 0x1a,
+                                           0x15, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a,
+                                           0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02,
+                                           0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02,
+                                           0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+  const byte *start = in;
+  byte tmp[32];
+  __m256i v, hi_nibbles, lo, hi;
+
+  for (; inlen >= 32; in += 32, inlen -= 32, out += 24)
+    {
+      v = _mm256_loadu_si256 ((const __m256i *)in);
+      hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (v, 4), mask_2f);
+      lo = _mm256_shuffle_epi8 (lut_lo, _mm256_and_si256 (v, mask_2f));
+      hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+      if (!_mm256_testz_si256 (lo, hi))
+        break;
+      v = _mm256_add_epi8 (v, _mm256_shuffle_epi8
+                           (lut_roll,
+                            _mm256_add_epi8 (_mm256_cmpeq_epi8 (v, mask_2f),
+                                             hi_nibbles)));
+
+      v = _mm256_maddubs_epi16 (v, _mm256_set1_epi32 (0x01400140));
+      v = _mm256_madd_epi16 (v, _mm256_set1_epi32 (0x00011000));
+      v = _mm256_shuffle_epi8 (v, _mm256_setr_epi8
+                               (2, 1, 0, 6, 5, 4, 10, 9,
+                                8, 14, 13, 12, -1, -1, -1, -1,
+                                2, 1, 0, 6, 5, 4, 10, 9,
+                                8, 14, 13, 12, -1, -1, -1, -1));
+      v = _mm256_permutevar8x32_epi32 (v, _mm256_setr_epi32 (0, 1, 2, 4,
+                                                             5, 6, -1, -1));
+      _mm256_storeu_si256 ((__m256i *)tmp, v);
+      memcpy (out, tmp, 24);
+    }
+  return (in - start) + decode_ssse3 (out, in, inlen);
+}
+
+#endif /*USE_X86_SIMD*/
+
+
+
+/*
+ * ARMv8 implementation.
+ */
+#ifdef USE_NEON
+
+/* Encode 48 bytes at a time into one line of 64 characters.  */
+static void
+encode_neon (byte *out, const byte *in, size_t inlen)
+{
+  uint8x16x4_t tbl;
+  uint8x16x3_t src;
+  uint8x16x4_t dst;
+
+  tbl.val[0] = vld1q_u8 (bintoasc);
+  tbl.val[1] = vld1q_u8 (bintoasc + 16);
+  tbl.val[2] = vld1q_u8 (bintoasc + 32);
+  tbl.val[3] = vld1q_u8 (bintoasc + 48);
+
+  for (; inlen >= 48; in += 48, inlen -= 48, out += 64)
+    {
+      src = vld3q_u8 (in);
+      dst.val[0] = vshrq_n_u8 (src.val[0], 2);
+      dst.val[1] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (src.val[0], 4),
+                                       vshrq_n_u8 (src.val[1], 4)),
+                             vdupq_n_u8 (0x3f));
+      dst.val[2] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (src.val[1], 2),
+                                       vshrq_n_u8 (src.val[2], 6)),
+                             vdupq_n_u8 (0x3f));
+      dst.val[3] = vandq_u8 (src.val[2], vdupq_n_u8 (0x3f));
+      dst.val[0] = vqtbl4q_u8 (tbl, dst.val[0]);
+      dst.val[1] = vqtbl4q_u8 (tbl, dst.val[1]);
+      dst.val[2] = vqtbl4q_u8 (tbl, dst.val[2]);
+      dst.val[3] = vqtbl4q_u8 (tbl, dst.val[3]);
+      vst4q_u8 (out, dst);
+    }
+  encode_generic (out, in, inlen);
+}
+
+
+/* Convert the characters in V to their 6 bit values.  Invalid
+   characters are mapped to a value with the high bit set.  */
+static inline uint8x16_t
+neon_dec_translate (uint8x16_t v, uint8x16x4_t tbl_lo, uint8x16x4_t tbl_hi)
+{
+  uint8x16_t r;
+
+  r = vqtbl4q_u8 (tbl_lo, v);
+  r = vqtbx4q_u8 (r, tbl_hi, vsubq_u8 (v, vdupq_n_u8 (64)));
+  return vorrq_u8 (r, vandq_u8 (v, vdupq_n_u8 (0x80)));
+}
+
+
+/* Decode 64 characters at a time.  */
+static size_t
+decode_neon (byte *out, const byte *in, size_t inlen)
+{
+  const byte *start = in;
+  uint8x16x4_t tbl_lo, tbl_hi;
+  uint8x16x4_t src;
+  uint8x16x3_t dst;
+  uint8x16_t any;
+
+  tbl_lo.val[0] = vld1q_u8 (asctobin);
+  tbl_lo.val[1] = vld1q_u8 (asctobin + 16);
+  tbl_lo.val[2] = vld1q_u8 (asctobin + 32);
+  tbl_lo.val[3] = vld1q_u8 (asctobin + 48);
+  tbl_hi.val[0] = vld1q_u8 (asctobin + 64);
+  tbl_hi.val[1] = vld1q_u8 (asctobin + 80);
+  tbl_hi.val[2] = vld1q_u8 (asctobin + 96);
+  tbl_hi.val[3] = vld1q_u8 (asctobin + 112);
+
+  for (; inlen >= 64; in += 64, inlen -= 64, out += 48)
+    {
+      src = vld4q_u8 (in);
+      src.val[0] = neon_dec_translate (src.val[0], tbl_lo, tbl_hi);
+      src.val[1] = neon_dec_translate (src.val[1], tbl_lo, tbl_hi);
+      src.val[2] = neon_dec_translate (src.val[2], tbl_lo, tbl_hi);
+      src.val[3] = neon_dec_translate (src.val[3], tbl_lo, tbl_hi);
+      any = vorrq_u8 (vorrq_u8 (src.val[0], src.val[1]),
+                      vorrq_u8 (src.val[2], src.val[3]));
+      if (vmaxvq_u8 (any) & 0x80)
+        break;
+      dst.val[0] = vorrq_u8 (vshlq_n_u8 (src.val[0], 2),
+                             vshrq_n_u8 (src.val[1], 4));
+      dst.val[1] = vorrq_u8 (vshlq_n_u8 (src.val[1], 4),
+                             vshrq_n_u8 (src.val[2], 2));
+      dst.val[2] = vorrq_u8 (vshlq_n_u8 (src.val[2], 6), src.val[3]);
+      vst3q_u8 (out, dst);
+    }
+  return (in - start) + decode_generic (out, in, inlen);
+}
+
+#endif /*USE_NEON*/
+
+
+
+/* Select the implementation IMPL, which is one of the
+   RADIX64_IMPL_ constants.  With RADIX64_IMPL_AUTO the fastest
+   implementation supported by the CPU is used.  Returns 0 on success
+   or -1 if IMPL is not supported.  */
+int
+radix64_set_impl (int impl)
+{
+  if (impl == RADIX64_IMPL_AUTO)
+    {
+#ifdef USE_X86_SIMD
+      if (!radix64_set_impl (RADIX64_IMPL_AVX2)
+          || !radix64_set_impl (RADIX64_IMPL_SSSE3))
+        return 0;
+#endif
+#ifdef USE_NEON
+      if (!radix64_set_impl (RADIX64_IMPL_NEON))
+        return 0;
+#endif
+      impl = RADIX64_IMPL_GENERIC;
+    }
+
+  switch (impl)
+    {
+    case RADIX64_IMPL_GENERIC:
+      encode_fnc = encode_generic;
+      decode_fnc = decode_generic;
+      break;
+
+#ifdef USE_X86_SIMD
+    case RADIX64_IMPL_SSSE3:
+      __builtin_cpu_init ();
+      if (!__builtin_cpu_supports ("ssse3"))
+        return -1;
+      encode_fnc = encode_ssse3;
+      decode_fnc = decode_ssse3;
+      break;
+
+    case RADIX64_IMPL_AVX2:
+      __builtin_cpu_init ();
+      if (!__builtin_cpu_supports ("avx2"))
+        return -1;
+      encode_fnc = encode_avx2;
+      decode_fnc = decode_avx2;
+      break;
+#endif /*USE_X86_SIMD*/
+
+#ifdef USE_NEON
+    case RADIX64_IMPL_NEON:
+      encode_fnc = encode_neon;
+      decode_fnc = decode_neon;
+      break;
+#endif /*USE_NEON*/
+
+    default:
+      return -1;
+    }
+
+  current_impl = impl;
+  return 0;
+}
+
+
+/* Return the name of the implementation IMPL or of the current
+   implementation if IMPL is RADIX64_IMPL_AUTO.  */
+const char *
+radix64_impl_name (int impl)
+{
+  if (impl == RADIX64_IMPL_AUTO)
+    {
+      if (!encode_fnc)
+        radix64_set_impl (RADIX64_IMPL_AUTO);
+      impl = current_impl;
+    }
+
+  switch (impl)
+    {
+    case RADIX64_IMPL_GENERIC: return "generic";
+    case RADIX64_IMPL_SSSE3:   return "ssse3";
+    case RADIX64_IMPL_AVX2:    return "avx2";
+    case RADIX64_IMPL_NEON:    return "neon";
+    default:                   return "?";
+    }
+}
+
+
+/* Encode the INLEN bytes at IN as radix64 and store the result at
+   OUT, which must have space for INLEN/3*4 bytes.  INLEN must be a
+   multiple of 3; neither padding nor line endings are written.  */
+void
+radix64_encode (byte *out, const byte *in, size_t inlen)
+{
+  if (!encode_fnc)
+    radix64_set_impl (RADIX64_IMPL_AUTO);
+  encode_fnc (out, in, inlen);
+}
+
+
+/* Decode the radix64 characters at IN in groups of four and store the
+   result at OUT, which must have space for INLEN/4*3 bytes.  The
+   decoding stops at the first group which contains anything but a
+   radix64 character, for example a line ending or a padding
+   character.  Returns the number of characters consumed; this is
+   always a multiple of 4.  */
+size_t
+radix64_decode (byte *out, const byte *in, size_t inlen)
+{
+  if (!decode_fnc)
+    radix64_set_impl (RADIX64_IMPL_AUTO);
+  return decode_fnc (out, in, inlen);
+}
@@ -0,0 +1,36 @@
+/* radix64.h - Radix64 encoding and decoding for the armor filter
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_RADIX64_H
+#define G10_RADIX64_H
+
+/* The available implementations.  */
+#define RADIX64_IMPL_AUTO     0
+#define RADIX64_IMPL_GENERIC  1
+#define RADIX64_IMPL_SSSE3    2
+#define RADIX64_IMPL_AVX2     3
+#define RADIX64_IMPL_NEON     4
+#define RADIX64_IMPL_LAST     4
+
+int radix64_set_impl (int impl);
+const char *radix64_impl_name (int impl);
+
+void radix64_encode (byte *out, const byte *in, size_t inlen);
+size_t radix64_decode (byte *out, const byte *in, size_t inlen);
+
+#endif /*G10_RADIX64_H*/
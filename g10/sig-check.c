@@ -41,7 +41,8 @@ static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 				int *r_expired, int *r_revoked,
 				PKT_public_key *ret_pk);
 
-static int check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
+static int check_signature_end_simple (ctrl_t ctrl, const byte *ubid,
+                                       PKT_public_key *pk, PKT_signature *sig,
                                        gcry_md_hd_t digest,
                                        const void *extrahash,
                                        size_t extrahashlen);
@@ -54,6 +55,8 @@ struct
   unsigned int cached; /* Number of seen cache entries.  */
   unsigned int goodsig;/* Number of good verifications from the cache.  */
   unsigned int badsig; /* Number of bad verifications from the cache.  */
+  unsigned int kbxd_hits;   /* Number of results from the keyboxd.  */
+  unsigned int kbxd_misses; /* Number of keyboxd lookups w/o result.  */
 } cache_stats;
 
 
@@ -61,9 +64,11 @@ struct
 void
 sig_check_dump_stats (void)
 {
-  log_info ("sig_cache: total=%u cached=%u good=%u bad=%u\n",
+  log_info ("sig_cache: total=%u cached=%u good=%u bad=%u"
+            " kbxd=%u/%u\n",
             cache_stats.total, cache_stats.cached,
-            cache_stats.goodsig, cache_stats.badsig);
+            cache_stats.goodsig, cache_stats.badsig,
+            cache_stats.kbxd_hits, cache_stats.kbxd_misses);
 }
 
 
@@ -265,6 +270,9 @@ check_signature2 (ctrl_t ctrl,
         int i;
         char hashbuf[20];  /* We use SHA-1 here.  */
 
+      rc = decode_sig_data (sig);
+      if (rc)
+        goto leave;
       nbytes = 6;
       for (i=0; i < nsig; i++ )
         {
@@ -323,6 +331,7 @@ check_signature2 (ctrl_t ctrl,
       xfree (buffer);
     }
 
+ leave:
   if (r_pk)
     *r_pk = pk;
   else
@@ -481,7 +490,7 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
                                                r_expired, r_revoked)))
     return rc;
 
-  if ((rc = check_signature_end_simple (pk, sig, digest,
+  if ((rc = check_signature_end_simple (NULL, NULL, pk, sig, digest,
                                         extrahash, extrahashlen)))
     return rc;
 
@@ -492,16 +501,92 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 }
 
 
+/* Compute the key for the keyboxd's signature cache and store it at
+ * R_HASH, which must have SIGCACHE_HASH_LEN bytes.  The key is a
+ * SHA-256 hash over the fingerprint of the signer PK, the finalized
+ * DIGEST and the signature values of SIG.  Returns 0 on success.  */
+static gpg_error_t
+compute_sigcache_hash (PKT_public_key *pk, PKT_signature *sig,
+                       gcry_md_hd_t digest, byte *r_hash)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen, n;
+  unsigned int nbits;
+  unsigned char *buf;
+  byte lenbuf[4];
+  int i, nsig;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    return err;
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_write (md, gcry_md_read (digest, sig->digest_algo),
+                 gcry_md_get_algo_dlen (sig->digest_algo));
+
+  gcry_md_putc (md, sig->pubkey_algo);
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  for (i=0; i < nsig && i < PUBKEY_MAX_NSIG; i++)
+    {
+      buf = NULL;
+      if (!sig->data[i])
+        n = 0;
+      else if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          gcry_mpi_get_opaque (sig->data[i], &nbits);
+          n = (nbits+7)/8;
+        }
+      else
+        {
+          err = gcry_mpi_aprint (GCRYMPI_FMT_USG, &buf, &n, sig->data[i]);
+          if (err)
+            goto leave;
+        }
+
+      lenbuf[0] = n >> 24;
+      lenbuf[1] = n >> 16;
+      lenbuf[2] = n >>  8;
+      lenbuf[3] = n;
+      gcry_md_write (md, lenbuf, 4);
+      if (buf)
+        gcry_md_write (md, buf, n);
+      else if (n)
+        gcry_md_write (md, gcry_mpi_get_opaque (sig->data[i], &nbits), n);
+      gcry_free (buf);
+    }
+
+  memcpy (r_hash, gcry_md_read (md, GCRY_MD_SHA256), SIGCACHE_HASH_LEN);
+
+ leave:
+  gcry_md_close (md);
+  return err;
+}
+
+
 /* This function is similar to check_signature_end, but it only checks
  * whether the signature was generated by PK.  It does not check
- * expiration, revocation, etc.  */
+ * expiration, revocation, etc.
+ *
+ * If UBID is not NULL and the keyboxd is used, the result of the
+ * public key operation is looked up in and stored to the keyboxd's
+ * signature cache using the keyblock with UBID.  This is only useful
+ * for key signatures, which are checked again and again.  */
 static int
-check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
+check_signature_end_simple (ctrl_t ctrl, const byte *ubid,
+                            PKT_public_key *pk, PKT_signature *sig,
                             gcry_md_hd_t digest,
                             const void *extrahash, size_t extrahashlen)
 {
   gcry_mpi_t result = NULL;
   int rc = 0;
+  byte sigcache_hash[SIGCACHE_HASH_LEN];
+  int use_sigcache, valid;
 
   if (!opt.flags.allow_weak_digest_algos)
     {
@@ -622,6 +707,24 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     }
     gcry_md_final( digest );
 
+    rc = decode_sig_data (sig);
+    if (rc)
+      return rc;
+
+    /* Check whether the keyboxd knows the result already.  */
+    use_sigcache = (ctrl && ubid && opt.use_keyboxd && !opt.no_sig_cache
+                    && !compute_sigcache_hash (pk, sig, digest,
+                                               sigcache_hash));
+    if (use_sigcache
+        && !keydb_sigcache_get (ctrl, ubid, sigcache_hash, &valid))
+      {
+        cache_stats.kbxd_hits++;
+        rc = valid? 0 : gpg_error (GPG_ERR_BAD_SIGNATURE);
+        goto verified;
+      }
+    if (use_sigcache)
+      cache_stats.kbxd_misses++;
+
     /* Convert the digest to an MPI.  */
     result = encode_md_value (pk, digest, sig->digest_algo );
     if (!result)
@@ -635,6 +738,11 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
       log_clock ("leave pk_verify");
     gcry_mpi_release (result);
 
+    if (use_sigcache
+        && (!rc || gpg_err_code (rc) == GPG_ERR_BAD_SIGNATURE))
+      keydb_sigcache_put (ctrl, ubid, sigcache_hash, !rc);
+
+ verified:
   if (!rc && sig->flags.unknown_critical)
     {
       log_info(_("assuming bad signature from key %s"
@@ -909,6 +1017,9 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
   gcry_md_hd_t md;
   int signer_alloced = 0;
   int stub_is_selfsig;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  const byte *ubid = NULL;
 
   if (!is_selfsig)
     is_selfsig = &stub_is_selfsig;
@@ -1019,6 +1130,16 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
         }
     }
 
+  /* The keyboxd keeps the results of key signature checks per
+   * keyblock; its UBID is the truncated fingerprint of the primary
+   * key.  */
+  if (opt.use_keyboxd && !opt.no_sig_cache)
+    {
+      fingerprint_from_pk (pripk, fpr, &fprlen);
+      if (fprlen >= UBID_LEN)
+        ubid = fpr;
+    }
+
   /* We checked above that we supported this algo, so an error here is
    * a bug.  */
   if (gcry_md_open (&md, sig->digest_algo, 0))
@@ -1030,21 +1151,24 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
     {
       log_assert (packet->pkttype == PKT_PUBLIC_KEY);
       hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+      rc = check_signature_end_simple (ctrl, ubid, signer, sig, md,
+                                       NULL, 0);
     }
   else if (IS_BACK_SIG (sig))
     {
       log_assert (packet->pkttype == PKT_PUBLIC_KEY);
       hash_public_key (md, packet->pkt.public_key);
       hash_public_key (md, signer);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+      rc = check_signature_end_simple (ctrl, ubid, signer, sig, md,
+                                       NULL, 0);
     }
   else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
     {
       log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
       hash_public_key (md, pripk);
       hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+      rc = check_signature_end_simple (ctrl, ubid, signer, sig, md,
+                                       NULL, 0);
     }
   else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
     {
@@ -1063,7 +1187,8 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
         {
           hash_public_key (md, pripk);
           hash_uid_packet (packet->pkt.user_id, md, sig);
-          rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+          rc = check_signature_end_simple (ctrl, ubid, signer, sig, md,
+                                           NULL, 0);
         }
     }
   else
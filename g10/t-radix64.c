@@ -0,0 +1,227 @@
+/* t-radix64.c - Module test and benchmark for radix64.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Run "t-radix64 --bench" to compare the speed of the
+   implementations.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/types.h"
+#include "radix64.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+static int verbose;
+
+/* A simple deterministic pseudo random generator.  */
+static unsigned int rndseed = 42;
+
+static byte
+rnd_byte (void)
+{
+  rndseed = rndseed * 1103515245 + 12345;
+  return rndseed >> 16;
+}
+
+
+static void
+run_test_vectors (int impl)
+{
+  static struct
+  {
+    const char *data;
+    const char *expect;
+  } testtbl[] =
+    {
+      { "", "" },
+      { "foo", "Zm9v" },
+      { "foobar", "Zm9vYmFy" },
+      { "\xfb\xff\xbf", "+/+/" },
+      { "The quick brown fox jumps over the lazy dog...",
+        "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRvZy4uLg" },
+      { NULL, NULL }
+    };
+  int idx;
+  size_t len, n;
+  byte buf[256];
+
+  for (idx=0; testtbl[idx].data; idx++)
+    {
+      /* The last vector is not a multiple of 3; we only use the
+       * complete groups.  */
+      len = strlen (testtbl[idx].data) / 3 * 3;
+      memset (buf, 0, sizeof buf);
+      radix64_encode (buf, (const byte *)testtbl[idx].data, len);
+      if (memcmp (buf, testtbl[idx].expect, len / 3 * 4))
+        fail (impl * 100 + idx);
+
+      n = radix64_decode (buf, (const byte *)testtbl[idx].expect,
+                          len / 3 * 4);
+      if (n != len / 3 * 4 || memcmp (buf, testtbl[idx].data, len))
+        fail (impl * 100 + 50 + idx);
+    }
+}
+
+
+/* Compare IMPL against the generic implementation using random data
+ * of all lengths up to 300 bytes and with an invalid character at
+ * every position.  */
+static void
+run_compare (int impl)
+{
+  byte data[300], enc[400], enc2[400], dec[300], dec2[300];
+  size_t len, pos, n, n2;
+  int i;
+
+  for (len = 0; len <= sizeof data; len += 3)
+    {
+      for (pos = 0; pos < len; pos++)
+        data[pos] = rnd_byte ();
+
+      radix64_set_impl (RADIX64_IMPL_GENERIC);
+      radix64_encode (enc, data, len);
+      radix64_set_impl (impl);
+      memset (enc2, 0, sizeof enc2);
+      radix64_encode (enc2, data, len);
+      if (memcmp (enc, enc2, len / 3 * 4))
+        fail (impl * 100 + 1);
+
+      n = radix64_decode (dec, enc, len / 3 * 4);
+      if (n != len / 3 * 4 || memcmp (dec, data, len))
+        fail (impl * 100 + 2);
+
+      /* Now put bad characters at all positions.  */
+      for (pos = 0; pos < len / 3 * 4; pos++)
+        {
+          static const byte bad[] = { '=', '\n', '-', 0, 0x80, 0xff, 'A' - 1,
+                                      'z' + 1, '0' - 2, '9' + 1, '+' + 1 };
+
+          memcpy (enc2, enc, len / 3 * 4);
+          enc2[pos] = bad[pos % sizeof bad];
+          radix64_set_impl (RADIX64_IMPL_GENERIC);
+          n = radix64_decode (dec, enc2, len / 3 * 4);
+          radix64_set_impl (impl);
+          n2 = radix64_decode (dec2, enc2, len / 3 * 4);
+          if (n != pos / 4 * 4 || n2 != n || memcmp (dec, dec2, n / 4 * 3))
+            fail (impl * 100 + 3);
+        }
+    }
+
+  /* Check that all 256 values are classified alike.  */
+  for (i = 0; i < 256; i++)
+    {
+      memset (enc, 'A', 64);
+      enc[i % 64] = i;
+      radix64_set_impl (RADIX64_IMPL_GENERIC);
+      n = radix64_decode (dec, enc, 64);
+      radix64_set_impl (impl);
+      n2 = radix64_decode (dec2, enc, 64);
+      if (n != n2 || memcmp (dec, dec2, n / 4 * 3))
+        fail (impl * 100 + 4);
+    }
+}
+
+
+static double
+elapsed (clock_t start)
+{
+  return (double)(clock () - start) / CLOCKS_PER_SEC;
+}
+
+
+/* Encode and decode a few MiB in armor line sized pieces.  */
+static void
+run_bench (int impl)
+{
+  enum { DATALEN = 48 * 64 * 1024 };
+  static byte data[DATALEN];
+  static byte enc[DATALEN / 3 * 4];
+  clock_t start;
+  double t_enc, t_dec;
+  size_t off;
+  int loop;
+
+  for (off = 0; off < DATALEN; off++)
+    data[off] = rnd_byte ();
+
+  start = clock ();
+  for (loop = 0; loop < 10; loop++)
+    for (off = 0; off < DATALEN; off += 48)
+      radix64_encode (enc + off / 3 * 4, data + off, 48);
+  t_enc = elapsed (start);
+
+  start = clock ();
+  for (loop = 0; loop < 10; loop++)
+    for (off = 0; off < DATALEN / 3 * 4; off += 64)
+      if (radix64_decode (data + off / 4 * 3, enc + off, 64) != 64)
+        fail (impl * 100 + 10);
+  t_dec = elapsed (start);
+
+  printf ("%-8s encode: %7.1f MiB/s  decode: %7.1f MiB/s\n",
+          radix64_impl_name (impl),
+          t_enc > 0? 10.0 * DATALEN / t_enc / (1024*1024) : 0.0,
+          t_dec > 0? 10.0 * DATALEN / t_dec / (1024*1024) : 0.0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int bench = 0;
+  int impl;
+
+  if (argc)
+    {
+      argc--; argv++;
+    }
+  while (argc && **argv == '-')
+    {
+      if (!strcmp (*argv, "--verbose"))
+        verbose = 1;
+      else if (!strcmp (*argv, "--bench"))
+        bench = 1;
+      argc--; argv++;
+    }
+
+  for (impl = RADIX64_IMPL_GENERIC; impl <= RADIX64_IMPL_LAST; impl++)
+    {
+      if (radix64_set_impl (impl))
+        {
+          if (verbose)
+            printf ("%s: not supported\n", radix64_impl_name (impl));
+          continue;
+        }
+      if (verbose)
+        printf ("%s: testing\n", radix64_impl_name (impl));
+      run_test_vectors (impl);
+      run_compare (impl);
+      if (bench)
+        run_bench (impl);
+    }
+
+  return 0;
+}
@@ -151,6 +151,15 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
 	return;
     }
 
+    /* Keep the updates in the record cache until we are done.  */
+    rc = tdbio_begin_transaction ();
+    if (rc) {
+	log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc) );
+	if (!is_stdin)
+	    es_fclose (fp);
+	return;
+    }
+
     while (es_fgets (line, DIM(line)-1, fp)) {
 	TRUSTREC rec;
 
@@ -233,11 +242,9 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
 	es_fclose (fp);
 
     if (any)
-      {
-        revalidation_mark (ctrl);
-        rc = tdbio_sync ();
-        if (rc)
-          log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc) );
-      }
+      revalidation_mark (ctrl);
+    rc = tdbio_end_transaction ();
+    if (rc)
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc) );
 
 }
@@ -49,17 +49,28 @@
 #endif
 
 
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_MMAP_TDB 1
+#endif
+
+
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache keeps the records written by us.  Records not in
+ * the cache are read from the memory mapped trustdb or, if that is
+ * not possible, using read(2).  The cache entries are found using a
+ * hash table indexed by the record number.  The dirty entries are
+ * also kept in an array so that a sync does not need to scan the
+ * entire cache and can write them in ascending order.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
-  CACHE_CTRL next;
+  CACHE_CTRL next;  /* Next entry in the same hash bucket.  */
   struct {
-    unsigned used:1;
     unsigned dirty:1;
   } flags;
   ulong recno;
@@ -70,13 +81,40 @@ struct cache_ctrl_struct
    transaction this may not be sufficient and thus we may increase it
    then up to the HARD limit.  */
 #define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+#define MAX_CACHE_ENTRIES_HARD	100000
 
+/* While in a transaction tdbio_sync writes the dirty records only if
+   there are at least that many.  The write lock is held from the
+   first access of such a batch until it has been written.  */
+#define TRANSACTION_BATCH_SIZE	2000
+
+/* Number of buckets in the cache's hash table; must be a power of 2.  */
+#define CACHE_HASH_SIZE 16384
+
+/* The maximum number of records written with one write(2).  */
+#define MAX_RECORDS_PER_WRITE 64
 
 /* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
+static CACHE_CTRL *cache_tbl;
+static CACHE_CTRL cache_unused;
 static int cache_entries;
-static int cache_is_dirty;
+static CACHE_CTRL *dirty_list;
+static size_t dirty_count;
+static size_t dirty_size;
+
+#ifdef USE_MMAP_TDB
+/* The trustdb mapped into memory.  DB_MAPLEN is the length of the
+ * mapping which may be larger than the file; DB_FILELEN is the known
+ * length of the file.  DB_MAP_FAILED is set if mmap did not work.  */
+static const byte *db_map;
+static size_t db_maplen;
+static size_t db_filelen;
+static int db_map_failed;
+
+/* Extra space mapped beyond the end of the file so that appending
+ * records does not require a new mapping.  */
+#define DB_MAP_HEADROOM (1024*1024)
+#endif /*USE_MMAP_TDB*/
 
 
 /* An object to pass information to cmp_krec_fpr. */
@@ -108,7 +146,11 @@ static unsigned int is_locked;
 static int  db_fd = -1;
 
 /* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+static int in_transaction;
+
+/* A flag indicating that the write lock has been taken for the
+ * current batch of a transaction.  */
+static int batch_locked;
 
 
 
@@ -181,6 +223,23 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/*
+ * Return the cache entry for RECNO or NULL.
+ */
+static CACHE_CTRL
+cache_lookup (ulong recno)
+{
+  CACHE_CTRL r;
+
+  if (!cache_tbl)
+    return NULL;
+  for (r = cache_tbl[recno & (CACHE_HASH_SIZE - 1)]; r; r = r->next)
+    if (r->recno == recno)
+      return r;
+  return NULL;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -191,225 +250,282 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
+  r = cache_lookup (recno);
+  return r? r->data : NULL;
+}
+
+
+/*
+ * Return a pointer to the record RECNUM in the memory mapped trustdb.
+ * NULL is returned if the trustdb can't be mapped or the record is
+ * beyond its end.
+ */
+static const byte *
+get_record_from_map (ulong recnum)
+{
+#ifdef USE_MMAP_TDB
+  size_t off = (size_t)recnum * TRUST_RECORD_LEN;
+  struct stat statbuf;
+  size_t len;
+  void *p;
+
+  if (off + TRUST_RECORD_LEN <= db_filelen)
+    return db_map + off;
+  if (db_map_failed)
+    return NULL;
+
+  /* The file may have been extended in the meantime.  */
+  if (fstat (db_fd, &statbuf))
+    return NULL;
+  if (off + TRUST_RECORD_LEN > (size_t)statbuf.st_size)
+    return NULL;
+  if (off + TRUST_RECORD_LEN <= db_maplen)
+    {
+      db_filelen = statbuf.st_size;
+      if (db_filelen > db_maplen)
+        db_filelen = db_maplen;
+      return db_map + off;
+    }
+
+  if (db_map)
+    munmap ((void *)db_map, db_maplen);
+  db_map = NULL;
+  db_maplen = db_filelen = 0;
+
+  len = statbuf.st_size + DB_MAP_HEADROOM;
+  p = mmap (NULL, len, PROT_READ, MAP_SHARED, db_fd, 0);
+  if (p == MAP_FAILED)
     {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
+      if (opt.debug)
+        log_debug ("trustdb: mmap failed: %s - using read\n",
+                   strerror (errno));
+      db_map_failed = 1;
+      return NULL;
     }
+  db_map = p;
+  db_maplen = len;
+  db_filelen = statbuf.st_size;
+  return db_map + off;
+#else
+  (void)recnum;
   return NULL;
+#endif
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write the N records starting at RECNO from BUF to the trustdb file.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_records (ulong recno, const char *buf, size_t n)
 {
   gpg_error_t err;
-  int n;
+  ssize_t nwritten;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+                 recno, strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  nwritten = write (db_fd, buf, n * TRUST_RECORD_LEN);
+  if (nwritten != n * TRUST_RECORD_LEN)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
+                 recno, (int)nwritten, strerror (errno) );
       return err;
     }
-  r->flags.dirty = 0;
   return 0;
 }
 
 
+/* Helper for flush_dirty_records to sort the dirty list.  */
+static int
+cmp_cache_recno (const void *a, const void *b)
+{
+  ulong ra = (*(const CACHE_CTRL *)a)->recno;
+  ulong rb = (*(const CACHE_CTRL *)b)->recno;
+
+  return ra < rb? -1 : ra > rb;
+}
+
+
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Write all dirty cache entries back to the trustdb file.  Runs of
+ * consecutive records are written at once.  The caller must hold the
+ * write lock.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (ulong recno, const char *data)
+flush_dirty_records (void)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  char buf[MAX_RECORDS_PER_WRITE * TRUST_RECORD_LEN];
+  size_t i, j, n;
+  ulong first;
+  int rc;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  qsort (dirty_list, dirty_count, sizeof *dirty_list, cmp_cache_recno);
+  for (i = 0; i < dirty_count; i += n)
     {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
+      first = dirty_list[i]->recno;
+      for (n = 0; (i + n < dirty_count && n < MAX_RECORDS_PER_WRITE
+                   && dirty_list[i+n]->recno == first + n); n++)
+        memcpy (buf + n * TRUST_RECORD_LEN, dirty_list[i+n]->data,
+                TRUST_RECORD_LEN);
+      rc = write_records (first, buf, n);
+      if (rc)
         {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
+          /* Keep the entries not yet written.  */
+          memmove (dirty_list, dirty_list + i,
+                   (dirty_count - i) * sizeof *dirty_list);
+          dirty_count -= i;
+          return rc;
+        }
+      for (j = 0; j < n; j++)
+        dirty_list[i+j]->flags.dirty = 0;
     }
+  dirty_count = 0;
+  return 0;
+}
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
-    {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
-    {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+/*
+ * Remove all clean entries from the cache.
+ */
+static void
+drop_clean_records (void)
+{
+  CACHE_CTRL r, *rp;
+  int i;
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
-    {
-      int n;
+  for (i = 0; i < CACHE_HASH_SIZE; i++)
+    for (rp = &cache_tbl[i]; (r = *rp); )
+      {
+        if (r->flags.dirty)
+          rp = &r->next;
+        else
+          {
+            *rp = r->next;
+            r->next = cache_unused;
+            cache_unused = r;
+            cache_entries--;
+          }
+      }
+}
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
+/*
+ * Put data into the cache.  This function may flush
+ * some cache entries if the cache is filled up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (ulong recno, const char *data)
+{
+  CACHE_CTRL r;
+  const byte *mapped;
+  int rc;
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
+  /* See whether we already cached this one.  */
+  r = cache_lookup (recno);
+  if (r)
+    {
+      if (!r->flags.dirty)
+        {
+          if (!memcmp (r->data, data, TRUST_RECORD_LEN))
+            return 0;
+          r->flags.dirty = 1;
+          goto add_to_dirty_list;
+        }
       memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
       return 0;
     }
 
-  /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
-  if (in_transaction)
+  /* Nothing to do if the record in the file is the same.  */
+  mapped = get_record_from_map (recno);
+  if (mapped && !memcmp (mapped, data, TRUST_RECORD_LEN))
+    return 0;
+
+  /* Not in the cache: add a new entry.  Make room first if we reached
+   * the limit.  Clean entries are simply dropped; if there are none we
+   * need to flush the dirty entries. */
+  if (cache_entries >= (in_transaction? MAX_CACHE_ENTRIES_HARD
+                        /*           */ : MAX_CACHE_ENTRIES_SOFT))
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
+      if (dirty_count == cache_entries)
         {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+          if (in_transaction && opt.debug)
+            log_debug ("trustdb transaction too large - flushing\n");
+          take_write_lock ();
+          rc = flush_dirty_records ();
+          release_write_lock ();
+          if (rc)
+            return rc;
+        }
+      drop_clean_records ();
     }
-#endif
 
-  if (dirty_count)
+  if (!cache_tbl)
+    cache_tbl = xcalloc (CACHE_HASH_SIZE, sizeof *cache_tbl);
+  if (cache_unused)
     {
-      int n;
-
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
+      r = cache_unused;
+      cache_unused = r->next;
+    }
+  else
+    r = xmalloc (sizeof *r);
+  r->recno = recno;
+  r->flags.dirty = 1;
+  r->next = cache_tbl[recno & (CACHE_HASH_SIZE - 1)];
+  cache_tbl[recno & (CACHE_HASH_SIZE - 1)] = r;
+  cache_entries++;
+
+ add_to_dirty_list:
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  if (dirty_count == dirty_size)
+    {
+      dirty_size = dirty_size? 2 * dirty_size : MAX_CACHE_ENTRIES_SOFT;
+      dirty_list = xrealloc (dirty_list, dirty_size * sizeof *dirty_list);
+    }
+  dirty_list[dirty_count++] = r;
+  return 0;
+}
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              int rc;
 
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
+/*
+ * Start a new batch of a transaction if not yet done.  The write lock
+ * is then held until the batch has been written so that neither the
+ * records we read nor those we write can be changed by another
+ * process in the meantime.  Clean records in the cache may have been
+ * changed by another process since the last batch and are thus
+ * dropped.
+ */
+static void
+begin_batch (void)
+{
+  if (!in_transaction || batch_locked)
+    return;
+  take_write_lock ();
+  batch_locked = 1;
+  if (cache_tbl)
+    drop_clean_records ();
+}
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
 
-  /* We should never reach this.  */
-  BUG();
+/* Release the write lock of the current batch.  */
+static void
+end_batch (void)
+{
+  if (!batch_locked)
+    return;
+  batch_locked = 0;
+  release_write_lock ();
 }
 
 
@@ -417,58 +533,59 @@ put_record_into_cache (ulong recno, const char *data)
 int
 tdbio_is_dirty (void)
 {
-  return cache_is_dirty;
+  return !!dirty_count;
 }
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction a call to this function
+ * marks a consistent state of the trustdb; the dirty records are then
+ * written only if TRANSACTION_BATCH_SIZE of them have accumulated.
  */
 int
 tdbio_sync (void)
 {
-    CACHE_CTRL r;
-    int did_lock = 0;
-
-    if( db_fd == -1 )
-	open_db();
-#if 0 /* Transactions are not yet used.  */
-    if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
-
-    if( !cache_is_dirty )
-	return 0;
+  int rc;
 
-    if (!take_write_lock ())
-        did_lock = 1;
+  if (db_fd == -1)
+    open_db ();
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
+  if (in_transaction && dirty_count < TRANSACTION_BATCH_SIZE)
+    return 0;
+  if (!dirty_count)
+    {
+      end_batch ();
+      return 0;
     }
-    cache_is_dirty = 0;
-    if (did_lock)
-        release_write_lock ();
 
-    return 0;
+  /* The lock is counted; thus we need to release it even if it was
+   * already taken.  The signals are blocked so that a batch is either
+   * written completely or not at all.  */
+  gnupg_block_all_signals ();
+  take_write_lock ();
+  rc = flush_dirty_records ();
+  release_write_lock ();
+  if (!rc)
+    end_batch ();
+  gnupg_unblock_all_signals ();
+
+  return rc;
 }
 
 
-#if 0  /* Not yet used.  */
 /*
  * Simple transactions system:
- * Everything between begin_transaction and end/cancel_transaction
- * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * Everything between begin_transaction and end/cancel_transaction is
+ * kept in the cache and written in batches by tdbio_sync; the rest is
+ * written at the time of end_transaction.  The write lock is taken
+ * with the first read or write of a batch and released after the
+ * batch has been written so that other processes are blocked only
+ * for the duration of a batch and not of the whole transaction.  A
+ * cancel drops only the records not yet written; thus callers should
+ * call tdbio_sync only at points where the trustdb is consistent.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction (void)
 {
   int rc;
 
@@ -483,48 +600,51 @@ tdbio_begin_transaction ()  /* Not yet used.  */
 }
 
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction (void)
 {
   int rc;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
-  take_write_lock ();
-  gnupg_block_all_signals ();
   in_transaction = 0;
-  rc = tdbio_sync();
-  gnupg_unblock_all_signals();
-  release_write_lock ();
+  rc = tdbio_sync ();
+  end_batch ();
   return rc;
 }
 
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction (void)
 {
-  CACHE_CTRL r;
+  CACHE_CTRL r, *rp;
+  int i;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
 
   /* Remove all dirty marked entries, so that the original ones are
    * read back the next time.  */
-  if (cache_is_dirty)
+  if (dirty_count)
     {
-      for (r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
+      for (i = 0; i < CACHE_HASH_SIZE; i++)
+        for (rp = &cache_tbl[i]; (r = *rp); )
+          {
+            if (!r->flags.dirty)
+              rp = &r->next;
+            else
+              {
+                *rp = r->next;
+                r->next = cache_unused;
+                cache_unused = r;
+                cache_entries--;
+              }
+          }
+      dirty_count = 0;
     }
 
   in_transaction = 0;
+  end_batch ();
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
 
@@ -842,10 +962,16 @@ create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type)
         log_fatal (_("%s: failed to create hashtable: %s\n"),
                    db_name, gpg_strerror (rc));
     }
-  /* Update the version record and flush. */
+  /* Update the version record and flush.  This is done even while in
+   * a transaction because tdbio_new_recnum appends at the end of the
+   * file.  */
   rc = tdbio_write_record (ctrl, vr);
   if (!rc)
-    rc = tdbio_sync ();
+    {
+      take_write_lock ();
+      rc = flush_dirty_records ();
+      release_write_lock ();
+    }
   if (rc)
     log_fatal (_("%s: error updating version record: %s\n"),
                db_name, gpg_strerror (rc));
@@ -1495,8 +1621,11 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
 
   if (db_fd == -1)
     open_db ();
+  begin_batch ();
 
   buf = get_record_from_cache( recnum );
+  if (!buf)
+    buf = get_record_from_map (recnum);
   if (!buf)
     {
       if (lseek (db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET) == -1)
@@ -1645,6 +1774,7 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
 
   if (db_fd == -1)
     open_db ();
+  begin_batch ();
 
   memset (buf, 0, TRUST_RECORD_LEN);
   p = buf;
@@ -315,6 +315,7 @@ get_override_session_key (DEK *dek, const char *string)
   return GPG_ERR_GENERAL;
 }
 
+#ifndef WITH_DECRYPT_DATA
 /* Stub: */
 int
 decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
@@ -327,6 +328,7 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
   (void)compliance_error;
   return GPG_ERR_GENERAL;
 }
+#endif /*!WITH_DECRYPT_DATA*/
 
 
 /* Stub:
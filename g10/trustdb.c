@@ -75,11 +75,21 @@ static int any_trusted_key_seen;
 /* Flag whether a trustdb check is pending.  */
 static int pending_check_trustdb;
 
+/* The version of the format used for the validation state file.  */
+#define WOT_STATE_VERSION 1
+
+/* The value stored as nextcheck to indicate that only the keys listed
+ * in the validation state file need to be revalidated.  Older
+ * versions take this as a check due in 1970 and do a full run.  */
+#define NEXTCHECK_CHANGED_KEYS 2
+
 
 
 static void write_record (ctrl_t ctrl, TRUSTREC *rec);
 static void do_sync (void);
 static int validate_keys (ctrl_t ctrl, int interactive);
+static gpg_error_t wot_state_get_nextcheck (ulong *r_nextcheck);
+static gpg_error_t wot_state_add_change (const char *hexfpr);
 
 
 /**********************************************
@@ -754,6 +764,40 @@ tdb_revalidation_mark (ctrl_t ctrl)
   pending_check_trustdb = 1;
 }
 
+/* Schedule a revalidation due to a change of the keyblock with the
+ * primary key PK.  If the validation state file of the last check is
+ * available, the key is appended to its list of changed keys so that
+ * the next check may restrict itself to these keys.  */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  char hexfpr[2*MAX_FINGERPRINT_LEN+1];
+  ulong scheduled, nextcheck;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  scheduled = tdbio_read_nextcheck ();
+  if (scheduled != 1 && scheduled != NEXTCHECK_CHANGED_KEYS)
+    {
+      /* The state file is only of use if it was written by the same
+       * check which stored the current nextcheck value.  */
+      if (wot_state_get_nextcheck (&nextcheck) || nextcheck != scheduled)
+        scheduled = 1;
+    }
+  if (scheduled == 1
+      || wot_state_add_change (hexfingerprint (pk, hexfpr, sizeof hexfpr)))
+    {
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  if (tdbio_write_nextcheck (ctrl, NEXTCHECK_CHANGED_KEYS))
+    do_sync ();
+  pending_check_trustdb = 1;
+}
+
 int
 trustdb_pending_check(void)
 {
@@ -2123,6 +2167,30 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   return NULL;
 }
 
+/* Clear the validity of all user IDs of PK like reset_trust_records
+ * does for all keys.  Caller must sync.  */
+static void
+reset_key_validity (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC trec, vrec;
+  ulong recno;
+
+  if (read_trust_record (ctrl, pk, &trec))
+    return;
+
+  for (recno = trec.r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK)
+          || vrec.r.valid.marginal_count || vrec.r.valid.full_count)
+        {
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (ctrl, &vrec);
+        }
+    }
+}
+
 /* Caller must sync */
 static void
 reset_trust_records (ctrl_t ctrl)
@@ -2167,6 +2235,625 @@ reset_trust_records (ctrl_t ctrl)
     }
 }
 
+/* Return the minimum ownertrust implied by a trust signature with the
+ * value TRUST_VALUE.  */
+static unsigned int
+min_ownertrust_from_trust_value (byte trust_value)
+{
+  /* 120 and 60 are as per RFC2440 */
+  if (trust_value >= 120)
+    return TRUST_FULLY;
+  else if (trust_value >= 60)
+    return TRUST_MARGINAL;
+  return 0;
+}
+
+
+/* Return a new item for the list of signers used at the next depth
+ * created from the validated key PK.  */
+static struct key_item *
+new_signer_key_item (ctrl_t ctrl, PKT_public_key *pk)
+{
+  struct key_item *k;
+
+  k = new_key_item ();
+  keyid_from_pk (pk, k->kid);
+  k->ownertrust = (tdb_get_ownertrust (ctrl, pk, 0) & TRUST_MASK);
+  k->min_ownertrust = tdb_get_min_ownertrust (ctrl, pk, 0);
+  k->trust_depth = pk->trust_depth;
+  k->trust_value = pk->trust_value;
+  if (pk->trust_regexp)
+    k->trust_regexp = xstrdup (pk->trust_regexp);
+  return k;
+}
+
+
+/*
+ * The validation state file.
+ *
+ * A full run of validate_keys records the signers used at each depth
+ * in a file next to the trustdb.  Import and edit-key append the
+ * fingerprints of the keys they change to that file (see
+ * tdb_revalidation_mark_key).  As long as none of these changes
+ * alters the list of signers, validate_changed_keys can bring the
+ * trustdb up to date by revalidating only the changed keys instead
+ * of walking the entire web of trust again.  The file is line based:
+ *
+ *   v <version> <model> <marginals> <completes> <depth> <level> <nextcheck>
+ *   u <keyid>
+ *   k <depth> <keyid> <ownertrust> <trust_depth> <trust_value> [=<regexp>]
+ *   c <fingerprint>
+ *
+ * The "v" line is always the first line; it gives the options used
+ * for the run and the nextcheck value it stored.  There is one "u"
+ * line for each ultimately trusted key and one "k" line for each
+ * signer at DEPTH with the values as used by validate_one_keyblock;
+ * the regexp is percent-plus escaped.  The "c" lines list the keys
+ * changed since then.
+ */
+
+/* Return a malloced string with the name of the state file.  */
+static char *
+wot_state_fname (void)
+{
+  return xstrconcat (tdbio_get_dbname (), ".wot", NULL);
+}
+
+
+/* Parse the "v" line LINE and check that it matches the current
+ * options.  On success the nextcheck value is stored at R_NEXTCHECK.
+ * LINE is modified.  */
+static gpg_error_t
+wot_state_parse_header (char *line, ulong *r_nextcheck)
+{
+  const char *fields[8];
+
+  trim_trailing_spaces (line);
+  if (split_fields (line, fields, DIM (fields)) != DIM (fields)
+      || strcmp (fields[0], "v")
+      || atoi (fields[1]) != WOT_STATE_VERSION
+      || atoi (fields[2]) != opt.trust_model
+      || atoi (fields[3]) != opt.marginals_needed
+      || atoi (fields[4]) != opt.completes_needed
+      || atoi (fields[5]) != opt.max_cert_depth
+      || atoi (fields[6]) != opt.min_cert_level)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  *r_nextcheck = strtoul (fields[7], NULL, 10);
+  return 0;
+}
+
+
+/* Parse the 16 hex digit key ID S into KID.  */
+static gpg_error_t
+wot_state_parse_keyid (const char *s, u32 *kid)
+{
+  byte buf[8];
+
+  if (strlen (s) != 16 || hex2bin (s, buf, 8) < 0)
+    return gpg_error (GPG_ERR_INV_DATA);
+  kid[0] = buf32_to_u32 (buf);
+  kid[1] = buf32_to_u32 (buf+4);
+  return 0;
+}
+
+
+/* Parse the NFIELDS FIELDS of a "k" line into a new key item and
+ * store its depth at R_DEPTH.  Returns NULL on error.  */
+static struct key_item *
+wot_state_parse_signer (const char **fields, int nfields, int *r_depth)
+{
+  struct key_item *k;
+
+  if (nfields < 6 || nfields > 7 || (nfields == 7 && *fields[6] != '='))
+    return NULL;
+
+  k = new_key_item ();
+  if (wot_state_parse_keyid (fields[2], k->kid))
+    {
+      release_key_items (k);
+      return NULL;
+    }
+  *r_depth = atoi (fields[1]);
+  k->ownertrust = atoi (fields[3]);
+  k->trust_depth = atoi (fields[4]);
+  k->trust_value = atoi (fields[5]);
+  if (nfields == 7)
+    {
+      k->trust_regexp = xstrdup (fields[6] + 1);
+      k->trust_regexp[percent_plus_unescape_inplace (k->trust_regexp, 0)] = 0;
+    }
+  return k;
+}
+
+
+/* Store the nextcheck value recorded in the state file at
+ * R_NEXTCHECK.  Returns an error if there is no usable state file.  */
+static gpg_error_t
+wot_state_get_nextcheck (ulong *r_nextcheck)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp;
+  char *line = NULL;
+  size_t maxlen = 0;
+
+  fname = wot_state_fname ();
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    err = gpg_error_from_syserror ();
+  else if (es_read_line (fp, &line, &maxlen, NULL) <= 0)
+    err = gpg_error (GPG_ERR_INV_DATA);
+  else
+    err = wot_state_parse_header (line, r_nextcheck);
+  es_free (line);
+  es_fclose (fp);
+  xfree (fname);
+  return err;
+}
+
+
+/* Append the hex fingerprint HEXFPR to the list of changed keys in
+ * the state file.  */
+static gpg_error_t
+wot_state_add_change (const char *hexfpr)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  estream_t fp;
+
+  fname = wot_state_fname ();
+  fp = es_fopen (fname, "a");
+  if (!fp)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      es_fprintf (fp, "c %s\n", hexfpr);
+      if (es_fclose (fp))
+        err = gpg_error_from_syserror ();
+    }
+  if (err)
+    log_error ("error writing '%s': %s\n", fname, gpg_strerror (err));
+  xfree (fname);
+  return err;
+}
+
+
+/* Append "k" lines for the signers in KLIST used at DEPTH to the
+ * stream FP.  */
+static gpg_error_t
+wot_state_put_klist (estream_t fp, int depth, struct key_item *klist)
+{
+  struct key_item *k;
+  char *p;
+
+  for (k = klist; k; k = k->next)
+    {
+      es_fprintf (fp, "k %d %08lX%08lX %u %u %u", depth,
+                  (ulong)k->kid[0], (ulong)k->kid[1],
+                  k->ownertrust, k->trust_depth, k->trust_value);
+      if (k->trust_regexp)
+        {
+          p = percent_plus_escape (k->trust_regexp);
+          if (!p)
+            return gpg_error_from_syserror ();
+          es_fprintf (fp, " =%s", p);
+          xfree (p);
+        }
+      es_putc ('\n', fp);
+    }
+
+  return es_ferror (fp)? gpg_error_from_syserror () : 0;
+}
+
+
+/* Write a new state file with a "v" line for the current options and
+ * NEXTCHECK, followed by the "u" and "k" lines read from SRCFP.  This
+ * function takes ownership of SRCFP.  */
+static gpg_error_t
+wot_state_write (estream_t srcfp, ulong nextcheck)
+{
+  gpg_error_t err = 0;
+  char *fname, *tmpfname;
+  estream_t fp;
+  char *line = NULL;
+  size_t maxlen = 0;
+  ssize_t len;
+
+  fname = wot_state_fname ();
+  tmpfname = xstrconcat (fname, ".tmp", NULL);
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  es_fprintf (fp, "v %d %d %d %d %d %d %lu\n", WOT_STATE_VERSION,
+              opt.trust_model, opt.marginals_needed, opt.completes_needed,
+              opt.max_cert_depth, opt.min_cert_level, nextcheck);
+  es_rewind (srcfp);
+  while ((len = es_read_line (srcfp, &line, &maxlen, NULL)) > 0)
+    if ((*line == 'u' || *line == 'k') && line[1] == ' ')
+      es_fwrite (line, len, 1, fp);
+  if (len < 0)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  /* We need to close SRCFP before the rename in case it is the
+   * current state file.  */
+  es_fclose (srcfp);
+  srcfp = NULL;
+
+  if (es_fclose (fp))
+    {
+      fp = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = NULL;
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+
+ leave:
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n", fname, gpg_strerror (err));
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+    }
+  es_fclose (srcfp);
+  es_free (line);
+  xfree (tmpfname);
+  xfree (fname);
+  return err;
+}
+
+
+/* Remove the state file.  */
+static void
+wot_state_remove (void)
+{
+  char *fname;
+
+  fname = wot_state_fname ();
+  if (gnupg_remove (fname) && errno != ENOENT)
+    log_error (_("can't remove '%s': %s\n"), fname,
+               gpg_strerror (gpg_error_from_syserror ()));
+  xfree (fname);
+}
+
+
+/* Return true if the signer entries A at DEPTH_A and B at DEPTH_B are
+ * the same.  A and B may be NULL.  */
+static int
+same_signer_p (struct key_item *a, int depth_a,
+               struct key_item *b, int depth_b)
+{
+  if (!a || !b)
+    return !a && !b;
+
+  return (depth_a == depth_b
+          && a->ownertrust == b->ownertrust
+          && a->trust_depth == b->trust_depth
+          && a->trust_value == b->trust_value
+          && !a->trust_regexp == !b->trust_regexp
+          && (!a->trust_regexp || !strcmp (a->trust_regexp, b->trust_regexp)));
+}
+
+
+/* An item of the list of changed keys used by validate_changed_keys.  */
+struct changed_key_s
+{
+  struct changed_key_s *next;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 kid[2];
+  struct key_item *old_signer;  /* Its entry in the state file or NULL.  */
+  int old_depth;                /* The depth of that entry.  */
+};
+
+
+/* Try to bring the trustdb up to date by revalidating only the keys
+ * listed as changed in the state file.  This is the same as steps 4
+ * to 8 of validate_keys restricted to these keys, with the signers
+ * at each depth taken from the state file.  That is only correct if
+ * none of the changed keys would now be listed with other values
+ * among the signers; otherwise the change may affect other keys as
+ * well.  Returns true if the trustdb has been updated; if not the
+ * caller needs to do a full run.  */
+static int
+validate_changed_keys (ctrl_t ctrl)
+{
+  char *fname;
+  estream_t fp = NULL;
+  char *line = NULL;
+  size_t maxlen = 0;
+  ssize_t len;
+  const char *fields[7];
+  int nfields;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 kid[2];
+  ulong nextcheck;
+  u32 start_time, next_expire;
+  KeyHashTable utks = NULL;
+  KeyHashTable changed_kids = NULL;
+  KeyHashTable signer_kids = NULL;
+  struct changed_key_s *changed = NULL;
+  struct changed_key_s *ck;
+  struct key_item **klists = NULL;
+  struct key_item *k;
+  struct key_item *newk = NULL;
+  kbnode_t keyblock = NULL;
+  kbnode_t node;
+  PKT_public_key *pk;
+  int nutks, nchanged, ndepths, depth, newdepth;
+  int done = 0;
+  gpg_error_t err;
+
+  if (!(opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC
+        || opt.trust_model == TM_TOFU_PGP))
+    return 0;
+  if (tdbio_read_nextcheck () != NEXTCHECK_CHANGED_KEYS)
+    return 0;
+
+  fname = wot_state_fname ();
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    goto leave;
+  if (es_read_line (fp, &line, &maxlen, NULL) <= 0
+      || wot_state_parse_header (line, &nextcheck))
+    goto leave;
+
+  /* If a key or signature expired in the meantime we need a full
+   * run.  */
+  start_time = make_timestamp ();
+  if (nextcheck && nextcheck <= start_time)
+    goto leave;
+  next_expire = nextcheck? nextcheck : 0xffffffff;
+
+  /* First pass: Read the ultimately trusted keys and the changed
+   * keys.  Collect the key IDs of all signers of the changed keys.  */
+  utks = new_key_hash_table ();
+  changed_kids = new_key_hash_table ();
+  signer_kids = new_key_hash_table ();
+  nutks = nchanged = 0;
+  while ((len = es_read_line (fp, &line, &maxlen, NULL)) > 0)
+    {
+      trim_trailing_spaces (line);
+      nfields = split_fields (line, fields, DIM (fields));
+      if (nfields == 2 && !strcmp (fields[0], "u"))
+        {
+          if (wot_state_parse_keyid (fields[1], kid))
+            goto leave;
+          add_key_hash_table (utks, kid);
+          nutks++;
+        }
+      else if (nfields == 2 && !strcmp (fields[0], "c"))
+        {
+          fprlen = strlen (fields[1]) / 2;
+          if (fprlen < 20 || fprlen > MAX_FINGERPRINT_LEN
+              || hex2bin (fields[1], fpr, fprlen) < 0)
+            goto leave;
+          keyid_from_fingerprint (ctrl, fpr, fprlen, kid);
+          if (test_key_hash_table (changed_kids, kid))
+            continue;
+          add_key_hash_table (changed_kids, kid);
+
+          ck = xcalloc (1, sizeof *ck);
+          memcpy (ck->fpr, fpr, fprlen);
+          ck->fprlen = fprlen;
+          ck->kid[0] = kid[0];
+          ck->kid[1] = kid[1];
+          ck->next = changed;
+          changed = ck;
+          nchanged++;
+
+          if (!get_keyblock_byfpr_fast (ctrl, &keyblock, NULL,
+                                        fpr, fprlen, 0))
+            {
+              for (node = keyblock; node; node = node->next)
+                if (node->pkt->pkttype == PKT_SIGNATURE)
+                  add_key_hash_table (signer_kids,
+                                      node->pkt->pkt.signature->keyid);
+              release_kbnode (keyblock);
+              keyblock = NULL;
+            }
+        }
+    }
+  if (len < 0)
+    goto leave;
+
+  /* The ultimately trusted keys must not have changed.  */
+  for (k = utk_list; k; k = k->next, nutks--)
+    if (!test_key_hash_table (utks, k->kid)
+        || test_key_hash_table (changed_kids, k->kid))
+      goto leave;
+  if (nutks)
+    goto leave;
+
+  /* Second pass: Build the lists of signers at each depth, restricted
+   * to the signers of the changed keys, and look up the current
+   * entries of the changed keys.  */
+  klists = xcalloc (opt.max_cert_depth, sizeof *klists);
+  ndepths = 0;
+  es_rewind (fp);
+  while ((len = es_read_line (fp, &line, &maxlen, NULL)) > 0)
+    {
+      trim_trailing_spaces (line);
+      nfields = split_fields (line, fields, DIM (fields));
+      if (nfields < 1 || strcmp (fields[0], "k"))
+        continue;
+
+      k = wot_state_parse_signer (fields, nfields, &depth);
+      if (!k || depth < 0 || depth >= opt.max_cert_depth)
+        {
+          release_key_items (k);
+          goto leave;
+        }
+      if (depth >= ndepths)
+        ndepths = depth + 1;
+
+      if (test_key_hash_table (changed_kids, k->kid))
+        {
+          for (ck = changed; ck; ck = ck->next)
+            if (ck->kid[0] == k->kid[0] && ck->kid[1] == k->kid[1])
+              break;
+          if (ck->old_signer)
+            {
+              release_key_items (k);
+              goto leave;  /* Duplicate entry.  */
+            }
+          ck->old_signer = copy_key_item (k);
+          ck->old_depth = depth;
+        }
+
+      if (test_key_hash_table (signer_kids, k->kid))
+        {
+          k->next = klists[depth];
+          klists[depth] = k;
+        }
+      else
+        release_key_items (k);
+    }
+  if (len < 0)
+    goto leave;
+
+  /* Now revalidate the changed keys.  */
+  for (ck = changed; ck; ck = ck->next)
+    {
+      newdepth = 0;
+      err = get_keyblock_byfpr_fast (ctrl, &keyblock, NULL,
+                                     ck->fpr, ck->fprlen, 0);
+      if (!err)
+        reset_key_validity (ctrl, keyblock->pkt->pkt.public_key);
+      for (depth = 0; !err && depth < ndepths; depth++)
+        {
+          if (!keyblock
+              && get_keyblock_byfpr_fast (ctrl, &keyblock, NULL,
+                                          ck->fpr, ck->fprlen, 0))
+            goto leave;
+
+          merge_keys_and_selfsig (ctrl, keyblock);
+          clear_kbnode_flags (keyblock);
+          pk = keyblock->pkt->pkt.public_key;
+          if (pk->has_expired || pk->flags.revoked)
+            break;
+
+          if (validate_one_keyblock (ctrl, keyblock, klists[depth],
+                                     start_time, &next_expire))
+            {
+              int any_full = 0;
+              int all_full = 1;
+
+              if (pk->expiredate && pk->expiredate >= start_time
+                  && pk->expiredate < next_expire)
+                next_expire = pk->expiredate;
+
+              store_validation_status (ctrl, depth, keyblock);
+
+              for (node = keyblock; node; node = node->next)
+                if (node->pkt->pkttype == PKT_USER_ID)
+                  {
+                    if ((node->flag & 4))
+                      any_full = 1;
+                    else
+                      all_full = 0;
+                  }
+
+              /* This key is now a signer at the next depth.  */
+              if (any_full && !newk && depth + 1 < opt.max_cert_depth)
+                {
+                  unsigned int min;
+
+                  newk = new_signer_key_item (ctrl, pk);
+                  newdepth = depth + 1;
+                  min = min_ownertrust_from_trust_value (newk->trust_value);
+                  if (newk->ownertrust < min)
+                    newk->ownertrust = min;
+                }
+
+              if (all_full)
+                break;
+            }
+          release_kbnode (keyblock);
+          keyblock = NULL;
+        }
+      release_kbnode (keyblock);
+      keyblock = NULL;
+
+      if (!same_signer_p (newk, newdepth, ck->old_signer, ck->old_depth))
+        {
+          if (opt.verbose)
+            log_info ("key %s changed its signer entry"
+                      " - full trustdb check required\n", keystr (ck->kid));
+          goto leave;
+        }
+      release_key_items (newk);
+      newk = NULL;
+    }
+
+  if (next_expire == 0xffffffff || next_expire < start_time)
+    nextcheck = 0;
+  else
+    nextcheck = next_expire;
+
+  /* Write the state file without the list of changes.  */
+  err = wot_state_write (fp, nextcheck);
+  fp = NULL;
+  if (err)
+    goto leave;
+
+  tdbio_write_nextcheck (ctrl, nextcheck);
+  if (!opt.quiet)
+    {
+      log_info (ngettext ("%d changed key revalidated\n",
+                          "%d changed keys revalidated\n",
+                          nchanged), nchanged);
+      if (nextcheck)
+        log_info (_("next trustdb check due at %s\n"),
+                  strtimestamp (nextcheck));
+    }
+
+  err = tdbio_update_version_record (ctrl);
+  if (err)
+    {
+      log_error (_("unable to update trustdb version record: "
+                   "write failed: %s\n"), gpg_strerror (err));
+      tdbio_invalid ();
+    }
+
+  do_sync ();
+  pending_check_trustdb = 0;
+  done = 1;
+
+ leave:
+  release_key_items (newk);
+  release_kbnode (keyblock);
+  while (changed)
+    {
+      ck = changed->next;
+      release_key_items (changed->old_signer);
+      xfree (changed);
+      changed = ck;
+    }
+  if (klists)
+    {
+      for (depth = 0; depth < opt.max_cert_depth; depth++)
+        release_key_items (klists[depth]);
+      xfree (klists);
+    }
+  release_key_hash_table (signer_kids);
+  release_key_hash_table (changed_kids);
+  release_key_hash_table (utks);
+  es_free (line);
+  es_fclose (fp);
+  xfree (fname);
+  return done;
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -2192,7 +2879,7 @@ reset_trust_records (ctrl_t ctrl)
  *
  */
 static int
-validate_keys (ctrl_t ctrl, int interactive)
+validate_keys_1 (ctrl_t ctrl, int interactive)
 {
   int rc = 0;
   int quit=0;
@@ -2207,6 +2894,16 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable used, full_trust;
   u32 start_time, next_expire;
+  estream_t wotfp = NULL;
+
+  /* If only some keys have been changed since the last run, it is
+     often sufficient to revalidate just these keys.  */
+  if (!interactive && validate_changed_keys (ctrl))
+    return 0;
+
+  /* The state file describes the last run which we are going to
+     replace.  */
+  wot_state_remove ();
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
@@ -2226,6 +2923,14 @@ validate_keys (ctrl_t ctrl, int interactive)
 
   reset_trust_records (ctrl);
 
+  /* Collect the signers used at each depth for the state file.  */
+  if (opt.trust_model != TM_TOFU)
+    wotfp = es_fopenmem (0, "w+b");
+  if (wotfp)
+    for (k=utk_list; k; k = k->next)
+      es_fprintf (wotfp, "u %08lX%08lX\n",
+                  (ulong)k->kid[0], (ulong)k->kid[1]);
+
   /* Step 1 */
   /* Fixme: Instead of always building a UTK list, we could just build it
    * here when needed */
@@ -2306,13 +3011,7 @@ validate_keys (ctrl_t ctrl, int interactive)
       ot_marginal = ot_full = ot_ultimate = 0;
       for (k=klist; k; k = k->next)
         {
-	  int min=0;
-
-	  /* 120 and 60 are as per RFC2440 */
-	  if(k->trust_value>=120)
-	    min=TRUST_FULLY;
-	  else if(k->trust_value>=60)
-	    min=TRUST_MARGINAL;
+	  int min = min_ownertrust_from_trust_value (k->trust_value);
 
 	  if(min!=k->min_ownertrust)
 	    update_min_ownertrust (ctrl, k->kid,min);
@@ -2360,6 +3059,12 @@ validate_keys (ctrl_t ctrl, int interactive)
 	  valids++;
         }
 
+      if (wotfp && wot_state_put_klist (wotfp, depth, klist))
+        {
+          es_fclose (wotfp);
+          wotfp = NULL;
+        }
+
       /* Step 4: Find all keys which are signed by a key in klist */
       keys = validate_key_list (ctrl, kdb, full_trust, klist,
 				start_time, &next_expire);
@@ -2407,23 +3112,8 @@ validate_keys (ctrl_t ctrl, int interactive)
 			 since we aren't using this hash as a skipfnc,
 			 that doesn't matter here. */
 		      add_key_hash_table (used,kid);
-		      k = new_key_item ();
-		      k->kid[0]=kid[0];
-		      k->kid[1]=kid[1];
-		      k->ownertrust =
-			(tdb_get_ownertrust
-                           (ctrl, kar->keyblock->pkt->pkt.public_key, 0)
-                         & TRUST_MASK);
-		      k->min_ownertrust = tdb_get_min_ownertrust
-                        (ctrl, kar->keyblock->pkt->pkt.public_key, 0);
-		      k->trust_depth=
-			kar->keyblock->pkt->pkt.public_key->trust_depth;
-		      k->trust_value=
-			kar->keyblock->pkt->pkt.public_key->trust_value;
-		      if(kar->keyblock->pkt->pkt.public_key->trust_regexp)
-			k->trust_regexp=
-			  xstrdup(kar->keyblock->pkt->
-				   pkt.public_key->trust_regexp);
+		      k = new_signer_key_item
+                        (ctrl, kar->keyblock->pkt->pkt.public_key);
 		      k->next = klist;
 		      klist = k;
 		      break;
@@ -2449,6 +3139,14 @@ validate_keys (ctrl_t ctrl, int interactive)
     {
       int rc2;
 
+      if (wotfp)
+        {
+          wot_state_write (wotfp, (next_expire == 0xffffffff
+                                   || next_expire < start_time)?
+                           0 : next_expire);
+          wotfp = NULL;
+        }
+
       if (next_expire == 0xffffffff || next_expire < start_time )
         tdbio_write_nextcheck (ctrl, 0);
       else
@@ -2470,6 +3168,41 @@ validate_keys (ctrl_t ctrl, int interactive)
       do_sync ();
       pending_check_trustdb = 0;
     }
+  es_fclose (wotfp);
 
   return rc;
 }
+
+
+/* Wrapper around validate_keys_1 to run a non-interactive check in a
+ * trustdb transaction.  The updated records are then kept in the
+ * record cache and written in batches after a key has been processed;
+ * on error the records of the batch not yet written are dropped.  An
+ * interactive check is not run in a transaction so that the ownertrust
+ * values entered by the user are written at once.  */
+static int
+validate_keys (ctrl_t ctrl, int interactive)
+{
+  int rc, rc2;
+
+  if (interactive)
+    return validate_keys_1 (ctrl, 1);
+
+  rc = tdbio_begin_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+      return rc;
+    }
+  rc = validate_keys_1 (ctrl, 0);
+  if (rc)
+    rc2 = tdbio_cancel_transaction ();
+  else
+    rc2 = tdbio_end_transaction ();
+  if (rc2)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc2));
+      g10_exit (2);
+    }
+  return rc;
+}
@@ -0,0 +1,268 @@
+/* workqueue.c - Jobs processed by a set of worker threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A work queue is used by the AEAD filters and the import to have
+ * some expensive operation done by nPth threads while the main thread
+ * does the I/O.  The caller owns the jobs and their state; the queue
+ * only hands them over to the workers in the order they are put.  All
+ * job states are to be changed with the queue's lock held so that the
+ * caller can wait for a job using workqueue_wait.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/sysutils.h"
+#include "options.h"
+#include "workqueue.h"
+
+
+/* A worker thread.  */
+struct workqueue_worker_s
+{
+  workqueue_t wq;
+  void *data;           /* The WORKER_DATA for the job function.  */
+  npth_t thd;
+};
+
+/* The queue object.  The queued jobs are kept in a ring buffer of
+ * SIZE slots starting at HEAD.  */
+struct workqueue_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;     /* Signaled on each state change.  */
+  int stop;             /* Request the workers to terminate.  */
+  workqueue_job_fnc_t job_fnc;
+  workqueue_done_fnc_t done_fnc;
+  int nworkers;
+  struct workqueue_worker_s workers[WORKQUEUE_MAX_WORKERS];
+  int head;
+  int nqueued;
+  int size;
+  void *queue[1];
+};
+
+
+/* Return the number of worker threads to use, but not more than MAX.
+ * Returns 0 if parallel processing has not been enabled or is not
+ * worthwhile on this box.  */
+int
+workqueue_max_workers (int max)
+{
+  int n;
+
+  if (!(opt.compat_flags & COMPAT_PARALLELIZED))
+    return 0;
+  n = gnupg_get_ncpus ();
+  if (n > max)
+    n = max;
+  if (n > WORKQUEUE_MAX_WORKERS)
+    n = WORKQUEUE_MAX_WORKERS;
+  return n < 2? 0 : n;
+}
+
+
+void
+workqueue_lock (workqueue_t wq)
+{
+  int rc = npth_mutex_lock (&wq->lock);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+void
+workqueue_unlock (workqueue_t wq)
+{
+  int rc = npth_mutex_unlock (&wq->lock);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Wait until a worker has finished a job.  The lock must be held.  */
+void
+workqueue_wait (workqueue_t wq)
+{
+  npth_cond_wait (&wq->cond, &wq->lock);
+}
+
+
+/* Hand JOB over to the workers.  The lock must be held and not more
+ * than MAXJOBS jobs may be queued at a time.  */
+void
+workqueue_put (workqueue_t wq, void *job)
+{
+  log_assert (wq->nqueued < wq->size);
+  wq->queue[(wq->head + wq->nqueued) % wq->size] = job;
+  wq->nqueued++;
+  npth_cond_broadcast (&wq->cond);
+}
+
+
+/* The thread function of a worker.  It takes the oldest queued job
+ * and processes it.  */
+static void *
+worker_thread (void *arg)
+{
+  struct workqueue_worker_s *worker = arg;
+  workqueue_t wq = worker->wq;
+  void *job;
+
+  workqueue_lock (wq);
+  for (;;)
+    {
+      if (!wq->nqueued)
+        {
+          if (wq->stop)
+            break;
+          npth_cond_wait (&wq->cond, &wq->lock);
+          continue;
+        }
+      job = wq->queue[wq->head];
+      wq->head = (wq->head + 1) % wq->size;
+      wq->nqueued--;
+      workqueue_unlock (wq);
+
+      wq->job_fnc (worker->data, job);
+
+      workqueue_lock (wq);
+      if (wq->done_fnc)
+        wq->done_fnc (job);
+      npth_cond_broadcast (&wq->cond);
+    }
+  workqueue_unlock (wq);
+
+  return NULL;
+}
+
+
+/* Create a new queue for up to MAXJOBS queued jobs and store it at
+ * R_WQ.  JOB_FNC is the function run by the workers for each job and
+ * the optional DONE_FNC is called after that with the lock held.  The
+ * queue has no workers yet; see workqueue_add_worker.  */
+gpg_error_t
+workqueue_new (workqueue_t *r_wq, int maxjobs,
+               workqueue_job_fnc_t job_fnc, workqueue_done_fnc_t done_fnc)
+{
+  gpg_error_t err;
+  workqueue_t wq;
+  int rc;
+
+  *r_wq = NULL;
+  log_assert (maxjobs > 0);
+
+  wq = xtrycalloc (1, sizeof *wq + (maxjobs - 1) * sizeof wq->queue[0]);
+  if (!wq)
+    return gpg_error_from_syserror ();
+  wq->size = maxjobs;
+  wq->job_fnc = job_fnc;
+  wq->done_fnc = done_fnc;
+
+  rc = npth_mutex_init (&wq->lock, NULL);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      xfree (wq);
+      return err;
+    }
+  rc = npth_cond_init (&wq->cond, NULL);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      npth_mutex_destroy (&wq->lock);
+      xfree (wq);
+      return err;
+    }
+
+  *r_wq = wq;
+  return 0;
+}
+
+
+/* Start another worker thread for WQ.  WORKER_DATA is passed to the
+ * job function for all jobs processed by this thread; it must be
+ * valid until the queue is released.  */
+gpg_error_t
+workqueue_add_worker (workqueue_t wq, void *worker_data)
+{
+  struct workqueue_worker_s *worker;
+  npth_attr_t tattr;
+  int rc;
+
+  if (wq->nworkers >= WORKQUEUE_MAX_WORKERS)
+    return gpg_error (GPG_ERR_TOO_MANY);
+
+  worker = wq->workers + wq->nworkers;
+  worker->wq = wq;
+  worker->data = worker_data;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&worker->thd, &tattr, worker_thread, worker);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+
+  wq->nworkers++;
+  return 0;
+}
+
+
+/* Return the number of running workers of WQ.  */
+int
+workqueue_nworkers (workqueue_t wq)
+{
+  return wq->nworkers;
+}
+
+
+/* Terminate the workers and release WQ.  Jobs which have not yet
+ * been taken by a worker are dropped; jobs being processed are
+ * finished first.  The lock may not be held.  */
+void
+workqueue_release (workqueue_t wq)
+{
+  int i;
+
+  if (!wq)
+    return;
+
+  workqueue_lock (wq);
+  wq->stop = 1;
+  wq->nqueued = 0;
+  npth_cond_broadcast (&wq->cond);
+  workqueue_unlock (wq);
+
+  for (i = 0; i < wq->nworkers; i++)
+    npth_join (wq->workers[i].thd, NULL);
+
+  npth_cond_destroy (&wq->cond);
+  npth_mutex_destroy (&wq->lock);
+  xfree (wq);
+}
@@ -0,0 +1,53 @@
+/* workqueue.h - Jobs processed by a set of worker threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_WORKQUEUE_H
+#define GNUPG_G10_WORKQUEUE_H
+
+/* The maximum number of worker threads of a queue.  */
+#define WORKQUEUE_MAX_WORKERS 16
+
+struct workqueue_s;
+typedef struct workqueue_s *workqueue_t;
+
+/* The function to process JOB.  It is called by a worker thread
+ * without the queue's lock held.  WORKER_DATA is the value given to
+ * workqueue_add_worker for this thread.  */
+typedef void (*workqueue_job_fnc_t) (void *worker_data, void *job);
+
+/* The function called by a worker thread with the queue's lock held
+ * after JOB has been processed.  It is used to mark the job as done;
+ * waiters are woken up after it returns.  */
+typedef void (*workqueue_done_fnc_t) (void *job);
+
+int workqueue_max_workers (int max);
+gpg_error_t workqueue_new (workqueue_t *r_wq, int maxjobs,
+                           workqueue_job_fnc_t job_fnc,
+                           workqueue_done_fnc_t done_fnc);
+gpg_error_t workqueue_add_worker (workqueue_t wq, void *worker_data);
+int workqueue_nworkers (workqueue_t wq);
+void workqueue_release (workqueue_t wq);
+
+void workqueue_lock (workqueue_t wq);
+void workqueue_unlock (workqueue_t wq);
+void workqueue_wait (workqueue_t wq);
+void workqueue_put (workqueue_t wq, void *job);
+
+#endif /*GNUPG_G10_WORKQUEUE_H*/
@@ -21,8 +21,19 @@
 /*
  * This cache backend is designed to be queried first and to deliver
  * cached items (which may also be not-found).  A set a maintenance
- * functions is used used by the frontend to fill the cache.
- * FIXME: Support x.509
+ * functions is used used by the frontend to fill the cache.  Only the
+ * first result of a search is delivered from the cache; if the caller
+ * continues the search, the actual database is searched and the key
+ * already returned is skipped.
+ *
+ * All cached objects are kept on a single LRU list and the memory
+ * they use is charged against a byte budget which can be set with
+ * the --cache-size option.  If the budget is exceeded the least
+ * recently used objects are evicted.  The hash tables are enlarged
+ * as needed so that lookups stay O(1).  Note that none of the
+ * functions here yield to other nPth threads; the reference counters
+ * protect objects which are handed to callers which may yield while
+ * using them.
  */
 
 #include <config.h>
@@ -38,12 +49,14 @@
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
-#define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
-#define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+/* The default and the minimum size of the cache in bytes.  */
+#define DEFAULT_CACHE_SIZE  (16*1024*1024)
+#define MIN_CACHE_SIZE      (256*1024)
+
+/* The initial number of buckets of the hash tables and the average
+ * number of items per bucket which triggers an enlargement.  */
+#define INITIAL_TABLE_SIZE  383
+#define MAX_ITEMS_PER_BUCKET  2
 
 
 /* Our definition of the backend handle.  */
@@ -54,13 +67,49 @@ struct backend_handle_s
 };
 
 
+/* The types of the cached objects.  */
+enum cache_obj_types
+  {
+   CACHE_OBJ_BLOB,
+   CACHE_OBJ_KEY
+  };
+
+
+/* The header of all cached objects.  This must be the first member
+ * of the actual object.  */
+typedef struct cache_obj_s
+{
+  struct cache_obj_s *lru_prev;  /* The next more recently used object. */
+  struct cache_obj_s *lru_next;  /* The next less recently used object. */
+  enum cache_obj_types type;
+  size_t size;                   /* The number of bytes charged.  */
+} *cache_obj_t;
+
+
+/* The LRU list.  The head is the most recently used object.  */
+static cache_obj_t lru_head;
+static cache_obj_t lru_tail;
+
+static size_t cache_size;   /* The budget in bytes.  */
+
+/* Bumped by each invalidation of the cache.  See
+ * db_request_s.cache_generation.  */
+static unsigned int cache_generation;
+static size_t cache_used;   /* The bytes charged by all cached objects.  */
+
+/* Counters for GETINFO.  */
+static struct be_cache_stats_s cache_stats;
+
+
 /* The object holding a blob.  */
 typedef struct blob_s
 {
-  struct blob_s *next;
+  struct cache_obj_s obj;     /* Must be the first member.  */
+  struct blob_s *next;        /* The next blob in the bucket.  */
   enum pubkey_types pktype;
+  unsigned int ephemeral:1;   /* The key is marked as ephemeral.  */
+  unsigned int revoked:1;     /* The key is marked as revoked.  */
   unsigned int refcount;
-  unsigned int usecount;
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
   unsigned char ubid[UBID_LEN];
@@ -69,281 +118,346 @@ typedef struct blob_s
 
 static blob_t *blob_table;                /* Hash table with the blobs.   */
 static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int blob_table_added;     /* Number of items added.       */
-static unsigned int blob_table_dropped;   /* Number of items dropped.     */
-static blob_t blob_attic;                 /* List of freed blobs.         */
-
-
-/* A list item to blob data.  This is so that a next operation on a
- * cached key item can actually work.  Things are complicated because
- * we do not want to force caching all object before we get a next
- * request from the client.  To accomplish this we keep a flag
- * indicating that the search needs to continue instead of delivering
- * the previous item from the cache.  */
+static size_t blob_table_count;           /* Number of blobs in the table.*/
+
+
+/* A list item to blob data.  Note that a bloblist is not guaranteed
+ * to list all blobs with a keyid; it only lists those which have been
+ * returned by a search.  */
 typedef struct bloblist_s
 {
   struct bloblist_s *next;
-  unsigned int final_kid:1;     /* The final blob for KID searches. */
-  unsigned int final_fpr:1;     /* The final blob for FPR searches. */
   unsigned int ubid_valid:1;    /* The blobid below is valid.   */
-  unsigned int subkey:1;        /* The entry is for a subkey.   */
   unsigned int fprlen:8;        /* The length of the fingerprint or 0.  */
+  unsigned int pkno:16;         /* 1 for the primary key, 2 for the
+                                 * first subkey, etc.  */
   char fpr[32];                 /* The buffer for the fingerprint.  */
   unsigned char ubid[UBID_LEN]; /* The Unique-Blob-ID of the blob.  */
 } *bloblist_t;
 
-static bloblist_t bloblist_attic;  /* List of freed items.  */
 
 /* The cache object.  For indexing we could use the fingerprint
  * directly as a hash value.  However, we use the keyid instead
  * because the keyid is used by OpenPGP in encrypted packets and older
  * signatures to identify a key.  Since v4 OpenPGP keys the keyid is
  * anyway a part of the fingerprint so it quickly extracted from a
- * fingerprint.  Note that v3 keys are not supported by gpg.
- * FIXME: Add support for X.509.
+ * fingerprint.  Note that v3 keys are not supported by gpg.  For
+ * X.509 the keyid is taken from the SHA-1 fingerprint the same way
+ * as for v4 keys.
  */
 typedef struct key_item_s
 {
-  struct key_item_s *next;
+  struct cache_obj_s obj;  /* Must be the first member.  */
+  struct key_item_s *next; /* The next key item in the bucket.  */
   bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
   unsigned int refcount;   /* Reference counter for this item.  */
+  unsigned int nf_types;   /* For not-found: the searched pubkey types.  */
   u32 kid_h;               /* Upper 4 bytes of the keyid.  */
   u32 kid_l;               /* Lower 4 bytes of the keyid.  */
 } *key_item_t;
 
 static key_item_t *key_table;            /* Hash table with the keys.    */
 static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int key_table_added;     /* Number of items added.       */
-static unsigned int key_table_dropped;   /* Number of items dropped.     */
-static key_item_t key_item_attic;        /* List of freed items.         */
+static size_t key_table_count;           /* Number of items in the table.*/
+
+
+/* Bit values for the NF_TYPES field.  */
+#define NF_TYPE_OPGP  1
+#define NF_TYPE_X509  2
+
+
+
+/* Return the pubkey types the search of CTRL is restricted to as a
+ * NF_TYPE bit mask.  */
+static unsigned int
+searched_types (ctrl_t ctrl)
+{
+  unsigned int types = 0;
+
+  if (ctrl->filter_opgp)
+    types |= NF_TYPE_OPGP;
+  if (ctrl->filter_x509)
+    types |= NF_TYPE_X509;
+  if (!types)  /* No filter means all types.  */
+    types = NF_TYPE_OPGP | NF_TYPE_X509;
+  return types;
+}
+
+
+/* Return true if a blob of PKTYPE may be returned to CTRL.  */
+static int
+pktype_allowed (ctrl_t ctrl, enum pubkey_types pktype)
+{
+  if (pktype == PUBKEY_TYPE_OPGP)
+    return !!(searched_types (ctrl) & NF_TYPE_OPGP);
+  if (pktype == PUBKEY_TYPE_X509)
+    return !!(searched_types (ctrl) & NF_TYPE_X509);
+  return 0;
+}
+
+
+/* Compute the keyid (R_KID_H,R_KID_L) from the fingerprint
+ * (FPR,FPRLEN).  Returns false for unsupported fingerprints.  */
+static int
+kid_from_fpr (const unsigned char *fpr, unsigned int fprlen,
+              u32 *r_kid_h, u32 *r_kid_l)
+{
+  if (fprlen < 20 || fprlen > 32)
+    return 0;  /* No support for v3 keys or unknown key versions.  */
+
+  if (fprlen == 20)  /* v4 key or X.509 */
+    {
+      *r_kid_h = buf32_to_u32 (fpr+12);
+      *r_kid_l = buf32_to_u32 (fpr+16);
+    }
+  else  /* v5 or later key */
+    {
+      *r_kid_h = buf32_to_u32 (fpr);
+      *r_kid_l = buf32_to_u32 (fpr+4);
+    }
+  return 1;
+}
+
+
+
+/* Put OBJ at the head of the LRU list.  */
+static void
+lru_link (cache_obj_t obj)
+{
+  obj->lru_prev = NULL;
+  obj->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = obj;
+  else
+    lru_tail = obj;
+  lru_head = obj;
+  cache_used += obj->size;
+}
 
 
+/* Remove OBJ from the LRU list.  */
+static void
+lru_unlink (cache_obj_t obj)
+{
+  if (obj->lru_prev)
+    obj->lru_prev->lru_next = obj->lru_next;
+  else
+    lru_head = obj->lru_next;
+  if (obj->lru_next)
+    obj->lru_next->lru_prev = obj->lru_prev;
+  else
+    lru_tail = obj->lru_prev;
+  obj->lru_prev = obj->lru_next = NULL;
+  cache_used -= obj->size;
+}
+
+
+/* Mark OBJ as the most recently used object.  */
+static void
+lru_touch (cache_obj_t obj)
+{
+  if (obj != lru_head)
+    {
+      lru_unlink (obj);
+      lru_link (obj);
+    }
+}
+
+
+/* Charge NBYTES more to the cached object OBJ.  */
+static void
+lru_charge (cache_obj_t obj, size_t nbytes)
+{
+  obj->size += nbytes;
+  cache_used += nbytes;
+}
+
+
+static void evict (cache_obj_t obj);
+static void remove_key_items (enum pubkey_types pktype,
+                              const unsigned char *ubid,
+                              const void *blob, size_t bloblen);
+
+/* Evict the least recently used objects until NEEDED bytes are
+ * available.  */
+static void
+make_room (size_t needed)
+{
+  while (lru_tail && cache_used + needed > cache_size)
+    {
+      evict (lru_tail);
+      cache_stats.evicted++;
+    }
+}
+
 
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
+/* The hash function we use for the blob_table.  */
 static inline unsigned int
-blob_table_hasher (const unsigned char *ubid)
+blob_table_hasher (const unsigned char *ubid, size_t size)
 {
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
+  return buf32_to_u32 (ubid) % size;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the blob table.  */
 static gpg_error_t
 blob_table_init (void)
 {
   if (blob_table)
     return 0;
-  blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
+  blob_table_size = INITIAL_TABLE_SIZE;
   blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
   if (!blob_table)
     return gpg_error_from_syserror ();
   return 0;
 }
 
-/* Free a blob.  This is done by moving it to the attic list.  */
+
+/* Enlarge the blob table if the chains get too long.  Errors are
+ * ignored; the table then just gets slower.  */
 static void
-blob_unref (blob_t blob)
+blob_table_maybe_resize (void)
 {
-  void *p;
+  blob_t *newtable, b, b_next;
+  size_t newsize, idx;
+  unsigned int hash;
 
+  if (blob_table_count <= blob_table_size * MAX_ITEMS_PER_BUCKET)
+    return;
+
+  newsize = 2 * blob_table_size + 1;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - ignore.  */
+
+  for (idx=0; idx < blob_table_size; idx++)
+    for (b = blob_table[idx]; b; b = b_next)
+      {
+        b_next = b->next;
+        hash = blob_table_hasher (b->ubid, newsize);
+        b->next = newtable[hash];
+        newtable[hash] = b;
+      }
+
+  xfree (blob_table);
+  blob_table = newtable;
+  blob_table_size = newsize;
+  if (DBG_CACHE)
+    log_debug ("cache: blob table enlarged to %zu buckets\n", newsize);
+}
+
+
+/* Release a reference to BLOB.  The blob is freed when the last
+ * reference is gone.  */
+static void
+blob_unref (blob_t blob)
+{
   if (!blob)
     return;
   log_assert (blob->refcount);
   if (!--blob->refcount)
     {
-      p = blob->data;
-      blob->data = NULL;
-      blob->next = blob_attic;
-      blob_attic = blob;
-      xfree (p);
+      xfree (blob->data);
+      xfree (blob);
     }
 }
 
 
-/* Given the hash value and the ubid, find the blob in the bucket.
- * Returns NULL if not found or the blob item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  */
+/* Find the blob with UBID.  Returns NULL if not found.  If R_PREV is
+ * not NULL the address of the pointer to the blob is stored there.  */
 static blob_t
-find_blob (unsigned int hash, const unsigned char *ubid,
-           unsigned int *r_count)
+find_blob (const unsigned char *ubid, blob_t **r_prev)
 {
-  blob_t b;
-  unsigned int count = 0;
+  blob_t b, *prev;
 
-  for (b = blob_table[hash]; b; b = b->next, count++)
+  prev = blob_table + blob_table_hasher (ubid, blob_table_size);
+  for (b = *prev; b; prev = &b->next, b = b->next)
     if (!memcmp (b->ubid, ubid, UBID_LEN))
       break;
-  if (r_count)
-    *r_count = count;
+  if (r_prev)
+    *r_prev = prev;
   return b;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
+/* Remove the blob with UBID from the cache.  The key items of the
+ * keys in the blob are also removed so that no key item refers to a
+ * blob which is not cached.  */
+static void
+blob_table_remove (const unsigned char *ubid)
 {
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
+  blob_t b, *prev;
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  b = find_blob (ubid, &prev);
+  if (!b)
+    return;
+  *prev = b->next;
+  b->next = NULL;
+  blob_table_count--;
+  lru_unlink (&b->obj);
+  remove_key_items (b->pktype, b->ubid, b->data, b->datalen);
+  blob_unref (b);
 }
 
 
 /* Put the blob (BLOBDATA, BLOBDATALEN) into the cache using UBID as
- * the index.  If it is already in the cache nothing happens.  */
+ * the index.  EPHEMERAL and REVOKED are the flags of the key.  If it
+ * is already in the cache nothing happens.  */
 static void
 blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
-                const void *blobdata, unsigned int blobdatalen)
+                const void *blobdata, unsigned int blobdatalen,
+                int ephemeral, int revoked)
 {
   unsigned int hash;
   blob_t b;
-  unsigned int count, n;
-  void *blobdatacopy = NULL;
+  size_t size;
 
-  hash = blob_table_hasher (ubid);
- find_again:
-  b = find_blob (hash, ubid, &count);
+  b = find_blob (ubid, NULL);
   if (b)
     {
-      xfree (blobdatacopy);
+      lru_touch (&b->obj);
       return;  /* Already got this blob.  */
     }
 
-  /* Create a copy of the blob if not yet done.  */
-  if (!blobdatacopy)
-    {
-      blobdatacopy = xtrymalloc (blobdatalen);
-      if (!blobdatacopy)
-        {
-          log_info ("Note: malloc failed while copying blob to the cache: %s\n",
-                    gpg_strerror (gpg_error_from_syserror ()));
-          return;  /* Out of core - ignore.  */
-        }
-      memcpy (blobdatacopy, blobdata, blobdatalen);
-    }
+  size = sizeof *b + blobdatalen;
+  if (size > cache_size / 4)
+    return;  /* Too large to be worth caching.  */
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
+  b = xtrycalloc (1, sizeof *b);
+  if (b)
     {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
+      b->data = xtrymalloc (blobdatalen);
+      if (!b->data)
         {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
+          xfree (b);
+          b = NULL;
         }
     }
-
-  /* Add an item to the bucket.  We allocate a whole block of items
-   * for cache performance reasons.  */
-  if (!blob_attic)
+  if (!b)
     {
-      blob_t b_block;
-      int b_blocksize = 256;
-
-      b_block = xtrymalloc (b_blocksize * sizeof *b_block);
-      if (!b_block)
-        {
-          log_info ("Note: malloc failed while adding blob to the cache: %s\n",
-                    gpg_strerror (gpg_error_from_syserror ()));
-          xfree (blobdatacopy);
-          return;  /* Out of core - ignore.  */
-        }
-      for (n = 0; n < b_blocksize; n++)
-        {
-          b = b_block + n;
-          b->next = blob_attic;
-          blob_attic = b;
-        }
-
-      /* During the malloc another thread might have changed the
-       * bucket.  Thus we need to start over.  */
-      goto find_again;
+      log_info ("Note: malloc failed while adding blob to the cache: %s\n",
+                gpg_strerror (gpg_error_from_syserror ()));
+      return;  /* Out of core - ignore.  */
     }
-
-  /* We now know that there is an item in the attic.  Put it into the
-   * chain.  Note that we may not use any system call here. */
-  b = blob_attic;
-  blob_attic = b->next;
-  b->next = NULL;
-  b->pktype = pktype;
-  b->data = blobdatacopy;
+  memcpy (b->data, blobdata, blobdatalen);
   b->datalen = blobdatalen;
+  b->pktype = pktype;
+  b->ephemeral = !!ephemeral;
+  b->revoked = !!revoked;
   memcpy (b->ubid, ubid, UBID_LEN);
-  b->usecount = 1;
   b->refcount = 1;
+  b->obj.type = CACHE_OBJ_BLOB;
+  b->obj.size = size;
+
+  make_room (size);
+  hash = blob_table_hasher (ubid, blob_table_size);
   b->next = blob_table[hash];
   blob_table[hash] = b;
-  blob_table_added++;
+  blob_table_count++;
+  lru_link (&b->obj);
+  cache_stats.added++;
+
+  blob_table_maybe_resize ();
 }
 
 
@@ -352,14 +466,12 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
 static blob_t
 blob_table_get (const unsigned char *ubid)
 {
-  unsigned int hash;
   blob_t b;
 
-  hash = blob_table_hasher (ubid);
-  b = find_blob (hash, ubid, NULL);
+  b = find_blob (ubid, NULL);
   if (b)
     {
-      b->usecount++;
+      lru_touch (&b->obj);
       b->refcount++;
       return b;  /* Found  */
     }
@@ -368,418 +480,266 @@ blob_table_get (const unsigned char *ubid)
 }
 
 
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
+
+/* The hash function we use for the key_table.  */
 static inline unsigned int
-key_table_hasher (u32 kid_l)
+key_table_hasher (u32 kid_l, size_t size)
 {
-  return kid_l % key_table_size;
+  return kid_l % size;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the key table.  */
 static gpg_error_t
 key_table_init (void)
 {
   if (key_table)
     return 0;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
+  key_table_size = INITIAL_TABLE_SIZE;
   key_table = xtrycalloc (key_table_size, sizeof *key_table);
   if (!key_table)
     return gpg_error_from_syserror ();
   return 0;
 }
 
-/* Free a key_item.  This is done by moving it to the attic list.  */
+
+/* Enlarge the key table if the chains get too long.  Errors are
+ * ignored; the table then just gets slower.  */
+static void
+key_table_maybe_resize (void)
+{
+  key_item_t *newtable, ki, ki_next;
+  size_t newsize, idx;
+  unsigned int hash;
+
+  if (key_table_count <= key_table_size * MAX_ITEMS_PER_BUCKET)
+    return;
+
+  newsize = 2 * key_table_size + 1;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - ignore.  */
+
+  for (idx=0; idx < key_table_size; idx++)
+    for (ki = key_table[idx]; ki; ki = ki_next)
+      {
+        ki_next = ki->next;
+        hash = key_table_hasher (ki->kid_l, newsize);
+        ki->next = newtable[hash];
+        newtable[hash] = ki;
+      }
+
+  xfree (key_table);
+  key_table = newtable;
+  key_table_size = newsize;
+  if (DBG_CACHE)
+    log_debug ("cache: key table enlarged to %zu buckets\n", newsize);
+}
+
+
+/* Release a reference to the key item KI.  The item is freed when the
+ * last reference is gone.  */
 static void
 key_item_unref (key_item_t ki)
 {
-  bloblist_t bl, bl2;
+  bloblist_t bl, bl_next;
 
   if (!ki)
     return;
   log_assert (ki->refcount);
   if (!--ki->refcount)
     {
-      bl = ki->blist;
-      ki->blist = NULL;
-      ki->next = key_item_attic;
-      key_item_attic = ki;
-
-      if (bl)
+      for (bl = ki->blist; bl; bl = bl_next)
         {
-          for (bl2 = bl; bl2->next; bl2 = bl2->next)
-            ;
-          bl2->next = bloblist_attic;
-          bloblist_attic = bl;
+          bl_next = bl->next;
+          xfree (bl);
         }
+      xfree (ki);
     }
 }
 
 
-/* Given the hash value and the search info, find the key item in the
- * bucket.  Return NULL if not found or the key item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  Note that FPR may only be NULL
- * if FPRLEN is 0. */
+/* Find the key item for the keyid (KID_H,KID_L).  Returns NULL if
+ * not found.  If R_PREV is not NULL the address of the pointer to the
+ * item is stored there.  */
 static key_item_t
-find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
-               unsigned int *r_count)
+find_in_chain (u32 kid_h, u32 kid_l, key_item_t **r_prev)
 {
-  key_item_t ki = key_table[hash];
-  unsigned int count = 0;
+  key_item_t ki, *prev;
 
-  for (; ki; ki = ki->next, count++)
+  prev = key_table + key_table_hasher (kid_l, key_table_size);
+  for (ki = *prev; ki; prev = &ki->next, ki = ki->next)
     if (ki->kid_h == kid_h && ki->kid_l == kid_l)
       break;
-  if (r_count)
-    *r_count = count;
+  if (r_prev)
+    *r_prev = prev;
   return ki;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_key_items (const void *arg_a, const void *arg_b)
-{
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
-
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
-}
-
-
-/* Allocate new key items.  They are put to the attic so that the
- * caller can take them from there.  On allocation failure a note
- * is printed and an error returned.  */
-static gpg_error_t
-alloc_more_key_items (void)
+/* Remove the key item for (KID_H,KID_L) from the cache.  */
+static void
+key_table_remove (u32 kid_h, u32 kid_l)
 {
-  gpg_error_t err;
-  key_item_t kiblock, ki;
-  int kiblocksize = 256;
-  unsigned int n;
+  key_item_t ki, *prev;
 
-  kiblock = xtrymalloc (kiblocksize * sizeof *kiblock);
-  if (!kiblock)
-    {
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while adding to the cache: %s\n",
-                gpg_strerror (err));
-      return err;
-    }
-  for (n = 0; n < kiblocksize; n++)
-    {
-      ki = kiblock + n;
-      ki->next = key_item_attic;
-      key_item_attic = ki;
-    }
-  return 0;
+  ki = find_in_chain (kid_h, kid_l, &prev);
+  if (!ki)
+    return;
+  *prev = ki->next;
+  ki->next = NULL;
+  key_table_count--;
+  lru_unlink (&ki->obj);
+  key_item_unref (ki);
 }
 
 
-/* Allocate new bloblist items.  They are put to the attic so that the
- * caller can take them from there.  On allocation failure a note is
- * printed and an error returned.  */
-static gpg_error_t
-alloc_more_bloblist_items (void)
+/* Allocate a new bloblist item.  Returns NULL on malloc failure.  */
+static bloblist_t
+new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
+                   const unsigned char *ubid, unsigned int pkno)
 {
-  gpg_error_t err;
   bloblist_t bl;
-  bloblist_t blistblock;
-  int blistblocksize = 256;
-  unsigned int n;
 
-  blistblock = xtrymalloc (blistblocksize * sizeof *blistblock);
-  if (!blistblock)
+  bl = xtrycalloc (1, sizeof *bl);
+  if (!bl)
     {
-      err = gpg_error_from_syserror ();
       log_info ("Note: malloc failed while adding to the cache: %s\n",
-                gpg_strerror (err));
-      return err;
+                gpg_strerror (gpg_error_from_syserror ()));
+      return NULL;
     }
-  for (n = 0; n < blistblocksize; n++)
-    {
-      bl = blistblock + n;
-      bl->next = bloblist_attic;
-      bloblist_attic = bl;
-    }
-  return 0;
-}
-
-
-/* Helper for key_table_put.  This function assumes that
- * bloblist_attaci is not NULL.  Returns a new bloblist item.  Be
- * aware that no system calls may be done - even not log
- * functions!  */
-static bloblist_t
-new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
-                   const unsigned char *ubid, int subkey)
-{
-  bloblist_t bl;
-
-  bl = bloblist_attic;
-  bloblist_attic = bl->next;
-  bl->next = NULL;
 
   if (ubid)
     memcpy (bl->ubid, ubid, UBID_LEN);
-  else
-    memset (bl->ubid, 0, UBID_LEN);
   bl->ubid_valid = 1;
-  bl->final_kid = 0;
-  bl->final_fpr = 0;
-  bl->subkey = !!subkey;
+  bl->pkno = pkno;
   bl->fprlen = fprlen;
   memcpy (bl->fpr, fpr, fprlen);
   return bl;
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
-{
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
-
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
-    {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
-    }
-
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
-
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
-    }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
-
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
-    {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
-    }
-  return err;
-}
-
-
 /* This is the core of
  *   key_table_put,
  *   key_table_put_no_fpr,
  *   key_table_put_no_kid.
+ * For a not-found mark FPR is NULL and NF_TYPES gives the pubkey
+ * types which were searched.
  */
 static void
 do_key_table_put (u32 kid_h, u32 kid_l,
                   const unsigned char *fpr, unsigned int fprlen,
-                  const unsigned char *ubid, int subkey)
+                  const unsigned char *ubid, unsigned int pkno,
+                  unsigned int nf_types)
 {
   unsigned int hash;
   key_item_t ki;
   bloblist_t bl, bl_tail;
-  unsigned int count;
-  int do_find_again;
   int mark_not_found = !fpr;
 
-  hash = key_table_hasher (kid_l);
- find_again:
-  do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
+  ki = find_in_chain (kid_h, kid_l, NULL);
   if (ki)
     {
+      lru_touch (&ki->obj);
       if (mark_not_found)
-        return; /* Can't put the mark because meanwhile a entry was
-                 * added.  */
+        {
+          /* Can't put the mark if meanwhile an entry was added.  */
+          if (!ki->blist)
+            ki->nf_types |= nf_types;
+          return;
+        }
 
-      for (bl = ki->blist; bl; bl = bl->next)
+      for (bl_tail = NULL, bl = ki->blist; bl; bl_tail = bl, bl = bl->next)
         if (bl->fprlen
             && bl->fprlen == fprlen
             && !memcmp (bl->fpr, fpr, fprlen))
-          break;
-      if (bl)
-        return;  /* Already in the bloblist for the keyid  */
+          return;  /* Already in the bloblist for the keyid  */
 
       /* Append to the list.  */
-      if (!bloblist_attic)
-        {
-          if (alloc_more_bloblist_items ())
-            return;  /* Out of core - ignore.  */
-          goto find_again; /* Need to start over due to the malloc.  */
-        }
-      for (bl_tail = NULL, bl = ki->blist; bl; bl_tail = bl, bl = bl->next)
-        ;
-      bl = new_bloblist_item (fpr, fprlen, ubid, subkey);
+      bl = new_bloblist_item (fpr, fprlen, ubid, pkno);
+      if (!bl)
+        return;  /* Out of core - ignore.  */
       if (bl_tail)
         bl_tail->next = bl;
       else
         ki->blist = bl;
-
+      ki->nf_types = 0;
+      lru_charge (&ki->obj, sizeof *bl);
+      make_room (0);
       return;
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
-
-  if (!key_item_attic)
-    {
-      if (alloc_more_key_items ())
-        return;  /* Out of core - ignore.  */
-      do_find_again = 1;
-    }
-
-  if (!bloblist_attic)
+  ki = xtrycalloc (1, sizeof *ki);
+  if (!ki)
     {
-      if (alloc_more_bloblist_items ())
-        return;  /* Out of core - ignore.  */
-      do_find_again = 1;
+      log_info ("Note: malloc failed while adding to the cache: %s\n",
+                gpg_strerror (gpg_error_from_syserror ()));
+      return;  /* Out of core - ignore.  */
     }
-
-  if (do_find_again)
-    goto find_again;
-
-  /* We now know that there are items in the attics.  Put them into
-   * the chain.  Note that we may not use any system call here. */
-  ki = key_item_attic;
-  key_item_attic = ki->next;
-  ki->next = NULL;
-
+  ki->obj.type = CACHE_OBJ_KEY;
+  ki->obj.size = sizeof *ki;
   if (mark_not_found)
-    ki->blist = NULL;
+    ki->nf_types = nf_types;
   else
-    ki->blist = new_bloblist_item (fpr, fprlen, ubid, subkey);
-
+    {
+      ki->blist = new_bloblist_item (fpr, fprlen, ubid, pkno);
+      if (!ki->blist)
+        {
+          xfree (ki);
+          return;  /* Out of core - ignore.  */
+        }
+      ki->obj.size += sizeof *ki->blist;
+    }
   ki->kid_h = kid_h;
   ki->kid_l = kid_l;
-  ki->usecount = 1;
   ki->refcount = 1;
 
+  make_room (ki->obj.size);
+  hash = key_table_hasher (kid_l, key_table_size);
   ki->next = key_table[hash];
   key_table[hash] = ki;
-  key_table_added++;
+  key_table_count++;
+  lru_link (&ki->obj);
+  cache_stats.added++;
+
+  key_table_maybe_resize ();
 }
 
 
 /* Given the fingerprint (FPR,FPRLEN) put the UBID into the cache.
- * SUBKEY indicates that the fingerprint is from a subkey.  */
+ * PKNO is the number of the key in the keyblock with 1 for the
+ * primary key.  */
 static void
 key_table_put (const unsigned char *fpr, unsigned int fprlen,
-               const unsigned char *ubid, int subkey)
+               const unsigned char *ubid, unsigned int pkno)
 {
   u32 kid_h, kid_l;
 
-  if (fprlen < 20 || fprlen > 32)
-    return;  /* No support for v3 keys or unknown key versions.  */
-
-  if (fprlen == 20)  /* v4 key */
-    {
-      kid_h = buf32_to_u32 (fpr+12);
-      kid_l = buf32_to_u32 (fpr+16);
-    }
-  else  /* v5 or later key */
-    {
-      kid_h = buf32_to_u32 (fpr);
-      kid_l = buf32_to_u32 (fpr+4);
-    }
-  do_key_table_put (kid_h, kid_l, fpr, fprlen, ubid, subkey);
+  if (kid_from_fpr (fpr, fprlen, &kid_h, &kid_l))
+    do_key_table_put (kid_h, kid_l, fpr, fprlen, ubid, pkno, 0);
 }
 
 
 /* Given the fingerprint (FPR,FPRLEN) put a flag into the cache that
- * this fingerprint was not found.  */
+ * this fingerprint was not found in a search for NF_TYPES.  */
 static void
-key_table_put_no_fpr (const unsigned char *fpr, unsigned int fprlen)
+key_table_put_no_fpr (const unsigned char *fpr, unsigned int fprlen,
+                      unsigned int nf_types)
 {
   u32 kid_h, kid_l;
 
-  if (fprlen < 20 || fprlen > 32)
-    return;  /* No support for v3 keys or unknown key versions.  */
-
-  if (fprlen == 20)  /* v4 key */
-    {
-      kid_h = buf32_to_u32 (fpr+12);
-      kid_l = buf32_to_u32 (fpr+16);
-    }
-  else  /* v5 or later key */
-    {
-      kid_h = buf32_to_u32 (fpr);
-      kid_l = buf32_to_u32 (fpr+4);
-    }
   /* Note that our not-found chaching is only based on the keyid. */
-  do_key_table_put (kid_h, kid_l, NULL, 0, NULL, 0);
+  if (kid_from_fpr (fpr, fprlen, &kid_h, &kid_l))
+    do_key_table_put (kid_h, kid_l, NULL, 0, NULL, 0, nf_types);
 }
 
 
 /* Given the keyid (KID_H, KID_L) put a flag into the cache that this
- * keyid was not found. */
+ * keyid was not found in a search for NF_TYPES. */
 static void
-key_table_put_no_kid (u32 kid_h, u32 kid_l)
+key_table_put_no_kid (u32 kid_h, u32 kid_l, unsigned int nf_types)
 {
-  do_key_table_put (kid_h, kid_l, NULL, 0, NULL, 0);
+  do_key_table_put (kid_h, kid_l, NULL, 0, NULL, 0, nf_types);
 }
 
 
@@ -789,14 +749,12 @@ key_table_put_no_kid (u32 kid_h, u32 kid_l)
 static key_item_t
 key_table_get (u32 kid_h, u32 kid_l)
 {
-  unsigned int hash;
   key_item_t ki;
 
-  hash = key_table_hasher (kid_l);
-  ki = find_in_chain (hash, kid_h, kid_l, NULL);
+  ki = find_in_chain (kid_h, kid_l, NULL);
   if (ki)
     {
-      ki->usecount++;
+      lru_touch (&ki->obj);
       ki->refcount++;
       return ki;  /* Found  */
     }
@@ -825,27 +783,80 @@ query_by_fpr (const unsigned char *fpr, unsigned int fprlen)
 {
   u32 kid_h, kid_l;
 
-  if (fprlen < 20 || fprlen > 32 )
-    return NULL;  /* No support for v3 keys or unknown key versions.  */
+  if (!kid_from_fpr (fpr, fprlen, &kid_h, &kid_l))
+    return NULL;
+
+  return key_table_get (kid_h, kid_l);
+}
+
+
+/* Remove the cached object OBJ from its hash table and the LRU
+ * list.  */
+static void
+evict (cache_obj_t obj)
+{
+  if (obj->type == CACHE_OBJ_BLOB)
+    blob_table_remove (((blob_t)obj)->ubid);
+  else
+    key_table_remove (((key_item_t)obj)->kid_h, ((key_item_t)obj)->kid_l);
+}
+
+
+/* Remove all key items from the cache.  */
+static void
+flush_key_items (void)
+{
+  size_t idx;
+  key_item_t ki;
+
+  for (idx=0; idx < key_table_size; idx++)
+    while ((ki = key_table[idx]))
+      key_table_remove (ki->kid_h, ki->kid_l);
+}
+
 
-  if (fprlen == 20)  /* v4 key */
+/* Remove the key items for all keys of the keyblock (BLOB,BLOBLEN)
+ * of type PKTYPE and with UBID.  */
+static void
+remove_key_items (enum pubkey_types pktype, const unsigned char *ubid,
+                  const void *blob, size_t bloblen)
+{
+  gpg_error_t err;
+  u32 kid_h, kid_l;
+
+  if (pktype == PUBKEY_TYPE_X509)
     {
-      kid_h = buf32_to_u32 (fpr+12);
-      kid_l = buf32_to_u32 (fpr+16);
+      /* For X.509 the UBID is the fingerprint.  */
+      if (kid_from_fpr (ubid, UBID_LEN, &kid_h, &kid_l))
+        key_table_remove (kid_h, kid_l);
     }
-  else  /* v5 or later key */
+  else if (pktype == PUBKEY_TYPE_OPGP)
     {
-      kid_h = buf32_to_u32 (fpr);
-      kid_l = buf32_to_u32 (fpr+4);
-    }
+      struct _keybox_openpgp_info info;
+      struct _keybox_openpgp_key_info *kinfo;
 
-  return key_table_get (kid_h, kid_l);
+      err = _keybox_parse_openpgp (blob, bloblen, NULL, &info);
+      if (err)
+        {
+          log_info ("cache: error parsing OpenPGP blob: %s\n",
+                    gpg_strerror (err));
+          flush_key_items ();
+          return;
+        }
+      kinfo = &info.primary;
+      if (kid_from_fpr (kinfo->fpr, kinfo->fprlen, &kid_h, &kid_l))
+        key_table_remove (kid_h, kid_l);
+      if (info.nsubkeys)
+        for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
+          if (kid_from_fpr (kinfo->fpr, kinfo->fprlen, &kid_h, &kid_l))
+            key_table_remove (kid_h, kid_l);
+      _keybox_destroy_openpgp_info (&info);
+    }
 }
 
 
 
 
-
 /* Make sure the tables are initialized.  */
 gpg_error_t
 be_cache_initialize (void)
@@ -855,10 +866,67 @@ be_cache_initialize (void)
   err = blob_table_init ();
   if (!err)
     err = key_table_init ();
+  if (!err && !cache_size)
+    be_cache_set_size (opt.cache_size);
   return err;
 }
 
 
+/* Set the size of the cache to NBYTES.  0 selects the default size.
+ * If the cache is shrunk objects are evicted as needed.  */
+void
+be_cache_set_size (size_t nbytes)
+{
+  if (!nbytes)
+    nbytes = DEFAULT_CACHE_SIZE;
+  else if (nbytes < MIN_CACHE_SIZE)
+    nbytes = MIN_CACHE_SIZE;
+  cache_size = nbytes;
+  make_room (0);
+}
+
+
+/* Remove all objects from the cache.  */
+void
+be_cache_flush (void)
+{
+  cache_generation++;
+  while (lru_tail)
+    evict (lru_tail);
+}
+
+
+/* Return the current cache generation.  */
+unsigned int
+be_cache_generation (void)
+{
+  return cache_generation;
+}
+
+
+/* Return true if the search of CTRL started before the last
+ * invalidation of the cache.  The database may then have returned
+ * an old version of a key or missed a new key.  */
+static int
+stale_search_p (ctrl_t ctrl)
+{
+  return (ctrl && ctrl->db_req
+          && ctrl->db_req->cache_generation != cache_generation);
+}
+
+
+/* Store the current statistics at R_STATS.  */
+void
+be_cache_get_stats (struct be_cache_stats_s *r_stats)
+{
+  *r_stats = cache_stats;
+  r_stats->size = cache_size;
+  r_stats->used = cache_used;
+  r_stats->nblobs = blob_table_count;
+  r_stats->nkeys = key_table_count;
+}
+
+
 /* Install a new resource and return a handle for that backend.  */
 gpg_error_t
 be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd)
@@ -901,248 +969,159 @@ be_cache_release_resource (ctrl_t ctrl, backend_handle_t hd)
     return;
   hd->db_type = DB_TYPE_NONE;
 
-  /* Fixme: Free the key_table.  */
+  be_cache_flush ();
 
   xfree (hd);
 }
 
 
-/* Search for the keys described by (DESC,NDESC) and return them to
- * the caller.  BACKEND_HD is the handle for this backend and REQUEST
- * is the current database request object.  On a cache hit either 0 or
- * GPG_ERR_NOT_FOUND is returned.  The former returns the item; the
- * latter indicates that the cache has known that the item won't be
- * found in any databases.  On a cache miss GPG_ERR_EOF is
+/* Search for the first key described by (DESC,NDESC) and return it
+ * to the caller.  BACKEND_HD is the handle for this backend and
+ * REQUEST is the current database request object.  Only a single
+ * search description for a long keyid, a fingerprint, or an UBID is
+ * considered.  On a cache hit 0 is returned and the UBID of the
+ * returned key is stored in REQUEST so that a continued search in the
+ * actual database skips that key.  On a cache miss GPG_ERR_EOF is
  * returned.  */
 gpg_error_t
 be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
                  KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
   gpg_error_t err;
-  db_request_part_t reqpart;
-  unsigned int n;
-  blob_t b;
-  key_item_t ki;
+  key_item_t ki = NULL;
   bloblist_t bl;
-  int not_found = 0;
-  int descidx = 0;
-  int found_bykid = 0;
+  blob_t b = NULL;
+  unsigned int pkno = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_CACHE);
   log_assert (request);
 
-  err = be_find_request_part (backend_hd, request, &reqpart);
-  if (err)
-    goto leave;
+  if (ndesc != 1)
+    return gpg_error (GPG_ERR_EOF);
 
-  if (!desc)
+  switch (desc->mode)
     {
-      /* Reset operation.  */
-      request->last_cached_valid = 0;
-      request->last_cached_final = 0;
-      reqpart->cache_seqno.fpr = 0;
-      reqpart->cache_seqno.kid = 0;
-      reqpart->cache_seqno.grip = 0;
-      reqpart->cache_seqno.ubid = 0;
-      err = 0;
-      goto leave;
-    }
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      ki = query_by_kid (desc->u.kid[0], desc->u.kid[1]);
+      break;
 
-  for (ki = NULL, n=0; n < ndesc && !ki; n++)
-    {
-      descidx = n;
-      switch (desc[n].mode)
-        {
-        case KEYDB_SEARCH_MODE_LONG_KID:
-          ki = query_by_kid (desc[n].u.kid[0], desc[n].u.kid[1]);
-          if (ki && ki->blist)
-            {
-              not_found = 0;
-              /* Note that in a bloblist all keyids are the same.  */
-              for (n=0, bl = ki->blist; bl; bl = bl->next)
-                if (n++ == reqpart->cache_seqno.kid)
-                  break;
-              if (!bl)
-                {
-                  key_item_unref (ki);
-                  ki = NULL;
-                }
-              else
-                {
-                  found_bykid = 1;
-                  reqpart->cache_seqno.kid++;
-                }
-            }
-          else if (ki)
-            not_found = 1;
-          break;
+    case KEYDB_SEARCH_MODE_FPR:
+      ki = query_by_fpr (desc->u.fpr, desc->fprlen);
+      break;
 
-        case KEYDB_SEARCH_MODE_FPR:
-          ki = query_by_fpr (desc[n].u.fpr, desc[n].fprlen);
-          if (ki && ki->blist)
-            {
-              not_found = 0;
-              for (n=0, bl = ki->blist; bl; bl = bl->next)
-                if (bl->fprlen
-                    && bl->fprlen == desc[n].fprlen
-                    && !memcmp (bl->fpr, desc[n].u.fpr, desc[n].fprlen)
-                    && n++ == reqpart->cache_seqno.fpr)
-                  break;
-              if (!bl)
-                {
-                  key_item_unref (ki);
-                  ki = NULL;
-                }
-              else
-                reqpart->cache_seqno.fpr++;
-            }
-          else if (ki)
-            not_found = 1;
-          break;
+    case KEYDB_SEARCH_MODE_UBID:
+      b = blob_table_get (desc->u.ubid);
+      if (b && !pktype_allowed (ctrl, b->pktype))
+        {
+          blob_unref (b);
+          b = NULL;
+        }
+      break;
 
-        /* case KEYDB_SEARCH_MODE_KEYGRIP: */
-        /*   ki = query_by_grip (desc[n].u.fpr, desc[n].fprlen); */
-        /*   break; */
-
-        case KEYDB_SEARCH_MODE_UBID:
-          /* This is the quite special UBID mode: If this is
-           * encountered in the search list we will return just this
-           * one and obviously look only into the blob cache.  */
-          if (reqpart->cache_seqno.ubid)
-            err = gpg_error (GPG_ERR_NOT_FOUND);
-          else
-            {
-              b = blob_table_get (desc[n].u.ubid);
-              if (b)
-                {
-                  err = be_return_pubkey (ctrl, b->data, b->datalen,
-                                          b->pktype, desc[n].u.ubid,
-                                          0, 0, 0, 0);
-                  blob_unref (b);
-                  reqpart->cache_seqno.ubid++;
-                }
-              else
-                err = gpg_error (GPG_ERR_EOF);
-            }
-          goto leave;
+    default:
+      return gpg_error (GPG_ERR_EOF);
+    }
 
-        default:
-          ki = NULL;
+  /* Take the first listed blob which is still cached.  Note that in
+   * a bloblist all keyids are the same.  */
+  for (bl = ki? ki->blist : NULL; bl; bl = bl->next)
+    {
+      if (!bl->ubid_valid)
+        continue;
+      if (desc->mode == KEYDB_SEARCH_MODE_FPR
+          && !(bl->fprlen == desc->fprlen
+               && !memcmp (bl->fpr, desc->u.fpr, desc->fprlen)))
+        continue;
+      b = blob_table_get (bl->ubid);
+      if (b && pktype_allowed (ctrl, b->pktype))
+        {
+          pkno = bl->pkno;
           break;
         }
+      blob_unref (b);
+      b = NULL;
     }
+  key_item_unref (ki);
 
-  if (not_found)
+  if (!b)
     {
-      err = gpg_error (GPG_ERR_NOT_FOUND);
-      key_item_unref (ki);
+      cache_stats.misses++;
+      return gpg_error (GPG_ERR_EOF);
     }
-  else if (ki)
+
+  cache_stats.hits++;
+  err = be_return_pubkey (ctrl, b->data, b->datalen, b->pktype, b->ubid,
+                          b->ephemeral, b->revoked, 0, pkno);
+  if (!err)
     {
-      if (bl && bl->ubid_valid)
-        {
-          memcpy (request->last_cached_ubid, bl->ubid, UBID_LEN);
-          request->last_cached_valid = 1;
-          request->last_cached_fprlen = desc[descidx].fprlen;
-          memcpy (request->last_cached_fpr,
-                  desc[descidx].u.fpr, desc[descidx].fprlen);
-          request->last_cached_kid_h = ki->kid_h;
-          request->last_cached_kid_l = ki->kid_l;
-          request->last_cached_valid = 1;
-          if ((bl->final_kid && found_bykid)
-              || (bl->final_fpr && !found_bykid))
-            request->last_cached_final = 1;
-          else
-            request->last_cached_final = 0;
-
-          b = blob_table_get (bl->ubid);
-          if (b)
-            {
-              err = be_return_pubkey (ctrl, b->data, b->datalen,
-                                      PUBKEY_TYPE_OPGP, bl->ubid, 0, 0, 0, 0);
-              blob_unref (b);
-            }
-          else
-            {
-              /* FIXME - return a different code so that the caller
-               * can lookup using the UBID.  */
-              err = gpg_error (GPG_ERR_MISSING_VALUE);
-            }
-        }
-      else if (bl)
-        err = gpg_error (GPG_ERR_MISSING_VALUE);
-      else
-        err = gpg_error (GPG_ERR_NOT_FOUND);
-      key_item_unref (ki);
+      memcpy (request->skip_ubid, b->ubid, UBID_LEN);
+      request->skip_ubid_valid = 1;
     }
-  else
-    err = gpg_error (GPG_ERR_EOF);
-
- leave:
+  blob_unref (b);
   return err;
 }
 
 
-/* Mark the last cached item as the final item.  This is called when
- * the actual database returned EOF in respond to a restart from the
- * last cached UBID.  */
-void
-be_cache_mark_final (ctrl_t ctrl, db_request_t request)
+/* Return true if the cache knows that none of the search descriptions
+ * (DESC,NDESC) will find anything.  This is used by the frontend to
+ * skip the actual database search.  */
+int
+be_cache_known_not_found (ctrl_t ctrl,
+                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
+  unsigned int n;
+  unsigned int types = searched_types (ctrl);
   key_item_t ki;
-  bloblist_t bl, blfound;
+  int not_found;
 
-  (void)ctrl;
-
-  log_assert (request);
-
-  if (!request->last_cached_valid)
-    return;
+  if (!ndesc)
+    return 0;
 
-  if (!request->last_cached_fprlen) /* Was cached via keyid.  */
+  for (n=0; n < ndesc; n++)
     {
-      ki = query_by_kid (request->last_cached_kid_h,
-                         request->last_cached_kid_l);
-      if (ki && (bl = ki->blist))
+      if (desc[n].mode == KEYDB_SEARCH_MODE_LONG_KID)
+        ki = find_in_chain (desc[n].u.kid[0], desc[n].u.kid[1], NULL);
+      else if (desc[n].mode == KEYDB_SEARCH_MODE_FPR)
         {
-          for (blfound=NULL; bl; bl = bl->next)
-            blfound = bl;
-          if (blfound)
-            blfound->final_kid = 1;
+          u32 kid_h, kid_l;
+
+          if (!kid_from_fpr (desc[n].u.fpr, desc[n].fprlen, &kid_h, &kid_l))
+            break;
+          ki = find_in_chain (kid_h, kid_l, NULL);
         }
-      key_item_unref (ki);
+      else
+        break;
+
+      not_found = (ki && !ki->blist && (ki->nf_types & types) == types);
+      if (!not_found)
+        break;
+      lru_touch (&ki->obj);
     }
-  else /* Was cached via fingerprint.  */
+
+  if (n < ndesc)
     {
-      ki = query_by_fpr (request->last_cached_fpr,
-                         request->last_cached_fprlen);
-      if (ki && (bl = ki->blist))
-        {
-          for (blfound=NULL; bl; bl = bl->next)
-            if (bl->fprlen
-                && bl->fprlen == request->last_cached_fprlen
-                && !memcmp (bl->fpr, request->last_cached_fpr,
-                            request->last_cached_fprlen))
-              blfound = bl;
-          if (blfound)
-            blfound->final_fpr = 1;
-        }
-      key_item_unref (ki);
+      cache_stats.misses++;
+      return 0;
     }
-
-  request->last_cached_valid = 0;
+  cache_stats.nf_hits++;
+  return 1;
 }
 
 
-/* Put the key (BLOB,BLOBLEN) of PUBKEY_TYPE into the cache.  */
+/* Put the key (BLOB,BLOBLEN) of PUBKEY_TYPE into the cache.
+ * IS_EPHEMERAL and IS_REVOKED are the flags of the key as returned by
+ * the database.  */
 void
 be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                  const void *blob, unsigned int bloblen,
-                 enum pubkey_types pubkey_type)
+                 enum pubkey_types pubkey_type,
+                 int is_ephemeral, int is_revoked)
 {
   gpg_error_t err;
+  unsigned int pkno;
 
-  (void)ctrl;
+  if (stale_search_p (ctrl))
+    return;
 
   if (pubkey_type == PUBKEY_TYPE_OPGP)
     {
@@ -1157,41 +1136,77 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
           return;
         }
 
-      blob_table_put (ubid, pubkey_type, blob, bloblen);
+      blob_table_put (ubid, pubkey_type, blob, bloblen,
+                      is_ephemeral, is_revoked);
 
+      pkno = 1;
       kinfo = &info.primary;
-      key_table_put (kinfo->fpr, kinfo->fprlen, ubid, 0);
+      key_table_put (kinfo->fpr, kinfo->fprlen, ubid, pkno);
       if (info.nsubkeys)
         for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
-          key_table_put (kinfo->fpr, kinfo->fprlen, ubid, 1);
+          key_table_put (kinfo->fpr, kinfo->fprlen, ubid, ++pkno);
 
       _keybox_destroy_openpgp_info (&info);
     }
+  else if (pubkey_type == PUBKEY_TYPE_X509)
+    {
+      /* For X.509 the UBID is the SHA-1 fingerprint of the
+       * certificate.  */
+      blob_table_put (ubid, pubkey_type, blob, bloblen,
+                      is_ephemeral, is_revoked);
+      key_table_put (ubid, UBID_LEN, ubid, 1);
+    }
+}
 
+
+/* Remove all cached data of the key with UBID.  (BLOB,BLOBLEN) of
+ * PUBKEY_TYPE is the new version of the key or NULL if the key has
+ * been deleted.  This must be called for each change of the
+ * database.  */
+void
+be_cache_invalidate (ctrl_t ctrl, const unsigned char *ubid,
+                     const void *blob, size_t bloblen,
+                     enum pubkey_types pubkey_type)
+{
+  (void)ctrl;
+
+  cache_generation++;
+
+  /* Drop the old version along with its key items.  */
+  blob_table_remove (ubid);
+
+  /* Drop the key items of the new version; they may carry not-found
+   * marks.  */
+  if (blob)
+    remove_key_items (pubkey_type, ubid, blob, bloblen);
 }
 
 
 /* Put the a non-found mark for PUBKEY_TYPE into the cache.  The
- * indices are taken from the search descriptors (DESC,NDESC).  */
+ * indices are taken from the search descriptors (DESC,NDESC).  The
+ * mark is valid for the pubkey types CTRL searched for.  */
 void
 be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                     KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
   unsigned int n;
+  unsigned int types = searched_types (ctrl);
 
-  (void)ctrl;
   (void)pubkey_type;
 
+  if (stale_search_p (ctrl))
+    return;
+
   for (n=0; n < ndesc; n++)
     {
-      switch (desc->mode)
+      switch (desc[n].mode)
         {
         case KEYDB_SEARCH_MODE_LONG_KID:
-          key_table_put_no_kid (desc[n].u.kid[0], desc[n].u.kid[1]);
+          key_table_put_no_kid (desc[n].u.kid[0], desc[n].u.kid[1], types);
           break;
 
         case KEYDB_SEARCH_MODE_FPR:
-          key_table_put_no_fpr (desc[n].u.fpr, desc[n].fprlen);
+          key_table_put_no_fpr (desc[n].u.fpr, desc[n].fprlen, types);
           break;
 
         default:
@@ -281,7 +281,7 @@ be_kbx_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
       err = be_return_pubkey (ctrl, buffer, buflen, pubkey_type, ubid,
                               0, 0, 0, 0);
       if (!err)
-        be_cache_pubkey (ctrl, ubid, buffer, buflen, pubkey_type);
+        be_cache_pubkey (ctrl, ubid, buffer, buflen, pubkey_type, 0, 0);
       xfree (buffer);
     }
 
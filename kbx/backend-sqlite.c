@@ -48,6 +48,10 @@ struct backend_handle_s
 /* Definition of local request data.  */
 struct be_sqlite_local_s
 {
+  /* A read-only connection used for searches of this request.  It is
+   * opened on demand and only used if the database is in WAL mode.  */
+  sqlite3 *readhd;
+
   /* The statement object of the current select command.  */
   sqlite3_stmt *select_stmt;
 
@@ -88,9 +92,18 @@ static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
 static sqlite3 *database_hd;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
+/* True if the database is in WAL mode and thus searches may use
+ * their own read-only connection.  */
+static int database_wal;
+/* True if the full-text indices on the userid table are available.  */
+static int database_fts;
 
 /* The version of our current database schema.  */
-#define DATABASE_VERSION 1
+#define DATABASE_VERSION 3
+
+/* The maximum number of entries in the signature cache.  If more
+ * entries are stored the oldest ones are removed.  */
+#define SIGCACHE_MAX_ENTRIES 100000
 
 /* Table definitions for the database.  */
 static struct
@@ -103,8 +116,10 @@ static struct
 
    /* Table to store config values:
     * Standard name value pairs:
-    *   dbversion = 1
+    *   dbversion = 3
     *   created = <ISO time string>
+    *   useridgen = <number of changes to the userid table>
+    *   ftsgen = <value of useridgen the full-text index matches>
     */
    { "CREATE TABLE IF NOT EXISTS config ("
      "name  TEXT NOT NULL UNIQUE,"
@@ -180,8 +195,101 @@ static struct
      /* The Unique Blob ID (usually the truncated fingerprint).  */
      "ubid BLOB NOT NULL REFERENCES pubkey"
      ")"  },
-   { "CREATE INDEX IF NOT EXISTS issueridx1 on issuer (dn)" }
+   { "CREATE INDEX IF NOT EXISTS issueridx1 on issuer (dn)" },
+
+   /* Table with the results of signature verifications done by gpg.
+    * The hash covers all data which makes up a verification; the
+    * ubid is only used to retrieve all results for a keyblock at
+    * once and to remove them along with the key.  */
+   { "CREATE TABLE IF NOT EXISTS sigcache ("
+     /* The SHA-256 hash over the signer's fingerprint, the digest of
+      * the signed data and the signature (SIGCACHE_HASH_LEN).  */
+     "hash  BLOB NOT NULL PRIMARY KEY,"
+     /* The Unique Blob ID of the keyblock with the signature.  */
+     "ubid  BLOB NOT NULL,"
+     /* 1 = good signature, 0 = bad signature.  */
+     "valid INTEGER NOT NULL,"
+     /* Creation time of the entry in seconds since Epoch.  */
+     "created INTEGER NOT NULL"
+     ")" },
+   { "CREATE INDEX IF NOT EXISTS sigcacheidx1 on sigcache (ubid)" },
+
+   /* Count the changes to the userid table so that a keyboxd with
+    * full-text indices can detect that another keyboxd without them
+    * has changed the table.  These triggers do not require any SQLite
+    * extension.  */
+   { "INSERT OR IGNORE INTO config (name, value) VALUES ('useridgen', '0')" },
+   { "CREATE TRIGGER IF NOT EXISTS useridgenins AFTER INSERT ON userid BEGIN"
+     " UPDATE config SET value = value + 1 WHERE name = 'useridgen';"
+     " END" },
+   { "CREATE TRIGGER IF NOT EXISTS useridgendel AFTER DELETE ON userid BEGIN"
+     " UPDATE config SET value = value + 1 WHERE name = 'useridgen';"
+     " END" },
+   { "CREATE TRIGGER IF NOT EXISTS useridgenupd AFTER UPDATE ON userid BEGIN"
+     " UPDATE config SET value = value + 1 WHERE name = 'useridgen';"
+     " END" }
+
+  };
 
+
+/* Full-text indices for the userid table.  These are FTS5 tables
+ * using the userid table as external content.  The trigram index is
+ * used for substring searches on the user id or the mail address and
+ * the word index for word searches.  The indices are kept in sync by
+ * TEMP triggers, which are not stored in the database file; thus a
+ * keyboxd without FTS5 support can still change the userid table.
+ * It then only increments useridgen but not ftsgen and the indices
+ * are rebuilt by the next keyboxd with FTS5 support.  */
+static const char *fts_definitions[] =
+  {
+   "CREATE VIRTUAL TABLE IF NOT EXISTS useridsub USING fts5 ("
+   "uid, addrspec,"
+   "content='userid', tokenize='trigram')",
+
+   "CREATE VIRTUAL TABLE IF NOT EXISTS useridword USING fts5 ("
+   "uid,"
+   "content='userid', tokenize='unicode61 remove_diacritics 0')",
+
+   "CREATE TEMP TRIGGER IF NOT EXISTS useridftsins"
+   " AFTER INSERT ON main.userid BEGIN"
+   " INSERT INTO useridsub (rowid, uid, addrspec)"
+   "  VALUES (new.rowid, new.uid, new.addrspec);"
+   " INSERT INTO useridword (rowid, uid)"
+   "  VALUES (new.rowid, new.uid);"
+   " UPDATE config SET value = value + 1 WHERE name = 'ftsgen';"
+   " END",
+
+   "CREATE TEMP TRIGGER IF NOT EXISTS useridftsdel"
+   " AFTER DELETE ON main.userid BEGIN"
+   " INSERT INTO useridsub (useridsub, rowid, uid, addrspec)"
+   "  VALUES ('delete', old.rowid, old.uid, old.addrspec);"
+   " INSERT INTO useridword (useridword, rowid, uid)"
+   "  VALUES ('delete', old.rowid, old.uid);"
+   " UPDATE config SET value = value + 1 WHERE name = 'ftsgen';"
+   " END",
+
+   "CREATE TEMP TRIGGER IF NOT EXISTS useridftsupd"
+   " AFTER UPDATE ON main.userid BEGIN"
+   " INSERT INTO useridsub (useridsub, rowid, uid, addrspec)"
+   "  VALUES ('delete', old.rowid, old.uid, old.addrspec);"
+   " INSERT INTO useridword (useridword, rowid, uid)"
+   "  VALUES ('delete', old.rowid, old.uid);"
+   " INSERT INTO useridsub (rowid, uid, addrspec)"
+   "  VALUES (new.rowid, new.uid, new.addrspec);"
+   " INSERT INTO useridword (rowid, uid)"
+   "  VALUES (new.rowid, new.uid);"
+   " UPDATE config SET value = value + 1 WHERE name = 'ftsgen';"
+   " END"
+  };
+
+
+/* Persistent triggers created by earlier versions of keyboxd which
+ * require FTS5 support and are thus removed.  */
+static const char *fts_obsolete_definitions[] =
+  {
+   "DROP TRIGGER IF EXISTS main.useridftsins",
+   "DROP TRIGGER IF EXISTS main.useridftsdel",
+   "DROP TRIGGER IF EXISTS main.useridftsupd"
   };
 
 
@@ -315,12 +423,13 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA or EXTRA2 are not NULL these parts are appended to the SQL
- * statement.  */
+/* Run an SQL prepare for SQLSTR on the connection HD and return a
+ * statement at R_STMT.  If EXTRA or EXTRA2 are not NULL these parts
+ * are appended to the SQL statement.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
-                 sqlite3_stmt **r_stmt)
+run_sql_prepare_hd (sqlite3 *hd, const char *sqlstr,
+                    const char *extra, const char *extra2,
+                    sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
   int res;
@@ -334,7 +443,7 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  res = sqlite3_prepare_v2 (hd, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -344,6 +453,15 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
 }
 
 
+/* Same as run_sql_prepare_hd but uses the global database handle.  */
+static gpg_error_t
+run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 sqlite3_stmt **r_stmt)
+{
+  return run_sql_prepare_hd (database_hd, sqlstr, extra, extra2, r_stmt);
+}
+
+
 /* Helper to bind a BLOB parameter to a statement.  */
 static gpg_error_t
 run_sql_bind_blob (sqlite3_stmt *stmt, int no,
@@ -439,6 +557,63 @@ run_sql_bind_text_like (sqlite3_stmt *stmt, int no, const char *value)
 }
 
 
+/* Helper to bind a word search pattern to a statement.  VALUE is
+ * split into words which are then bound as a FTS5 query requiring all
+ * these words.  Word delimiters are the same as used by gpg for
+ * keyrings; that is all non-alphanumeric ASCII characters.  */
+static gpg_error_t
+run_sql_bind_text_words (sqlite3_stmt *stmt, int no, const char *value)
+{
+  gpg_error_t err;
+  int res;
+  const unsigned char *s;
+  char *buf, *p;
+  int inword = 0;
+
+  /* We need at most 3 extra characters per word plus the nul.  */
+  buf = xtrymalloc (3 * strlen (value) + 1);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  p = buf;
+  for (s = (const unsigned char *)value; *s; s++)
+    {
+      if (*s >= 0x80 || alnump (s))
+        {
+          if (!inword)
+            {
+              if (p != buf)
+                *p++ = ' ';
+              *p++ = '\"';
+              inword = 1;
+            }
+          *p++ = *s;
+        }
+      else if (inword)
+        {
+          *p++ = '\"';
+          inword = 0;
+        }
+    }
+  if (inword)
+    *p++ = '\"';
+  *p = 0;
+
+  if (!*buf)
+    {
+      xfree (buf);
+      return gpg_error (GPG_ERR_INV_USER_ID);  /* No words at all.  */
+    }
+
+  res = sqlite3_bind_text (stmt, no, buf, strlen (buf), SQLITE_TRANSIENT);
+  if (res)
+    err = diag_bind_err (res, stmt);
+  else
+    err = 0;
+  xfree (buf);
+  return err;
+}
+
+
 /* Wrapper around sqlite3_step for use with simple functions.  */
 static gpg_error_t
 run_sql_step (sqlite3_stmt *stmt)
@@ -458,14 +633,23 @@ run_sql_step (sqlite3_stmt *stmt)
 
 /* Wrapper around sqlite3_step for use with select.  This version does
  * not print diags for SQLITE_DONE or SQLITE_ROW but returns them as
- * gpg error codes.  */
+ * gpg error codes.  If UNPROTECT is set other threads are allowed to
+ * run while SQLite is working; this may only be used if STMT belongs
+ * to a connection not shared with other threads.  */
 static gpg_error_t
-run_sql_step_for_select (sqlite3_stmt *stmt)
+run_sql_step_for_select (sqlite3_stmt *stmt, int unprotect)
 {
   gpg_error_t err;
   int res;
 
-  res = sqlite3_step (stmt);
+  if (unprotect)
+    {
+      npth_unprotect ();
+      res = sqlite3_step (stmt);
+      npth_protect ();
+    }
+  else
+    res = sqlite3_step (stmt);
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -555,6 +739,106 @@ dblock_info_cb (dotlock_t h, void *opaque, enum dotlock_reasons reason,
   return rc;
 }
 
+/* Switch the database to WAL mode.  In this mode readers on other
+ * connections do not block a writer and vice versa, which allows us
+ * to run searches on per-request connections.  If WAL mode can't be
+ * enabled all searches use the global handle.  */
+static void
+enable_wal_mode (void)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  const char *s;
+
+  database_wal = 0;
+  err = run_sql_prepare ("PRAGMA journal_mode = WAL", NULL, NULL, &stmt);
+  if (err)
+    return;
+  err = run_sql_step_for_select (stmt, 0);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      s = (const char *)sqlite3_column_text (stmt, 0);
+      if (s && !ascii_strcasecmp (s, "wal"))
+        database_wal = 1;
+    }
+  sqlite3_finalize (stmt);
+
+  if (!database_wal)
+    log_info ("database is not in WAL mode - searches are serialized\n");
+}
+
+
+/* Create the full-text indices for the userid table if the SQLite
+ * library supports them and set DATABASE_FTS on success.  If the
+ * indices are added to an existing database or if the userid table
+ * has been changed by a keyboxd without FTS5 support they are filled
+ * from the userid table.  */
+static void
+create_fts_indices (void)
+{
+  gpg_error_t err;
+  int idx;
+  char *useridgen = NULL;
+  char *ftsgen = NULL;
+
+  database_fts = 0;
+
+  /* Remove triggers which would break all changes to the userid
+   * table if FTS5 is not available.  */
+  for (idx=0; idx < DIM(fts_obsolete_definitions); idx++)
+    if (run_sql_statement (fts_obsolete_definitions[idx]))
+      return;
+
+  /* The trigram tokenizer is available since SQLite 3.34.  */
+  if (sqlite3_libversion_number () < 3034000
+      || !sqlite3_compileoption_used ("ENABLE_FTS5"))
+    {
+      log_info ("SQLite has no FTS5 trigram support"
+                " - substring searches are slow\n");
+      return;
+    }
+
+  err = run_sql_statement ("SAVEPOINT fts");
+  if (err)
+    return;
+  for (idx=0; !err && idx < DIM(fts_definitions); idx++)
+    err = run_sql_statement (fts_definitions[idx]);
+  if (!err)
+    err = get_config_value ("useridgen", &useridgen);
+  if (!err)
+    {
+      err = get_config_value ("ftsgen", &ftsgen);
+      if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+        err = 0;
+    }
+  if (!err && (!ftsgen || strcmp (ftsgen, useridgen)))
+    {
+      log_info ("creating full-text index for the user ids\n");
+      err = run_sql_statement
+        ("INSERT INTO useridsub (useridsub) VALUES ('rebuild')");
+      if (!err)
+        err = run_sql_statement
+          ("INSERT INTO useridword (useridword) VALUES ('rebuild')");
+      if (!err)
+        err = set_config_value ("ftsgen", useridgen);
+    }
+  xfree (useridgen);
+  xfree (ftsgen);
+  if (err)
+    {
+      run_sql_statement ("ROLLBACK TO fts");
+      run_sql_statement ("RELEASE fts");
+      log_info ("full-text index not available"
+                " - substring searches are slow\n");
+      return;
+    }
+  if (run_sql_statement ("RELEASE fts"))
+    return;
+
+  database_fts = 1;
+}
+
+
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
  * available.  */
@@ -630,6 +914,8 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   /* Enable extended error codes.  */
   sqlite3_extended_result_codes (database_hd, 1);
 
+  enable_wal_mode ();
+
   /* Create the tables if needed.  */
   for (idx=0; idx < DIM(table_definitions); idx++)
     {
@@ -659,6 +945,15 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
             }
           log_info ("database version: %d\n", dbversion);
 
+          /* Version 3 changed the layout of the signature cache.  It
+           * is only a cache and thus we simply start a new one.  */
+          if (dbversion && dbversion < 3)
+            {
+              err = run_sql_statement ("DROP TABLE IF EXISTS sigcache");
+              if (err)
+                goto leave;
+            }
+
           xfree (value);
           err = get_config_value ("created", &value);
           if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
@@ -674,13 +969,15 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
         }
     }
 
+  create_fts_indices ();
+
   if (!opt.quiet)
     log_info (_("database '%s' created\n"), filename);
 
-  if (setdbversion)
+  if (setdbversion || (dbversion && dbversion < DATABASE_VERSION))
     {
       err = set_config_value ("dbversion", STR2(DATABASE_VERSION));
-      if (!err)
+      if (!err && setdbversion)
         err = set_config_value ("created", isotimestamp (gnupg_get_time ()));
     }
 
@@ -759,10 +1056,42 @@ be_sqlite_release_local (be_sqlite_local_t ctx)
 {
   if (ctx->select_stmt)
     sqlite3_finalize (ctx->select_stmt);
+  if (ctx->readhd)
+    sqlite3_close (ctx->readhd);
   xfree (ctx);
 }
 
 
+/* Make sure that CTX has a read-only connection to the database
+ * FILENAME.  Such a connection is used by just one request and thus
+ * SQLite may be called on it without holding our mutex.  */
+static gpg_error_t
+open_read_connection (be_sqlite_local_t ctx, const char *filename)
+{
+  int res;
+
+  if (ctx->readhd)
+    return 0;
+
+  res = sqlite3_open_v2 (filename, &ctx->readhd,
+                         (SQLITE_OPEN_READONLY
+                          | SQLITE_OPEN_NOMUTEX),
+                         NULL);
+  if (res)
+    {
+      log_error ("error opening '%s' for reading: %s\n",
+                 filename, sqlite3_errstr (res));
+      sqlite3_close (ctx->readhd);
+      ctx->readhd = NULL;
+      return gpg_error (gpg_err_code_from_sqlite (res));
+    }
+  sqlite3_extended_result_codes (ctx->readhd, 1);
+  /* A reader may need to wait for a checkpoint to finish.  */
+  sqlite3_busy_timeout (ctx->readhd, 10000);
+  return 0;
+}
+
+
 gpg_error_t
 be_sqlite_rollback (void)
 {
@@ -821,7 +1150,7 @@ get_config_value (const char *name, char **r_value)
   if (err)
     return err;
 
-  err = run_sql_step_for_select (stmt);
+  err = run_sql_step_for_select (stmt, 0);
   if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
     {
       s = sqlite3_column_text (stmt, 0);
@@ -866,10 +1195,10 @@ set_config_value (const char *name, const char *value)
 }
 
 
-/* Run a select for the search given by (DESC,NDESC).  The data is not
- * returned but stored in the request item.  */
+/* Run a select for the search given by (DESC,NDESC) on the connection
+ * HD.  The data is not returned but stored in the request item.  */
 static gpg_error_t
-run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
+run_select_statement (ctrl_t ctrl, sqlite3 *hd, be_sqlite_local_t ctx,
                       KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
   gpg_error_t err = 0;
@@ -890,7 +1219,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
   /* Check whether we can reuse the current select statement.  */
   if (!ctx->select_stmt)
     ;
-  else if (ctx->select_mode != desc[descidx].mode)
+  else if (ctx->select_mode != desc[descidx].mode
+           || sqlite3_db_handle (ctx->select_stmt) != hd)
     {
       sqlite3_finalize (ctx->select_stmt);
       ctx->select_stmt = NULL;
@@ -938,22 +1268,24 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.uid = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         {
           s = desc[descidx].u.name;
@@ -973,12 +1305,23 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (ctx->select_stmt)
+        ;
+      else if (database_fts)
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.rowid IN"
+           " (SELECT rowid FROM useridsub WHERE addrspec LIKE ?1)",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -986,30 +1329,58 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (ctx->select_stmt)
+        ;
+      else if (database_fts)
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.rowid IN"
+           " (SELECT rowid FROM useridsub WHERE uid LIKE ?1)",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
       break;
 
-    case KEYDB_SEARCH_MODE_MAILEND:
     case KEYDB_SEARCH_MODE_WORDS:
+      ctx->select_col_uidno = 5;
+      if (!database_fts)
+        err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+      else if (!ctx->select_stmt)
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.rowid IN"
+           " (SELECT rowid FROM useridword WHERE useridword MATCH ?1)",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (!err)
+        err = run_sql_bind_text_words (ctx->select_stmt, 1,
+                                       desc[descidx].u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
       err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
       break;
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob"
-                               " FROM pubkey as p, issuer as i"
-                               " WHERE p.ubid = i.ubid"
-                               " AND i.dn = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob"
+           " FROM pubkey as p, issuer as i"
+           " WHERE p.ubid = i.ubid"
+           " AND i.dn = $1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1025,13 +1396,14 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                                   " p.revoked, p.keyblob"
-                                   " FROM pubkey as p, issuer as i"
-                                   " WHERE p.ubid = i.ubid"
-                                   " AND i.sn = $1 AND i.dn = $2",
-                                   extra, " ORDER BY p.ubid",
-                                   &ctx->select_stmt);
+            err = run_sql_prepare_hd
+              (hd, "SELECT p.ubid, p.type, p.ephemeral,"
+               " p.revoked, p.keyblob"
+               " FROM pubkey as p, issuer as i"
+               " WHERE p.ubid = i.ubid"
+               " AND i.sn = $1 AND i.dn = $2",
+               extra, " ORDER BY p.ubid",
+               &ctx->select_stmt);
           if (!err)
             err = run_sql_bind_ntext (ctx->select_stmt, 1,
                                       desc[descidx].sn, desc[descidx].snlen);
@@ -1051,12 +1423,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid"
-                               " AND u.uid = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid"
+           " AND u.uid = $1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1065,12 +1438,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SHORT_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND"
-                               " substr(f.kid,5) = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND"
+           " substr(f.kid,5) = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
@@ -1080,11 +1454,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.kid = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf),
@@ -1094,11 +1469,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.fpr = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.fpr, desc[descidx].fprlen);
@@ -1107,11 +1483,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.grip, KEYGRIP_LEN);
@@ -1119,10 +1496,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
-                               " FROM pubkey as p"
-                               " WHERE ubid = ?1",
-                               extra, NULL, &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (hd, "SELECT ubid, type, ephemeral, revoked, keyblob"
+           " FROM pubkey as p"
+           " WHERE ubid = ?1",
+           extra, NULL, &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.ubid, UBID_LEN);
@@ -1140,10 +1518,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
-                                 " keyblob"
-                                 " FROM pubkey as p",
-                                 extra, NULL, &ctx->select_stmt);
+          err = run_sql_prepare_hd
+            (hd, "SELECT ubid, type, ephemeral, revoked,"
+             " keyblob"
+             " FROM pubkey as p",
+             extra, NULL, &ctx->select_stmt);
         }
       break;
 
@@ -1172,6 +1551,8 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  sqlite3 *hd, *stmthd;
+  int got_mutex = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
@@ -1180,7 +1561,15 @@ be_sqlite_search (ctrl_t ctrl,
   if (err)
     return err;
 
-  acquire_mutex ();
+  /* In WAL mode we run the search on a connection private to this
+   * request so that no mutex is required and other threads can run
+   * while SQLite is busy.  During a global transaction we need to use
+   * the global handle to see the changes done in that transaction.  */
+  if (!database_wal || opt.in_transaction)
+    {
+      acquire_mutex ();
+      got_mutex = 1;
+    }
 
   /* Find the specific request part or allocate it.  */
   err = be_find_request_part (backend_hd, request, &part);
@@ -1206,6 +1595,16 @@ be_sqlite_search (ctrl_t ctrl,
       goto leave;
     }
 
+  if (got_mutex)
+    hd = database_hd;
+  else
+    {
+      err = open_read_connection (ctx, backend_hd->filename);
+      if (err)
+        goto leave;
+      hd = ctx->readhd;
+    }
+
   /* Start a global transaction if needed.  */
   if (!opt.active_transaction && opt.in_transaction)
     {
@@ -1220,7 +1619,7 @@ be_sqlite_search (ctrl_t ctrl,
   if (!ctx->select_done)
     {
       /* Initial search - run the select.  */
-      err = run_select_statement (ctrl, ctx, desc, ndesc);
+      err = run_select_statement (ctrl, hd, ctx, desc, ndesc);
       if (err)
         goto leave;
       ctx->select_done = 1;
@@ -1228,8 +1627,12 @@ be_sqlite_search (ctrl_t ctrl,
 
   show_sqlstmt (ctx->select_stmt);
 
-  /* SQL select succeeded - get the first or next row. */
-  err = run_sql_step_for_select (ctx->select_stmt);
+  /* SQL select succeeded - get the first or next row.  Note that the
+   * statement may belong to the read connection even if we are now
+   * in a transaction; thus we need to use the statement's handle.  */
+  stmthd = sqlite3_db_handle (ctx->select_stmt);
+  err = run_sql_step_for_select (ctx->select_stmt,
+                                 (ctx->readhd && stmthd == ctx->readhd));
   if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
     {
       int n;
@@ -1243,7 +1646,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1276,7 +1679,7 @@ be_sqlite_search (ctrl_t ctrl,
       ctx->lastubid_valid = 1;
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1287,7 +1690,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1298,7 +1701,7 @@ be_sqlite_search (ctrl_t ctrl,
       is_ephemeral = !!n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1312,7 +1715,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1326,7 +1729,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1345,7 +1748,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (stmthd) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1364,7 +1767,8 @@ be_sqlite_search (ctrl_t ctrl,
       err = be_return_pubkey (ctrl, keyblob, keybloblen, pubkey_type,
                               ubid, is_ephemeral, is_revoked, uid_no, pk_no);
       if (!err)
-        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type);
+        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type,
+                         is_ephemeral, is_revoked);
     }
   else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
     {
@@ -1382,7 +1786,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (got_mutex)
+    release_mutex ();
   return err;
 }
 
@@ -1848,6 +2253,9 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
   if (!err)
     err = run_sql_statement_bind_ubid
       ("DELETE from issuer WHERE ubid = ?1", ubid);
+  if (!err)
+    err = run_sql_statement_bind_ubid
+      ("DELETE from sigcache WHERE ubid = ?1", ubid);
   if (!err)
     err = run_sql_statement_bind_ubid
       ("DELETE from pubkey WHERE ubid = ?1", ubid);
@@ -1874,3 +2282,145 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
   release_mutex ();
   return err;
 }
+
+
+/* Return the cached results of the signature verifications for the
+ * keyblock UBID as status lines "SIGCACHE <hash> good|bad".
+ * BACKEND_HD is the handle for this backend.  */
+gpg_error_t
+be_sqlite_sigcache_get (ctrl_t ctrl, backend_handle_t backend_hd,
+                        const unsigned char *ubid)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt = NULL;
+  const unsigned char *hash;
+  char hexhash[2*SIGCACHE_HASH_LEN+1];
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
+
+  err = create_or_open_database (ctrl, backend_hd->filename);
+  if (err)
+    return err;
+
+  acquire_mutex ();
+
+  err = run_sql_prepare ("SELECT hash, valid FROM sigcache WHERE ubid = ?1",
+                         NULL, NULL, &stmt);
+  if (!err)
+    err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
+  if (err)
+    goto leave;
+
+  while (gpg_err_code (err = run_sql_step_for_select (stmt, 0))
+         == GPG_ERR_SQL_ROW)
+    {
+      hash = sqlite3_column_blob (stmt, 0);
+      if (!hash || sqlite3_column_bytes (stmt, 0) != SIGCACHE_HASH_LEN)
+        continue;  /* Ignore invalid entries.  */
+      bin2hex (hash, SIGCACHE_HASH_LEN, hexhash);
+      err = kbxd_status_printf (ctrl, "SIGCACHE", "%s %s", hexhash,
+                                sqlite3_column_int (stmt, 1)? "good":"bad");
+      if (err)
+        goto leave;
+    }
+  if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    err = 0;
+
+ leave:
+  if (stmt)
+    sqlite3_finalize (stmt);
+  release_mutex ();
+  return err;
+}
+
+
+/* Store the results of NITEMS signature verifications for the
+ * keyblock UBID in the signature cache.  HASHES holds NITEMS hashes
+ * of SIGCACHE_HASH_LEN bytes each and VALID the corresponding
+ * results.  BACKEND_HD is the handle for this backend.  If the cache
+ * gets too large the oldest entries are removed.  */
+gpg_error_t
+be_sqlite_sigcache_put (ctrl_t ctrl, backend_handle_t backend_hd,
+                        const unsigned char *ubid,
+                        const unsigned char *hashes, const char *valid,
+                        unsigned int nitems)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt = NULL;
+  int in_transaction = 0;
+  unsigned int n;
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
+
+  err = create_or_open_database (ctrl, backend_hd->filename);
+  if (err)
+    return err;
+
+  acquire_mutex ();
+
+  if (!opt.active_transaction)
+    {
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        goto leave;
+      if (opt.in_transaction)
+        opt.active_transaction = 1;
+    }
+  in_transaction = 1;
+
+  err = run_sql_prepare ("INSERT OR REPLACE INTO sigcache"
+                         " (hash, ubid, valid, created)"
+                         " VALUES (?1, ?2, ?3, strftime('%s','now'))",
+                         NULL, NULL, &stmt);
+  for (n=0; !err && n < nitems; n++)
+    {
+      err = run_sql_bind_blob (stmt, 1, hashes + n * SIGCACHE_HASH_LEN,
+                               SIGCACHE_HASH_LEN);
+      if (!err)
+        err = run_sql_bind_blob (stmt, 2, ubid, UBID_LEN);
+      if (!err)
+        err = run_sql_bind_int (stmt, 3, !!valid[n]);
+      if (!err)
+        err = run_sql_step (stmt);
+      if (!err)
+        err = run_sql_reset (stmt);
+    }
+  if (stmt)
+    {
+      sqlite3_finalize (stmt);
+      stmt = NULL;
+    }
+  if (err)
+    goto leave;
+
+  /* Limit the size of the cache.  A replaced entry gets a new rowid
+   * and thus the rowids roughly give the age of the entries.  */
+  err = run_sql_prepare ("DELETE FROM sigcache WHERE rowid <="
+                         " (SELECT max(rowid) FROM sigcache) - ?1",
+                         NULL, NULL, &stmt);
+  if (!err)
+    err = run_sql_bind_int (stmt, 1, SIGCACHE_MAX_ENTRIES);
+  if (!err)
+    err = run_sql_step (stmt);
+
+ leave:
+  if (stmt)
+    sqlite3_finalize (stmt);
+
+  if (in_transaction && !err)
+    {
+      if (opt.active_transaction)
+        ; /* We are in a global transaction.  */
+      else
+        err = run_sql_statement ("commit");
+    }
+  else if (in_transaction)
+    {
+      if (opt.active_transaction)
+        ; /* We are in a global transaction.  */
+      else if (run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+    }
+  release_mutex ();
+  return err;
+}
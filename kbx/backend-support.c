@@ -163,7 +163,8 @@ be_find_request_part (backend_handle_t backend_hd, db_request_t request,
 
 
 /* Return the public key (BUFFER,BUFLEN) which has the type
- * PUBKEY_TYPE to the caller.  */
+ * PUBKEY_TYPE to the caller.  GPG_ERR_TRUE is returned if the key
+ * has already been returned from the cache.  */
 gpg_error_t
 be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
                   enum pubkey_types pubkey_type, const unsigned char *ubid,
@@ -172,6 +173,15 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
   gpg_error_t err;
   char hexubid[2*UBID_LEN+1];
 
+  /* Do not return the key again which has already been returned from
+   * the cache.  The backend continues the search on GPG_ERR_TRUE.  */
+  if (ctrl->db_req && ctrl->db_req->skip_ubid_valid
+      && !memcmp (ctrl->db_req->skip_ubid, ubid, UBID_LEN))
+    {
+      ctrl->db_req->skip_ubid_valid = 0;
+      return gpg_error (GPG_ERR_TRUE);
+    }
+
   bin2hex (ubid, UBID_LEN, hexubid);
   err = kbxd_status_printf (ctrl, "PUBKEY_INFO", "%d %s %c%c %d %d",
                             pubkey_type, hexubid,
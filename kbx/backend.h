@@ -59,15 +59,6 @@ struct db_request_part_s
 
   /* Local data for a sqlite backend.  */
   be_sqlite_local_t besqlite;
-
-  /* For the CACHE backend the indices into the bloblist for each
-   * index type.  */
-  struct {
-    unsigned int fpr;
-    unsigned int kid;
-    unsigned int grip;
-    unsigned int ubid;
-  } cache_seqno;
 };
 typedef struct db_request_part_s *db_request_part_t;
 
@@ -78,24 +69,22 @@ struct db_request_s
 {
   unsigned int any_search:1;  /* Any search has been done.  */
   unsigned int any_found:1;   /* Any object has been found.  */
-  unsigned int last_cached_valid:1; /* see below */
-  unsigned int last_cached_final:1; /* see below */
-  unsigned int last_cached_fprlen:8;/* see below */
+  unsigned int skip_ubid_valid:1; /* see below */
 
   db_request_part_t part;
 
   /* Counter to track the next to be searched database index.  */
   unsigned int next_dbidx;
 
-  /* The last UBID found in the cache and the corresponding keyid and,
-   * if found via fpr, the fingerprint.  For the LAST_CACHED_FPRLEN see
-   * above.  The entry here is only valid if LAST_CACHED_VALID is set;
-   * if LAST_CACHED_FINAL is also set, this indicates that no further
-   * database searches are required.  */
-  unsigned char last_cached_ubid[UBID_LEN];
-  u32 last_cached_kid_h;
-  u32 last_cached_kid_l;
-  unsigned char last_cached_fpr[32];
+  /* The UBID of the key returned from the cache for the first search.
+   * A continued search in the database must not return that key
+   * again.  Only valid if SKIP_UBID_VALID is set.  */
+  unsigned char skip_ubid[UBID_LEN];
+
+  /* The cache generation at the start of the search.  Results of a
+   * search which started before the cache has been invalidated may
+   * be stale and are not put into the cache.  */
+  unsigned int cache_generation;
 };
 
 
@@ -121,18 +110,42 @@ gpg_error_t be_get_x509_keygrip (ksba_cert_t cert, unsigned char *keygrip);
 
 
 /*-- backend-cache.c --*/
+
+/* Counters of the cache as returned by be_cache_get_stats.  */
+struct be_cache_stats_s
+{
+  unsigned long hits;      /* Searches answered from the cache.  */
+  unsigned long nf_hits;   /* Searches answered by a not-found mark.  */
+  unsigned long misses;    /* Searches not answered from the cache.  */
+  unsigned long added;     /* Objects added to the cache.  */
+  unsigned long evicted;   /* Objects evicted to make room.  */
+  size_t size;             /* The size of the cache in bytes.  */
+  size_t used;             /* The bytes used by cached objects.  */
+  size_t nblobs;           /* The number of cached blobs.  */
+  size_t nkeys;            /* The number of cached key items.  */
+};
+
 gpg_error_t be_cache_initialize (void);
+void be_cache_set_size (size_t nbytes);
+void be_cache_flush (void);
+unsigned int be_cache_generation (void);
+void be_cache_get_stats (struct be_cache_stats_s *r_stats);
 gpg_error_t be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd);
 void be_cache_release_resource (ctrl_t ctrl, backend_handle_t hd);
 gpg_error_t be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd,
                              db_request_t request,
                              KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
-void be_cache_mark_final (ctrl_t ctrl, db_request_t request);
 void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       const void *blob, unsigned int bloblen,
-                      enum pubkey_types pubkey_type);
+                      enum pubkey_types pubkey_type,
+                      int is_ephemeral, int is_revoked);
 void be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+int be_cache_known_not_found (ctrl_t ctrl,
+                              KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+void be_cache_invalidate (ctrl_t ctrl, const unsigned char *ubid,
+                          const void *blob, size_t bloblen,
+                          enum pubkey_types pubkey_type);
 
 
 /*-- backend-kbx.c --*/
@@ -178,6 +191,12 @@ gpg_error_t be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
                              const void *blob, size_t bloblen);
 gpg_error_t be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
                               db_request_t request, const unsigned char *ubid);
+gpg_error_t be_sqlite_sigcache_get (ctrl_t ctrl, backend_handle_t backend_hd,
+                                    const unsigned char *ubid);
+gpg_error_t be_sqlite_sigcache_put (ctrl_t ctrl, backend_handle_t backend_hd,
+                                    const unsigned char *ubid,
+                                    const unsigned char *hashes,
+                                    const char *valid, unsigned int nitems);
 
 
 #endif /*KBX_BACKEND_H*/
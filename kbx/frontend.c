@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -37,6 +38,19 @@ struct
 {
   enum database_types db_type;
   backend_handle_t backend_handle;
+  /* The cache which is queried before the actual database.  */
+  backend_handle_t cache_handle;
+  /* Reader/writer lock to protect the backends.  Searches take a
+   * shared lock so that many clients can search at the same time;
+   * stores and deletes take an exclusive lock.  */
+  npth_rwlock_t lock;
+  /* A writer holds this mutex while it waits for the exclusive lock.
+   * Readers pass through it before taking the shared lock.  Thus new
+   * searches queue up behind a waiting store and a steady stream of
+   * searches can't starve the writers.  The price is that searches
+   * arriving while a store waits are delayed until that store is
+   * done, even if they could share the lock with running searches.  */
+  npth_mutex_t writer_gate;
 } the_database;
 
 
@@ -45,8 +59,22 @@ struct
 static void
 take_read_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  log_assert (!ctrl->db_lock);
+  res = npth_mutex_lock (&the_database.writer_gate);
+  if (res)
+    log_fatal ("failed to acquire database writer gate: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  res = npth_mutex_unlock (&the_database.writer_gate);
+  if (res)
+    log_fatal ("failed to release database writer gate: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  res = npth_rwlock_rdlock (&the_database.lock);
+  if (res)
+    log_fatal ("failed to acquire database read lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_lock = 1;
 }
 
 
@@ -54,8 +82,22 @@ take_read_lock (ctrl_t ctrl)
 static void
 take_read_write_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  log_assert (!ctrl->db_lock);
+  res = npth_mutex_lock (&the_database.writer_gate);
+  if (res)
+    log_fatal ("failed to acquire database writer gate: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  res = npth_rwlock_wrlock (&the_database.lock);
+  if (res)
+    log_fatal ("failed to acquire database write lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  res = npth_mutex_unlock (&the_database.writer_gate);
+  if (res)
+    log_fatal ("failed to release database writer gate: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_lock = 2;
 }
 
 
@@ -64,8 +106,15 @@ take_read_write_lock (ctrl_t ctrl)
 static void
 release_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  if (!ctrl->db_lock)
+    return;
+  res = npth_rwlock_unlock (&the_database.lock);
+  if (res)
+    log_fatal ("failed to release database lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_lock = 0;
 }
 
 
@@ -83,6 +132,7 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
   enum database_types db_type = 0;
   backend_handle_t handle = NULL;
   unsigned int n;
+  int res;
 
   /* Do tilde expansion etc. */
   if (strchr (filename_arg, DIRSEP_C)
@@ -105,8 +155,18 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
       goto leave;
     }
 
+  res = npth_rwlock_init (&the_database.lock, NULL);
+  if (!res)
+    res = npth_mutex_init (&the_database.writer_gate, NULL);
+  if (res)
+    {
+      err = gpg_error_from_errno (res);
+      log_error ("error initializing database lock: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
   /* Init the cache.  */
-  err = be_cache_initialize ();
+  err = be_cache_add_resource (ctrl, &the_database.cache_handle);
   if (err)
     goto leave;
 
@@ -174,9 +234,16 @@ kbxd_release_session_info (ctrl_t ctrl)
 
 
 gpg_error_t
-kbxd_rollback (void)
+kbxd_rollback (ctrl_t ctrl)
 {
-  return be_sqlite_rollback ();
+  gpg_error_t err;
+
+  take_read_write_lock (ctrl);
+  /* The cache may hold keys stored during the transaction.  */
+  be_cache_flush ();
+  err = be_sqlite_rollback ();
+  release_lock (ctrl);
+  return err;
 }
 
 
@@ -333,6 +400,7 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
       request->any_search = 0;
       request->any_found = 0;
+      request->skip_ubid_valid = 0;
       request->next_dbidx = 0;
       if (!desc) /* Reset only mode */
         {
@@ -341,26 +409,48 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
     }
 
-  /* Divert to the backend for the actual search.  */
-  switch (the_database.db_type)
+  /* The cache may know that the search won't find anything.  */
+  if (!request->any_search && be_cache_known_not_found (ctrl, desc, ndesc))
     {
-    case DB_TYPE_CACHE:
-      err = be_cache_search (ctrl, the_database.backend_handle, request,
+      if (DBG_LOOKUP)
+        log_debug ("%s: not-found mark in the cache\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  /* The first key of a search may be taken from the cache.  Expected
+   * error codes from the cache lookup are:
+   *  0 - found and returned via the cache
+   *  GPG_ERR_EOF - cache miss. */
+  if (!request->any_search)
+    {
+      request->cache_generation = be_cache_generation ();
+      err = be_cache_search (ctrl, the_database.cache_handle, request,
                              desc, ndesc);
-      /* Expected error codes from the cache lookup are:
-       *  0 - found and returned via the cache
-       *  GPG_ERR_NOT_FOUND - marked in the cache as not available
-       *  GPG_ERR_EOF - cache miss. */
-      break;
+      if (DBG_LOOKUP)
+        log_debug ("%s: searched cache => %s\n", __func__,
+                   gpg_strerror (err));
+      if (gpg_err_code (err) != GPG_ERR_EOF)
+        goto searched;
+    }
 
+  /* Divert to the backend for the actual search.  GPG_ERR_TRUE tells
+   * that the backend skipped the key already returned from the
+   * cache.  */
+  switch (the_database.db_type)
+    {
     case DB_TYPE_KBX:
-      err = be_kbx_search (ctrl, the_database.backend_handle, request,
-                           desc, ndesc);
+      do
+        err = be_kbx_search (ctrl, the_database.backend_handle, request,
+                             desc, ndesc);
+      while (gpg_err_code (err) == GPG_ERR_TRUE);
       break;
 
     case DB_TYPE_SQLITE:
-      err = be_sqlite_search (ctrl, the_database.backend_handle, request,
-                              desc, ndesc);
+      do
+        err = be_sqlite_search (ctrl, the_database.backend_handle, request,
+                                desc, ndesc);
+      while (gpg_err_code (err) == GPG_ERR_TRUE);
       break;
 
     default:
@@ -373,6 +463,8 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
   if (DBG_LOOKUP)
     log_debug ("%s: searched %s => %s\n", __func__,
                strdbtype (the_database.db_type), gpg_strerror (err));
+
+ searched:
   request->any_search = 1;
   if (!err)
     {
@@ -380,14 +472,11 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
     }
   else if (gpg_err_code (err) == GPG_ERR_EOF)
     {
-      if (the_database.db_type == DB_TYPE_CACHE && request->last_cached_valid)
-        {
-          if (request->last_cached_final)
-            goto leave;
-        }
       request->next_dbidx++;
-      /* FIXME: We need to see which pubkey type we need to insert.  */
-      be_cache_not_found (ctrl, PUBKEY_TYPE_UNKNOWN, desc, ndesc);
+      /* Only a search which found nothing at all may be recorded as
+       * not-found; the mark covers the pubkey types searched for.  */
+      if (!request->any_found)
+        be_cache_not_found (ctrl, PUBKEY_TYPE_UNKNOWN, desc, ndesc);
       err = gpg_error (GPG_ERR_NOT_FOUND);
       goto leave;
     }
@@ -443,6 +532,8 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
   if (err)
     goto leave;
 
+  be_cache_invalidate (ctrl, ubid, blob, bloblen, pktype);
+
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
@@ -528,6 +619,8 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
       goto leave;
     }
 
+  be_cache_invalidate (ctrl, ubid, NULL, 0, PUBKEY_TYPE_UNKNOWN);
+
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
@@ -564,3 +657,72 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
     log_clock ("%s: leave", __func__);
   return err;
 }
+
+
+/* Return the cached results of the signature verifications for the
+ * keyblock UBID as status lines.  Returns GPG_ERR_NOT_SUPPORTED if
+ * the database has no signature cache.  */
+gpg_error_t
+kbxd_sigcache_get (ctrl_t ctrl, const unsigned char *ubid)
+{
+  gpg_error_t err;
+
+  take_read_lock (ctrl);
+
+  if (!the_database.db_type)
+    {
+      log_error ("%s: error: no database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+    }
+  else if (the_database.db_type == DB_TYPE_SQLITE)
+    err = be_sqlite_sigcache_get (ctrl, the_database.backend_handle, ubid);
+  else
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  release_lock (ctrl);
+  return err;
+}
+
+
+/* Store the NITEMS verification results VALID for the signatures
+ * identified by HASHES in the signature cache.  The signatures are
+ * part of the keyblock UBID.  */
+gpg_error_t
+kbxd_sigcache_put (ctrl_t ctrl, const unsigned char *ubid,
+                   const unsigned char *hashes, const char *valid,
+                   unsigned int nitems)
+{
+  gpg_error_t err;
+
+  take_read_write_lock (ctrl);
+
+  if (!the_database.db_type)
+    {
+      log_error ("%s: error: no database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+    }
+  else if (the_database.db_type == DB_TYPE_SQLITE)
+    err = be_sqlite_sigcache_put (ctrl, the_database.backend_handle,
+                                  ubid, hashes, valid, nitems);
+  else
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  release_lock (ctrl);
+  return err;
+}
+
+
+/* Return a malloced string with the statistics of the cache.  Returns
+ * NULL and sets ERRNO on malloc failure.  */
+char *
+kbxd_get_cache_info (void)
+{
+  struct be_cache_stats_s stats;
+
+  be_cache_get_stats (&stats);
+  return xtryasprintf ("hits=%lu nf_hits=%lu misses=%lu added=%lu"
+                       " evicted=%lu size=%zu used=%zu blobs=%zu keys=%zu",
+                       stats.hits, stats.nf_hits, stats.misses,
+                       stats.added, stats.evicted, stats.size,
+                       stats.used, stats.nblobs, stats.nkeys);
+}
@@ -28,7 +28,7 @@ gpg_error_t kbxd_set_database (ctrl_t ctrl,
 
 void kbxd_release_session_info (ctrl_t ctrl);
 
-gpg_error_t kbxd_rollback (void);
+gpg_error_t kbxd_rollback (ctrl_t ctrl);
 gpg_error_t kbxd_commit (void);
 gpg_error_t kbxd_search (ctrl_t ctrl,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
@@ -36,6 +36,11 @@ gpg_error_t kbxd_search (ctrl_t ctrl,
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
+gpg_error_t kbxd_sigcache_get (ctrl_t ctrl, const unsigned char *ubid);
+gpg_error_t kbxd_sigcache_put (ctrl_t ctrl, const unsigned char *ubid,
+                               const unsigned char *hashes,
+                               const char *valid, unsigned int nitems);
+char *kbxd_get_cache_info (void);
 
 
 #endif /*KBX_FRONTEND_H*/
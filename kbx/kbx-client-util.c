@@ -366,13 +366,15 @@ kbx_client_data_simple (kbx_client_data_t kcd, const char *command)
 }
 
 
-/* Send the COMMAND down to the keyboxd associated with KCD.
- * STATUS_CB and STATUS_CB_VALUE are the usual status callback as used
- * by assuan_transact.  After this function has returned success
- * kbx_client_data_wait needs to be called to actually return the
- * data.  */
+/* Send the COMMAND down to the keyboxd associated with KCD.  INQ_CB
+ * and INQ_CB_VALUE as well as STATUS_CB and STATUS_CB_VALUE are the
+ * usual inquire and status callbacks as used by assuan_transact.
+ * After this function has returned success kbx_client_data_wait needs
+ * to be called to actually return the data.  */
 gpg_error_t
 kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
+                     gpg_error_t (*inq_cb)(void *opaque, const char *line),
+                     void *inq_cb_value,
                      gpg_error_t (*status_cb)(void *opaque, const char *line),
                      void *status_cb_value)
 {
@@ -388,7 +390,7 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
       /* log_debug ("%s: sending command '%s'\n", __func__, command); */
       err = assuan_transact (kcd->ctx, command,
                              NULL, NULL,
-                             NULL, NULL,
+                             inq_cb, inq_cb_value,
                              status_cb, status_cb_value);
       if (err)
         {
@@ -411,7 +413,7 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
       init_membuf (&mb, 8192);
       err = assuan_transact (kcd->ctx, command,
                              put_membuf_cb, &mb,
-                             NULL, NULL,
+                             inq_cb, inq_cb_value,
                              status_cb, status_cb_value);
       if (err)
         {
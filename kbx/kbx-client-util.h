@@ -30,6 +30,9 @@ gpg_error_t kbx_client_data_new (kbx_client_data_t *r_kcd,
 void kbx_client_data_release (kbx_client_data_t kcd);
 gpg_error_t kbx_client_data_simple (kbx_client_data_t kcd, const char *command);
 gpg_error_t kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
+                                 gpg_error_t (*inq_cb)(void *opaque,
+                                                       const char *line),
+                                 void *inq_cb_value,
                                  gpg_error_t (*status_cb)(void *opaque,
                                                           const char *line),
                                  void *status_cb_value);
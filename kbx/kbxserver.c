@@ -320,31 +320,207 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Append the current search description to the list of search
+ * descriptions used for a multi pattern search.  */
+static gpg_error_t
+append_multi_search_desc (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  unsigned int n, k;
+  KEYBOX_SEARCH_DESC *desc;
+  struct search_backing_store_s *store;
+
+  if (!ctrl->server_local->multi_search_desc_size)
+    {
+      n = 10;
+      ctrl->server_local->multi_search_desc
+        = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_desc);
+      if (!ctrl->server_local->multi_search_desc)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      ctrl->server_local->multi_search_store
+        = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_store);
+      if (!ctrl->server_local->multi_search_store)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (ctrl->server_local->multi_search_desc);
+          ctrl->server_local->multi_search_desc = NULL;
+          goto leave;
+        }
+      ctrl->server_local->multi_search_desc_size = n;
+    }
+
+  if (ctrl->server_local->multi_search_desc_len
+      == ctrl->server_local->multi_search_desc_size)
+    {
+      /* Grow geometrically so that SEARCH --multi with many patterns
+       * does not copy the array over and over.  */
+      n = ctrl->server_local->multi_search_desc_size * 2;
+      desc = xtrycalloc (n, sizeof *desc);
+      if (!desc)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      store = xtrycalloc (n, sizeof *store);
+      if (!store)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (desc);
+          goto leave;
+        }
+      for (k=0; k < ctrl->server_local->multi_search_desc_size; k++)
+        {
+          desc[k] = ctrl->server_local->multi_search_desc[k];
+          store[k] = ctrl->server_local->multi_search_store[k];
+        }
+      xfree (ctrl->server_local->multi_search_desc);
+      xfree (ctrl->server_local->multi_search_store);
+      ctrl->server_local->multi_search_desc = desc;
+      ctrl->server_local->multi_search_store = store;
+      ctrl->server_local->multi_search_desc_size = n;
+    }
+  /* Actually store. We need to fix up the const pointers by
+   * copies from our backing store.  */
+  desc = &(ctrl->server_local->multi_search_desc
+           [ctrl->server_local->multi_search_desc_len]);
+  store = &(ctrl->server_local->multi_search_store
+            [ctrl->server_local->multi_search_desc_len]);
+  *desc = ctrl->server_local->search_desc;
+  if (ctrl->server_local->search_desc.sn)
+    {
+      xfree (store->sn);
+      store->sn = xtrymalloc (ctrl->server_local->search_desc.snlen);
+      if (!store->sn)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      memcpy (store->sn, ctrl->server_local->search_desc.sn,
+              ctrl->server_local->search_desc.snlen);
+      desc->sn = store->sn;
+    }
+  if (ctrl->server_local->search_desc.name_used)
+    {
+      xfree (store->name);
+      store->name = xtrystrdup (ctrl->server_local->search_desc.u.name);
+      if (!store->name)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (store->sn);
+          store->sn = NULL;
+          goto leave;
+        }
+      desc->u.name = store->name;
+    }
+  ctrl->server_local->multi_search_desc_len++;
+
+  return 0;
+
+ leave:
+  return err;
+}
+
+
+/* Helper for cmd_search to read the patterns for option --multi
+ * using an inquiry.  The patterns are delimited by LFs and appended
+ * to the list of search descriptions.  */
+static gpg_error_t
+inquire_search_patterns (assuan_context_t ctx, ctrl_t ctrl)
+{
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *buffer = NULL;
+  char *pattern, *p;
+
+  ctrl->server_local->multi_search_desc_len = 0;
+
+  err = assuan_inquire (ctx, "PATTERNS", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  buffer = xtrymalloc (valuelen + 1);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (buffer, value, valuelen);
+  buffer[valuelen] = 0;
+
+  for (pattern = buffer; pattern; pattern = p)
+    {
+      p = strchr (pattern, '\n');
+      if (p)
+        *p++ = 0;
+      trim_spaces (pattern);
+      if (!*pattern)
+        continue;
+
+      err = classify_user_id (pattern, &ctrl->server_local->search_desc, 1);
+      if (err)
+        goto leave;
+      err = append_multi_search_desc (ctrl);
+      if (err)
+        goto leave;
+    }
+
+  if (!ctrl->server_local->multi_search_desc_len)
+    err = set_error (GPG_ERR_INV_ARG, "no pattern");
+
+ leave:
+  xfree (buffer);
+  xfree (value);
+  return err;
+}
+
+
 static const char hlp_search[] =
   "SEARCH [--no-data] [--openpgp|--x509] [[--more] PATTERN]\n"
+  "SEARCH [--no-data] [--openpgp|--x509] --multi\n"
   "\n"
   "Search for the keys identified by PATTERN.  With --more more\n"
   "patterns to be used for the search are expected with the next\n"
-  "command.  With --no-data only the search status is returned but\n"
-  "not the actual data.  With --openpgp or --x509 only the respective\n"
-  "keys are returned.  See also \"NEXT\".";
+  "command.  With --multi all patterns are requested using\n"
+  "  INQUIRE PATTERNS\n"
+  "and are expected as LF delimited lines.  With --no-data only the\n"
+  "search status is returned but not the actual data.  With --openpgp\n"
+  "or --x509 only the respective keys are returned.  See also \"NEXT\".";
 static gpg_error_t
 cmd_search (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_more, opt_no_data, opt_openpgp, opt_x509;
+  int opt_more, opt_multi, opt_no_data, opt_openpgp, opt_x509;
   gpg_error_t err;
-  unsigned int n, k;
 
   opt_no_data = has_option (line, "--no-data");
   opt_more = has_option (line, "--more");
+  opt_multi = has_option (line, "--multi");
   opt_openpgp = has_option (line, "--openpgp");
   opt_x509 = has_option (line, "--x509");
   line = skip_options (line);
 
   ctrl->server_local->search_any_found = 0;
 
-  if (!*line)
+  if (opt_multi)
+    {
+      if (opt_more || *line || ctrl->server_local->search_expecting_more)
+        {
+          err = set_error (GPG_ERR_INV_ARG,
+                           "--multi may not be used with a pattern");
+          goto leave;
+        }
+      err = inquire_search_patterns (ctx, ctrl);
+      if (err)
+        goto leave;
+    }
+  else if (!*line)
     {
       if (opt_more)
         {
@@ -376,93 +552,9 @@ cmd_search (assuan_context_t ctx, char *line)
     {
       /* More pattern are expected - store the current one and return
        * success.  */
-      KEYBOX_SEARCH_DESC *desc;
-      struct search_backing_store_s *store;
-
-      if (!ctrl->server_local->multi_search_desc_size)
-        {
-          n = 10;
-          ctrl->server_local->multi_search_desc
-            = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_desc);
-          if (!ctrl->server_local->multi_search_desc)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          ctrl->server_local->multi_search_store
-            = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_store);
-          if (!ctrl->server_local->multi_search_store)
-            {
-              err = gpg_error_from_syserror ();
-              xfree (ctrl->server_local->multi_search_desc);
-              ctrl->server_local->multi_search_desc = NULL;
-              goto leave;
-            }
-          ctrl->server_local->multi_search_desc_size = n;
-        }
-
-      if (ctrl->server_local->multi_search_desc_len
-          == ctrl->server_local->multi_search_desc_size)
-        {
-          n = ctrl->server_local->multi_search_desc_size + 10;
-          desc = xtrycalloc (n, sizeof *desc);
-          if (!desc)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          store = xtrycalloc (n, sizeof *store);
-          if (!store)
-            {
-              err = gpg_error_from_syserror ();
-              xfree (desc);
-              goto leave;
-            }
-          for (k=0; k < ctrl->server_local->multi_search_desc_size; k++)
-            {
-              desc[k] = ctrl->server_local->multi_search_desc[k];
-              store[k] = ctrl->server_local->multi_search_store[k];
-            }
-          xfree (ctrl->server_local->multi_search_desc);
-          xfree (ctrl->server_local->multi_search_store);
-          ctrl->server_local->multi_search_desc = desc;
-          ctrl->server_local->multi_search_store = store;
-          ctrl->server_local->multi_search_desc_size = n;
-        }
-      /* Actually store. We need to fix up the const pointers by
-       * copies from our backing store.  */
-      desc = &(ctrl->server_local->multi_search_desc
-               [ctrl->server_local->multi_search_desc_len]);
-      store = &(ctrl->server_local->multi_search_store
-                [ctrl->server_local->multi_search_desc_len]);
-      *desc = ctrl->server_local->search_desc;
-      if (ctrl->server_local->search_desc.sn)
-        {
-          xfree (store->sn);
-          store->sn = xtrymalloc (ctrl->server_local->search_desc.snlen);
-          if (!store->sn)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          memcpy (store->sn, ctrl->server_local->search_desc.sn,
-                  ctrl->server_local->search_desc.snlen);
-          desc->sn = store->sn;
-        }
-      if (ctrl->server_local->search_desc.name_used)
-        {
-          xfree (store->name);
-          store->name = xtrystrdup (ctrl->server_local->search_desc.u.name);
-          if (!store->name)
-            {
-              err = gpg_error_from_syserror ();
-              xfree (store->sn);
-              store->sn = NULL;
-              goto leave;
-            }
-          desc->u.name = store->name;
-        }
-      ctrl->server_local->multi_search_desc_len++;
+      err = append_multi_search_desc (ctrl);
+      if (err)
+        goto leave;
 
       if (opt_more)
         {
@@ -473,7 +565,7 @@ cmd_search (assuan_context_t ctx, char *line)
       ctrl->server_local->search_expecting_more = 0;
       /* Continue with the actual search.  */
     }
-  else
+  else if (!opt_multi)
     ctrl->server_local->multi_search_desc_len = 0;
 
   ctrl->server_local->inhibit_data_logging = 1;
@@ -567,20 +659,106 @@ cmd_next (assuan_context_t ctx, char *line)
 }
 
 
+/* Helper for cmd_store to store all keys given by the buffer
+ * (BUFFER,BUFLEN).  Each key is prefixed by its length as a 4 byte
+ * big endian value.  All keys are stored in one transaction.  */
+static gpg_error_t
+store_multi (assuan_context_t ctx, ctrl_t ctrl,
+             const unsigned char *buffer, size_t buflen,
+             enum kbxd_store_modes mode)
+{
+  gpg_error_t err = 0;
+  gpg_error_t firsterr = 0;
+  size_t n;
+  unsigned int count = 0;
+  unsigned int nfailed = 0;
+  int own_transaction = 0;
+
+  if (!opt.in_transaction)
+    {
+      opt.in_transaction = 1;
+      opt.transaction_pid = assuan_get_pid (ctx);
+      own_transaction = 1;
+    }
+
+  while (buflen)
+    {
+      if (buflen < 4)
+        {
+          err = set_error (GPG_ERR_INV_LENGTH, "truncated length prefix");
+          break;
+        }
+      n = buf32_to_size_t (buffer);
+      buffer += 4;
+      buflen -= 4;
+      if (!n || n > buflen)
+        {
+          err = set_error (GPG_ERR_INV_LENGTH, "invalid blob length");
+          break;
+        }
+
+      err = kbxd_store (ctrl, buffer, n, mode);
+      if (err)
+        {
+          /* Tell the client which key failed and go on with the
+           * next one.  */
+          log_info ("storing key %u of the batch failed: %s\n",
+                    count, gpg_strerror (err));
+          if (!firsterr)
+            firsterr = err;
+          nfailed++;
+          err = kbxd_status_printf (ctrl, "STORE_FAILED", "%u %u",
+                                    count, err);
+          if (err)
+            break;
+        }
+      buffer += n;
+      buflen -= n;
+      count++;
+    }
+
+  if (own_transaction)
+    {
+      if (err || nfailed)
+        {
+          kbxd_rollback (ctrl);
+          if (!err)
+            err = firsterr;
+        }
+      else
+        err = kbxd_commit ();
+    }
+
+  if (!err && opt.verbose)
+    log_info ("stored %u of %u keys in one batch\n", count - nfailed, count);
+  return err;
+}
+
+
 static const char hlp_store[] =
-  "STORE [--update|--insert]\n"
+  "STORE [--update|--insert] [--multi]\n"
   "\n"
   "Insert a key into the database.  Whether to insert or update\n"
   "the key is decided by looking at the primary key's fingerprint.\n"
   "With option --update the key must already exist.\n"
   "With option --insert the key must not already exist.\n"
   "The actual key material is requested by this function using\n"
-  "  INQUIRE BLOB";
+  "  INQUIRE BLOB\n"
+  "With option --multi any number of keys, each prefixed by its\n"
+  "length as a 4 byte big endian value, are requested using\n"
+  "  INQUIRE BLOBS\n"
+  "and stored in one transaction.  For each key which can't be stored\n"
+  "a status line\n"
+  "  STORE_FAILED <index> <errorcode>\n"
+  "with the 0-based index of that key is emitted.  Without a global\n"
+  "transaction none of the keys is stored if one fails and the error\n"
+  "is returned; with a global transaction the other keys are stored\n"
+  "and the command succeeds.";
 static gpg_error_t
 cmd_store (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_update, opt_insert;
+  int opt_update, opt_insert, opt_multi;
   enum kbxd_store_modes mode;
   gpg_error_t err;
   unsigned char *value = NULL;
@@ -588,6 +766,7 @@ cmd_store (assuan_context_t ctx, char *line)
 
   opt_update = has_option (line, "--update");
   opt_insert = has_option (line, "--insert");
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
   if (*line)
     {
@@ -602,7 +781,8 @@ cmd_store (assuan_context_t ctx, char *line)
     mode = KBXD_STORE_AUTO;
 
   /* Ask for the key material.  */
-  err = assuan_inquire (ctx, "BLOB", &value, &valuelen, 0);
+  err = assuan_inquire (ctx, opt_multi? "BLOBS" : "BLOB",
+                        &value, &valuelen, 0);
   if (err)
     {
       log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
@@ -615,7 +795,10 @@ cmd_store (assuan_context_t ctx, char *line)
       goto leave;
     }
 
-  err = kbxd_store (ctrl, value, valuelen, mode);
+  if (opt_multi)
+    err = store_multi (ctx, ctrl, value, valuelen, mode);
+  else
+    err = kbxd_store (ctrl, value, valuelen, mode);
 
 
  leave:
@@ -666,6 +849,117 @@ cmd_delete (assuan_context_t ctx, char *line)
 
 
 
+static const char hlp_sigcache[] =
+  "SIGCACHE [--store] <ubid>\n"
+  "\n"
+  "Access the cache of signature verification results for the\n"
+  "keyblock UBID.  Each result is identified by the hex encoded\n"
+  "SHA-256 hash over the signer's fingerprint, the digest of the\n"
+  "signed data and the signature as computed by gpg.  Without an\n"
+  "option all cached results of the keyblock are returned as status\n"
+  "lines\n"
+  "  SIGCACHE <hash> good|bad\n"
+  "With --store the results are inquired using the keyword RESULTS\n"
+  "as LF delimited lines \"<hash> good|bad\" and stored.  The cache\n"
+  "is limited in size and the oldest results are removed first; all\n"
+  "results of a keyblock are removed when the key is deleted.";
+static gpg_error_t
+cmd_sigcache (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int opt_store;
+  int n;
+  unsigned char ubid[UBID_LEN];
+  unsigned char *value = NULL;
+  size_t valuelen;
+  unsigned char *hashes = NULL;
+  char *valid = NULL;
+  unsigned int nitems, maxitems;
+  char *p, *pend;
+
+  opt_store = has_option (line, "--store");
+  line = skip_options (line);
+  if (!*line)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "UBID missing");
+      goto leave;
+    }
+  if ((n=hex2bin (line, ubid, UBID_LEN)) < 0)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "invalid UBID");
+      goto leave;
+    }
+  if (line[n])
+    {
+      err = set_error (GPG_ERR_INV_ARG, "garbage after UBID");
+      goto leave;
+    }
+
+  if (!opt_store)
+    {
+      err = kbxd_sigcache_get (ctrl, ubid);
+      goto leave;
+    }
+
+  err = assuan_inquire (ctx, "RESULTS", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Each result line needs at least 2*SIGCACHE_HASH_LEN+4 bytes.  */
+  maxitems = valuelen / (2*SIGCACHE_HASH_LEN + 4) + 1;
+  hashes = xtrymalloc (maxitems * SIGCACHE_HASH_LEN);
+  valid = xtrymalloc (maxitems);
+  if (!hashes || !valid)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  nitems = 0;
+  for (p = (char *)value; p < (char *)value + valuelen; p = pend + 1)
+    {
+      pend = memchr (p, '\n', (char *)value + valuelen - p);
+      if (!pend)
+        pend = (char *)value + valuelen;
+      if (pend == p)
+        continue;  /* Empty line.  */
+      if (nitems >= maxitems
+          || (n = hex2bin (p, hashes + nitems * SIGCACHE_HASH_LEN,
+                           SIGCACHE_HASH_LEN)) < 0
+          || p[n] != ' ')
+        {
+          err = set_error (GPG_ERR_INV_DATA, "invalid result line");
+          goto leave;
+        }
+      p += n + 1;
+      if (pend - p == 4 && !memcmp (p, "good", 4))
+        valid[nitems] = 1;
+      else if (pend - p == 3 && !memcmp (p, "bad", 3))
+        valid[nitems] = 0;
+      else
+        {
+          err = set_error (GPG_ERR_INV_DATA, "invalid result line");
+          goto leave;
+        }
+      nitems++;
+    }
+
+  if (nitems)
+    err = kbxd_sigcache_put (ctrl, ubid, hashes, valid, nitems);
+
+ leave:
+  xfree (hashes);
+  xfree (valid);
+  xfree (value);
+  return leave_cmd (ctx, err);
+}
+
+
+
 static const char hlp_transaction[] =
   "TRANSACTION [begin|commit|rollback]\n"
   "\n"
@@ -677,6 +971,7 @@ static const char hlp_transaction[] =
 static gpg_error_t
 cmd_transaction (assuan_context_t ctx, char *line)
 {
+  ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err = 0;
 
   line = skip_options (line);
@@ -709,7 +1004,7 @@ cmd_transaction (assuan_context_t ctx, char *line)
       else if (opt.transaction_pid != assuan_get_pid (ctx))
         err = set_error (GPG_ERR_CONFLICT, "other client is in a transaction");
       else
-        err = kbxd_rollback ();
+        err = kbxd_rollback (ctrl);
     }
   else if (!*line)
     {
@@ -735,6 +1030,25 @@ cmd_transaction (assuan_context_t ctx, char *line)
 
 
 
+/* Return true if the command CMD implements the option OPT.  */
+static int
+command_has_option (const char *cmd, const char *cmdopt)
+{
+  if (!strcmp (cmd, "SEARCH"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+        return 1;
+    }
+  else if (!strcmp (cmd, "STORE"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+        return 1;
+    }
+
+  return 0;
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -746,7 +1060,10 @@ static const char hlp_getinfo[] =
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
   "connections - Return number of active connections.\n"
-  "getenv NAME - Return value of envvar NAME\n";
+  "cache_info  - Return the counters of the key cache.\n"
+  "getenv NAME - Return value of envvar NAME\n"
+  "cmd_has_option CMD OPT\n"
+  "            - Returns OK if command CMD has option OPT.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -799,6 +1116,49 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_kbxd_active_connection_count ());
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "cache_info"))
+    {
+      char *s = kbxd_get_cache_info ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strncmp (line, "cmd_has_option", 14)
+           && (line[14] == ' ' || line[14] == '\t' || !line[14]))
+    {
+      char *cmd, *cmdopt;
+      line += 14;
+      while (*line == ' ' || *line == '\t')
+        line++;
+      if (!*line)
+        err = gpg_error (GPG_ERR_MISSING_VALUE);
+      else
+        {
+          cmd = line;
+          while (*line && (*line != ' ' && *line != '\t'))
+            line++;
+          if (!*line)
+            err = gpg_error (GPG_ERR_MISSING_VALUE);
+          else
+            {
+              *line++ = 0;
+              while (*line == ' ' || *line == '\t')
+                line++;
+              if (!*line)
+                err = gpg_error (GPG_ERR_MISSING_VALUE);
+              else
+                {
+                  cmdopt = line;
+                  err = command_has_option (cmd, cmdopt)?
+                    0 : gpg_error (GPG_ERR_FALSE);
+                }
+            }
+        }
+    }
   else
     err = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
 
@@ -862,6 +1222,7 @@ register_commands (assuan_context_t ctx)
     { "NEXT",       cmd_next,       hlp_next   },
     { "STORE",      cmd_store,      hlp_store  },
     { "DELETE",     cmd_delete,     hlp_delete  },
+    { "SIGCACHE",   cmd_sigcache,   hlp_sigcache },
     { "TRANSACTION",cmd_transaction,hlp_transaction },
     { "GETINFO",    cmd_getinfo,    hlp_getinfo },
     { "OUTPUT",     NULL,           hlp_output },
@@ -1048,7 +1409,7 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
           npids++;
 
       if (npids == 1)
-        kbxd_rollback ();
+        kbxd_rollback (ctrl);
     }
 
   assuan_close_output_fd (ctx);
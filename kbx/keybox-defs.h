@@ -37,6 +37,7 @@ typedef struct keyboxblob *KEYBOXBLOB;
 
 
 typedef struct keybox_name *KB_NAME;
+struct keybox_index_s;
 struct keybox_name
 {
   /* Link to the next resources, so that we can walk all
@@ -61,6 +62,12 @@ struct keybox_name
   /* Not yet used.  */
   int did_full_scan;
 
+  /* The in-memory key index or NULL if not yet built.  These fields
+   * are protected by the lock in keybox-index.c.  */
+  struct keybox_index_s *index;
+  int index_building;                /* A search is building INDEX.  */
+  unsigned int index_generation;     /* Bumped on each invalidation.  */
+
   /* The name of the resource file. */
   char fname[1];
 };
@@ -179,6 +186,16 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 int _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp);
 
+/*-- keybox-index.c --*/
+void _keybox_index_invalidate (KB_NAME kb);
+void _keybox_index_unpin (struct keybox_index_s *idx);
+int _keybox_index_check_desc (KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                              int *r_need_grips);
+gpg_error_t _keybox_index_prepare (KEYBOX_HANDLE hd, int need_grips,
+                                   struct keybox_index_s **r_idx);
+off_t _keybox_index_next (struct keybox_index_s *idx,
+                          KEYBOX_SEARCH_DESC *desc, size_t ndesc, off_t pos);
+
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
                                           size_t length,
@@ -0,0 +1,717 @@
+/* keybox-index.c - In-memory key index for keybox files
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A search for a key ID, fingerprint, keygrip or UBID in a keybox
+ * file requires a scan over all blobs.  To speed this up we keep an
+ * index for each keybox resource which maps the key IDs and, on
+ * demand, the keygrips of all keys to the file offsets of their
+ * blobs.  The index is built by one full scan of the file and then
+ * used by keybox_search to seek directly to the candidate blobs.
+ * Each candidate is still checked by the regular match functions and
+ * thus a stale entry can at worst lead to a useless read.
+ *
+ * The index is tied to the identity of the file as seen by the
+ * handle's stream (device, inode, size and mtime).  Updates done by
+ * this process drop the index via _keybox_index_invalidate.  Updates
+ * by other processes either replace the file via a rename or modify
+ * it in place; the former is detected by the identity check and the
+ * latter (setting flags, deleting a blob) does not move any blobs.
+ *
+ * In keyboxd several searches may run at the same time.  Thus the
+ * index is reference counted: The resource holds one reference and
+ * each search pins the index it started with.  An invalidated index
+ * is marked stale and freed when the last search has unpinned it; a
+ * search which finds its index stale continues with a linear scan.
+ * The index of a resource is built by only one search at a time and
+ * without holding the lock.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+
+#define get16(a) buf16_to_ulong ((a))
+
+
+/* This lock protects the INDEX, INDEX_BUILDING and INDEX_GENERATION
+ * fields of all resources and the reference counters of all
+ * indices.  */
+GPGRT_LOCK_DEFINE (index_lock);
+
+
+/* An entry mapping a 64 bit key ID to a blob.  The table is sorted
+ * by the low part first so that short key ID searches can use a
+ * range of it.  */
+struct kid_entry_s
+{
+  u32 kid_l;
+  u32 kid_h;
+  off_t off;
+};
+
+/* An entry mapping a keygrip to a blob.  */
+struct grip_entry_s
+{
+  unsigned char grip[20];
+  off_t off;
+};
+
+struct keybox_index_s
+{
+  /* The number of references to this index.  */
+  unsigned int refcount;
+
+  /* Set if the index has been invalidated.  */
+  unsigned int stale:1;
+
+  /* The identity of the file the index has been built from.  */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+
+  /* Set if the file has records which are skipped by a search (too
+   * large blobs).  Such files are not handled via the index so that
+   * the caller's skip counter stays correct.  */
+  unsigned int unusable:1;
+
+  /* Set if the GRIPS table has been built.  */
+  unsigned int have_grips:1;
+
+  /* Set if the file has blobs whose keygrips are not in GRIPS.  */
+  unsigned int grips_incomplete:1;
+
+  size_t nkids;
+  size_t kidsize;
+  struct kid_entry_s *kids;
+
+  size_t ngrips;
+  size_t gripsize;
+  struct grip_entry_s *grips;
+};
+
+
+
+static void
+lock_index (void)
+{
+  gpg_err_code_t ec = gpgrt_lock_lock (&index_lock);
+  if (ec)
+    log_fatal ("%s: failed to acquire lock: %s\n", __func__,
+               gpg_strerror (ec));
+}
+
+
+static void
+unlock_index (void)
+{
+  gpg_err_code_t ec = gpgrt_lock_unlock (&index_lock);
+  if (ec)
+    log_fatal ("%s: failed to release lock: %s\n", __func__,
+               gpg_strerror (ec));
+}
+
+
+static void
+release_index (struct keybox_index_s *idx)
+{
+  if (!idx)
+    return;
+  xfree (idx->kids);
+  xfree (idx->grips);
+  xfree (idx);
+}
+
+
+/* Drop a reference to IDX.  The lock must be held.  */
+static void
+unref_index (struct keybox_index_s *idx)
+{
+  if (idx && !--idx->refcount)
+    release_index (idx);
+}
+
+
+/* Drop the index of the resource KB.  The lock must be held.  */
+static void
+invalidate_index (KB_NAME kb)
+{
+  kb->index_generation++;
+  if (kb->index)
+    {
+      kb->index->stale = 1;
+      unref_index (kb->index);
+      kb->index = NULL;
+    }
+}
+
+
+/* Drop the index of the resource KB.  This must be called whenever
+ * the keybox file is modified by this process.  Searches which are
+ * using the index switch to a linear scan.  */
+void
+_keybox_index_invalidate (KB_NAME kb)
+{
+  if (!kb)
+    return;
+  lock_index ();
+  invalidate_index (kb);
+  unlock_index ();
+}
+
+
+/* Release the index IDX pinned by _keybox_index_prepare.  */
+void
+_keybox_index_unpin (struct keybox_index_s *idx)
+{
+  if (!idx)
+    return;
+  lock_index ();
+  unref_index (idx);
+  unlock_index ();
+}
+
+
+static int
+compare_kid_entries (const void *a_arg, const void *b_arg)
+{
+  const struct kid_entry_s *a = a_arg;
+  const struct kid_entry_s *b = b_arg;
+
+  if (a->kid_l != b->kid_l)
+    return a->kid_l < b->kid_l? -1 : 1;
+  if (a->kid_h != b->kid_h)
+    return a->kid_h < b->kid_h? -1 : 1;
+  if (a->off != b->off)
+    return a->off < b->off? -1 : 1;
+  return 0;
+}
+
+
+static int
+compare_grip_entries (const void *a_arg, const void *b_arg)
+{
+  const struct grip_entry_s *a = a_arg;
+  const struct grip_entry_s *b = b_arg;
+  int cmp;
+
+  cmp = memcmp (a->grip, b->grip, 20);
+  if (cmp)
+    return cmp;
+  if (a->off != b->off)
+    return a->off < b->off? -1 : 1;
+  return 0;
+}
+
+
+static gpg_error_t
+add_kid (struct keybox_index_s *idx, const unsigned char *kid, off_t off)
+{
+  struct kid_entry_s *e;
+
+  if (idx->nkids == idx->kidsize)
+    {
+      size_t newsize = idx->kidsize? 2 * idx->kidsize : 256;
+      struct kid_entry_s *tmp;
+
+      tmp = xtryreallocarray (idx->kids, idx->kidsize, newsize, sizeof *tmp);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      idx->kids = tmp;
+      idx->kidsize = newsize;
+    }
+  e = idx->kids + idx->nkids++;
+  e->kid_h = buf32_to_u32 (kid);
+  e->kid_l = buf32_to_u32 (kid + 4);
+  e->off = off;
+  return 0;
+}
+
+
+static gpg_error_t
+add_grip (struct keybox_index_s *idx, const unsigned char *grip, off_t off)
+{
+  struct grip_entry_s *e;
+
+  if (idx->ngrips == idx->gripsize)
+    {
+      size_t newsize = idx->gripsize? 2 * idx->gripsize : 256;
+      struct grip_entry_s *tmp;
+
+      tmp = xtryreallocarray (idx->grips, idx->gripsize, newsize, sizeof *tmp);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      idx->grips = tmp;
+      idx->gripsize = newsize;
+    }
+  e = idx->grips + idx->ngrips++;
+  memcpy (e->grip, grip, 20);
+  e->off = off;
+  return 0;
+}
+
+
+/* Add the key IDs of all keys in the BLOB to IDX.  The key ID is
+ * taken from the fingerprint the same way blob_cmp_fpr_part does
+ * it.  */
+static gpg_error_t
+index_blob_kids (struct keybox_index_s *idx, KEYBOXBLOB blob, off_t off)
+{
+  gpg_error_t err;
+  const unsigned char *buffer;
+  size_t length;
+  size_t pos, keyoff;
+  size_t nkeys, keyinfolen;
+  int n;
+  int fpr32;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return 0; /* Blob too short - ignore.  */
+  fpr32 = buffer[5] == 2;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (keyinfolen < (fpr32?56:28))
+    return 0; /* Invalid blob - ignore.  */
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return 0; /* Out of bounds - ignore.  */
+
+  for (n=0; n < nkeys; n++)
+    {
+      keyoff = pos + n*keyinfolen;
+      if (fpr32 && (buffer[keyoff + 32 + 1] & 0x80))
+        err = add_kid (idx, buffer + keyoff, off);
+      else
+        err = add_kid (idx, buffer + keyoff + 12, off);
+      if (err)
+        return err;
+    }
+
+  return 0;
+}
+
+
+/* Add the keygrips of all keys in the OpenPGP BLOB to IDX.  */
+static gpg_error_t
+index_blob_grips (struct keybox_index_s *idx, KEYBOXBLOB blob, off_t off)
+{
+  gpg_error_t err;
+  const unsigned char *buffer;
+  size_t length;
+  size_t cert_off, cert_len;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return 0; /* Too short - ignore.  */
+  cert_off = buf32_to_size_t (buffer+8);
+  cert_len = buf32_to_size_t (buffer+12);
+  if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length)
+    return 0; /* Too short - ignore.  */
+
+  if (_keybox_parse_openpgp (buffer + cert_off, cert_len, NULL, &info))
+    return 0; /* Parse error - has_keygrip won't find it either.  */
+
+  err = add_grip (idx, info.primary.grip, off);
+  if (!err && info.nsubkeys)
+    {
+      for (k = &info.subkeys; k && !err; k = k->next)
+        err = add_grip (idx, k->grip, off);
+    }
+
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+/* Build a new index from the stream FP and store it at R_IDX.  The
+ * file position of FP is not restored.  */
+static gpg_error_t
+build_index (estream_t fp, const struct stat *st, int with_grips,
+             struct keybox_index_s **r_idx)
+{
+  gpg_error_t err;
+  struct keybox_index_s *idx;
+  KEYBOXBLOB blob = NULL;
+  off_t off;
+  int blobtype;
+
+  *r_idx = NULL;
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx)
+    return gpg_error_from_syserror ();
+  idx->dev = st->st_dev;
+  idx->ino = st->st_ino;
+  idx->size = st->st_size;
+  idx->mtime = st->st_mtime;
+  idx->have_grips = !!with_grips;
+
+  if (es_fseeko (fp, 0, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (;;)
+    {
+      _keybox_release_blob (blob);
+      err = _keybox_read_blob (&blob, fp, NULL);
+      if (err == -1)
+        {
+          err = 0;
+          break;
+        }
+      if (gpg_err_code (err) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (err) == GPG_ERR_SOURCE_KEYBOX)
+        {
+          idx->unusable = 1;
+          continue;
+        }
+      if (err)
+        goto leave;
+
+      blobtype = blob_get_type (blob);
+      if (blobtype != KEYBOX_BLOBTYPE_PGP && blobtype != KEYBOX_BLOBTYPE_X509)
+        continue;
+      off = _keybox_get_blob_fileoffset (blob);
+
+      err = index_blob_kids (idx, blob, off);
+      if (!err && with_grips)
+        {
+          if (blobtype == KEYBOX_BLOBTYPE_PGP)
+            err = index_blob_grips (idx, blob, off);
+#ifdef KEYBOX_WITH_X509
+          else
+            idx->grips_incomplete = 1;
+#endif
+        }
+      if (err)
+        goto leave;
+    }
+
+  if (idx->nkids)
+    qsort (idx->kids, idx->nkids, sizeof *idx->kids, compare_kid_entries);
+  if (idx->ngrips)
+    qsort (idx->grips, idx->ngrips, sizeof *idx->grips, compare_grip_entries);
+
+  idx->refcount = 1;
+  *r_idx = idx;
+  idx = NULL;
+
+ leave:
+  _keybox_release_blob (blob);
+  release_index (idx);
+  return err;
+}
+
+
+/* Return true if all search descriptions in DESC can be served by
+ * the index.  If one of them requires the keygrip table, true is
+ * stored at R_NEED_GRIPS.  */
+int
+_keybox_index_check_desc (KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                          int *r_need_grips)
+{
+  size_t n;
+
+  *r_need_grips = 0;
+  if (!ndesc)
+    return 0;
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_UBID:
+          break;
+        case KEYDB_SEARCH_MODE_FPR:
+          if (desc[n].fprlen != 20 && desc[n].fprlen != 32)
+            return 0; /* v3 fingerprints can't be mapped to a key ID.  */
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          *r_need_grips = 1;
+          break;
+        default:
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+
+/* Make sure that the resource of HD has an index matching the file
+ * opened at HD->FP.  NEED_GRIPS requests the keygrip table.  On
+ * success the index is pinned and stored at R_IDX if it can be used
+ * for the search; the caller must release it with
+ * _keybox_index_unpin.  NULL is stored if the search needs to scan
+ * the file.  The file position of HD->FP is not changed.  An error
+ * is only returned if the file position could not be restored.  */
+gpg_error_t
+_keybox_index_prepare (KEYBOX_HANDLE hd, int need_grips,
+                       struct keybox_index_s **r_idx)
+{
+  gpg_error_t err;
+  KB_NAME kb = hd->kb;
+  struct keybox_index_s *idx;
+  unsigned int generation;
+  struct stat st;
+  off_t pos;
+
+  *r_idx = NULL;
+
+  if (fstat (es_fileno (hd->fp), &st))
+    return 0;  /* Can't check the identity - don't use an index.  */
+
+  lock_index ();
+  idx = kb->index;
+  if (idx
+      && (idx->dev != st.st_dev || idx->ino != st.st_ino
+          || idx->size != st.st_size || idx->mtime != st.st_mtime
+          || (need_grips && !idx->have_grips)))
+    {
+      invalidate_index (kb);
+      idx = NULL;
+    }
+  if (idx)
+    idx->refcount++;
+  else if (kb->index_building)
+    {
+      /* Another search is building the index; don't wait for it.  */
+      unlock_index ();
+      return 0;
+    }
+  else
+    kb->index_building = 1;
+  generation = kb->index_generation;
+  unlock_index ();
+
+  if (!idx)
+    {
+      pos = es_ftello (hd->fp);
+      if (pos == (off_t)-1)
+        err = 0;
+      else
+        {
+          err = build_index (hd->fp, &st, need_grips, &idx);
+          if (err)
+            log_info ("error building the key index for '%s': %s\n",
+                      kb->fname, gpg_strerror (err));
+          err = 0;
+          if (es_fseeko (hd->fp, pos, SEEK_SET))
+            err = gpg_error_from_syserror ();
+        }
+
+      lock_index ();
+      kb->index_building = 0;
+      if (idx && generation == kb->index_generation)
+        {
+          /* Install the new index.  The resource's reference is the
+           * one from build_index; take another one for us.  */
+          log_assert (!kb->index);
+          kb->index = idx;
+          idx->refcount++;
+        }
+      else
+        {
+          /* The file has been modified while we were building the
+           * index or the build failed.  */
+          release_index (idx);
+          idx = NULL;
+        }
+      unlock_index ();
+
+      if (err)
+        {
+          _keybox_index_unpin (idx);
+          return err;
+        }
+      if (!idx)
+        return 0;
+    }
+
+  if (idx->unusable || (need_grips && idx->grips_incomplete))
+    {
+      _keybox_index_unpin (idx);
+      return 0;
+    }
+
+  *r_idx = idx;
+  return 0;
+}
+
+
+/* Return the smallest offset not less than POS of a blob with the
+ * key ID {KID_H,KID_L} or -1 if there is none.  */
+static off_t
+lookup_long_kid (struct keybox_index_s *idx, u32 kid_h, u32 kid_l, off_t pos)
+{
+  struct kid_entry_s key;
+  size_t lo, hi, mid;
+
+  key.kid_l = kid_l;
+  key.kid_h = kid_h;
+  key.off = pos;
+
+  lo = 0;
+  hi = idx->nkids;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (compare_kid_entries (idx->kids + mid, &key) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo < idx->nkids
+      && idx->kids[lo].kid_l == kid_l && idx->kids[lo].kid_h == kid_h)
+    return idx->kids[lo].off;
+  return (off_t)-1;
+}
+
+
+/* Same as lookup_long_kid but only the low 32 bits are given.  */
+static off_t
+lookup_short_kid (struct keybox_index_s *idx, u32 kid_l, off_t pos)
+{
+  size_t lo, hi, mid;
+  off_t found = (off_t)-1;
+
+  lo = 0;
+  hi = idx->nkids;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (idx->kids[mid].kid_l < kid_l)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (; lo < idx->nkids && idx->kids[lo].kid_l == kid_l; lo++)
+    if (idx->kids[lo].off >= pos
+        && (found == (off_t)-1 || idx->kids[lo].off < found))
+      found = idx->kids[lo].off;
+
+  return found;
+}
+
+
+static off_t
+lookup_grip (struct keybox_index_s *idx, const unsigned char *grip, off_t pos)
+{
+  struct grip_entry_s key;
+  size_t lo, hi, mid;
+
+  memcpy (key.grip, grip, 20);
+  key.off = pos;
+
+  lo = 0;
+  hi = idx->ngrips;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (compare_grip_entries (idx->grips + mid, &key) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo < idx->ngrips && !memcmp (idx->grips[lo].grip, grip, 20))
+    return idx->grips[lo].off;
+  return (off_t)-1;
+}
+
+
+/* Return the file offset of the next blob at or after POS which may
+ * match one of the search descriptions in DESC.  IDX is the index
+ * pinned by _keybox_index_prepare.  Returns -1 if there is no such
+ * blob and -2 if the index has been invalidated in the meantime; the
+ * search must then continue with a linear scan.  */
+off_t
+_keybox_index_next (struct keybox_index_s *idx,
+                    KEYBOX_SEARCH_DESC *desc, size_t ndesc, off_t pos)
+{
+  const unsigned char *p;
+  off_t best = (off_t)-1;
+  off_t off, off2;
+  size_t n;
+  int stale;
+
+  lock_index ();
+  stale = idx->stale;
+  unlock_index ();
+  if (stale)
+    return (off_t)-2;
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          off = lookup_short_kid (idx, desc[n].u.kid[1], pos);
+          break;
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          off = lookup_long_kid (idx, desc[n].u.kid[0], desc[n].u.kid[1], pos);
+          break;
+        case KEYDB_SEARCH_MODE_FPR:
+          p = desc[n].fprlen == 32? desc[n].u.fpr : desc[n].u.fpr + 12;
+          off = lookup_long_kid (idx, buf32_to_u32 (p), buf32_to_u32 (p+4),
+                                 pos);
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          off = lookup_grip (idx, desc[n].u.grip, pos);
+          break;
+        case KEYDB_SEARCH_MODE_UBID:
+          /* The UBID is the fingerprint or, for 32 byte fingerprints,
+           * its leftmost 20 bytes.  We don't know which one and thus
+           * try both ways to derive the key ID.  */
+          p = desc[n].u.ubid;
+          off = lookup_long_kid (idx, buf32_to_u32 (p+12), buf32_to_u32 (p+16),
+                                 pos);
+          off2 = lookup_long_kid (idx, buf32_to_u32 (p), buf32_to_u32 (p+4),
+                                  pos);
+          if (off == (off_t)-1 || (off2 != (off_t)-1 && off2 < off))
+            off = off2;
+          break;
+        default:
+          off = (off_t)-1;  /* Not reached due to _keybox_index_check_desc. */
+          break;
+        }
+
+      if (off != (off_t)-1 && (best == (off_t)-1 || off < best))
+        best = off;
+    }
+
+  return best;
+}
@@ -82,6 +82,9 @@ keybox_register_file (const char *fname, int secret, void **r_token)
   kr->lockhd = NULL;
   kr->is_locked = 0;
   kr->did_full_scan = 0;
+  kr->index = NULL;
+  kr->index_building = 0;
+  kr->index_generation = 0;
   /* keep a list of all issued pointers */
   kr->next = kb_names;
   kb_names = kr;
@@ -922,6 +922,8 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  struct keybox_index_s *idx = NULL;
+  int need_grips;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1067,6 +1069,19 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* If all descriptions are for keys we can use the index to seek
+   * directly to the candidate blobs.  The found blobs are checked
+   * below as usual.  */
+  if (_keybox_index_check_desc (desc, ndesc, &need_grips))
+    {
+      rc = _keybox_index_prepare (hd, need_grips, &idx);
+      if (rc)
+        {
+          if (sn_array)
+            release_sn_array (sn_array, ndesc);
+          return (hd->error = rc);
+        }
+    }
 
   pk_no = uid_no = 0;
   for (;;)
@@ -1075,6 +1090,33 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       int blobtype;
 
       _keybox_release_blob (blob); blob = NULL;
+      if (idx)
+        {
+          off_t off = es_ftello (hd->fp);
+
+          if (off == (off_t)-1)
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+          off = _keybox_index_next (idx, desc, ndesc, off);
+          if (off == (off_t)-2)
+            {
+              /* The index has been invalidated; scan the rest.  */
+              _keybox_index_unpin (idx);
+              idx = NULL;
+            }
+          else if (off == (off_t)-1)
+            {
+              rc = -1;
+              break;
+            }
+          else if (es_fseeko (hd->fp, off, SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+        }
       rc = _keybox_read_blob (&blob, hd->fp, NULL);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
@@ -1218,6 +1260,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       hd->error = rc;
     }
 
+  _keybox_index_unpin (idx);
   if (sn_array)
     release_sn_array (sn_array, ndesc);
 
@@ -375,6 +375,7 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
      search.  Fixme: it would be better to adjust the position after
      the write operation.  */
   _keybox_close_file (hd);
+  _keybox_index_invalidate (hd->kb);
 
   err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
   if (err)
@@ -425,6 +426,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   /* Close the file so that we do no mess up the position for a
      next search.  */
   _keybox_close_file (hd);
+  _keybox_index_invalidate (hd->kb);
 
   /* Build a new blob.  */
   err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
@@ -467,6 +469,7 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
      search.  Fixme: it would be better to adjust the position after
      the write operation.  */
   _keybox_close_file (hd);
+  _keybox_index_invalidate (hd->kb);
 
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
@@ -535,6 +538,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  _keybox_index_invalidate (hd->kb);
 
   err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
   if (err)
@@ -602,6 +606,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   off += 4;
 
   _keybox_close_file (hd);
+  _keybox_index_invalidate (hd->kb);
   rc = _keybox_ll_open (&fp, hd->kb->fname, KEYBOX_LL_OPEN_UPDATE);
   if (rc)
     return rc;
@@ -652,6 +657,7 @@ keybox_compress (KEYBOX_HANDLE hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
 
   _keybox_close_file (hd);
+  _keybox_index_invalidate (hd->kb);
 
   /* Open the source file. Because we do a rename, we have to check the
      permissions of the file */
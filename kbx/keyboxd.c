@@ -90,6 +90,7 @@ enum cmd_and_opt_values
     oFakedSystemTime,
     oListenBacklog,
     oDisableCheckOwnSocket,
+    oCacheSize,
 
     oDummy
   };
@@ -123,6 +124,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCacheSize, "cache-size",
+                N_("|N|use up to N KiB for the key cache")),
 
   ARGPARSE_end () /* End of list */
 };
@@ -587,6 +590,10 @@ main (int argc, char **argv )
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oCacheSize:
+          opt.cache_size = (size_t)pargs.r.ret_ulong * 1024;
+          break;
+
         default:
           if (configname)
             pargs.err = ARGPARSE_PRINT_WARNING;
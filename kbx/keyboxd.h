@@ -43,6 +43,9 @@ struct
   /* True if we are running detached from the tty. */
   int running_detached;
 
+  /* The size of the key cache in bytes; 0 for the default.  */
+  size_t cache_size;
+
   /*
    * Global state variables.
    */
@@ -117,6 +120,10 @@ struct server_control_s
    * auto-created as needed.  */
   db_request_t db_req;
 
+  /* The database lock currently held by this connection: 0 = none,
+   * 1 = read lock, 2 = read-write lock.  See frontend.c.  */
+  int db_lock;
+
   /* Flags for the current request.  */
 
   /* If the any of the filter flags are set a search returns only
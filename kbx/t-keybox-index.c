@@ -0,0 +1,556 @@
+/* t-keybox-index.c - Regression test for keybox-index.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The test copies a keybox file and runs searches for all key IDs,
+ * fingerprints and keygrips found in it.  Each search is done once
+ * via the index and once via a full scan.  To force the scan an
+ * additional description which the index can't handle and which
+ * never matches is passed to keybox_search.  The same is done after
+ * the file has been changed by this process and after it has been
+ * replaced by "another process".  Finally the index is invalidated
+ * and rebuilt by another handle while a search is in progress.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+
+
+#define PGM "t-keybox-index"
+
+/* The keybox file used as input and the working copy.  */
+#define INPUT_FILE "../g10/t-keydb-keyring.kbx"
+#define WORK_FILE  "t-keybox-index.kbx"
+
+/* The maximum number of blobs returned by a search.  */
+#define MAX_HITS 32
+
+/* The maximum number of keys tested.  */
+#define MAX_KEYS 64
+
+static int verbose;
+static int any_error;
+
+static void die (const char *format, ...) GPGRT_ATTR_NR_PRINTF(1,2);
+static void err (const char *format, ...) GPGRT_ATTR_PRINTF(1,2);
+static void inf (const char *format, ...) GPGRT_ATTR_PRINTF(1,2);
+
+
+/* A key found in the keybox.  */
+struct testkey_s
+{
+  unsigned char keyid[8];
+  unsigned char grip[20];
+  unsigned char fpr[32];
+  int fprlen;
+};
+
+static struct testkey_s testkeys[MAX_KEYS];
+static int ntestkeys;
+
+
+/* Print diagnostic message and exit with failure. */
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  if (!*format || format[strlen(format)-1] != '\n')
+    putc ('\n', stderr);
+
+  exit (1);
+}
+
+
+/* Print diagnostic message. */
+static void
+err (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  any_error = 1;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  if (!*format || format[strlen(format)-1] != '\n')
+    putc ('\n', stderr);
+}
+
+
+/* Print an info message. */
+static void
+inf (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  if (verbose)
+    {
+      fprintf (stderr, "%s: ", PGM);
+
+      va_start (arg_ptr, format);
+      vfprintf (stderr, format, arg_ptr);
+      va_end (arg_ptr);
+      if (!*format || format[strlen(format)-1] != '\n')
+        putc ('\n', stderr);
+    }
+}
+
+
+/* Prepend FNAME with the srcdir environment variable's value and
+ * return an allocated filename.  */
+static char *
+prepend_srcdir (const char *fname)
+{
+  static const char *srcdir;
+
+  if (!srcdir && !(srcdir = getenv ("srcdir")))
+    srcdir = ".";
+  return xstrconcat (srcdir, "/", fname, NULL);
+}
+
+
+/* Copy the file SRC to DST.  DST is written to a temporary file which
+ * is then renamed so that the file gets a new identity.  */
+static void
+copy_file (const char *src, const char *dst)
+{
+  FILE *in, *out;
+  char buffer[4096];
+  size_t n;
+  char *tmpname;
+
+  tmpname = xstrconcat (dst, ".tmp", NULL);
+  in = fopen (src, "rb");
+  if (!in)
+    die ("can't open '%s': %s", src, strerror (errno));
+  out = fopen (tmpname, "wb");
+  if (!out)
+    die ("can't create '%s': %s", tmpname, strerror (errno));
+  while ((n = fread (buffer, 1, sizeof buffer, in)))
+    if (fwrite (buffer, n, 1, out) != 1)
+      die ("error writing '%s': %s", tmpname, strerror (errno));
+  if (ferror (in))
+    die ("error reading '%s': %s", src, strerror (errno));
+  fclose (in);
+  if (fclose (out))
+    die ("error closing '%s': %s", tmpname, strerror (errno));
+  if (rename (tmpname, dst))
+    die ("error renaming '%s': %s", tmpname, strerror (errno));
+  xfree (tmpname);
+}
+
+
+static void
+add_testkey (struct _keybox_openpgp_key_info *ki)
+{
+  struct testkey_s *tk;
+
+  if (ntestkeys >= MAX_KEYS)
+    return;
+  tk = testkeys + ntestkeys++;
+  memcpy (tk->keyid, ki->keyid, 8);
+  memcpy (tk->grip, ki->grip, 20);
+  memcpy (tk->fpr, ki->fpr, ki->fprlen);
+  tk->fprlen = ki->fprlen;
+}
+
+
+/* Collect the keys of all OpenPGP blobs in HD.  */
+static void
+collect_testkeys (KEYBOX_HANDLE hd)
+{
+  gpg_error_t rc;
+  KEYBOX_SEARCH_DESC desc;
+  void *image;
+  size_t imagelen, nparsed;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *ki;
+
+  ntestkeys = 0;
+  keybox_search_reset (hd);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!(rc = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP,
+                               NULL, NULL)))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      rc = keybox_get_data (hd, &image, &imagelen, NULL, NULL);
+      if (rc)
+        die ("keybox_get_data failed: %s", gpg_strerror (rc));
+      rc = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
+      if (rc)
+        die ("_keybox_parse_openpgp failed: %s", gpg_strerror (rc));
+      add_testkey (&info.primary);
+      if (info.nsubkeys)
+        for (ki = &info.subkeys; ki; ki = ki->next)
+          add_testkey (ki);
+      _keybox_destroy_openpgp_info (&info);
+      xfree (image);
+    }
+  if (gpg_err_code (rc) != GPG_ERR_EOF)
+    die ("keybox_search failed: %s", gpg_strerror (rc));
+  if (!ntestkeys)
+    die ("no keys found");
+}
+
+
+/* Run the search DESC on HD and store the offsets of all found blobs
+ * at HITS.  Returns the number of hits.  If NO_INDEX is set the
+ * search is forced to scan the file.  */
+static int
+search_all (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, int no_index,
+            off_t *hits)
+{
+  gpg_error_t rc;
+  KEYBOX_SEARCH_DESC descs[2];
+  int nhits = 0;
+
+  descs[0] = *desc;
+  memset (&descs[1], 0, sizeof descs[1]);
+  descs[1].mode = KEYDB_SEARCH_MODE_MAIL;
+  descs[1].u.name = "no-such-user@example.invalid";
+  descs[1].name_used = 1;
+
+  rc = keybox_search_reset (hd);
+  if (rc)
+    die ("keybox_search_reset failed: %s", gpg_strerror (rc));
+  while (!(rc = keybox_search (hd, descs, no_index? 2 : 1,
+                               KEYBOX_BLOBTYPE_PGP, NULL, NULL)))
+    {
+      if (nhits >= MAX_HITS)
+        die ("too many hits");
+      hits[nhits++] = _keybox_get_blob_fileoffset (hd->found.blob);
+    }
+  if (gpg_err_code (rc) != GPG_ERR_EOF)
+    die ("keybox_search failed: %s", gpg_strerror (rc));
+  return nhits;
+}
+
+
+/* Run the search DESC on HD with and without the index and compare
+ * the results.  Returns the number of hits.  */
+static int
+check_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, const char *what,
+              int keyno)
+{
+  off_t hits1[MAX_HITS], hits2[MAX_HITS];
+  int n1, n2, i;
+
+  n1 = search_all (hd, desc, 0, hits1);
+  n2 = search_all (hd, desc, 1, hits2);
+  if (n1 != n2)
+    {
+      err ("key %d: %s search: %d hits with index, %d without",
+           keyno, what, n1, n2);
+      return n2;
+    }
+  for (i = 0; i < n1; i++)
+    if (hits1[i] != hits2[i])
+      {
+        err ("key %d: %s search: hit %d at %lld with index, %lld without",
+             keyno, what, i, (long long)hits1[i], (long long)hits2[i]);
+        break;
+      }
+  inf ("key %d: %s search: %d hits", keyno, what, n1);
+  return n1;
+}
+
+
+/* Search for all test keys by all supported modes.  */
+static void
+check_all_searches (KEYBOX_HANDLE hd, const char *stage)
+{
+  KEYBOX_SEARCH_DESC desc;
+  struct testkey_s *tk;
+  int i;
+
+  inf ("checking searches %s", stage);
+  for (i = 0; i < ntestkeys; i++)
+    {
+      tk = testkeys + i;
+
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+      desc.u.kid[0] = buf32_to_u32 (tk->keyid);
+      desc.u.kid[1] = buf32_to_u32 (tk->keyid + 4);
+      if (!check_search (hd, &desc, "long kid", i))
+        err ("key %d: not found by long key ID %s", i, stage);
+
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_SHORT_KID;
+      desc.u.kid[1] = buf32_to_u32 (tk->keyid + 4);
+      check_search (hd, &desc, "short kid", i);
+
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_FPR;
+      memcpy (desc.u.fpr, tk->fpr, tk->fprlen);
+      desc.fprlen = tk->fprlen;
+      check_search (hd, &desc, "fpr", i);
+
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_KEYGRIP;
+      memcpy (desc.u.grip, tk->grip, 20);
+      check_search (hd, &desc, "keygrip", i);
+    }
+
+  /* A key ID which is not in the file.  */
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+  desc.u.kid[0] = 0xdeadbeef;
+  desc.u.kid[1] = 0x01234567;
+  if (check_search (hd, &desc, "unknown kid", -1))
+    err ("unknown key ID found %s", stage);
+}
+
+
+/* Parameters for skip_and_invalidate.  */
+struct skip_parm_s
+{
+  KEYBOX_HANDLE hd;      /* The handle used by the search.  */
+  KEYBOX_HANDLE hd2;     /* Another handle for the same file.  */
+  int ncalls;
+};
+
+/* A skip function which invalidates the index of the running search
+ * and lets the other handle build a new one.  The first hit is
+ * skipped so that the search continues.  */
+static int
+skip_and_invalidate (void *opaque, u32 *kid, int uid_no)
+{
+  struct skip_parm_s *parm = opaque;
+  KEYBOX_SEARCH_DESC desc;
+  gpg_error_t rc;
+
+  (void)kid;
+  (void)uid_no;
+
+  if (parm->ncalls++)
+    return 0;
+
+  _keybox_index_invalidate (parm->hd->kb);
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+  desc.u.kid[0] = buf32_to_u32 (testkeys[0].keyid);
+  desc.u.kid[1] = buf32_to_u32 (testkeys[0].keyid + 4);
+  keybox_search_reset (parm->hd2);
+  rc = keybox_search (parm->hd2, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (rc)
+    err ("search on the second handle failed: %s", gpg_strerror (rc));
+
+  return 1;
+}
+
+
+/* Search for the key with fingerprint FPR/FPRLEN, which is expected
+ * to be in the file at least twice, and invalidate the index while
+ * the search is running.  The search must then continue without the
+ * index and find the second blob.  */
+static void
+check_invalidation (KEYBOX_HANDLE hd, KEYBOX_HANDLE hd2,
+                    const unsigned char *fpr, int fprlen)
+{
+  gpg_error_t rc;
+  KEYBOX_SEARCH_DESC desc;
+  struct skip_parm_s parm;
+  off_t hits[MAX_HITS];
+  off_t off;
+  int nhits;
+
+  inf ("checking invalidation during a search");
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  memcpy (desc.u.fpr, fpr, fprlen);
+  desc.fprlen = fprlen;
+  nhits = search_all (hd, &desc, 1, hits);
+  if (nhits < 2)
+    die ("key not found twice");
+
+  /* Make sure that the search starts with an index.  */
+  search_all (hd, &desc, 0, hits + nhits);
+
+  memset (&parm, 0, sizeof parm);
+  parm.hd = hd;
+  parm.hd2 = hd2;
+  desc.skipfnc = skip_and_invalidate;
+  desc.skipfncvalue = &parm;
+  keybox_search_reset (hd);
+  rc = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (rc)
+    {
+      err ("search with invalidation failed: %s", gpg_strerror (rc));
+      return;
+    }
+  off = _keybox_get_blob_fileoffset (hd->found.blob);
+  if (off != hits[1])
+    err ("search with invalidation found %lld instead of %lld",
+         (long long)off, (long long)hits[1]);
+  if (parm.ncalls != 2)
+    err ("skip function called %d times", parm.ncalls);
+}
+
+
+/* Replace the blob with the first test key by the keyblock of the
+ * last test key.  Thus the last key is found twice afterwards.  */
+static void
+update_keybox (KEYBOX_HANDLE hd)
+{
+  gpg_error_t rc;
+  KEYBOX_SEARCH_DESC desc;
+  void *image;
+  size_t imagelen;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  memcpy (desc.u.fpr, testkeys[ntestkeys-1].fpr, testkeys[ntestkeys-1].fprlen);
+  desc.fprlen = testkeys[ntestkeys-1].fprlen;
+  keybox_search_reset (hd);
+  rc = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (rc)
+    die ("searching the last key failed: %s", gpg_strerror (rc));
+  rc = keybox_get_data (hd, &image, &imagelen, NULL, NULL);
+  if (rc)
+    die ("keybox_get_data failed: %s", gpg_strerror (rc));
+
+  memcpy (desc.u.fpr, testkeys[0].fpr, testkeys[0].fprlen);
+  desc.fprlen = testkeys[0].fprlen;
+  keybox_search_reset (hd);
+  rc = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (rc)
+    die ("searching the first key failed: %s", gpg_strerror (rc));
+  rc = keybox_update_keyblock (hd, image, imagelen);
+  if (rc)
+    die ("keybox_update_keyblock failed: %s", gpg_strerror (rc));
+  xfree (image);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  char *fname;
+  char *bakname;
+  void *token;
+  KEYBOX_HANDLE hd, hd2;
+  KEYBOX_SEARCH_DESC desc;
+  off_t hits[MAX_HITS];
+  int nkeys;
+  gpg_error_t rc;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [--verbose]\n", stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose++;
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (1);
+        }
+    }
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, NULL);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, NULL);
+
+  fname = prepend_srcdir (INPUT_FILE);
+  copy_file (fname, WORK_FILE);
+
+  rc = keybox_register_file (WORK_FILE, 0, &token);
+  if (rc)
+    die ("keybox_register_file failed: %s", gpg_strerror (rc));
+  hd = keybox_new_openpgp (token, 0);
+  hd2 = keybox_new_openpgp (token, 0);
+  if (!hd || !hd2)
+    die ("keybox_new_openpgp failed: %s",
+         gpg_strerror (gpg_error_from_syserror ()));
+
+  collect_testkeys (hd);
+  if (ntestkeys < 2)
+    die ("not enough keys in '%s'", fname);
+  nkeys = ntestkeys;
+  check_all_searches (hd, "initially");
+
+  /* An update by this process must invalidate the index.  */
+  update_keybox (hd);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  memcpy (desc.u.fpr, testkeys[0].fpr, testkeys[0].fprlen);
+  desc.fprlen = testkeys[0].fprlen;
+  if (search_all (hd, &desc, 0, hits))
+    err ("replaced key still found via the index");
+  memcpy (desc.u.fpr, testkeys[nkeys-1].fpr, testkeys[nkeys-1].fprlen);
+  desc.fprlen = testkeys[nkeys-1].fprlen;
+  if (search_all (hd, &desc, 0, hits) != 2)
+    err ("updated key not found twice via the index");
+  check_invalidation (hd, hd2, testkeys[nkeys-1].fpr,
+                      testkeys[nkeys-1].fprlen);
+  collect_testkeys (hd);
+  check_all_searches (hd, "after an update");
+
+  /* Replacing the file must also invalidate the index.  */
+  copy_file (fname, WORK_FILE);
+  collect_testkeys (hd);
+  if (ntestkeys != nkeys)
+    err ("number of keys changed after restoring the file");
+  check_all_searches (hd, "after replacing the file");
+
+  keybox_release (hd2);
+  keybox_release (hd);
+  xfree (fname);
+
+  remove (WORK_FILE);
+  bakname = xstrconcat (WORK_FILE, "~", NULL);
+  remove (bakname);
+  xfree (bakname);
+
+  return !!any_error;
+}
@@ -1786,7 +1786,8 @@ keydb_search (ctrl_t ctrl, KEYDB_HANDLE hd,
       if (strlen (line) + 5 >= sizeof line)
         err = gpg_error (GPG_ERR_ASS_LINE_TOO_LONG);
       else
-        err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
+        err = kbx_client_data_cmd (hd->kbl->kcd, line, NULL, NULL,
+                                   search_status_cb, hd);
       if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd,
                                                 &hd->kbl->search_result.buf,
                                                 &hd->kbl->search_result.len)))
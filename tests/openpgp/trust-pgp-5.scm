@@ -0,0 +1,85 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "trust-pgp" "common.scm"))
+
+(display "Checking incremental trustdb updates (PGP trust model)...\n")
+
+(initscenario "scenario1")
+
+(define all-keys (list ALICE BOBBY CAROL DAVID FRANK GRACE))
+
+;; Return the validities of all keys.
+(define (validities)
+  (map gettrust all-keys))
+
+;; Run a trustdb check and return its diagnostics.
+(define (checktrustdb)
+  (let ((result (call-with-io `(,@GPG --check-trustdb) "")))
+    (unless (= 0 (:retcode result))
+	    (fail "--check-trustdb failed:" (:stderr result)))
+    (:stderr result)))
+
+;; Remove the key KEYFPR and run a full check.  Then import it again
+;; so that the next check may only revalidate this key.
+(define (reimport keyfpr)
+  (call-check `(,@GPG --output reimport.gpg --yes --export ,keyfpr))
+  (call-check `(,@GPG --batch --yes --delete-keys ,keyfpr))
+  (updatetrustdb)
+  (call-check `(,@GPG --no-auto-check-trustdb --import reimport.gpg)))
+
+;; Check that the validities after an incremental check match those
+;; of a full check.  INCREMENTAL? tells whether the incremental check
+;; is expected to be used.
+(define (check-against-full incremental?)
+  (let* ((diag (checktrustdb))
+	 (incremental (validities)))
+    (if incremental?
+	(unless (string-contains? diag "changed key revalidated")
+		(fail "Expected an incremental trustdb check:" diag))
+	(when (string-contains? diag "changed key revalidated")
+	      (fail "Expected a full trustdb check:" diag)))
+    (updatetrustdb)
+    (let ((full (validities)))
+      (unless (equal? incremental full)
+	      (fail "Incremental check yields" incremental
+		    "but full check yields" full)))))
+
+(unless (file-exists? "trustdb.gpg.wot")
+	(fail "Full trustdb check did not write trustdb.gpg.wot"))
+(define initial (validities))
+
+;; Frank's key is not fully valid and thus does not act as a signer.
+;; It can be revalidated alone.
+(info "Re-importing a key which does not sign other keys...")
+(reimport FRANK)
+(check-against-full #t)
+(checktrust FRANK "q")
+(unless (equal? initial (validities))
+	(fail "Validities changed after re-importing Frank's key"))
+
+;; Bobby's key introduces Carol's, David's, and Frank's keys.  This
+;; needs a full run.
+(info "Re-importing a key which signs other keys...")
+(reimport BOBBY)
+(check-against-full #f)
+(checktrust BOBBY "f")
+(checktrust CAROL "q")
+(unless (equal? initial (validities))
+	(fail "Validities changed after re-importing Bobby's key"))
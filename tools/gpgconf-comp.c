@@ -338,6 +338,7 @@ static known_option_t known_options_gpg_agent[] =
    { "default-cache-ttl-ssh", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
    { "max-cache-ttl", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "max-cache-ttl-ssh", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
+   { "unlocked-key-cache-ttl", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "ignore-cache-for-signing", GC_OPT_FLAG_RUNTIME, GC_LEVEL_BASIC },
    { "allow-emacs-pinentry", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
    { "grab", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },